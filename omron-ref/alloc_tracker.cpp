@@ -0,0 +1,150 @@
+#include "alloc_tracker.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace daq
+{
+
+namespace
+{
+// Plain thread_local PODs, no dynamic initialization, so operator new can use them on any thread at any time
+thread_local uint64_t num_allocations = 0;
+thread_local uint64_t num_bytes = 0;
+
+void *allocate(std::size_t size, std::size_t alignment = 0) noexcept
+{
+	++num_allocations;
+	num_bytes += size;
+	if (size == 0)
+	{
+		size = 1;
+	}
+	if (alignment > alignof(std::max_align_t))
+	{
+		// aligned_alloc wants a multiple of the alignment
+		return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+	}
+	return std::malloc(size);
+}
+
+void *allocate_or_throw(std::size_t size, std::size_t alignment = 0)
+{
+	auto *ptr = allocate(size, alignment);
+	if (!ptr)
+	{
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+}
+
+AllocationCount thread_allocations()
+{
+	return {.allocations = num_allocations, .bytes = num_bytes};
+}
+
+}
+
+// Every form of the global allocation functions is replaced, so nothing mixes with the default implementation
+
+void *operator new(std::size_t size)
+{
+	return daq::allocate_or_throw(size);
+}
+
+void *operator new[](std::size_t size)
+{
+	return daq::allocate_or_throw(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+	return daq::allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return daq::allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	return daq::allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+	return daq::allocate(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	return daq::allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	return daq::allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+	std::free(ptr);
+}
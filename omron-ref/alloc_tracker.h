@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+namespace daq
+{
+
+struct AllocationCount
+{
+	uint64_t allocations = 0;
+	uint64_t bytes = 0;
+};
+
+// Heap allocations made so far by the calling thread. Counted by the global operator new replacement in
+// alloc_tracker.cpp, so this only sees allocations of executables that link that file (and is meant for the
+// benchmark, not for the library).
+AllocationCount thread_allocations();
+
+// Counts the allocations of the current thread between construction and count(), e.g. to check that a hot path
+// doesn't touch the heap:
+//
+//   AllocationScope scope;
+//   rc.request();
+//   assert(scope.count().allocations == 0);
+class AllocationScope
+{
+public:
+	AllocationScope() : _start(thread_allocations())
+	{
+	}
+
+	AllocationCount count() const
+	{
+		const auto now = thread_allocations();
+		return {.allocations = now.allocations - _start.allocations, .bytes = now.bytes - _start.bytes};
+	}
+
+private:
+	AllocationCount _start;
+};
+
+}
@@ -0,0 +1,484 @@
+#include "arrow_ipc.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <stdexcept>
+#include <string_view>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "data_type.h"
+#include "serialization.h"
+
+namespace daq
+{
+
+namespace
+{
+// Minimal FlatBuffers builder, just enough for the Arrow metadata (Schema.fbs, Message.fbs, File.fbs).
+// Like the real one it builds back to front, but the bytes are stored reversed, so prepending is a push_back.
+class FlatBufferBuilder
+{
+public:
+	uint32_t size() const
+	{
+		return static_cast<uint32_t>(_rev.size());
+	}
+
+	template <typename T>
+	void push(T v)
+	{
+		align(sizeof(T), sizeof(T));
+		v = ser::to_endian<std::endian::little>(v);
+		put_bytes({reinterpret_cast<const uint8_t *>(&v), sizeof(T)});
+	}
+
+	void push_offset(uint32_t target)
+	{
+		align(sizeof(uint32_t), sizeof(uint32_t));
+		push<uint32_t>(size() + sizeof(uint32_t) - target);
+	}
+
+	uint32_t create_string(std::string_view str)
+	{
+		align(str.size() + 1, sizeof(uint32_t));
+		_rev.push_back(0);
+		put_bytes({reinterpret_cast<const uint8_t *>(str.data()), str.size()});
+		push<uint32_t>(static_cast<uint32_t>(str.size()));
+		return size();
+	}
+
+	uint32_t create_offset_vector(std::span<const uint32_t> offsets)
+	{
+		align(offsets.size() * sizeof(uint32_t), sizeof(uint32_t));
+		for (auto it = offsets.rbegin(); it != offsets.rend(); ++it)
+		{
+			push_offset(*it);
+		}
+		push<uint32_t>(static_cast<uint32_t>(offsets.size()));
+		return size();
+	}
+
+	// Structs are already serialized (little endian, with their padding). All arrow structs have 8 byte alignment.
+	uint32_t create_struct_vector(std::span<const uint8_t> structs, size_t num)
+	{
+		align(structs.size(), 8);
+		put_bytes(structs);
+		push<uint32_t>(static_cast<uint32_t>(num));
+		return size();
+	}
+
+	void start_table()
+	{
+		_fields.clear();
+		_table_start = size();
+	}
+
+	template <typename T>
+	void add_field(uint16_t slot, T v)
+	{
+		push(v);
+		_fields.push_back({slot, size()});
+	}
+
+	void add_offset_field(uint16_t slot, uint32_t offset)
+	{
+		push_offset(offset);
+		_fields.push_back({slot, size()});
+	}
+
+	uint32_t end_table()
+	{
+		push<int32_t>(0); // vtable offset, patched below
+		const auto table = size();
+
+		uint16_t num_slots = 0;
+		for (const auto &field : _fields)
+		{
+			num_slots = std::max<uint16_t>(num_slots, field.slot + 1);
+		}
+		for (int slot = num_slots - 1; slot >= 0; --slot)
+		{
+			const auto it = std::find_if(_fields.begin(), _fields.end(), [&](const auto &f) { return f.slot == slot; });
+			push<uint16_t>(it == _fields.end() ? 0 : static_cast<uint16_t>(table - it->offset));
+		}
+		push<uint16_t>(static_cast<uint16_t>(table - _table_start));
+		push<uint16_t>(static_cast<uint16_t>((num_slots + 2) * sizeof(uint16_t)));
+		const auto vtable = size();
+
+		// table - vtable in final addresses
+		const auto soffset = static_cast<int32_t>(vtable - table);
+		for (size_t i = 0; i < sizeof(soffset); ++i)
+		{
+			_rev[table - 1 - i] = static_cast<uint8_t>(static_cast<uint32_t>(soffset) >> (8 * i));
+		}
+		return table;
+	}
+
+	std::vector<uint8_t> finish(uint32_t root)
+	{
+		align(sizeof(uint32_t), _min_align);
+		push_offset(root);
+		return {_rev.rbegin(), _rev.rend()};
+	}
+
+private:
+	void align(size_t len, size_t alignment)
+	{
+		_min_align = std::max(_min_align, alignment);
+		const auto padding = (~(_rev.size() + len) + 1) & (alignment - 1);
+		_rev.insert(_rev.end(), padding, 0);
+	}
+
+	void put_bytes(std::span<const uint8_t> bytes)
+	{
+		_rev.insert(_rev.end(), bytes.rbegin(), bytes.rend());
+	}
+
+	struct FieldLoc
+	{
+		uint16_t slot;
+		uint32_t offset;
+	};
+
+	std::vector<uint8_t> _rev;
+	std::vector<FieldLoc> _fields;
+	uint32_t _table_start = 0;
+	size_t _min_align = 1;
+};
+
+// Values from the Arrow format flatbuffer schemas
+constexpr int16_t metadata_version_v5 = 4;
+
+enum class MessageHeader : uint8_t
+{
+	Schema = 1,
+	RecordBatch = 3,
+};
+
+enum class TypeTag : uint8_t
+{
+	Int = 2,
+	FloatingPoint = 3,
+	Timestamp = 10,
+};
+
+constexpr std::array<uint8_t, 8> file_magic{'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+constexpr std::array<uint8_t, 8> zeros{};
+
+uint32_t build_type(FlatBufferBuilder &fbb, ArrowType type, TypeTag &tag)
+{
+	if (type == ArrowType::TimestampNs)
+	{
+		const auto timezone = fbb.create_string("UTC");
+		tag = TypeTag::Timestamp;
+		fbb.start_table();
+		fbb.add_field<int16_t>(0, 3); // NANOSECOND
+		fbb.add_offset_field(1, timezone);
+		return fbb.end_table();
+	}
+	if (type == ArrowType::Float32 || type == ArrowType::Float64)
+	{
+		tag = TypeTag::FloatingPoint;
+		fbb.start_table();
+		fbb.add_field<int16_t>(0, type == ArrowType::Float32 ? 1 : 2); // SINGLE/DOUBLE
+		return fbb.end_table();
+	}
+
+	bool is_signed = false;
+	switch (type)
+	{
+		case ArrowType::Int8:
+		case ArrowType::Int16:
+		case ArrowType::Int32:
+		case ArrowType::Int64:
+			is_signed = true;
+			break;
+		default:
+			break;
+	}
+	tag = TypeTag::Int;
+	fbb.start_table();
+	fbb.add_field<int32_t>(0, static_cast<int32_t>(arrow_type_size(type) * 8));
+	fbb.add_field<uint8_t>(1, is_signed);
+	return fbb.end_table();
+}
+
+uint32_t build_schema(FlatBufferBuilder &fbb, const std::vector<ArrowField> &schema)
+{
+	std::vector<uint32_t> fields;
+	fields.reserve(schema.size());
+	for (const auto &field : schema)
+	{
+		const auto name = fbb.create_string(field.name);
+		TypeTag tag{};
+		const auto type = build_type(fbb, field.type, tag);
+		const auto children = fbb.create_offset_vector({});
+		fbb.start_table();
+		fbb.add_offset_field(0, name);
+		fbb.add_field<uint8_t>(1, 0); // not nullable
+		fbb.add_field<uint8_t>(2, static_cast<uint8_t>(tag));
+		fbb.add_offset_field(3, type);
+		fbb.add_offset_field(5, children);
+		fields.push_back(fbb.end_table());
+	}
+	const auto fields_vec = fbb.create_offset_vector(fields);
+
+	fbb.start_table();
+	fbb.add_field<int16_t>(0, 0); // little endian
+	fbb.add_offset_field(1, fields_vec);
+	return fbb.end_table();
+}
+
+std::vector<uint8_t> build_message(
+	FlatBufferBuilder &fbb, MessageHeader header_type, uint32_t header, int64_t body_length)
+{
+	fbb.start_table();
+	fbb.add_field<int64_t>(3, body_length);
+	fbb.add_offset_field(2, header);
+	fbb.add_field<int16_t>(0, metadata_version_v5);
+	fbb.add_field<uint8_t>(1, static_cast<uint8_t>(header_type));
+	return fbb.finish(fbb.end_table());
+}
+
+size_t padding_to_8(size_t len)
+{
+	return (8 - len % 8) % 8;
+}
+
+template <typename... Args>
+void append_le(std::vector<uint8_t> &buf, Args... args)
+{
+	(
+		[&]
+		{
+			const auto v = ser::to_endian<std::endian::little>(args);
+			const auto *p = reinterpret_cast<const uint8_t *>(&v);
+			buf.insert(buf.end(), p, p + sizeof(v));
+		}(),
+		...);
+}
+}
+
+size_t arrow_type_size(ArrowType type)
+{
+	switch (type)
+	{
+		case ArrowType::Uint8:
+		case ArrowType::Int8:
+			return 1;
+		case ArrowType::Uint16:
+		case ArrowType::Int16:
+			return 2;
+		case ArrowType::Uint32:
+		case ArrowType::Int32:
+		case ArrowType::Float32:
+			return 4;
+		case ArrowType::Uint64:
+		case ArrowType::Int64:
+		case ArrowType::Float64:
+		case ArrowType::TimestampNs:
+			return 8;
+	}
+	return 0;
+}
+
+std::optional<ArrowType> arrow_type(DataType type)
+{
+	const auto *traits = data_type_traits(type);
+	if (!traits)
+	{
+		return std::nullopt;
+	}
+	switch (traits->kind)
+	{
+		case ValueKind::Bool:
+			return ArrowType::Uint8;
+		case ValueKind::Time:
+			return ArrowType::Int64;
+		case ValueKind::Float:
+			return traits->size == 4 ? ArrowType::Float32 : ArrowType::Float64;
+		case ValueKind::Signed:
+		case ValueKind::Unsigned:
+		case ValueKind::Bits:
+		{
+			constexpr std::array signed_types{ArrowType::Int8, ArrowType::Int16, ArrowType::Int32, ArrowType::Int64};
+			constexpr std::array unsigned_types{
+				ArrowType::Uint8, ArrowType::Uint16, ArrowType::Uint32, ArrowType::Uint64};
+			const auto log2_size = std::countr_zero(traits->size);
+			return traits->kind == ValueKind::Signed ? signed_types[log2_size] : unsigned_types[log2_size];
+		}
+		default:
+			return std::nullopt;
+	}
+}
+
+std::vector<ArrowField> arrow_wide_schema(std::span<const VariableInfo> vars)
+{
+	std::vector<ArrowField> schema;
+	schema.reserve(vars.size() + 1);
+	schema.push_back({.name = "timestamp", .type = ArrowType::TimestampNs});
+	for (const auto &var : vars)
+	{
+		const auto type = var.array_info ? std::nullopt : arrow_type(var.data_type);
+		if (!type)
+		{
+			throw std::runtime_error(fmt::format(
+				"Variable '{}' of type {} can not be exported to arrow", var.name, to_string(var.data_type)));
+		}
+		schema.push_back({.name = var.name, .type = *type});
+	}
+	return schema;
+}
+
+std::vector<ArrowField> arrow_long_schema(DataType value_type)
+{
+	const auto type = arrow_type(value_type);
+	if (!type)
+	{
+		throw std::runtime_error(fmt::format("Type {} can not be exported to arrow", to_string(value_type)));
+	}
+	return {
+		{.name = "timestamp", .type = ArrowType::TimestampNs},
+		{.name = "tag_id", .type = ArrowType::Uint32},
+		{.name = "value", .type = *type},
+	};
+}
+
+ArrowIpcWriter::ArrowIpcWriter(Sink sink, std::vector<ArrowField> schema, Format format)
+	: _sink(std::move(sink))
+	, _schema(std::move(schema))
+	, _format(format)
+{
+	if (_format == Format::File)
+	{
+		write(file_magic);
+	}
+
+	FlatBufferBuilder fbb;
+	const auto message = build_message(fbb, MessageHeader::Schema, build_schema(fbb, _schema), 0);
+	const auto padding = padding_to_8(message.size());
+	_metadata.clear();
+	append_le(_metadata, uint32_t{0xFFFFFFFF}, static_cast<int32_t>(message.size() + padding));
+	write(_metadata);
+	write(message);
+	write_padding(padding);
+}
+
+void ArrowIpcWriter::write_batch(size_t num_rows, std::span<const std::span<const uint8_t>> columns)
+{
+	if (_finished)
+	{
+		throw std::runtime_error("Arrow writer is already finished");
+	}
+	if (columns.size() != _schema.size())
+	{
+		throw std::runtime_error(
+			fmt::format("Record batch has {} columns, but the schema has {}", columns.size(), _schema.size()));
+	}
+
+	// FieldNode {length, null_count} and Buffer {offset, length} per column. Each column has an empty validity buffer
+	// (no nulls) followed by the data buffer.
+	std::vector<uint8_t> nodes;
+	std::vector<uint8_t> buffers;
+	nodes.reserve(columns.size() * 16);
+	buffers.reserve(columns.size() * 32);
+	int64_t body_length = 0;
+	for (size_t i = 0; i < columns.size(); ++i)
+	{
+		const auto expected = num_rows * arrow_type_size(_schema[i].type);
+		if (columns[i].size() != expected)
+		{
+			throw std::runtime_error(fmt::format(
+				"Column '{}' has {} bytes, expected {}", _schema[i].name, columns[i].size(), expected));
+		}
+		append_le(nodes, static_cast<int64_t>(num_rows), int64_t{0});
+		append_le(buffers, body_length, int64_t{0}, body_length, static_cast<int64_t>(expected));
+		body_length += static_cast<int64_t>(expected + padding_to_8(expected));
+	}
+
+	FlatBufferBuilder fbb;
+	const auto buffers_vec = fbb.create_struct_vector(buffers, buffers.size() / 16);
+	const auto nodes_vec = fbb.create_struct_vector(nodes, nodes.size() / 16);
+	fbb.start_table();
+	fbb.add_field<int64_t>(0, static_cast<int64_t>(num_rows));
+	fbb.add_offset_field(1, nodes_vec);
+	fbb.add_offset_field(2, buffers_vec);
+	const auto record_batch = fbb.end_table();
+	const auto message = build_message(fbb, MessageHeader::RecordBatch, record_batch, body_length);
+
+	const auto padding = padding_to_8(message.size());
+	const auto metadata_length = static_cast<int32_t>(8 + message.size() + padding);
+	_record_batches.push_back(
+		{.offset = static_cast<int64_t>(_offset), .metadata_length = metadata_length, .body_length = body_length});
+
+	_metadata.clear();
+	append_le(_metadata, uint32_t{0xFFFFFFFF}, static_cast<int32_t>(message.size() + padding));
+	write(_metadata);
+	write(message);
+	write_padding(padding);
+	for (const auto &column : columns)
+	{
+		write(column);
+		write_padding(padding_to_8(column.size()));
+	}
+}
+
+void ArrowIpcWriter::finish()
+{
+	if (_finished)
+	{
+		return;
+	}
+	_finished = true;
+
+	_metadata.clear();
+	append_le(_metadata, uint32_t{0xFFFFFFFF}, int32_t{0});
+	write(_metadata);
+
+	if (_format != Format::File)
+	{
+		return;
+	}
+
+	std::vector<uint8_t> blocks;
+	blocks.reserve(_record_batches.size() * 24);
+	for (const auto &block : _record_batches)
+	{
+		append_le(blocks, block.offset, block.metadata_length, int32_t{0}, block.body_length);
+	}
+
+	FlatBufferBuilder fbb;
+	const auto schema = build_schema(fbb, _schema);
+	const auto record_batches = fbb.create_struct_vector(blocks, _record_batches.size());
+	const auto dictionaries = fbb.create_struct_vector({}, 0);
+	fbb.start_table();
+	fbb.add_offset_field(1, schema);
+	fbb.add_offset_field(2, dictionaries);
+	fbb.add_offset_field(3, record_batches);
+	fbb.add_field<int16_t>(0, metadata_version_v5);
+	const auto footer = fbb.finish(fbb.end_table());
+
+	write(footer);
+	_metadata.clear();
+	append_le(_metadata, static_cast<int32_t>(footer.size()));
+	write(_metadata);
+	write(std::span(file_magic).first(6));
+}
+
+void ArrowIpcWriter::write(std::span<const uint8_t> data)
+{
+	if (!data.empty())
+	{
+		_sink(data);
+	}
+	_offset += data.size();
+}
+
+void ArrowIpcWriter::write_padding(size_t num)
+{
+	write(std::span(zeros).first(num));
+}
+
+}
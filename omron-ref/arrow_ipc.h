@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "omron.h"
+
+namespace daq
+{
+
+// Only fixed width types are supported, so column buffers can be handed to the sink as they are.
+enum class ArrowType : uint8_t
+{
+	Uint8,
+	Int8,
+	Uint16,
+	Int16,
+	Uint32,
+	Int32,
+	Uint64,
+	Int64,
+	Float32,
+	Float64,
+	TimestampNs, // int64 nanoseconds since epoch, UTC
+};
+
+size_t arrow_type_size(ArrowType type);
+
+// Returns nullopt for types that don't have a fixed width value representation (strings, structures, arrays).
+// BOOL is exported as one byte per value and the date/time types as their raw 64 bit nanosecond counts.
+std::optional<ArrowType> arrow_type(DataType type);
+
+struct ArrowField
+{
+	std::string name;
+	ArrowType type;
+};
+
+// Timestamp column plus one column per variable. Throws if a variable has no fixed width representation.
+std::vector<ArrowField> arrow_wide_schema(std::span<const VariableInfo> vars);
+
+// Long layout: (timestamp, tag_id, value) with one schema per value type.
+std::vector<ArrowField> arrow_long_schema(DataType value_type);
+
+// Writes the Arrow IPC streaming or file format. Only the message metadata and padding are produced by the writer,
+// column data is passed to the sink straight from the caller's buffers, so the sink can do a gather write without
+// any copies. Column buffers must contain densely packed little endian values, which is what the CIP replies are.
+class ArrowIpcWriter
+{
+public:
+	enum class Format
+	{
+		Stream,
+		File,
+	};
+
+	using Sink = std::function<void(std::span<const uint8_t>)>;
+
+	ArrowIpcWriter(Sink sink, std::vector<ArrowField> schema, Format format = Format::Stream);
+
+	// One record batch, e.g. one poll window. columns[i] holds num_rows values of schema[i].
+	void write_batch(size_t num_rows, std::span<const std::span<const uint8_t>> columns);
+
+	// Writes the end of stream marker (and the footer for the file format). No batches can be written afterwards.
+	void finish();
+
+private:
+	void write(std::span<const uint8_t> data);
+	void write_padding(size_t num);
+
+	struct Block
+	{
+		int64_t offset;
+		int32_t metadata_length;
+		int64_t body_length;
+	};
+
+	Sink _sink;
+	std::vector<ArrowField> _schema;
+	Format _format;
+	uint64_t _offset = 0;
+	std::vector<Block> _record_batches;
+	std::vector<uint8_t> _metadata;
+	bool _finished = false;
+};
+
+}
@@ -0,0 +1,295 @@
+// Checks the byte layout of ArrowIpcWriter output: the continuation markers and 8 byte aligned metadata of every
+// message, the message headers and body lengths, the column data of each record batch at the offsets its Buffer
+// entries give, the end of stream marker, and for the file format the magic, the footer length and the footer's
+// record batch blocks. The flatbuffers are read with a minimal table reader, so the test doesn't need Arrow itself.
+
+#include <cstring>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "arrow_ipc.h"
+#include "test_util.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+template <typename T>
+T read_le(std::span<const uint8_t> buf, size_t pos)
+{
+	if (pos + sizeof(T) > buf.size())
+	{
+		throw std::runtime_error(fmt::format("Read of {} bytes at {} is past the end of {} bytes", sizeof(T), pos,
+			buf.size()));
+	}
+	std::make_unsigned_t<T> v = 0;
+	for (size_t i = 0; i < sizeof(T); ++i)
+	{
+		v |= static_cast<std::make_unsigned_t<T>>(static_cast<std::make_unsigned_t<T>>(buf[pos + i]) << (8 * i));
+	}
+	return static_cast<T>(v);
+}
+
+// Just enough of a FlatBuffers reader to follow tables, vectors and strings
+struct Table
+{
+	std::span<const uint8_t> buf;
+	size_t pos;
+
+	static Table root(std::span<const uint8_t> buf)
+	{
+		return {buf, read_le<uint32_t>(buf, 0)};
+	}
+
+	// 0 if the field is absent
+	size_t field(uint16_t slot) const
+	{
+		const auto vtable = static_cast<size_t>(static_cast<int64_t>(pos) - read_le<int32_t>(buf, pos));
+		const auto vtable_size = read_le<uint16_t>(buf, vtable);
+		const size_t entry = 4 + 2 * size_t{slot};
+		if (entry >= vtable_size)
+		{
+			return 0;
+		}
+		const auto offset = read_le<uint16_t>(buf, vtable + entry);
+		return offset == 0 ? 0 : pos + offset;
+	}
+
+	template <typename T>
+	T scalar(uint16_t slot, T default_value = 0) const
+	{
+		const auto p = field(slot);
+		return p == 0 ? default_value : read_le<T>(buf, p);
+	}
+
+	size_t indirect(uint16_t slot) const
+	{
+		const auto p = field(slot);
+		if (p == 0)
+		{
+			throw std::runtime_error(fmt::format("Field {} is missing", slot));
+		}
+		return p + read_le<uint32_t>(buf, p);
+	}
+
+	Table table(uint16_t slot) const
+	{
+		return {buf, indirect(slot)};
+	}
+
+	// Returns the position of the first element and the number of elements
+	std::pair<size_t, uint32_t> vector(uint16_t slot) const
+	{
+		const auto v = indirect(slot);
+		return {v + 4, read_le<uint32_t>(buf, v)};
+	}
+
+	std::string_view string(uint16_t slot) const
+	{
+		const auto [data, size] = vector(slot);
+		if (data + size > buf.size())
+		{
+			throw std::runtime_error("String is past the end of the buffer");
+		}
+		return {reinterpret_cast<const char *>(buf.data() + data), size};
+	}
+};
+
+struct Batch
+{
+	size_t num_rows;
+	std::vector<std::vector<uint8_t>> columns;
+};
+
+constexpr int16_t metadata_version_v5 = 4;
+constexpr uint8_t header_schema = 1;
+constexpr uint8_t header_record_batch = 3;
+
+std::vector<uint8_t> values(std::initializer_list<uint8_t> bytes)
+{
+	return bytes;
+}
+
+template <typename T>
+std::vector<uint8_t> values_of(std::initializer_list<T> list)
+{
+	std::vector<uint8_t> bytes(list.size() * sizeof(T));
+	std::memcpy(bytes.data(), list.begin(), bytes.size());
+	return bytes;
+}
+
+std::vector<uint8_t> write(ArrowIpcWriter::Format format, const std::vector<ArrowField> &schema,
+	const std::vector<Batch> &batches)
+{
+	std::vector<uint8_t> out;
+	ArrowIpcWriter writer([&](std::span<const uint8_t> data) { out.insert(out.end(), data.begin(), data.end()); },
+		schema,
+		format);
+	for (const auto &batch : batches)
+	{
+		std::vector<std::span<const uint8_t>> columns(batch.columns.begin(), batch.columns.end());
+		writer.write_batch(batch.num_rows, columns);
+	}
+	writer.finish();
+	return out;
+}
+
+// Walks the messages of a stream starting at pos and returns the offset of each record batch message. pos ends up
+// after the end of stream marker.
+std::vector<size_t> check_stream(Checker &check, std::span<const uint8_t> buf, size_t &pos,
+	const std::vector<ArrowField> &schema, const std::vector<Batch> &batches)
+{
+	std::vector<size_t> offsets;
+	for (size_t message = 0; message <= batches.size(); ++message)
+	{
+		const auto start = pos;
+		check.expect(read_le<uint32_t>(buf, pos) == 0xFFFFFFFF, fmt::format("continuation marker at {}", pos));
+		const auto length = static_cast<size_t>(read_le<int32_t>(buf, pos + 4));
+		check.expect(length % 8 == 0, fmt::format("metadata length {} is a multiple of 8", length));
+		pos += 8;
+		const auto metadata = buf.subspan(pos, length);
+		pos += length;
+
+		const auto msg = Table::root(metadata);
+		check.expect(msg.scalar<int16_t>(0) == metadata_version_v5, "metadata version V5");
+		const auto body_length = static_cast<size_t>(msg.scalar<int64_t>(3));
+		const auto header = msg.table(2);
+		if (message == 0)
+		{
+			check.expect(msg.scalar<uint8_t>(1) == header_schema, "first message is the schema");
+			check.expect(body_length == 0, "schema has no body");
+			const auto [fields, num_fields] = header.vector(1);
+			check.expect(num_fields == schema.size(), fmt::format("{} schema fields", schema.size()));
+			for (uint32_t i = 0; i < num_fields && i < schema.size(); ++i)
+			{
+				const auto field_pos = fields + 4 * size_t{i};
+				const Table field{metadata, field_pos + read_le<uint32_t>(metadata, field_pos)};
+				check.expect(field.string(0) == schema[i].name, fmt::format("field {} is named {}", i, schema[i].name));
+			}
+			continue;
+		}
+
+		const auto &batch = batches[message - 1];
+		offsets.push_back(start);
+		check.expect(msg.scalar<uint8_t>(1) == header_record_batch, "message is a record batch");
+		check.expect(static_cast<size_t>(header.scalar<int64_t>(0)) == batch.num_rows,
+			fmt::format("record batch has {} rows", batch.num_rows));
+		const auto [nodes, num_nodes] = header.vector(1);
+		const auto [buffers, num_buffers] = header.vector(2);
+		check.expect(num_nodes == batch.columns.size(), "one field node per column");
+		check.expect(num_buffers == 2 * batch.columns.size(), "validity and data buffer per column");
+		const auto body = buf.subspan(pos, std::min(body_length, buf.size() - pos));
+		check.expect(body.size() == body_length, "body is complete");
+		for (uint32_t i = 0; i < num_nodes && i < batch.columns.size(); ++i)
+		{
+			check.expect(static_cast<size_t>(read_le<int64_t>(metadata, nodes + 16 * i)) == batch.num_rows,
+				fmt::format("field node {} length", i));
+			check.expect(read_le<int64_t>(metadata, nodes + 16 * i + 8) == 0, fmt::format("field node {} nulls", i));
+			check.expect(read_le<int64_t>(metadata, buffers + 32 * i + 8) == 0,
+				fmt::format("column {} has no validity bitmap", i));
+			const auto offset = static_cast<size_t>(read_le<int64_t>(metadata, buffers + 32 * i + 16));
+			const auto size = static_cast<size_t>(read_le<int64_t>(metadata, buffers + 32 * i + 24));
+			const auto &column = batch.columns[i];
+			check.expect(offset % 8 == 0, fmt::format("column {} data is 8 byte aligned", i));
+			check.expect(size == column.size() && offset + size <= body.size() &&
+					std::equal(column.begin(), column.end(), body.begin() + static_cast<ptrdiff_t>(offset)),
+				fmt::format("column {} data", i));
+		}
+		pos += body_length;
+	}
+
+	check.expect(read_le<uint32_t>(buf, pos) == 0xFFFFFFFF && read_le<int32_t>(buf, pos + 4) == 0,
+		"end of stream marker");
+	pos += 8;
+	return offsets;
+}
+
+void check_file(Checker &check, std::span<const uint8_t> file, std::span<const uint8_t> stream,
+	const std::vector<ArrowField> &schema, const std::vector<Batch> &batches)
+{
+	constexpr std::string_view magic("ARROW1\0\0", 8);
+	check.expect(file.size() > 16 && std::equal(magic.begin(), magic.end(), file.begin()), "leading magic");
+	check.expect(std::equal(magic.begin(), magic.begin() + 6, file.end() - 6), "trailing magic");
+
+	size_t pos = 8;
+	const auto offsets = check_stream(check, file, pos, schema, batches);
+	check.expect(std::equal(stream.begin(), stream.end(), file.begin() + 8, file.begin() + 8 + stream.size()),
+		"file embeds the stream");
+
+	const auto footer_length = static_cast<size_t>(read_le<int32_t>(file, file.size() - 10));
+	check.expect(pos + footer_length + 10 == file.size(), "footer follows the end of stream marker");
+	const auto footer = Table::root(file.subspan(pos, footer_length));
+	check.expect(footer.scalar<int16_t>(0) == metadata_version_v5, "footer metadata version V5");
+	const auto [fields, num_fields] = footer.table(1).vector(1);
+	check.expect(num_fields == schema.size(), "footer schema fields");
+	const auto [blocks, num_blocks] = footer.vector(3);
+	check.expect(num_blocks == batches.size(), fmt::format("{} record batch blocks", batches.size()));
+	for (uint32_t i = 0; i < num_blocks && i < offsets.size(); ++i)
+	{
+		const auto block = blocks + 24 * size_t{i};
+		const auto offset = static_cast<size_t>(read_le<int64_t>(footer.buf, block));
+		const auto metadata_length = static_cast<size_t>(read_le<int32_t>(footer.buf, block + 8));
+		check.expect(offset == offsets[i], fmt::format("block {} offset {}", i, offsets[i]));
+		check.expect(metadata_length == 8 + static_cast<size_t>(read_le<int32_t>(file, offset + 4)),
+			fmt::format("block {} metadata length includes the prefix", i));
+	}
+}
+
+bool run()
+{
+	const std::vector<ArrowField> schema{
+		{.name = "timestamp", .type = ArrowType::TimestampNs},
+		{.name = "Line2.Speed", .type = ArrowType::Int16},
+		{.name = "Pump_Alarm", .type = ArrowType::Uint8},
+		{.name = "Tank.Level", .type = ArrowType::Float64},
+	};
+	const std::vector<Batch> batches{
+		{3,
+			{values_of<int64_t>({1'700'000'000'000'000'000, 1'700'000'000'100'000'000, 1'700'000'000'200'000'000}),
+				values_of<int16_t>({-3, 0, 1200}),
+				values({1, 0, 1}),
+				values_of<double>({12.5, 12.75, 13.0})}},
+		{0, {{}, {}, {}, {}}},
+		{1,
+			{values_of<int64_t>({1'700'000'000'300'000'000}),
+				values_of<int16_t>({7}),
+				values({0}),
+				values_of<double>({-1.0})}},
+	};
+
+	Checker check;
+	check.context("stream");
+	const auto stream = write(ArrowIpcWriter::Format::Stream, schema, batches);
+	size_t pos = 0;
+	check_stream(check, stream, pos, schema, batches);
+	check.expect(pos == stream.size(), "nothing after the end of stream marker");
+
+	check.context("file");
+	check_file(check, write(ArrowIpcWriter::Format::File, schema, batches), stream, schema, batches);
+
+	check.context("empty file");
+	const auto empty_stream = write(ArrowIpcWriter::Format::Stream, schema, {});
+	check_file(check, write(ArrowIpcWriter::Format::File, schema, {}), empty_stream, schema, {});
+
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS stream and file with {} batches\n", batches.size());
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
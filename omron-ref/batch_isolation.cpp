@@ -0,0 +1,140 @@
+#include "batch_isolation.h"
+
+#include <optional>
+
+#include "cip_error.h"
+#include "log.h"
+
+namespace daq
+{
+
+namespace
+{
+struct Status
+{
+	uint8_t general;
+	std::vector<uint8_t> extended;
+};
+
+class Bisector
+{
+public:
+	Bisector(const BatchRequest &request, TagQuarantine &quarantine, TagQuarantine::Clock::time_point now)
+		: _request(request)
+		, _quarantine(quarantine)
+		, _now(now)
+	{
+	}
+
+	// batch is known to fail with status. A failed batch, or half of one, contains a bad tag whatever the status says,
+	// only the status of a single tag tells whether it's the tag or the controller. own is false if status is of a
+	// larger batch around this one.
+	void isolate(std::span<const NameId> batch, const Status &status, bool own)
+	{
+		if (batch.empty() || result.controller_status)
+		{
+			return;
+		}
+		if (batch.size() == 1)
+		{
+			isolate_single(batch.front(), status, own);
+			return;
+		}
+
+		const auto left = batch.first(batch.size() / 2);
+		const auto right = batch.subspan(left.size());
+		if (const auto left_status = try_request(left))
+		{
+			isolate(left, *left_status, true);
+			if (result.controller_status)
+			{
+				return;
+			}
+			if (const auto right_status = try_request(right))
+			{
+				isolate(right, *right_status, true);
+			}
+		}
+		else
+		{
+			// The left half is fine, so the right half has to contain the failure
+			isolate(right, status, false);
+		}
+	}
+
+	BatchIsolationResult result;
+
+private:
+	void isolate_single(NameId tag, const Status &status, bool own)
+	{
+		if (!own)
+		{
+			const auto tag_status = try_request(std::span(&tag, 1));
+			if (!tag_status)
+			{
+				// Worked on its own this time, nothing to hold against it
+				return;
+			}
+			isolate_single(tag, *tag_status, true);
+			return;
+		}
+		if (!is_tag_specific_error(status.general, status.extended))
+		{
+			// Says nothing about the tag, and the rest of the batch would only fail the same way
+			result.controller_status = status.general;
+			return;
+		}
+		result.failed.push_back(tag);
+		_quarantine.quarantine(tag, status.general, status.extended, _now);
+	}
+
+	std::optional<Status> try_request(std::span<const NameId> batch)
+	{
+		++result.num_requests;
+		try
+		{
+			_request(batch);
+			return std::nullopt;
+		}
+		catch (const CipStatusError &e)
+		{
+			const auto ext = e.extended_status();
+			return Status{.general = e.general_status(), .extended = {ext.begin(), ext.end()}};
+		}
+	}
+
+	const BatchRequest &_request;
+	TagQuarantine &_quarantine;
+	TagQuarantine::Clock::time_point _now;
+};
+}
+
+BatchIsolationResult isolate_batch_failure(
+	std::span<const NameId> batch,
+	uint8_t general_status,
+	std::span<const uint8_t> extended_status,
+	const BatchRequest &request,
+	TagQuarantine &quarantine,
+	TagQuarantine::Clock::time_point now)
+{
+	Bisector bisector(request, quarantine, now);
+	bisector.isolate(
+		batch, {.general = general_status, .extended = {extended_status.begin(), extended_status.end()}}, true);
+	if (bisector.result.controller_status)
+	{
+		logger->debug(
+			"Stopped isolating failures in a batch of {} after {} requests, controller wide status {:#04x}",
+			batch.size(),
+			bisector.result.num_requests,
+			*bisector.result.controller_status);
+		return std::move(bisector.result);
+	}
+	logger->debug(
+		"Isolated {} failing tags in a batch of {} with {} requests",
+		bisector.result.failed.size(),
+		batch.size(),
+		bisector.result.num_requests);
+	return std::move(bisector.result);
+}
+
+}
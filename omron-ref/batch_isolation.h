@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "name_interner.h"
+#include "tag_quarantine.h"
+
+namespace daq
+{
+
+// Sends the services for the given tags as one batch (e.g. one Multiple Service Packet, or the service alone for a
+// single tag). Returns normally if the batch succeeded and throws CipStatusError if it failed as a whole.
+using BatchRequest = std::function<void(std::span<const NameId>)>;
+
+struct BatchIsolationResult
+{
+	std::vector<NameId> failed;
+	size_t num_requests = 0;
+	// Set if a single tag failed with a controller wide status (see is_tag_specific_error). Bisection stops there, the
+	// tags isolated before stay in failed.
+	std::optional<uint8_t> controller_status;
+};
+
+// Finds the tags that make a batch fail by splitting it in halves recursively, so k bad tags in a batch of n cost
+// O(k log n) requests instead of n single reads. general_status and extended_status are of the failed batch request,
+// whatever they are (e.g. 0x11 reply too large for a packet), the batch is taken to contain a bad tag. Only tags that
+// fail alone with a tag specific error are put into quarantine, which keeps them out of future batches. Errors other
+// than CipStatusError are rethrown, because they say nothing about the tags.
+BatchIsolationResult isolate_batch_failure(
+	std::span<const NameId> batch,
+	uint8_t general_status,
+	std::span<const uint8_t> extended_status,
+	const BatchRequest &request,
+	TagQuarantine &quarantine,
+	TagQuarantine::Clock::time_point now);
+
+}
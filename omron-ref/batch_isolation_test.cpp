@@ -0,0 +1,116 @@
+// Runs QuarantinedReadPlan::isolate_failure against a simulated controller (sim_plc.h) with a variable that fails a
+// whole Multiple Service Packet and, in the same batch, a variable whose Read Data fails on its own, so the part of the
+// batch around it goes through with 0x1E. The first is isolated by bisection, the second has to be recorded from the
+// embedded reply. Both end up in quarantine, nothing else does.
+
+#include <iostream>
+#include <memory_resource>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "cip_error.h"
+#include "list_signals.h"
+#include "read_plan.h"
+#include "sim_plc.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+// The simulated variable numbered n, its name ends with "_n"
+uint32_t variable_number(const VariableTable &vars, size_t n)
+{
+	const auto suffix = fmt::format("_{}", n);
+	for (uint32_t i = 0; i < vars.size(); ++i)
+	{
+		if (vars[i].name.ends_with(suffix))
+		{
+			return i;
+		}
+	}
+	throw std::runtime_error(fmt::format("The simulated controller has no variable {}", n));
+}
+
+bool run()
+{
+	constexpr size_t bulk_failing = 2;
+	constexpr size_t failing = 6;
+	std::vector<SimulatedControllerConfig> configs(1);
+	configs[0].num_variables = 16;
+	configs[0].failing_variables = {failing};
+	configs[0].bulk_failing_variables = {bulk_failing};
+	SimulatedPlcServer server(configs);
+	plc_tag::Attributes attributes;
+	attributes.gateway = server.gateway(0);
+	attributes.path = "1,0";
+	attributes.plc = "omron-njnx";
+	RequestContext rc(attributes);
+
+	Checker check;
+	const auto vars = get_variables_fast(rc, VariableAddressing::Symbolic, std::pmr::get_default_resource());
+	const auto bulk_failing_variable = variable_number(vars, bulk_failing);
+	const auto failing_variable = variable_number(vars, failing);
+	QuarantinedReadPlan reads(
+		vars,
+		VariableAddressing::Symbolic,
+		1994,
+		{.max_failures = 1, .initial_backoff = std::chrono::seconds(1), .max_backoff = std::chrono::seconds(1)});
+	check.expect(reads.batches().size() == 1, fmt::format("{} batches, expected 1", reads.batches().size()));
+	const auto &batch = reads.batches().front();
+
+	std::optional<CipStatusError> failure;
+	rc.serializer.reset();
+	ser::serialize(rc.serializer, batch.request);
+	try
+	{
+		rc.request();
+	}
+	catch (const CipStatusError &e)
+	{
+		failure = e;
+	}
+	check.expect(failure && failure->general_status() == 0x1F, "the batch fails as a whole");
+	if (!failure)
+	{
+		return false;
+	}
+
+	const auto now = TagQuarantine::Clock::now();
+	const auto result =
+		reads.isolate_failure(rc, batch, failure->general_status(), failure->extended_status(), now);
+	check.expect(!result.controller_status, "no controller wide status");
+	check.expect(result.failed == std::vector<NameId>{bulk_failing_variable}, "bisection isolates the bulk failure");
+	const auto &quarantine = reads.quarantine();
+	check.expect(quarantine.is_quarantined(bulk_failing_variable), "the bulk failing variable is quarantined");
+	check.expect(quarantine.is_quarantined(failing_variable), "the failure in a 0x1E reply is recorded");
+	check.expect(quarantine.num_quarantined() == 2, fmt::format("{} quarantined", quarantine.num_quarantined()));
+
+	reads.update(now);
+	size_t planned = 0;
+	for (const auto &b : reads.batches())
+	{
+		planned += b.variables.size();
+	}
+	check.expect(planned == vars.size() - 2, fmt::format("{} of {} variables planned", planned, vars.size()));
+
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS isolated with {} requests\n", result.num_requests);
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
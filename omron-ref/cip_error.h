@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace daq
+{
+
+// Thrown by RequestContext::request() when the reply has a non zero general status, so callers can react to the
+// status codes without parsing the message.
+class CipStatusError : public std::runtime_error
+{
+public:
+	CipStatusError(const std::string &message, uint8_t general_status, std::span<const uint8_t> extended_status)
+		: std::runtime_error(message)
+		, _general_status(general_status)
+		, _extended_status(extended_status.begin(), extended_status.end())
+	{
+	}
+
+	uint8_t general_status() const
+	{
+		return _general_status;
+	}
+
+	std::span<const uint8_t> extended_status() const
+	{
+		return _extended_status;
+	}
+
+private:
+	uint8_t _general_status;
+	std::vector<uint8_t> _extended_status;
+};
+
+}
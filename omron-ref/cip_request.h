@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+namespace daq
+{
+
+// Builds a CIP request (service, request path, request data) in a constant expression. The segments are encoded like
+// address_request_path() and variable_request_path(). It is a structural type, so the finished request can be passed
+// to cip_request:
+//
+//   constexpr auto request = cip_request<CipRequestBuilder(0x01).class_id(0x6a).instance_id(0)>;
+//
+// Misuse (a segment after data, overflowing the buffer) throws, which is a compile error in a constant expression.
+struct CipRequestBuilder
+{
+	static constexpr size_t capacity = 256;
+
+	std::array<uint8_t, capacity> bytes{};
+	size_t size = 2; // service and path size
+	bool path_closed = false;
+
+	constexpr explicit CipRequestBuilder(uint8_t service)
+	{
+		bytes[0] = service;
+	}
+
+	// 8 bit logical class segment
+	constexpr CipRequestBuilder class_id(uint8_t id) const
+	{
+		return segment(0x20).raw(id);
+	}
+
+	// 16 bit logical instance segment, 32 bit if the id doesn't fit
+	constexpr CipRequestBuilder instance_id(uint32_t id) const
+	{
+		if (id > 0xFFFF)
+		{
+			return segment(0x26).raw(uint8_t{0}).raw(id);
+		}
+		return segment(0x25).raw(uint8_t{0}).raw(static_cast<uint16_t>(id));
+	}
+
+	constexpr CipRequestBuilder attribute_id(uint8_t id) const
+	{
+		return segment(0x30).raw(id);
+	}
+
+	// ANSI extended symbol segment, padded to a full word
+	constexpr CipRequestBuilder symbol(std::string_view name) const
+	{
+		if (name.size() > 0xFF)
+		{
+			throw std::length_error("Symbol too long");
+		}
+		auto result = segment(0x91).raw(static_cast<uint8_t>(name.size())).raw(name);
+		return name.size() % 2 != 0 ? result.raw(uint8_t{0}) : result;
+	}
+
+	// Request data, little endian. Ends the request path.
+	constexpr CipRequestBuilder data(std::integral auto value) const
+	{
+		auto result = *this;
+		result.path_closed = true;
+		return result.raw(value);
+	}
+
+	constexpr CipRequestBuilder data(std::string_view raw_bytes) const
+	{
+		auto result = *this;
+		result.path_closed = true;
+		return result.raw(raw_bytes);
+	}
+
+	// The builder has to stay structural, these are only public because of that
+	constexpr CipRequestBuilder segment(uint8_t type) const
+	{
+		if (path_closed)
+		{
+			throw std::logic_error("Path segment after request data");
+		}
+		return raw(type);
+	}
+
+	constexpr CipRequestBuilder raw(std::integral auto value) const
+	{
+		auto result = *this;
+		for (size_t i = 0; i < sizeof(value); ++i)
+		{
+			result.push(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i)));
+		}
+		return result.update_path_size();
+	}
+
+	constexpr CipRequestBuilder raw(std::string_view raw_bytes) const
+	{
+		auto result = *this;
+		for (const auto c : raw_bytes)
+		{
+			result.push(static_cast<uint8_t>(c));
+		}
+		return result.update_path_size();
+	}
+
+	constexpr void push(uint8_t byte)
+	{
+		if (size == capacity)
+		{
+			throw std::length_error("CIP request too long");
+		}
+		bytes[size++] = byte;
+	}
+
+	constexpr CipRequestBuilder update_path_size() const
+	{
+		auto result = *this;
+		if (!result.path_closed)
+		{
+			result.bytes[1] = static_cast<uint8_t>((result.size - 2 + 1) / 2);
+		}
+		return result;
+	}
+};
+
+// The encoded request, sized exactly
+template <CipRequestBuilder Request>
+constexpr auto cip_request = []
+{
+	std::array<uint8_t, Request.size> packet{};
+	std::copy_n(Request.bytes.begin(), Request.size, packet.begin());
+	return packet;
+}();
+
+}
@@ -0,0 +1,137 @@
+// Checks the bytes CipRequestBuilder produces: hand written requests for each segment, the request path size in
+// words, padding and request data, and paths that match address_request_path and variable_request_path. Misuse throws.
+
+#include <cstdint>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "cip_request.h"
+#include "hex.h"
+#include "test_util.h"
+#include "variable_address.h"
+
+namespace daq
+{
+
+namespace
+{
+// Get Attribute All of the class attributes of the variable object, as list_signals sends it
+static_assert(
+	cip_request<CipRequestBuilder(0x01).class_id(0x6a).instance_id(0)>
+	== std::array<uint8_t, 8>{0x01, 0x03, 0x20, 0x6a, 0x25, 0x00, 0x00, 0x00});
+
+std::vector<uint8_t> bytes_of(const CipRequestBuilder &request)
+{
+	return {request.bytes.begin(), request.bytes.begin() + static_cast<ptrdiff_t>(request.size)};
+}
+
+// The request path of a request without data
+std::vector<uint8_t> path_of(const CipRequestBuilder &request)
+{
+	return {request.bytes.begin() + 2, request.bytes.begin() + 2 + 2 * request.bytes[1]};
+}
+
+template <typename Error, typename F>
+bool throws(F &&f)
+{
+	try
+	{
+		f();
+	}
+	catch (const Error &)
+	{
+		return true;
+	}
+	return false;
+}
+
+bool run()
+{
+	Checker check;
+	const auto expect_bytes = [&](const CipRequestBuilder &request, std::vector<uint8_t> expected, std::string what)
+	{
+		const auto actual = bytes_of(request);
+		check.expect(actual == expected, fmt::format("{}: {}, expected {}", what, hex(actual), hex(expected)));
+	};
+
+	check.context("segments");
+	expect_bytes(CipRequestBuilder(0x0E), {0x0E, 0x00}, "service only");
+	expect_bytes(
+		CipRequestBuilder(0x0E).class_id(0x6b).instance_id(0x1234).attribute_id(0x02),
+		{0x0E, 0x04, 0x20, 0x6b, 0x25, 0x00, 0x34, 0x12, 0x30, 0x02},
+		"class, 16 bit instance, attribute");
+	expect_bytes(
+		CipRequestBuilder(0x01).class_id(0x6b).instance_id(0x12345),
+		{0x01, 0x04, 0x20, 0x6b, 0x26, 0x00, 0x45, 0x23, 0x01, 0x00},
+		"32 bit instance");
+	expect_bytes(
+		CipRequestBuilder(0x4C).symbol("abc"),
+		{0x4C, 0x03, 0x91, 0x03, 'a', 'b', 'c', 0x00},
+		"odd symbol, padded");
+	expect_bytes(CipRequestBuilder(0x4C).symbol("ab"), {0x4C, 0x02, 0x91, 0x02, 'a', 'b'}, "even symbol");
+
+	check.context("data");
+	expect_bytes(
+		CipRequestBuilder(0x4C).symbol("ab").data(uint16_t{1}),
+		{0x4C, 0x02, 0x91, 0x02, 'a', 'b', 0x01, 0x00},
+		"element count");
+	expect_bytes(
+		CipRequestBuilder(0x54).class_id(0x06).instance_id(1).data(uint8_t{0x0a}).data(uint32_t{0x11223344}),
+		{0x54, 0x03, 0x20, 0x06, 0x25, 0x00, 0x01, 0x00, 0x0a, 0x44, 0x33, 0x22, 0x11},
+		"path size ends at the data");
+	expect_bytes(
+		CipRequestBuilder(0x4D).symbol("a").data("\x01\x02"), {0x4D, 0x02, 0x91, 0x01, 'a', 0x00, 1, 2}, "raw data");
+
+	check.context("paths");
+	for (const uint32_t instance_id : {0u, 1u, 0xFFFFu, 0x10000u, 0xFFFFFFFFu})
+	{
+		check.expect(
+			path_of(CipRequestBuilder(0x01).class_id(0x6b).instance_id(instance_id))
+				== address_request_path(0x6b, instance_id),
+			fmt::format("instance {} differs from address_request_path", instance_id));
+	}
+	for (const auto &name : std::vector<std::string>{"a", "ab", "Line1", "Motor_Speed", std::string(249, 'x')})
+	{
+		check.expect(
+			path_of(CipRequestBuilder(0x4C).symbol(name)) == variable_request_path(name),
+			fmt::format("{} differs from variable_request_path", name));
+	}
+
+	check.context("misuse");
+	check.expect(
+		throws<std::logic_error>([] { CipRequestBuilder(0x4C).data(uint8_t{1}).class_id(0x6b); }),
+		"segment after data accepted");
+	check.expect(
+		throws<std::length_error>([] { CipRequestBuilder(0x4C).symbol(std::string(256, 'x')); }),
+		"256 character symbol accepted");
+	check.expect(
+		throws<std::length_error>(
+			[]
+			{
+				auto request = CipRequestBuilder(0x4C);
+				for (size_t i = 0; i < CipRequestBuilder::capacity / 2; ++i)
+				{
+					request = request.class_id(0x6b);
+				}
+			}),
+		"overflow accepted");
+
+	if (check.ok)
+	{
+		std::cout << "PASS\n";
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#include "omron.h"
+
+namespace daq
+{
+
+// How the bytes of a value are interpreted. Code that decodes values switches on it, so the table needs no decoder
+// function per type.
+enum class ValueKind : uint8_t
+{
+	None, // not a value
+	Bool,
+	Signed,
+	Unsigned,
+	Float,
+	Bits, // BYTE, WORD, DWORD, LWORD
+	Time, // signed 64 bit nanoseconds
+	String,
+	Structure,
+	Array,
+};
+
+struct DataTypeTraits
+{
+	DataType type;
+	std::string_view name;
+	uint8_t size; // of a value in a read reply, 0 if it depends on the variable
+	ValueKind kind;
+	bool valid; // can be the type of a variable
+};
+
+// Everything known about a type. Adding a type only needs a line here.
+constexpr std::array data_types{
+	DataTypeTraits{DataType::Undefined, "UNDEFINED", 0, ValueKind::None, false},
+	DataTypeTraits{DataType::Date, "DATE", 8, ValueKind::Time, true},
+	DataTypeTraits{DataType::Time, "TIME", 8, ValueKind::Time, true},
+	DataTypeTraits{DataType::DateAndTime, "DATE_AND_TIME", 8, ValueKind::Time, true},
+	DataTypeTraits{DataType::TimeOfDay, "TIME_OF_DAY", 8, ValueKind::Time, true},
+	DataTypeTraits{DataType::Bool, "BOOL", 1, ValueKind::Bool, true},
+	DataTypeTraits{DataType::Sint, "SINT", 1, ValueKind::Signed, true},
+	DataTypeTraits{DataType::Int, "INT", 2, ValueKind::Signed, true},
+	DataTypeTraits{DataType::Dint, "DINT", 4, ValueKind::Signed, true},
+	DataTypeTraits{DataType::Lint, "LINT", 8, ValueKind::Signed, true},
+	DataTypeTraits{DataType::Usint, "USINT", 1, ValueKind::Unsigned, true},
+	DataTypeTraits{DataType::Uint, "UINT", 2, ValueKind::Unsigned, true},
+	DataTypeTraits{DataType::Udint, "UDINT", 4, ValueKind::Unsigned, true},
+	DataTypeTraits{DataType::Ulint, "ULINT", 8, ValueKind::Unsigned, true},
+	DataTypeTraits{DataType::Real, "REAL", 4, ValueKind::Float, true},
+	DataTypeTraits{DataType::Lreal, "LREAL", 8, ValueKind::Float, true},
+	DataTypeTraits{DataType::String, "STRING", 0, ValueKind::String, true},
+	DataTypeTraits{DataType::Byte, "BYTE", 1, ValueKind::Bits, true},
+	DataTypeTraits{DataType::Word, "WORD", 2, ValueKind::Bits, true},
+	DataTypeTraits{DataType::Dword, "DWORD", 4, ValueKind::Bits, true},
+	DataTypeTraits{DataType::Lword, "LWORD", 8, ValueKind::Bits, true},
+	DataTypeTraits{DataType::Time2, "TIME2", 8, ValueKind::Time, true},
+	DataTypeTraits{DataType::AbbreviatedStructure, "ABBREVIATED_STRUCTURE", 0, ValueKind::Structure, true},
+	DataTypeTraits{DataType::Structure, "STRUCTURE", 0, ValueKind::Structure, true},
+	DataTypeTraits{DataType::Array, "ARRAY", 0, ValueKind::Array, true},
+};
+
+namespace detail
+{
+constexpr uint8_t no_data_type = 0xff;
+
+// Type code -> index into data_types
+constexpr auto data_type_index = []
+{
+	static_assert(data_types.size() < no_data_type);
+	std::array<uint8_t, 256> index{};
+	index.fill(no_data_type);
+	for (size_t i = 0; i < data_types.size(); ++i)
+	{
+		index[static_cast<uint8_t>(data_types[i].type)] = static_cast<uint8_t>(i);
+	}
+	return index;
+}();
+}
+
+// nullptr for codes that aren't in the table
+constexpr const DataTypeTraits *data_type_traits(DataType type)
+{
+	const auto i = detail::data_type_index[static_cast<uint8_t>(type)];
+	return i == detail::no_data_type ? nullptr : &data_types[i];
+}
+
+// Empty for codes that aren't in the table. Unlike to_string() this never allocates.
+constexpr std::string_view data_type_name(DataType type)
+{
+	const auto *traits = data_type_traits(type);
+	return traits ? traits->name : std::string_view();
+}
+
+constexpr ValueKind value_kind(DataType type)
+{
+	const auto *traits = data_type_traits(type);
+	return traits ? traits->kind : ValueKind::None;
+}
+
+}
@@ -0,0 +1,114 @@
+// Checks the data type table against itself and the codes of the CIP data types: every code is in it once and is
+// found by data_type_traits, codes that aren't in it are found by none of the lookups, and the size of each value
+// kind is one the decoders handle. to_string and is_valid_value are derived from the table too.
+
+#include <cstdint>
+#include <iostream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "data_type.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+// The lookups are usable at compile time
+static_assert(data_type_traits(DataType::Dint)->size == 4);
+static_assert(data_type_name(DataType::Lreal) == "LREAL");
+static_assert(value_kind(DataType::Ulint) == ValueKind::Unsigned);
+static_assert(data_type_traits(static_cast<DataType>(0x42)) == nullptr);
+
+bool size_fits_kind(const DataTypeTraits &traits)
+{
+	switch (traits.kind)
+	{
+		case ValueKind::None:
+		case ValueKind::String:
+		case ValueKind::Structure:
+		case ValueKind::Array:
+			return traits.size == 0;
+		case ValueKind::Bool:
+			return traits.size == 1;
+		case ValueKind::Signed:
+		case ValueKind::Unsigned:
+		case ValueKind::Bits:
+			return traits.size == 1 || traits.size == 2 || traits.size == 4 || traits.size == 8;
+		case ValueKind::Float:
+			return traits.size == 4 || traits.size == 8;
+		case ValueKind::Time:
+			return traits.size == 8;
+	}
+	return false;
+}
+
+bool run()
+{
+	Checker check;
+	std::set<uint8_t> codes;
+	std::set<std::string_view> names;
+	for (const auto &traits : data_types)
+	{
+		const auto code = static_cast<uint8_t>(traits.type);
+		check.context(fmt::format("{:#04x} {}", code, traits.name));
+		check.expect(codes.insert(code).second, "code twice in the table");
+		check.expect(names.insert(traits.name).second, "name twice in the table");
+		check.expect(data_type_traits(traits.type) == &traits, "not found by its code");
+		check.expect(size_fits_kind(traits), fmt::format("size {} doesn't fit the kind", traits.size));
+		check.expect(to_string(traits.type) == traits.name, fmt::format("to_string gives {}", to_string(traits.type)));
+		check.expect(is_valid_value(traits.type) == traits.valid, "is_valid_value differs");
+	}
+
+	check.context("codes not in the table");
+	for (unsigned code = 0; code < 256; ++code)
+	{
+		if (codes.contains(static_cast<uint8_t>(code)))
+		{
+			continue;
+		}
+		const auto type = static_cast<DataType>(code);
+		check.expect(
+			data_type_traits(type) == nullptr && data_type_name(type).empty() && value_kind(type) == ValueKind::None
+				&& !is_valid_value(type),
+			fmt::format("{:#04x} found", code));
+		check.expect(to_string(type) == fmt::format("Unknown({:x})", code), fmt::format("{:#04x} has a name", code));
+	}
+
+	check.context("CIP codes");
+	const std::pair<DataType, uint8_t> cip_codes[] = {
+		{DataType::Bool, 0xC1},
+		{DataType::Dint, 0xC4},
+		{DataType::Real, 0xCA},
+		{DataType::String, 0xD0},
+		{DataType::Structure, 0xA2},
+		{DataType::Array, 0xA3},
+	};
+	for (const auto &[type, code] : cip_codes)
+	{
+		const auto *traits = data_type_traits(static_cast<DataType>(code));
+		check.expect(traits && traits->type == type, fmt::format("{} ({:#04x}) missing", to_string(type), code));
+	}
+	check.expect(!is_valid_value(DataType::Undefined), "UNDEFINED is a valid type");
+	check.expect(value_kind(DataType::Word) == ValueKind::Bits, "WORD is not bits");
+	check.expect(value_kind(DataType::DateAndTime) == ValueKind::Time, "DATE_AND_TIME is not a time");
+
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS {} types\n", data_types.size());
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
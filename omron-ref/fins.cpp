@@ -0,0 +1,681 @@
+#include "fins.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "metrics.h"
+#include "serialization.h"
+#include "trace.h"
+
+namespace daq
+{
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+using Serializer = ser::FixedBufferSerializer<std::endian::big>;
+using Deserializer = ser::FixedBufferDeserializer<std::endian::big>;
+
+constexpr size_t header_size = 10;
+constexpr size_t response_header_size = header_size + 2 + 2; // command code, end code
+constexpr size_t max_frame_size = 2048;
+
+// FINS/TCP: "FINS", length (of what follows it), command, error code
+constexpr size_t tcp_header_size = 16;
+constexpr uint32_t tcp_node_address_request = 0;
+constexpr uint32_t tcp_node_address_response = 1;
+constexpr uint32_t tcp_frame = 2;
+
+constexpr uint8_t icf_command = 0x80; // response required
+constexpr uint8_t icf_response = 0x40;
+constexpr uint8_t gateway_count = 0x02;
+
+struct EndCodeMessage
+{
+	uint16_t code;
+	std::string_view message;
+};
+
+// Sorted by code
+constexpr std::array end_code_messages{
+	EndCodeMessage{0x0001, "Service canceled"},
+	EndCodeMessage{0x0101, "Local node not in network"},
+	EndCodeMessage{0x0102, "Token timeout"},
+	EndCodeMessage{0x0103, "Retries failed"},
+	EndCodeMessage{0x0104, "Too many send frames"},
+	EndCodeMessage{0x0105, "Node address range error"},
+	EndCodeMessage{0x0106, "Node address duplication"},
+	EndCodeMessage{0x0201, "Destination node not in network"},
+	EndCodeMessage{0x0202, "Unit missing"},
+	EndCodeMessage{0x0203, "Third node missing"},
+	EndCodeMessage{0x0204, "Destination node busy"},
+	EndCodeMessage{0x0205, "Response timeout"},
+	EndCodeMessage{0x0301, "Communications controller error"},
+	EndCodeMessage{0x0302, "CPU Unit error"},
+	EndCodeMessage{0x0303, "Controller error"},
+	EndCodeMessage{0x0304, "Unit number error"},
+	EndCodeMessage{0x0401, "Undefined command"},
+	EndCodeMessage{0x0402, "Not supported by model/version"},
+	EndCodeMessage{0x0501, "Destination address setting error"},
+	EndCodeMessage{0x0502, "No routing tables"},
+	EndCodeMessage{0x0503, "Routing table error"},
+	EndCodeMessage{0x0504, "Too many relays"},
+	EndCodeMessage{0x1001, "Command too long"},
+	EndCodeMessage{0x1002, "Command too short"},
+	EndCodeMessage{0x1003, "Elements/data don't match"},
+	EndCodeMessage{0x1004, "Command format error"},
+	EndCodeMessage{0x1005, "Header error"},
+	EndCodeMessage{0x1101, "Area classification missing"},
+	EndCodeMessage{0x1102, "Access size error"},
+	EndCodeMessage{0x1103, "Address range error"},
+	EndCodeMessage{0x1104, "Address range exceeded"},
+	EndCodeMessage{0x1106, "Program missing"},
+	EndCodeMessage{0x1109, "Relational error"},
+	EndCodeMessage{0x110A, "Duplicate data access"},
+	EndCodeMessage{0x110B, "Response too long"},
+	EndCodeMessage{0x110C, "Parameter error"},
+	EndCodeMessage{0x2002, "Protected"},
+	EndCodeMessage{0x2003, "Table missing"},
+	EndCodeMessage{0x2004, "Data missing"},
+	EndCodeMessage{0x2005, "Program missing"},
+	EndCodeMessage{0x2006, "File missing"},
+	EndCodeMessage{0x2007, "Data mismatch"},
+	EndCodeMessage{0x2101, "Read-only"},
+	EndCodeMessage{0x2102, "Protected, cannot write data link table"},
+	EndCodeMessage{0x2103, "Cannot register"},
+	EndCodeMessage{0x2201, "Not possible during execution"},
+	EndCodeMessage{0x2202, "Not possible while running"},
+	EndCodeMessage{0x2203, "Wrong PLC mode (program)"},
+	EndCodeMessage{0x2204, "Wrong PLC mode (debug)"},
+	EndCodeMessage{0x2205, "Wrong PLC mode (monitor)"},
+	EndCodeMessage{0x2206, "Wrong PLC mode (run)"},
+	EndCodeMessage{0x2301, "File device missing"},
+	EndCodeMessage{0x2302, "Memory missing"},
+	EndCodeMessage{0x2303, "Clock missing"},
+	EndCodeMessage{0x2401, "Table missing"},
+	EndCodeMessage{0x2502, "Memory error"},
+	EndCodeMessage{0x2503, "I/O setting error"},
+	EndCodeMessage{0x2504, "Too many I/O points"},
+	EndCodeMessage{0x2505, "CPU bus error"},
+	EndCodeMessage{0x2506, "I/O duplication"},
+	EndCodeMessage{0x2507, "I/O bus error"},
+	EndCodeMessage{0x2601, "No protection"},
+	EndCodeMessage{0x2602, "Incorrect password"},
+	EndCodeMessage{0x2604, "Protected"},
+	EndCodeMessage{0x2605, "Service already executing"},
+	EndCodeMessage{0x2606, "Service stopped"},
+	EndCodeMessage{0x2607, "No execution right"},
+	EndCodeMessage{0x3001, "No access right"},
+	EndCodeMessage{0x4001, "Service aborted"},
+};
+
+uint16_t command_code(std::span<const uint8_t> command)
+{
+	return command.size() >= 2 ? static_cast<uint16_t>(command[0] << 8 | command[1]) : 0;
+}
+
+std::string socket_error(std::string_view what)
+{
+	return fmt::format("{}: {}", what, std::strerror(errno));
+}
+}
+
+std::string_view fins_end_code_message(uint16_t end_code)
+{
+	const auto code = static_cast<uint16_t>(end_code & fins_end_code_mask);
+	if (code == 0)
+	{
+		return "Normal completion";
+	}
+	const auto it = std::lower_bound(
+		end_code_messages.begin(),
+		end_code_messages.end(),
+		code,
+		[](const EndCodeMessage &m, uint16_t c) { return m.code < c; });
+	return it != end_code_messages.end() && it->code == code ? it->message : std::string_view();
+}
+
+FinsClient::FinsClient(FinsOptions options) : _options(std::move(options))
+{
+	if (_options.max_in_flight == 0 || _options.max_in_flight > 255)
+	{
+		throw std::runtime_error("FINS max_in_flight must be 1 to 255");
+	}
+	_pending.fill(-1);
+	_send_buffer.resize(tcp_header_size + max_frame_size);
+	_receive_buffer.resize(max_frame_size);
+	open();
+}
+
+FinsClient::~FinsClient()
+{
+	close();
+}
+
+void FinsClient::open()
+{
+	addrinfo hints{};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = _options.transport == FinsTransport::Tcp ? SOCK_STREAM : SOCK_DGRAM;
+	addrinfo *result = nullptr;
+	const auto port = std::to_string(_options.port);
+	const auto rc = getaddrinfo(_options.host.c_str(), port.c_str(), &hints, &result);
+	if (rc != 0)
+	{
+		throw std::runtime_error(fmt::format("Could not resolve '{}': {}", _options.host, gai_strerror(rc)));
+	}
+	_fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (_fd < 0)
+	{
+		freeaddrinfo(result);
+		throw std::runtime_error(socket_error("Could not create FINS socket"));
+	}
+	// UDP sockets are connected too, so only datagrams from the controller are received
+	const auto connected = ::connect(_fd, result->ai_addr, result->ai_addrlen);
+	freeaddrinfo(result);
+	if (connected != 0)
+	{
+		const auto message = socket_error(fmt::format("Could not connect to {}:{}", _options.host, _options.port));
+		close();
+		throw std::runtime_error(message);
+	}
+
+	if (_options.transport == FinsTransport::Tcp)
+	{
+		int one = 1;
+		setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		handshake();
+	}
+	else if (_options.source.node == 0)
+	{
+		sockaddr_in local{};
+		socklen_t len = sizeof(local);
+		getsockname(_fd, reinterpret_cast<sockaddr *>(&local), &len);
+		_options.source.node = static_cast<uint8_t>(ntohl(local.sin_addr.s_addr) & 0xFF);
+	}
+}
+
+void FinsClient::close()
+{
+	if (_fd >= 0)
+	{
+		::close(_fd);
+		_fd = -1;
+	}
+	_pending.fill(-1);
+}
+
+// Asks for a client node number (or the configured one) and learns the controller's
+void FinsClient::handshake()
+{
+	std::array<uint8_t, tcp_header_size + 4> request{};
+	Serializer ser(request);
+	ser::serialize_multi(ser, "FINS", uint32_t{8 + 4}, tcp_node_address_request, uint32_t{0});
+	ser::serialize(ser, static_cast<uint32_t>(_options.source.node));
+	if (::send(_fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+	{
+		const auto message = socket_error("Could not send FINS node address request");
+		close();
+		throw std::runtime_error(message);
+	}
+
+	std::array<uint8_t, tcp_header_size + 8> response{};
+	if (!receive_exact(response, Clock::now() + _options.timeout))
+	{
+		close();
+		throw std::runtime_error("Timeout waiting for the FINS node address response");
+	}
+	Deserializer des(response);
+	des.advance(8);
+	const auto command = ser::read<uint32_t>(des);
+	const auto error = ser::read<uint32_t>(des);
+	const auto client_node = ser::read<uint32_t>(des);
+	const auto server_node = ser::read<uint32_t>(des);
+	if (std::memcmp(response.data(), "FINS", 4) != 0 || command != tcp_node_address_response || error != 0)
+	{
+		close();
+		throw std::runtime_error(
+			fmt::format("FINS node address request failed, command {}, error {:#x}", command, error));
+	}
+	_options.source.node = static_cast<uint8_t>(client_node);
+	_options.destination.node = static_cast<uint8_t>(server_node);
+}
+
+void FinsClient::send_frame(std::span<const uint8_t> command, uint8_t sid)
+{
+	Serializer ser(_send_buffer);
+	if (_options.transport == FinsTransport::Tcp)
+	{
+		ser::serialize_multi(
+			ser, "FINS", static_cast<uint32_t>(8 + header_size + command.size()), tcp_frame, uint32_t{0});
+	}
+	const auto &dst = _options.destination;
+	const auto &src = _options.source;
+	ser::serialize_multi(ser,
+		icf_command,
+		uint8_t{0},
+		gateway_count,
+		dst.network,
+		dst.node,
+		dst.unit,
+		src.network,
+		src.node,
+		src.unit,
+		sid);
+	ser::serialize(ser, command);
+	if (ser.has_error())
+	{
+		_pending.fill(-1);
+		throw std::runtime_error(fmt::format("FINS command too long ({} bytes)", command.size()));
+	}
+	const auto frame = ser.serialized_buffer();
+	if (::send(_fd, frame.data(), frame.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(frame.size()))
+	{
+		const auto message = socket_error("Could not send FINS frame");
+		close();
+		throw std::runtime_error(message);
+	}
+	if (auto *metrics = ControllerMetrics::current())
+	{
+		metrics->record_fins_request(command_code(command), header_size + command.size());
+	}
+}
+
+bool FinsClient::wait_readable(Clock::time_point deadline)
+{
+	while (true)
+	{
+		const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now());
+		pollfd pfd{.fd = _fd, .events = POLLIN, .revents = 0};
+		const auto ready = ::poll(&pfd, 1, static_cast<int>(std::max<int64_t>(0, remaining.count())));
+		if (ready < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (ready < 0)
+		{
+			const auto message = socket_error("FINS poll failed");
+			close();
+			throw std::runtime_error(message);
+		}
+		return ready > 0;
+	}
+}
+
+bool FinsClient::receive_exact(std::span<uint8_t> dst, Clock::time_point deadline)
+{
+	size_t received = 0;
+	while (received < dst.size())
+	{
+		if (!wait_readable(deadline))
+		{
+			return false;
+		}
+		const auto n = ::recv(_fd, dst.data() + received, dst.size() - received, 0);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			const auto message = n == 0 ? std::string("FINS connection closed") : socket_error("FINS receive failed");
+			close();
+			throw std::runtime_error(message);
+		}
+		received += static_cast<size_t>(n);
+	}
+	return true;
+}
+
+std::span<const uint8_t> FinsClient::receive_frame(Clock::time_point deadline)
+{
+	if (_options.transport == FinsTransport::Udp)
+	{
+		// One datagram is one frame
+		while (wait_readable(deadline))
+		{
+			const auto n = ::recv(_fd, _receive_buffer.data(), _receive_buffer.size(), 0);
+			if (n >= 0)
+			{
+				return std::span(_receive_buffer).first(static_cast<size_t>(n));
+			}
+			// ECONNREFUSED from an earlier ICMP port unreachable, keep waiting for the real response
+			if (errno != EINTR && errno != ECONNREFUSED)
+			{
+				// The socket stays open, but the requests in flight are given up like on a timeout
+				const auto message = socket_error("FINS receive failed");
+				_pending.fill(-1);
+				throw std::runtime_error(message);
+			}
+		}
+		return {};
+	}
+
+	while (true)
+	{
+		std::array<uint8_t, tcp_header_size> header{};
+		if (!receive_exact(header, deadline))
+		{
+			return {};
+		}
+		Deserializer des(header);
+		des.advance(4);
+		const auto length = ser::read<uint32_t>(des);
+		const auto command = ser::read<uint32_t>(des);
+		const auto error = ser::read<uint32_t>(des);
+		if (std::memcmp(header.data(), "FINS", 4) != 0 || length < 8 || length - 8 > _receive_buffer.size())
+		{
+			close();
+			throw std::runtime_error(fmt::format("Invalid FINS/TCP header, length {}", length));
+		}
+		if (error != 0)
+		{
+			close();
+			throw std::runtime_error(fmt::format("FINS/TCP error {:#x}", error));
+		}
+		const auto frame = std::span(_receive_buffer).first(length - 8);
+		// A frame that times out halfway leaves the stream out of sync
+		if (!receive_exact(frame, deadline))
+		{
+			close();
+			throw std::runtime_error("Timeout in the middle of a FINS/TCP frame");
+		}
+		if (command == tcp_frame)
+		{
+			return frame;
+		}
+	}
+}
+
+void FinsClient::transact(std::span<const std::span<const uint8_t>> commands, std::vector<FinsReply> &replies)
+{
+	TraceSpan span("fins transact");
+	if (_fd < 0)
+	{
+		open();
+	}
+	replies.assign(commands.size(), FinsReply{.end_code = 0, .data = {}});
+	if (_reply_storage.size() < commands.size() * max_frame_size)
+	{
+		_reply_storage.resize(commands.size() * max_frame_size);
+	}
+	auto *metrics = ControllerMetrics::current();
+
+	size_t next = 0;
+	size_t done = 0;
+	size_t in_flight = 0;
+	while (done < commands.size())
+	{
+		while (next < commands.size() && in_flight < _options.max_in_flight)
+		{
+			// SIDs keep counting across calls, so a late response to an earlier call is only mistaken for one of this
+			// call after 256 requests
+			const auto sid = _next_sid++;
+			send_frame(commands[next], sid);
+			_pending[sid] = static_cast<int32_t>(next);
+			++next;
+			++in_flight;
+		}
+
+		const auto frame = receive_frame(Clock::now() + _options.timeout);
+		if (frame.empty())
+		{
+			if (_options.transport == FinsTransport::Tcp)
+			{
+				close();
+			}
+			_pending.fill(-1);
+			throw std::runtime_error(fmt::format(
+				"Timeout waiting for FINS response from {}:{}, {} of {} received",
+				_options.host,
+				_options.port,
+				done,
+				commands.size()));
+		}
+
+		Deserializer des(frame);
+		const auto icf = ser::read<uint8_t>(des);
+		des.advance(header_size - 2);
+		const auto sid = ser::read<uint8_t>(des);
+		const auto code = ser::read<uint16_t>(des);
+		const auto end_code = ser::read<uint16_t>(des);
+		const auto index = _pending[sid];
+		// Late responses to timed out requests and anything unexpected is dropped. An index from an earlier call that
+		// wasn't cleared can be past this call's commands.
+		if (des.has_error() || (icf & icf_response) == 0 || index < 0 || static_cast<size_t>(index) >= commands.size()
+				|| code != command_code(commands[index]))
+		{
+			continue;
+		}
+		_pending[sid] = -1;
+		--in_flight;
+		++done;
+
+		const auto data = frame.subspan(response_header_size);
+		auto slot = std::span(_reply_storage).subspan(static_cast<size_t>(index) * max_frame_size, data.size());
+		std::copy(data.begin(), data.end(), slot.begin());
+		replies[index] = {.end_code = end_code, .data = slot};
+
+		if (metrics)
+		{
+			metrics->record_fins_reply(code, frame.size());
+			if (!replies[index].ok())
+			{
+				metrics->record_fins_error(static_cast<uint16_t>(end_code & fins_end_code_mask));
+			}
+		}
+	}
+}
+
+FinsReadPlan::FinsReadPlan(std::span<const FinsReadItem> items, FinsPlanOptions options)
+{
+	if (options.max_read_words == 0 || options.max_multi_read_elements == 0)
+	{
+		throw std::runtime_error("FINS read plan limits must not be 0");
+	}
+
+	_word_offsets.reserve(items.size());
+	for (const auto &item : items)
+	{
+		_word_offsets.push_back(_num_words);
+		_num_words += item.num_words;
+	}
+
+	std::vector<uint32_t> order(items.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(
+		order.begin(),
+		order.end(),
+		[&](uint32_t a, uint32_t b)
+		{
+			return std::pair(items[a].area, items[a].address) < std::pair(items[b].area, items[b].address);
+		});
+
+	// Multiple Memory Area Read being filled, its copies get the command index when it's flushed
+	std::vector<uint8_t> multi_read;
+	std::vector<Copy> multi_copies;
+	const auto add_command = [&](std::vector<uint8_t> command, size_t reply_size)
+	{
+		_commands.push_back(std::move(command));
+		_reply_sizes.push_back(reply_size);
+		return static_cast<uint32_t>(_commands.size() - 1);
+	};
+	const auto flush_multi_read = [&]
+	{
+		if (multi_read.empty())
+		{
+			return;
+		}
+		const auto num_elements = (multi_read.size() - 2) / 4;
+		const auto command = add_command(std::move(multi_read), num_elements * 3);
+		for (auto &copy : multi_copies)
+		{
+			copy.command = command;
+			_copies.push_back(copy);
+		}
+		multi_read.clear();
+		multi_copies.clear();
+	};
+
+	// Merged range of one area, [start, end) in words, with its items
+	FinsArea area{};
+	uint32_t start = 0;
+	uint32_t end = 0;
+	std::vector<uint32_t> range_items;
+	const auto flush_range = [&]
+	{
+		if (range_items.empty())
+		{
+			return;
+		}
+		const auto overlap = [&](uint32_t item, uint32_t from, uint32_t to)
+		{
+			const auto item_start = std::max<uint32_t>(items[item].address, from);
+			const auto item_end = std::min<uint32_t>(items[item].address + items[item].num_words, to);
+			return std::pair(item_start, item_end);
+		};
+
+		if (end - start <= options.max_multi_read_words)
+		{
+			for (auto word = start; word < end; ++word)
+			{
+				if (multi_read.empty())
+				{
+					multi_read.reserve(2 + 4 * options.max_multi_read_elements);
+					multi_read.push_back(static_cast<uint8_t>(fins_multiple_memory_area_read >> 8));
+					multi_read.push_back(static_cast<uint8_t>(fins_multiple_memory_area_read));
+				}
+				const auto element = static_cast<uint32_t>((multi_read.size() - 2) / 4);
+				std::array<uint8_t, 4> segment{};
+				Serializer ser(segment);
+				ser::serialize_multi(ser, static_cast<uint8_t>(area), static_cast<uint16_t>(word), uint8_t{0});
+				multi_read.insert(multi_read.end(), segment.begin(), segment.end());
+				for (const auto item : range_items)
+				{
+					const auto [from, to] = overlap(item, word, word + 1);
+					if (from < to)
+					{
+						multi_copies.push_back({
+							.command = 0,
+							.item = item,
+							.reply_offset = element * 3 + 1, // area code, then the word
+							.stride = 3,
+							.num_words = 1,
+							.word_offset = static_cast<uint32_t>(_word_offsets[item] + (from - items[item].address)),
+						});
+					}
+				}
+				if (element + 1 == options.max_multi_read_elements)
+				{
+					flush_multi_read();
+				}
+			}
+		}
+		else
+		{
+			for (auto chunk_start = start; chunk_start < end; chunk_start += options.max_read_words)
+			{
+				const auto chunk_end = std::min<uint32_t>(chunk_start + options.max_read_words, end);
+				std::vector<uint8_t> read(8);
+				Serializer ser(read);
+				ser::serialize_multi(
+					ser,
+					fins_memory_area_read,
+					static_cast<uint8_t>(area),
+					static_cast<uint16_t>(chunk_start),
+					uint8_t{0},
+					static_cast<uint16_t>(chunk_end - chunk_start));
+				const auto command = add_command(std::move(read), (chunk_end - chunk_start) * 2);
+				for (const auto item : range_items)
+				{
+					const auto [from, to] = overlap(item, chunk_start, chunk_end);
+					if (from < to)
+					{
+						_copies.push_back({
+							.command = command,
+							.item = item,
+							.reply_offset = (from - chunk_start) * 2,
+							.stride = 2,
+							.num_words = to - from,
+							.word_offset = static_cast<uint32_t>(_word_offsets[item] + (from - items[item].address)),
+						});
+					}
+				}
+			}
+		}
+		range_items.clear();
+	};
+
+	for (const auto i : order)
+	{
+		const auto &item = items[i];
+		if (item.num_words == 0)
+		{
+			continue;
+		}
+		if (item.address + item.num_words > 0x10000)
+		{
+			throw std::runtime_error(
+				fmt::format("FINS read of {} words at {} is out of range", item.num_words, item.address));
+		}
+		if (range_items.empty() || item.area != area || item.address > end + options.max_gap_words)
+		{
+			flush_range();
+			area = item.area;
+			start = item.address;
+			end = item.address;
+		}
+		end = std::max<uint32_t>(end, item.address + item.num_words);
+		range_items.push_back(i);
+	}
+	flush_range();
+	flush_multi_read();
+
+	_command_spans.assign(_commands.begin(), _commands.end());
+}
+
+void FinsReadPlan::decode(
+	std::span<const FinsReply> replies, std::span<uint16_t> words, std::vector<size_t> &failed) const
+{
+	if (replies.size() != _commands.size() || words.size() < _num_words)
+	{
+		throw std::runtime_error(fmt::format(
+			"FINS read plan has {} commands and {} words, got {} replies and {} words",
+			_commands.size(),
+			_num_words,
+			replies.size(),
+			words.size()));
+	}
+	const auto first_failed = failed.size();
+	for (const auto &copy : _copies)
+	{
+		const auto &reply = replies[copy.command];
+		if (!reply.ok() || reply.data.size() < _reply_sizes[copy.command])
+		{
+			failed.push_back(copy.item);
+			continue;
+		}
+		Deserializer des(reply.data.subspan(copy.reply_offset));
+		for (uint32_t w = 0; w < copy.num_words; ++w)
+		{
+			words[copy.word_offset + w] = ser::read<uint16_t>(des);
+			des.advance(copy.stride - 2);
+		}
+	}
+	std::sort(failed.begin() + static_cast<ptrdiff_t>(first_failed), failed.end());
+	failed.erase(std::unique(failed.begin() + static_cast<ptrdiff_t>(first_failed), failed.end()), failed.end());
+}
+
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace daq
+{
+
+// FINS client for CS/CJ/CP controllers (and the CIO/DM compatible areas of NJ/NX), over FINS/UDP or FINS/TCP.
+// Frames are big endian and built with ser::FixedBufferSerializer<std::endian::big>.
+
+// Word memory area codes (CS/CJ)
+enum class FinsArea : uint8_t
+{
+	Cio = 0xB0,
+	Work = 0xB1,
+	Holding = 0xB2,
+	Auxiliary = 0xB3,
+	Dm = 0x82,
+	TimerCounterPv = 0x89,
+	EmCurrentBank = 0x98,
+};
+
+// EM bank 0-12
+constexpr FinsArea fins_em_bank(uint8_t bank)
+{
+	return static_cast<FinsArea>(0xA0 + bank);
+}
+
+constexpr uint16_t fins_memory_area_read = 0x0101;
+constexpr uint16_t fins_multiple_memory_area_read = 0x0104;
+
+// The relay error flag of the main code and the CPU error flags of the sub code don't say anything about the command
+constexpr uint16_t fins_end_code_mask = 0x7F3F;
+
+// Empty for unknown codes. The flags outside fins_end_code_mask are ignored.
+std::string_view fins_end_code_message(uint16_t end_code);
+
+struct FinsNodeAddress
+{
+	uint8_t network = 0;
+	uint8_t node = 0;
+	uint8_t unit = 0;
+};
+
+enum class FinsTransport
+{
+	Udp,
+	Tcp,
+};
+
+struct FinsOptions
+{
+	std::string host;
+	uint16_t port = 9600;
+	FinsTransport transport = FinsTransport::Udp;
+	// With TCP the node numbers are taken from the node address handshake. With UDP a source node of 0 uses the last
+	// byte of the local IP address, which is what the automatic address conversion of the Ethernet units expects.
+	FinsNodeAddress destination;
+	FinsNodeAddress source;
+	std::chrono::milliseconds timeout{1000};
+	// Requests sent before waiting for the first reply. The Ethernet units queue them.
+	size_t max_in_flight = 8;
+};
+
+struct FinsReply
+{
+	uint16_t end_code;
+	std::span<const uint8_t> data; // after the end code
+
+	bool ok() const
+	{
+		return (end_code & fins_end_code_mask) == 0;
+	}
+};
+
+class FinsClient
+{
+public:
+	// Connects (and does the node address handshake for TCP). After a TCP error or timeout the next transact()
+	// reconnects.
+	explicit FinsClient(FinsOptions options);
+	~FinsClient();
+
+	FinsClient(const FinsClient &) = delete;
+	FinsClient &operator=(const FinsClient &) = delete;
+
+	// Sends the commands (command code and parameters, the FINS header is added here) with up to max_in_flight of them
+	// outstanding, each with its own SID, and matches the responses by SID. replies[i] is the response to commands[i]
+	// and points into the client's buffers until the next call. End codes are reported in the replies, timeouts and
+	// connection errors throw. Records into ControllerMetrics::current().
+	void transact(std::span<const std::span<const uint8_t>> commands, std::vector<FinsReply> &replies);
+
+	const FinsNodeAddress &destination() const
+	{
+		return _options.destination;
+	}
+
+	const FinsNodeAddress &source() const
+	{
+		return _options.source;
+	}
+
+private:
+	void open();
+	void close();
+	void handshake();
+	void send_frame(std::span<const uint8_t> command, uint8_t sid);
+	bool wait_readable(std::chrono::steady_clock::time_point deadline);
+	// Receives one FINS frame into _receive_buffer. Returns an empty span if nothing arrived before the deadline.
+	std::span<const uint8_t> receive_frame(std::chrono::steady_clock::time_point deadline);
+	bool receive_exact(std::span<uint8_t> dst, std::chrono::steady_clock::time_point deadline);
+
+	FinsOptions _options;
+	int _fd = -1;
+	uint8_t _next_sid = 0;
+	std::vector<uint8_t> _send_buffer;
+	std::vector<uint8_t> _receive_buffer;
+	std::vector<uint8_t> _reply_storage; // one max_frame_size slot per command
+	std::array<int32_t, 256> _pending{}; // SID -> command index, -1 if free
+};
+
+struct FinsReadItem
+{
+	FinsArea area;
+	uint16_t address; // word
+	uint16_t num_words;
+};
+
+struct FinsPlanOptions
+{
+	// Words per Memory Area Read (0x0101), 998 fits into one frame
+	uint16_t max_read_words = 998;
+	// Elements per Multiple Memory Area Read (0x0104)
+	uint16_t max_multi_read_elements = 167;
+	// Unrequested words that are read to merge two ranges into one, instead of another element or command
+	uint16_t max_gap_words = 8;
+	// Ranges up to this many words are read word by word with 0x0104, longer ones with 0x0101
+	uint16_t max_multi_read_words = 2;
+};
+
+// Turns a list of word reads into few commands: overlapping and close ranges of an area are merged, long ranges are
+// read with Memory Area Read (split at max_read_words), short ones are collected into Multiple Memory Area Reads.
+// Built once, the commands are sent every cycle with FinsClient::transact.
+class FinsReadPlan
+{
+public:
+	explicit FinsReadPlan(std::span<const FinsReadItem> items, FinsPlanOptions options = {});
+
+	FinsReadPlan(const FinsReadPlan &) = delete;
+	FinsReadPlan &operator=(const FinsReadPlan &) = delete;
+	FinsReadPlan(FinsReadPlan &&) = default;
+	FinsReadPlan &operator=(FinsReadPlan &&) = default;
+
+	std::span<const std::span<const uint8_t>> commands() const
+	{
+		return _command_spans;
+	}
+
+	// The words of item i are words[word_offset(i)] to words[word_offset(i) + num_words - 1]
+	size_t num_words() const
+	{
+		return _num_words;
+	}
+
+	size_t word_offset(size_t item) const
+	{
+		return _word_offsets[item];
+	}
+
+	// Copies the reply data into words. The indices of items that are (partly) in a failed or short reply are appended
+	// to failed, sorted and without duplicates, and their words are left as they were.
+	void decode(std::span<const FinsReply> replies, std::span<uint16_t> words, std::vector<size_t> &failed) const;
+
+private:
+	// A run of words of one item in one reply
+	struct Copy
+	{
+		uint32_t command;
+		uint32_t item;
+		uint32_t reply_offset; // byte offset into the reply data
+		uint32_t stride; // bytes per word in the reply data
+		uint32_t num_words;
+		uint32_t word_offset; // into words
+	};
+
+	std::vector<std::vector<uint8_t>> _commands;
+	std::vector<std::span<const uint8_t>> _command_spans;
+	std::vector<size_t> _reply_sizes; // expected data size per command
+	std::vector<size_t> _word_offsets;
+	std::vector<Copy> _copies; // ordered by command
+	size_t _num_words = 0;
+};
+
+}
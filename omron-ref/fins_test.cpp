@@ -0,0 +1,418 @@
+// Checks FinsReadPlan against hand encoded commands (overlapping and gap merged ranges, a range split at
+// max_read_words, Multiple Memory Area Reads flushed at max_multi_read_elements) and its decode() offsets and failed
+// items, then runs plans through FinsClient against a FINS/UDP responder on 127.0.0.1 that answers in reverse order,
+// sends a response nobody waits for and drops a command to force a timeout.
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "fins.h"
+#include "hex.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+// Value of a word in the simulated memory, so any read can be checked without storing the memory
+uint16_t word_value(FinsArea area, uint32_t address)
+{
+	return static_cast<uint16_t>(static_cast<uint8_t>(area) * 0x101 + address * 3);
+}
+
+void put_word(std::vector<uint8_t> &data, uint16_t word)
+{
+	data.push_back(static_cast<uint8_t>(word >> 8));
+	data.push_back(static_cast<uint8_t>(word));
+}
+
+// Response data of a 0x0101 or 0x0104 command, as the controller sends it after the end code
+std::vector<uint8_t> respond(std::span<const uint8_t> command)
+{
+	std::vector<uint8_t> data;
+	const auto code = static_cast<uint16_t>(command[0] << 8 | command[1]);
+	if (code == fins_memory_area_read && command.size() == 8)
+	{
+		const auto area = static_cast<FinsArea>(command[2]);
+		const uint32_t address = command[3] << 8 | command[4];
+		const uint32_t count = command[6] << 8 | command[7];
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			put_word(data, word_value(area, address + i));
+		}
+	}
+	else if (code == fins_multiple_memory_area_read)
+	{
+		for (size_t pos = 2; pos + 4 <= command.size(); pos += 4)
+		{
+			const auto area = static_cast<FinsArea>(command[pos]);
+			data.push_back(command[pos]);
+			put_word(data, word_value(area, command[pos + 1] << 8 | command[pos + 2]));
+		}
+	}
+	return data;
+}
+
+// The words the items should decode to
+std::vector<uint16_t> expected_words(std::span<const FinsReadItem> items)
+{
+	std::vector<uint16_t> words;
+	for (const auto &item : items)
+	{
+		for (uint32_t i = 0; i < item.num_words; ++i)
+		{
+			words.push_back(word_value(item.area, item.address + i));
+		}
+	}
+	return words;
+}
+
+void check_commands(Checker &check, const FinsReadPlan &plan, const std::vector<std::vector<uint8_t>> &expected)
+{
+	const auto commands = plan.commands();
+	check.expect(commands.size() == expected.size(),
+		fmt::format("{} commands, expected {}", commands.size(), expected.size()));
+	for (size_t i = 0; i < std::min(commands.size(), expected.size()); ++i)
+	{
+		check.expect(std::equal(commands[i].begin(), commands[i].end(), expected[i].begin(), expected[i].end()),
+			fmt::format("command {} is {}, expected {}", i, hex(commands[i]), hex(expected[i])));
+	}
+}
+
+// Decodes replies made by respond() and compares the words with the items
+void check_decode(Checker &check, const FinsReadPlan &plan, std::span<const FinsReadItem> items, uint16_t end_code = 0)
+{
+	std::vector<std::vector<uint8_t>> data;
+	std::vector<FinsReply> replies;
+	for (const auto command : plan.commands())
+	{
+		data.push_back(respond(command));
+	}
+	for (const auto &d : data)
+	{
+		replies.push_back({.end_code = end_code, .data = d});
+	}
+	std::vector<uint16_t> words(plan.num_words());
+	std::vector<size_t> failed;
+	plan.decode(replies, words, failed);
+	check.expect(failed.empty(), fmt::format("{} failed items", failed.size()));
+	const auto expected = expected_words(items);
+	check.expect(words == expected, "decoded words");
+	size_t offset = 0;
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		check.expect(plan.word_offset(i) == offset, fmt::format("word offset of item {}", i));
+		offset += items[i].num_words;
+	}
+}
+
+void check_overlap(Checker &check)
+{
+	check.context("overlapping ranges");
+	const std::vector<FinsReadItem> items{
+		{FinsArea::Dm, 102, 4},
+		{FinsArea::Dm, 100, 4},
+		{FinsArea::Dm, 101, 1},
+	};
+	const FinsReadPlan plan(items);
+	check_commands(check, plan, {{0x01, 0x01, 0x82, 0x00, 0x64, 0x00, 0x00, 0x06}});
+	check.expect(plan.num_words() == 9, "9 words");
+	// The relay error and CPU error flags outside fins_end_code_mask don't make a reply fail
+	check_decode(check, plan, items, 0x0040);
+}
+
+void check_gaps(Checker &check)
+{
+	check.context("gap merged ranges");
+	const std::vector<FinsReadItem> items{
+		{FinsArea::Dm, 100, 3},
+		{FinsArea::Dm, 111, 3}, // 8 words after the first one ends, merged
+		{FinsArea::Dm, 123, 3}, // 9 words after, a command of its own
+		{FinsArea::Cio, 100, 3}, // same address in another area
+	};
+	const FinsReadPlan plan(items);
+	check_commands(check,
+		plan,
+		{
+			{0x01, 0x01, 0x82, 0x00, 0x64, 0x00, 0x00, 0x0E},
+			{0x01, 0x01, 0x82, 0x00, 0x7B, 0x00, 0x00, 0x03},
+			{0x01, 0x01, 0xB0, 0x00, 0x64, 0x00, 0x00, 0x03},
+		});
+	check_decode(check, plan, items);
+}
+
+void check_split(Checker &check)
+{
+	check.context("split at max_read_words");
+	const std::vector<FinsReadItem> items{
+		{FinsArea::Holding, 0, 1000},
+		{FinsArea::Holding, 990, 1010},
+	};
+	const FinsReadPlan plan(items);
+	check_commands(check,
+		plan,
+		{
+			{0x01, 0x01, 0xB2, 0x00, 0x00, 0x00, 0x03, 0xE6},
+			{0x01, 0x01, 0xB2, 0x03, 0xE6, 0x00, 0x03, 0xE6},
+			{0x01, 0x01, 0xB2, 0x07, 0xCC, 0x00, 0x00, 0x04},
+		});
+	check_decode(check, plan, items);
+}
+
+const std::vector<FinsReadItem> multi_read_items{
+	{FinsArea::Dm, 10, 1},
+	{FinsArea::Holding, 7, 2}, // two words are still read word by word
+	{FinsArea::Cio, 5, 1},
+	{FinsArea::Dm, 20, 1},
+	{FinsArea::Work, 1, 1},
+	{FinsArea::Auxiliary, 448, 1},
+};
+
+void check_multi_read(Checker &check)
+{
+	check.context("multiple memory area read");
+	const FinsReadPlan plan(multi_read_items, FinsPlanOptions{.max_multi_read_elements = 3});
+	check_commands(check,
+		plan,
+		{
+			{0x01, 0x04, 0x82, 0x00, 0x0A, 0x00, 0x82, 0x00, 0x14, 0x00, 0xB0, 0x00, 0x05, 0x00},
+			{0x01, 0x04, 0xB1, 0x00, 0x01, 0x00, 0xB2, 0x00, 0x07, 0x00, 0xB2, 0x00, 0x08, 0x00},
+			{0x01, 0x04, 0xB3, 0x01, 0xC0, 0x00},
+		});
+	check_decode(check, plan, multi_read_items);
+}
+
+void check_failed(Checker &check)
+{
+	check.context("failed replies");
+	const FinsReadPlan plan(multi_read_items, FinsPlanOptions{.max_multi_read_elements = 3});
+	std::vector<std::vector<uint8_t>> data;
+	for (const auto command : plan.commands())
+	{
+		data.push_back(respond(command));
+	}
+	data[2].pop_back(); // short
+	const std::vector<FinsReply> replies{
+		{.end_code = 0, .data = data[0]},
+		{.end_code = 0x1103, .data = data[1]}, // address range error
+		{.end_code = 0, .data = data[2]},
+	};
+	constexpr uint16_t untouched = 0xDEAD;
+	std::vector<uint16_t> words(plan.num_words(), untouched);
+	std::vector<size_t> failed{42}; // appended to, not replaced
+	plan.decode(replies, words, failed);
+	check.expect(failed == std::vector<size_t>{42, 1, 4, 5}, "items of the failed and the short reply");
+	const auto expected = expected_words(multi_read_items);
+	for (size_t item = 0; item < multi_read_items.size(); ++item)
+	{
+		const auto is_failed = item == 1 || item == 4 || item == 5;
+		for (size_t w = 0; w < multi_read_items[item].num_words; ++w)
+		{
+			const auto offset = plan.word_offset(item) + w;
+			check.expect(words[offset] == (is_failed ? untouched : expected[offset]),
+				fmt::format("word {} of item {}", w, item));
+		}
+	}
+}
+
+// FINS/UDP controller on 127.0.0.1. Collects the commands that arrive close together and answers them in reverse
+// order, after a response with a SID nobody waits for. Commands to drop_address aren't answered.
+class UdpResponder
+{
+public:
+	static constexpr uint16_t drop_address = 0x7777;
+
+	UdpResponder()
+	{
+		_fd = socket(AF_INET, SOCK_DGRAM, 0);
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t len = sizeof(addr);
+		if (_fd < 0 || bind(_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0
+				|| getsockname(_fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+		{
+			throw std::runtime_error("Could not bind the FINS responder");
+		}
+		_port = ntohs(addr.sin_port);
+		_thread = std::jthread([this](std::stop_token stop) { run(stop); });
+	}
+
+	~UdpResponder()
+	{
+		_thread.request_stop();
+		_thread.join();
+		::close(_fd);
+	}
+
+	uint16_t port() const
+	{
+		return _port;
+	}
+
+	size_t max_batch() const
+	{
+		return _max_batch.load();
+	}
+
+private:
+	struct Request
+	{
+		std::vector<uint8_t> frame;
+		sockaddr_in from;
+	};
+
+	void run(std::stop_token stop)
+	{
+		std::vector<Request> batch;
+		while (!stop.stop_requested())
+		{
+			pollfd pfd{.fd = _fd, .events = POLLIN, .revents = 0};
+			if (::poll(&pfd, 1, batch.empty() ? 50 : 20) <= 0)
+			{
+				if (!batch.empty())
+				{
+					answer(batch);
+					batch.clear();
+				}
+				continue;
+			}
+			Request request{.frame = std::vector<uint8_t>(2048), .from = {}};
+			socklen_t len = sizeof(request.from);
+			const auto n = recvfrom(_fd, request.frame.data(), request.frame.size(), 0,
+				reinterpret_cast<sockaddr *>(&request.from), &len);
+			if (n >= 12)
+			{
+				request.frame.resize(static_cast<size_t>(n));
+				batch.push_back(std::move(request));
+			}
+		}
+	}
+
+	void answer(const std::vector<Request> &batch)
+	{
+		_max_batch = std::max(_max_batch.load(), batch.size());
+		send_response(batch.front(), static_cast<uint8_t>(batch.front().frame[9] + 128), {});
+		for (auto it = batch.rbegin(); it != batch.rend(); ++it)
+		{
+			const auto command = std::span(it->frame).subspan(10);
+			if (command.size() >= 5 && (command[3] << 8 | command[4]) == drop_address)
+			{
+				continue;
+			}
+			send_response(*it, it->frame[9], respond(command));
+		}
+	}
+
+	void send_response(const Request &request, uint8_t sid, std::span<const uint8_t> data)
+	{
+		const auto &f = request.frame;
+		// ICF response, RSV, GCT, destination and source swapped, SID, command code, end code
+		std::vector<uint8_t> response{0xC0, 0x00, 0x02, f[6], f[7], f[8], f[3], f[4], f[5], sid, f[10], f[11], 0, 0};
+		response.insert(response.end(), data.begin(), data.end());
+		sendto(_fd, response.data(), response.size(), 0, reinterpret_cast<const sockaddr *>(&request.from),
+			sizeof(request.from));
+	}
+
+	int _fd = -1;
+	uint16_t _port = 0;
+	std::atomic<size_t> _max_batch = 0;
+	std::jthread _thread;
+};
+
+void check_udp(Checker &check)
+{
+	check.context("FINS/UDP");
+	UdpResponder responder;
+	FinsClient client({
+		.host = "127.0.0.1",
+		.port = responder.port(),
+		.transport = FinsTransport::Udp,
+		.destination = {},
+		.source = {},
+		.timeout = std::chrono::milliseconds(300),
+		.max_in_flight = 4,
+	});
+	check.expect(client.source().node == 1, "source node from the local address");
+
+	std::vector<FinsReadItem> items;
+	for (uint16_t i = 0; i < 40; ++i)
+	{
+		// Every other item is far enough away for a command of its own, the rest go into Multiple Memory Area Reads
+		const auto far = i % 2 == 0;
+		items.push_back({
+			.area = far ? FinsArea::Dm : FinsArea::Cio,
+			.address = static_cast<uint16_t>(i * 50),
+			.num_words = static_cast<uint16_t>(far ? 20 : 1),
+		});
+	}
+	const FinsReadPlan plan(items, FinsPlanOptions{.max_multi_read_elements = 4});
+	std::vector<FinsReply> replies;
+	std::vector<uint16_t> words(plan.num_words());
+	std::vector<size_t> failed;
+	for (int round = 0; round < 3; ++round)
+	{
+		client.transact(plan.commands(), replies);
+		failed.clear();
+		std::fill(words.begin(), words.end(), 0);
+		plan.decode(replies, words, failed);
+		check.expect(failed.empty() && words == expected_words(items), fmt::format("round {} words", round));
+	}
+	check.expect(responder.max_batch() > 1, "responses came out of order");
+
+	const std::vector<FinsReadItem> dropped{{FinsArea::Dm, UdpResponder::drop_address, 4}};
+	const FinsReadPlan dropped_plan(dropped);
+	bool timed_out = false;
+	try
+	{
+		client.transact(dropped_plan.commands(), replies);
+	}
+	catch (const std::runtime_error &e)
+	{
+		timed_out = std::string_view(e.what()).starts_with("Timeout");
+	}
+	check.expect(timed_out, "unanswered command times out");
+
+	client.transact(plan.commands(), replies);
+	failed.clear();
+	plan.decode(replies, words, failed);
+	check.expect(failed.empty() && words == expected_words(items), "reads after the timeout");
+}
+
+bool run()
+{
+	Checker check;
+	check_overlap(check);
+	check_gaps(check);
+	check_split(check);
+	check_multi_read(check);
+	check_failed(check);
+	check_udp(check);
+	if (check.ok)
+	{
+		std::cout << "PASS FINS read plans and FINS/UDP\n";
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
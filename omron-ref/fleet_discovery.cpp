@@ -0,0 +1,261 @@
+#include "fleet_discovery.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "list_signals.h"
+#include "log.h"
+#include "trace.h"
+
+namespace daq
+{
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+class FleetDiscovery
+{
+public:
+	FleetDiscovery(
+		std::span<const DiscoveryJob> jobs, const DiscoveryOptions &options, std::vector<DiscoveryResult> &results)
+		: _jobs(jobs)
+		, _options(options)
+		, _results(results)
+	{
+	}
+
+	void run(std::span<const size_t> pending)
+	{
+		const auto num_workers = std::max<size_t>(1, std::min(_options.num_workers, pending.size()));
+		for (size_t i = 0; i < num_workers; ++i)
+		{
+			_workers.push_back(std::make_unique<Worker>());
+		}
+		// Deal round robin, so every worker starts with high priority jobs at its front
+		for (size_t i = 0; i < pending.size(); ++i)
+		{
+			push(i % num_workers, pending[i]);
+		}
+
+		std::vector<std::jthread> threads;
+		threads.reserve(num_workers);
+		for (size_t i = 0; i < num_workers; ++i)
+		{
+			threads.emplace_back([this, i] { work(i); });
+		}
+	}
+
+private:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<size_t> jobs;
+	};
+
+	void work(size_t self)
+	{
+		set_trace_thread_name("discovery " + std::to_string(self));
+		while (true)
+		{
+			uint64_t seen = 0;
+			{
+				std::lock_guard lock(_gateway_mutex);
+				if (_remaining == 0)
+				{
+					return;
+				}
+				seen = _changes;
+			}
+			const auto job = take(self);
+			if (!job)
+			{
+				// Everything left is blocked by gateway limits or running. Wait until a job is pushed or a discovery
+				// finishes, a change since seen means there may be something to take again.
+				std::unique_lock lock(_gateway_mutex);
+				_changed_cv.wait(lock, [&] { return _changes != seen || _remaining == 0; });
+				continue;
+			}
+			execute(*job);
+			release(*job);
+		}
+	}
+
+	void push(size_t worker, size_t job)
+	{
+		{
+			std::lock_guard lock(_workers[worker]->mutex);
+			_workers[worker]->jobs.push_back(job);
+		}
+		{
+			std::lock_guard lock(_gateway_mutex);
+			++_remaining;
+			++_changes;
+		}
+		_changed_cv.notify_all();
+	}
+
+	// Own jobs are taken from the front (highest priority first), stolen jobs from the back
+	std::optional<size_t> take(size_t self)
+	{
+		for (size_t k = 0; k < _workers.size(); ++k)
+		{
+			auto &worker = *_workers[(self + k) % _workers.size()];
+			std::lock_guard lock(worker.mutex);
+			const auto own = k == 0;
+			for (size_t n = 0; n < worker.jobs.size(); ++n)
+			{
+				const auto pos = own ? n : worker.jobs.size() - 1 - n;
+				const auto job = worker.jobs[pos];
+				if (try_acquire(_jobs[job].attributes.gateway))
+				{
+					worker.jobs.erase(worker.jobs.begin() + static_cast<ptrdiff_t>(pos));
+					return job;
+				}
+			}
+		}
+		return std::nullopt;
+	}
+
+	bool try_acquire(const std::string &gateway)
+	{
+		std::lock_guard lock(_gateway_mutex);
+		auto &active = _active[gateway];
+		if (active >= _options.max_per_gateway)
+		{
+			return false;
+		}
+		++active;
+		return true;
+	}
+
+	void release(size_t job)
+	{
+		{
+			std::lock_guard lock(_gateway_mutex);
+			--_active[_jobs[job].attributes.gateway];
+			--_remaining;
+			++_changes;
+		}
+		_changed_cv.notify_all();
+	}
+
+	void execute(size_t job)
+	{
+		const auto &attributes = _jobs[job].attributes;
+		auto &result = _results[job];
+		const auto metrics = _options.metrics ? _options.metrics->controller(attributes.gateway) : nullptr;
+		const auto start = Clock::now();
+		TraceSpan span("discover");
+		try
+		{
+			ControllerMetrics::Scope scope(metrics.get());
+			result.signals = _options.discover(attributes);
+		}
+		catch (const std::exception &e)
+		{
+			result.error = e.what();
+			logger->warn("Discovery of {} ({}) failed: {}", attributes.gateway, attributes.path, e.what());
+		}
+		const auto duration = Clock::now() - start;
+		result.duration = std::chrono::duration_cast<std::chrono::milliseconds>(duration);
+		if (metrics)
+		{
+			metrics->record_discovery(duration);
+		}
+
+		// The discovery stands even if it can't be cached, the next run just has to do it again
+		if (result.error.empty() && _options.cache_store)
+		{
+			try
+			{
+				_options.cache_store(attributes, result.signals);
+			}
+			catch (const std::exception &e)
+			{
+				logger->warn(
+					"Could not cache the discovery of {} ({}): {}", attributes.gateway, attributes.path, e.what());
+			}
+		}
+	}
+
+	std::span<const DiscoveryJob> _jobs;
+	const DiscoveryOptions &_options;
+	std::vector<DiscoveryResult> &_results;
+
+	std::vector<std::unique_ptr<Worker>> _workers;
+
+	std::mutex _gateway_mutex; // also guards _remaining and _changes
+	std::condition_variable _changed_cv;
+	std::unordered_map<std::string, size_t> _active;
+	size_t _remaining = 0; // pushed and not finished
+	uint64_t _changes = 0; // counts pushes and releases, so idle workers know when to look for work again
+};
+
+// A cache that fails is a miss, the controller is discovered as if there was no cache
+std::optional<nlohmann::json> lookup_cached(const DiscoveryOptions &options, const plc_tag::Attributes &attributes)
+{
+	try
+	{
+		return options.cache_lookup(attributes);
+	}
+	catch (const std::exception &e)
+	{
+		logger->warn(
+			"Could not look up the cached discovery of {} ({}): {}", attributes.gateway, attributes.path, e.what());
+		return std::nullopt;
+	}
+}
+}
+
+std::vector<DiscoveryResult> discover_fleet(std::span<const DiscoveryJob> jobs, DiscoveryOptions options)
+{
+	if (!options.discover)
+	{
+		options.discover = [](const plc_tag::Attributes &attributes) { return list_signals(attributes); };
+	}
+	if (options.max_per_gateway == 0)
+	{
+		options.max_per_gateway = 1;
+	}
+
+	std::vector<DiscoveryResult> results(jobs.size());
+	std::vector<size_t> pending;
+	pending.reserve(jobs.size());
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		if (options.cache_lookup)
+		{
+			if (auto cached = lookup_cached(options, jobs[i].attributes))
+			{
+				results[i].signals = std::move(*cached);
+				results[i].from_cache = true;
+				continue;
+			}
+		}
+		pending.push_back(i);
+	}
+	std::stable_sort(
+		pending.begin(),
+		pending.end(),
+		[&](size_t a, size_t b) { return jobs[a].num_configured_tags > jobs[b].num_configured_tags; });
+
+	const auto start = Clock::now();
+	if (!pending.empty())
+	{
+		FleetDiscovery(jobs, options, results).run(pending);
+	}
+	logger->info(
+		"Discovered {} controllers ({} from cache) in {}s",
+		jobs.size(),
+		jobs.size() - pending.size(),
+		std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - start).count());
+	return results;
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "metrics.h"
+#include "plc_tag.h"
+
+namespace daq
+{
+
+struct DiscoveryJob
+{
+	plc_tag::Attributes attributes;
+	// Controllers with more configured tags are discovered first
+	size_t num_configured_tags = 0;
+};
+
+struct DiscoveryResult
+{
+	nlohmann::json signals;
+	bool from_cache = false;
+	std::string error; // empty on success
+	std::chrono::milliseconds duration{0};
+};
+
+struct DiscoveryOptions
+{
+	size_t num_workers = 16;
+	// Discoveries running at the same time through one gateway. More than one PLC behind a gateway (backplane routing)
+	// will otherwise overload the gateway's connection resources.
+	size_t max_per_gateway = 1;
+	std::function<nlohmann::json(const plc_tag::Attributes &)> discover;
+	// Optional cache of previous runs. Hits are returned without contacting the controller, an exception from
+	// cache_lookup is logged and counts as a miss. cache_store is called from the worker threads after each successful
+	// discovery, an exception from it is logged and the result is kept.
+	std::function<std::optional<nlohmann::json>(const plc_tag::Attributes &)> cache_lookup;
+	std::function<void(const plc_tag::Attributes &, const nlohmann::json &)> cache_store;
+	// Optional. Discovery durations and requests are recorded per gateway.
+	MetricsRegistry *metrics = nullptr;
+};
+
+// Runs discover (list_signals by default) for many controllers at once on a work stealing pool. Each worker starts
+// with its own share of the jobs, ordered by priority, and steals from the others when it runs out or all of its jobs
+// are blocked by the per-gateway limit. Results are in the order of jobs.
+std::vector<DiscoveryResult> discover_fleet(std::span<const DiscoveryJob> jobs, DiscoveryOptions options);
+
+}
@@ -0,0 +1,144 @@
+// Runs discover_fleet with a fake discover over controllers behind a few gateways. Every controller that isn't cached
+// is discovered exactly once and never more than max_per_gateway at a time per gateway. Failures of discover,
+// cache_lookup and cache_store only affect their own controller.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "fleet_discovery.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+constexpr size_t num_jobs = 24;
+constexpr size_t num_gateways = 4;
+constexpr size_t cached = 1;
+constexpr size_t lookup_failing = 2;
+constexpr size_t store_failing = 3;
+constexpr size_t discover_failing = 5;
+
+// The job index is the last link of the path
+size_t job_of(const plc_tag::Attributes &attributes)
+{
+	return std::stoul(attributes.path.substr(attributes.path.rfind(',') + 1));
+}
+
+bool run()
+{
+	std::vector<DiscoveryJob> jobs(num_jobs);
+	for (size_t i = 0; i < num_jobs; ++i)
+	{
+		jobs[i].attributes.gateway = fmt::format("192.168.250.{}", i % num_gateways + 1);
+		jobs[i].attributes.path = fmt::format("1,{}", i);
+		jobs[i].attributes.plc = "omron-njnx";
+		jobs[i].num_configured_tags = i * 7 % 5;
+	}
+
+	std::array<std::atomic<int>, num_jobs> discovered{};
+	std::array<std::atomic<int>, num_jobs> stored{};
+	std::mutex gateways_mutex;
+	std::unordered_map<std::string, size_t> active;
+	size_t max_active = 0;
+
+	DiscoveryOptions options;
+	options.num_workers = 8;
+	options.max_per_gateway = 1;
+	options.discover = [&](const plc_tag::Attributes &attributes)
+	{
+		const auto job = job_of(attributes);
+		++discovered[job];
+		{
+			std::lock_guard lock(gateways_mutex);
+			max_active = std::max(max_active, ++active[attributes.gateway]);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		{
+			std::lock_guard lock(gateways_mutex);
+			--active[attributes.gateway];
+		}
+		if (job == discover_failing)
+		{
+			throw std::runtime_error("Connection refused");
+		}
+		return nlohmann::json{{"job", job}};
+	};
+	options.cache_lookup = [](const plc_tag::Attributes &attributes) -> std::optional<nlohmann::json>
+	{
+		const auto job = job_of(attributes);
+		if (job == lookup_failing)
+		{
+			throw std::runtime_error("Cache unreadable");
+		}
+		if (job == cached)
+		{
+			return nlohmann::json{{"cached", job}};
+		}
+		return std::nullopt;
+	};
+	options.cache_store = [&](const plc_tag::Attributes &attributes, const nlohmann::json &)
+	{
+		const auto job = job_of(attributes);
+		++stored[job];
+		if (job == store_failing)
+		{
+			throw std::runtime_error("Disk full");
+		}
+	};
+
+	Checker check;
+	const auto results = discover_fleet(jobs, options);
+	check.expect(results.size() == num_jobs, fmt::format("{} results", results.size()));
+	check.expect(max_active <= 1, fmt::format("{} discoveries at a time through one gateway", max_active));
+	for (size_t i = 0; i < num_jobs && i < results.size(); ++i)
+	{
+		check.context(fmt::format("job {}", i));
+		const auto &result = results[i];
+		if (i == cached)
+		{
+			check.expect(discovered[i] == 0, "discovered although cached");
+			check.expect(result.from_cache, "not from the cache");
+			check.expect(result.signals == nlohmann::json{{"cached", i}}, "not the cached signals");
+			continue;
+		}
+		check.expect(discovered[i] == 1, fmt::format("discovered {} times", discovered[i].load()));
+		check.expect(!result.from_cache, "from the cache");
+		if (i == discover_failing)
+		{
+			check.expect(result.error == "Connection refused", fmt::format("error \"{}\"", result.error));
+			check.expect(stored[i] == 0, "failed discovery stored");
+			continue;
+		}
+		check.expect(result.error.empty(), fmt::format("error \"{}\"", result.error));
+		check.expect(result.signals == nlohmann::json{{"job", i}}, "wrong signals");
+		check.expect(stored[i] == 1, fmt::format("stored {} times", stored[i].load()));
+	}
+
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS {} controllers\n", num_jobs);
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
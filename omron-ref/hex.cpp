@@ -0,0 +1,157 @@
+#include "hex.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace daq
+{
+
+namespace
+{
+constexpr size_t dump_line_bytes = 16;
+// "00000000  " + 16 * "xx " + extra spaces in the middle and at the end + "|" ... "|\n"
+constexpr size_t dump_line_overhead = 10 + dump_line_bytes * 3 + 2 + 3;
+
+constexpr auto hex_pairs = []
+{
+	constexpr char digits[] = "0123456789abcdef";
+	std::array<char, 512> table{};
+	for (size_t i = 0; i < 256; ++i)
+	{
+		table[2 * i] = digits[i >> 4];
+		table[2 * i + 1] = digits[i & 0xf];
+	}
+	return table;
+}();
+
+char *encode_byte(uint8_t byte, char *dst)
+{
+	std::memcpy(dst, &hex_pairs[2 * byte], 2);
+	return dst + 2;
+}
+
+char *encode_plain(std::span<const uint8_t> src, char *dst)
+{
+	size_t i = 0;
+#if defined(__SSE2__)
+	const auto nibble_mask = _mm_set1_epi8(0x0f);
+	const auto ascii_zero = _mm_set1_epi8('0');
+	const auto nine = _mm_set1_epi8(9);
+	const auto letter_offset = _mm_set1_epi8('a' - '0' - 10);
+	const auto to_ascii = [&](__m128i nibbles)
+	{
+		const auto letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, nine), letter_offset);
+		return _mm_add_epi8(_mm_add_epi8(nibbles, ascii_zero), letters);
+	};
+	for (; i + 16 <= src.size(); i += 16)
+	{
+		const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src.data() + i));
+		const auto hi = to_ascii(_mm_and_si128(_mm_srli_epi16(v, 4), nibble_mask));
+		const auto lo = to_ascii(_mm_and_si128(v, nibble_mask));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_unpackhi_epi8(hi, lo));
+		dst += 32;
+	}
+#endif
+	for (; i < src.size(); ++i)
+	{
+		dst = encode_byte(src[i], dst);
+	}
+	return dst;
+}
+
+char *encode_bytes(std::span<const uint8_t> src, char *dst)
+{
+	for (size_t i = 0; i < src.size(); ++i)
+	{
+		if (i > 0)
+		{
+			*dst++ = ' ';
+		}
+		dst = encode_byte(src[i], dst);
+	}
+	return dst;
+}
+
+char *encode_dump(std::span<const uint8_t> src, char *dst, size_t offset)
+{
+	for (size_t line = 0; line < src.size(); line += dump_line_bytes)
+	{
+		const auto bytes = src.subspan(line, std::min(dump_line_bytes, src.size() - line));
+		const auto line_offset = static_cast<uint32_t>(offset + line);
+		for (int shift = 24; shift >= 0; shift -= 8)
+		{
+			dst = encode_byte(static_cast<uint8_t>(line_offset >> shift), dst);
+		}
+		*dst++ = ' ';
+		*dst++ = ' ';
+		for (size_t i = 0; i < dump_line_bytes; ++i)
+		{
+			if (i < bytes.size())
+			{
+				dst = encode_byte(bytes[i], dst);
+			}
+			else
+			{
+				*dst++ = ' ';
+				*dst++ = ' ';
+			}
+			*dst++ = ' ';
+			if (i == dump_line_bytes / 2 - 1)
+			{
+				*dst++ = ' ';
+			}
+		}
+		*dst++ = ' ';
+		*dst++ = '|';
+		for (const auto byte : bytes)
+		{
+			*dst++ = byte >= 0x20 && byte < 0x7f ? static_cast<char>(byte) : '.';
+		}
+		*dst++ = '|';
+		*dst++ = '\n';
+	}
+	return dst;
+}
+}
+
+size_t hex_size(size_t num_bytes, HexLayout layout)
+{
+	switch (layout)
+	{
+		case HexLayout::Plain:
+			return 2 * num_bytes;
+		case HexLayout::Bytes:
+			return num_bytes == 0 ? 0 : 3 * num_bytes - 1;
+		case HexLayout::Dump:
+			return (num_bytes + dump_line_bytes - 1) / dump_line_bytes * dump_line_overhead + num_bytes;
+	}
+	return 0;
+}
+
+char *encode_hex(std::span<const uint8_t> src, char *dst, HexLayout layout, size_t dump_offset)
+{
+	switch (layout)
+	{
+		case HexLayout::Plain:
+			return encode_plain(src, dst);
+		case HexLayout::Bytes:
+			return encode_bytes(src, dst);
+		case HexLayout::Dump:
+			return encode_dump(src, dst, dump_offset);
+	}
+	return dst;
+}
+
+void append_hex(fmt::memory_buffer &buf, std::span<const uint8_t> src, HexLayout layout)
+{
+	const auto old_size = buf.size();
+	buf.resize(old_size + hex_size(src.size(), layout));
+	encode_hex(src, buf.data() + old_size, layout);
+}
+
+}
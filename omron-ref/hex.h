@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include <spdlog/fmt/fmt.h>
+
+namespace daq
+{
+
+enum class HexLayout
+{
+	Plain, // 0a1b2c
+	Bytes, // 0a 1b 2c
+	Dump, // hexdump -C style lines: offset, 16 bytes, ascii
+};
+
+// Exact number of characters encode_hex writes
+size_t hex_size(size_t num_bytes, HexLayout layout = HexLayout::Plain);
+
+// Writes hex_size(src.size(), layout) characters to dst and returns the end. Never allocates.
+// dump_offset is the offset printed in the first line of the Dump layout.
+char *encode_hex(std::span<const uint8_t> src, char *dst, HexLayout layout = HexLayout::Plain, size_t dump_offset = 0);
+
+void append_hex(fmt::memory_buffer &buf, std::span<const uint8_t> src, HexLayout layout = HexLayout::Plain);
+
+struct HexView
+{
+	std::span<const uint8_t> data;
+	HexLayout layout;
+};
+
+// For use in fmt::format/fmt::format_to, which streams the encoded output without a temporary string
+inline HexView hex(std::span<const uint8_t> data, HexLayout layout = HexLayout::Plain)
+{
+	return {data, layout};
+}
+
+}
+
+template <>
+struct fmt::formatter<daq::HexView>
+{
+	constexpr auto parse(format_parse_context &ctx)
+	{
+		return ctx.begin();
+	}
+
+	template <typename FormatContext>
+	auto format(const daq::HexView &view, FormatContext &ctx) const
+	{
+		// Encode in chunks on the stack. 64 is a multiple of the 16 byte dump line, so chunks don't split lines.
+		constexpr size_t chunk_size = 64;
+		char chunk[chunk_size * 5];
+		auto out = ctx.out();
+		for (size_t i = 0; i < view.data.size(); i += chunk_size)
+		{
+			const auto src = view.data.subspan(i, std::min(chunk_size, view.data.size() - i));
+			const auto *end = daq::encode_hex(src, chunk, view.layout, i);
+			if (view.layout == daq::HexLayout::Bytes && i > 0)
+			{
+				*out++ = ' ';
+			}
+			out = std::copy(static_cast<const char *>(chunk), end, out);
+		}
+		return out;
+	}
+};
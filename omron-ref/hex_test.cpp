@@ -0,0 +1,115 @@
+// Checks encode_hex against a byte by byte reference for every length up to a few SSE2 blocks and every byte value,
+// the Bytes and Dump layouts against hand written output (hexdump -C for Dump), that hex_size is the exact size of
+// each layout, and that the fmt formatter, which encodes in chunks, matches a single encode_hex.
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "hex.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+constexpr std::array layouts = {HexLayout::Plain, HexLayout::Bytes, HexLayout::Dump};
+
+std::string encode(std::span<const uint8_t> src, HexLayout layout, size_t dump_offset = 0)
+{
+	// Guard bytes after the end catch writes past hex_size
+	std::string out(hex_size(src.size(), layout) + 16, '#');
+	const auto *end = encode_hex(src, out.data(), layout, dump_offset);
+	out.resize(static_cast<size_t>(end - out.data()));
+	return out;
+}
+
+std::string reference_plain(std::span<const uint8_t> src)
+{
+	std::string out;
+	for (const auto byte : src)
+	{
+		out += fmt::format("{:02x}", byte);
+	}
+	return out;
+}
+
+bool run()
+{
+	Checker check;
+
+	// All byte values, at every alignment of the source, so the vector loop sees unaligned loads
+	std::vector<uint8_t> all(256 + 3);
+	for (size_t i = 0; i < all.size(); ++i)
+	{
+		all[i] = static_cast<uint8_t>(i * 167 + 13);
+	}
+	for (size_t align = 0; align < 4; ++align)
+	{
+		const auto src = std::span(all).subspan(align, 256);
+		check.context(fmt::format("all bytes at +{}", align));
+		check.expect(encode(src, HexLayout::Plain) == reference_plain(src), "plain");
+	}
+	for (size_t size = 0; size <= 80; ++size)
+	{
+		const auto src = std::span(all).subspan(1, size);
+		check.context(fmt::format("{} bytes", size));
+		check.expect(encode(src, HexLayout::Plain) == reference_plain(src), "plain");
+		for (const auto layout : layouts)
+		{
+			const auto encoded = encode(src, layout);
+			const auto expected = hex_size(size, layout);
+			check.expect(
+				encoded.size() == expected,
+				fmt::format("layout {} wrote {} of {}", static_cast<int>(layout), encoded.size(), expected));
+			check.expect(
+				encoded.find('#') == std::string::npos,
+				fmt::format("layout {} wrote too little", static_cast<int>(layout)));
+		}
+	}
+
+	check.context("layouts");
+	constexpr char text[] = "Hello, world!\x00\xff\x01\x02\x03\x7f\x20";
+	const auto bytes = std::span(reinterpret_cast<const uint8_t *>(text), sizeof(text) - 1);
+	check.expect(encode(bytes.first(4), HexLayout::Plain) == "48656c6c", "plain");
+	check.expect(encode(bytes.first(4), HexLayout::Bytes) == "48 65 6c 6c", "bytes");
+	check.expect(encode(bytes.first(0), HexLayout::Bytes).empty(), "empty bytes");
+	check.expect(
+		encode(bytes, HexLayout::Dump, 0x100) ==
+			"00000100  48 65 6c 6c 6f 2c 20 77  6f 72 6c 64 21 00 ff 01  |Hello, world!...|\n"
+			"00000110  02 03 7f 20                                       |... |\n",
+		"dump");
+
+	check.context("formatter");
+	for (const auto layout : layouts)
+	{
+		const auto src = std::span(all).first(200);
+		check.expect(
+			fmt::format("{}", hex(src, layout)) == encode(src, layout),
+			fmt::format("layout {} differs from encode_hex", static_cast<int>(layout)));
+	}
+	fmt::memory_buffer buf;
+	append_hex(buf, bytes.first(3), HexLayout::Bytes);
+	check.expect(std::string_view(buf.data(), buf.size()) == "48 65 6c", "append_hex");
+
+	if (check.ok)
+	{
+		std::cout << "PASS\n";
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
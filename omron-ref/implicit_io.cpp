@@ -0,0 +1,499 @@
+#include "implicit_io.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "cip_request.h"
+#include "data_type.h"
+#include "log.h"
+#include "serialization.h"
+
+namespace daq
+{
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+using Serializer = ser::FixedBufferSerializer<std::endian::little>;
+using Deserializer = ser::FixedBufferDeserializer<std::endian::little>;
+
+constexpr auto forward_open_header = cip_request<CipRequestBuilder(0x54).class_id(0x06).instance_id(1)>;
+constexpr auto large_forward_open_header = cip_request<CipRequestBuilder(0x5B).class_id(0x06).instance_id(1)>;
+constexpr auto forward_close_header = cip_request<CipRequestBuilder(0x4E).class_id(0x06).instance_id(1)>;
+
+// Priority/time tick and timeout ticks of the Forward Open itself, about 14 seconds like libplctag
+constexpr uint8_t priority_time_tick = 0x0A;
+constexpr uint8_t timeout_ticks = 0x0E;
+
+// Network connection parameters: point to point, scheduled priority, fixed size
+constexpr uint16_t point_to_point_scheduled = 0x4000 | 0x0800;
+// Transport class 1, cyclic trigger, client direction
+constexpr uint8_t transport_class_1 = 0x01;
+
+// Sequenced address item and connected data item of the common packet format
+constexpr uint16_t sequenced_address_item = 0x8002;
+constexpr uint16_t connected_data_item = 0x00B1;
+// The 16 bit sequence count in front of the data
+constexpr size_t sequence_count_size = 2;
+
+// The receive thread also wakes up this often, so stop() doesn't wait long
+constexpr auto max_wait = std::chrono::milliseconds(100);
+
+std::string socket_error(std::string_view what)
+{
+	return fmt::format("{}: {}", what, std::strerror(errno));
+}
+
+uint32_t resolve_ipv4(std::string_view host)
+{
+	addrinfo hints{};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	addrinfo *result = nullptr;
+	const std::string name(host);
+	const auto rc = getaddrinfo(name.c_str(), nullptr, &hints, &result);
+	if (rc != 0)
+	{
+		throw std::runtime_error(fmt::format("Could not resolve '{}': {}", host, gai_strerror(rc)));
+	}
+	const auto address = reinterpret_cast<const sockaddr_in *>(result->ai_addr)->sin_addr.s_addr;
+	freeaddrinfo(result);
+	return address;
+}
+}
+
+ImplicitConsumer::ImplicitConsumer(ImplicitConsumerOptions options) : _options(std::move(options))
+{
+	std::random_device random;
+	_id_base = random() & 0xFFFF0000;
+	_originator_serial = random();
+
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(_options.port);
+	if (inet_pton(AF_INET, _options.local_address.c_str(), &addr.sin_addr) != 1)
+	{
+		throw std::runtime_error(fmt::format("Invalid local address '{}'", _options.local_address));
+	}
+	_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (_fd < 0)
+	{
+		throw std::runtime_error(socket_error("Could not create implicit I/O socket"));
+	}
+	const int one = 1;
+	setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	// Bound right away, so the data that arrives between open() and start() waits in the socket
+	if (bind(_fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0)
+	{
+		const auto message = socket_error(fmt::format("Could not bind {}:{}", _options.local_address, _options.port));
+		::close(_fd);
+		throw std::runtime_error(message);
+	}
+}
+
+ImplicitConsumer::~ImplicitConsumer()
+{
+	stop();
+	::close(_fd);
+}
+
+size_t ImplicitConsumer::open(RequestContext &rc, std::string_view controller_host, const ProducedTag &tag)
+{
+	if (_thread.joinable())
+	{
+		throw std::logic_error("Connections can only be opened before the consumer is started");
+	}
+	if (_connections.size() > 0xFFFF)
+	{
+		throw std::runtime_error("Too many implicit connections");
+	}
+
+	auto conn = std::make_unique<Connection>();
+	conn->name = tag.name;
+	conn->size = tag.size;
+	conn->controller_address = resolve_ipv4(controller_host);
+	conn->t_o_id = _id_base + static_cast<uint32_t>(_connections.size());
+	conn->serial = static_cast<uint16_t>(_originator_serial + _connections.size());
+
+	// The layout: one copy or bit extraction per field, in the order of the data
+	for (size_t i = 0; i < tag.fields.size(); ++i)
+	{
+		const auto &field = tag.fields[i];
+		const auto *traits = data_type_traits(field.type);
+		const auto kind = traits ? traits->kind : ValueKind::None;
+		if (!traits || traits->size == 0 || kind == ValueKind::None || kind == ValueKind::String)
+		{
+			throw std::runtime_error(fmt::format("Field '{}' of produced tag '{}' has unsupported type {:#x}",
+				field.name,
+				tag.name,
+				static_cast<uint8_t>(field.type)));
+		}
+		if (field.offset + traits->size > tag.size || (kind == ValueKind::Bool && field.bit > 7))
+		{
+			throw std::runtime_error(fmt::format(
+				"Field '{}' at offset {} doesn't fit into produced tag '{}' of {} bytes",
+				field.name,
+				field.offset,
+				tag.name,
+				tag.size));
+		}
+		conn->layout.push_back({
+			.offset = field.offset,
+			.slot = static_cast<uint32_t>(i),
+			.width = static_cast<uint8_t>(kind == ValueKind::Bool ? 0 : traits->size),
+			.bit = field.bit,
+		});
+	}
+	std::stable_sort(
+		conn->layout.begin(), conn->layout.end(), [](const Op &a, const Op &b) { return a.offset < b.offset; });
+	conn->num_values = tag.fields.size();
+	conn->values = std::make_unique<std::atomic<uint64_t>[]>(conn->num_values);
+
+	conn->connection_path = tag.route;
+	const auto symbol = variable_request_path(tag.name);
+	conn->connection_path.insert(conn->connection_path.end(), symbol.begin(), symbol.end());
+
+	// O->T only carries the sequence count as heartbeat, T->O the sequence count and the data
+	const uint32_t t_o_size = tag.size + sequence_count_size;
+	const uint32_t o_t_size = sequence_count_size;
+	const bool large = t_o_size > 0x1FF;
+	const auto rpi = static_cast<uint32_t>(tag.rpi.count());
+	rc.serializer.reset();
+	if (large)
+	{
+		ser::serialize(rc.serializer, large_forward_open_header);
+	}
+	else
+	{
+		ser::serialize(rc.serializer, forward_open_header);
+	}
+	// The target picks the O->T id, the T->O id is ours, so the datagrams can be matched to the connection
+	ser::serialize_multi(rc.serializer, priority_time_tick, timeout_ticks, uint32_t{0}, conn->t_o_id, conn->serial,
+		_vendor_id, _originator_serial, _options.timeout_multiplier, "\x00\x00\x00", rpi);
+	if (large)
+	{
+		ser::serialize_multi(rc.serializer, static_cast<uint32_t>(point_to_point_scheduled << 16 | o_t_size), rpi,
+			static_cast<uint32_t>(point_to_point_scheduled << 16 | t_o_size));
+	}
+	else
+	{
+		ser::serialize_multi(rc.serializer, static_cast<uint16_t>(point_to_point_scheduled | o_t_size), rpi,
+			static_cast<uint16_t>(point_to_point_scheduled | t_o_size));
+	}
+	ser::serialize_multi(rc.serializer, transport_class_1, static_cast<uint8_t>(conn->connection_path.size() / 2));
+	ser::serialize(rc.serializer, std::span<const uint8_t>(conn->connection_path));
+	if (rc.serializer.has_error())
+	{
+		throw std::runtime_error(
+			fmt::format("Forward Open for produced tag '{}' doesn't fit into the send buffer", tag.name));
+	}
+	rc.request();
+
+	conn->o_t_id = ser::read<uint32_t>(rc.deserializer);
+	const auto t_o_id = ser::read<uint32_t>(rc.deserializer);
+	rc.deserializer.advance(2 + 2 + 4);
+	const auto o_t_api = ser::read<uint32_t>(rc.deserializer);
+	const auto t_o_api = ser::read<uint32_t>(rc.deserializer);
+	if (rc.deserializer.has_error() || t_o_id != conn->t_o_id)
+	{
+		throw std::runtime_error(fmt::format("Could not decode Forward Open response for produced tag '{}'", tag.name));
+	}
+	// An API of 0 would mean sending heartbeats all the time
+	conn->o_t_api = o_t_api > 0 ? std::chrono::microseconds(o_t_api) : tag.rpi;
+	conn->timeout = (t_o_api > 0 ? std::chrono::microseconds(t_o_api) : tag.rpi) * (4 << _options.timeout_multiplier);
+	conn->next_heartbeat = Clock::now();
+	conn->last_packet = conn->next_heartbeat;
+	conn->open.store(true);
+	logger->info("Opened class 1 connection for produced tag '{}', RPI {} us, O->T id {:#x}, T->O id {:#x}", tag.name,
+		t_o_api, conn->o_t_id, conn->t_o_id);
+
+	_connections.push_back(std::move(conn));
+	return _connections.size() - 1;
+}
+
+void ImplicitConsumer::close(RequestContext &rc, size_t connection)
+{
+	auto &conn = *_connections.at(connection);
+	if (!conn.open.exchange(false))
+	{
+		return;
+	}
+	rc.serializer.reset();
+	ser::serialize(rc.serializer, forward_close_header);
+	ser::serialize_multi(rc.serializer, priority_time_tick, timeout_ticks, conn.serial, _vendor_id, _originator_serial,
+		static_cast<uint8_t>(conn.connection_path.size() / 2), "\x00");
+	ser::serialize(rc.serializer, std::span<const uint8_t>(conn.connection_path));
+	rc.request();
+}
+
+void ImplicitConsumer::start()
+{
+	if (_thread.joinable())
+	{
+		return;
+	}
+	_thread = std::jthread([this](std::stop_token stop) { run(stop); });
+}
+
+void ImplicitConsumer::stop()
+{
+	if (_thread.joinable())
+	{
+		_thread.request_stop();
+		_thread.join();
+	}
+}
+
+bool ImplicitConsumer::read(
+	size_t connection, std::span<uint64_t> values, std::chrono::system_clock::time_point *time) const
+{
+	const auto &conn = *_connections.at(connection);
+	if (values.size() != conn.num_values)
+	{
+		throw std::runtime_error(fmt::format(
+			"Produced tag '{}' has {} fields, {} values requested", conn.name, conn.num_values, values.size()));
+	}
+	uint32_t version;
+	int64_t nanoseconds;
+	while (true)
+	{
+		version = conn.version.load(std::memory_order_acquire);
+		if (version % 2 != 0)
+		{
+			continue;
+		}
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			values[i] = conn.values[i].load(std::memory_order_relaxed);
+		}
+		nanoseconds = conn.time.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (conn.version.load(std::memory_order_relaxed) == version)
+		{
+			break;
+		}
+	}
+	if (time)
+	{
+		*time = std::chrono::system_clock::time_point(std::chrono::nanoseconds(nanoseconds));
+	}
+	return version > 0 && !conn.timed_out.load(std::memory_order_relaxed);
+}
+
+ImplicitStats ImplicitConsumer::stats(size_t connection) const
+{
+	const auto &conn = *_connections.at(connection);
+	return {
+		.packets = conn.packets.load(std::memory_order_relaxed),
+		.stale_packets = conn.stale_packets.load(std::memory_order_relaxed),
+		.timeouts = conn.timeouts.load(std::memory_order_relaxed),
+	};
+}
+
+void ImplicitConsumer::run(std::stop_token stop)
+{
+	// Room for the largest connection, everything else is the common packet format around it
+	size_t datagram_size = 64;
+	for (const auto &conn : _connections)
+	{
+		datagram_size = std::max<size_t>(datagram_size, conn->size + 64);
+	}
+	const auto batch_size = std::max<size_t>(1, _options.batch_size);
+	std::vector<uint8_t> buffers(batch_size * datagram_size);
+	std::vector<iovec> iovecs(batch_size);
+	std::vector<mmsghdr> headers(batch_size);
+	for (size_t i = 0; i < batch_size; ++i)
+	{
+		iovecs[i] = {.iov_base = buffers.data() + i * datagram_size, .iov_len = datagram_size};
+		headers[i].msg_hdr.msg_iov = &iovecs[i];
+		headers[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (!stop.stop_requested())
+	{
+		const auto next = send_heartbeats(Clock::now());
+		const auto wait = std::clamp<Clock::duration>(next - Clock::now(), Clock::duration::zero(), max_wait);
+		const auto wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count();
+		const timespec timeout{.tv_sec = wait_ns / 1'000'000'000, .tv_nsec = wait_ns % 1'000'000'000};
+		pollfd pfd{.fd = _fd, .events = POLLIN, .revents = 0};
+		if (ppoll(&pfd, 1, &timeout, nullptr) <= 0 || !(pfd.revents & POLLIN))
+		{
+			continue;
+		}
+
+		// Drain the socket, a full batch means there may be more
+		while (true)
+		{
+			const auto n = recvmmsg(_fd, headers.data(), static_cast<unsigned>(batch_size), MSG_DONTWAIT, nullptr);
+			if (n <= 0)
+			{
+				break;
+			}
+			const auto now = Clock::now();
+			for (int i = 0; i < n; ++i)
+			{
+				if (!(headers[i].msg_hdr.msg_flags & MSG_TRUNC))
+				{
+					const auto datagram =
+						std::span<const uint8_t>(buffers.data() + i * datagram_size, headers[i].msg_len);
+					handle_packet(datagram, now);
+				}
+			}
+			if (static_cast<size_t>(n) < batch_size)
+			{
+				break;
+			}
+		}
+	}
+}
+
+void ImplicitConsumer::handle_packet(std::span<const uint8_t> packet, Clock::time_point now)
+{
+	Deserializer des(packet);
+	const auto num_items = ser::read<uint16_t>(des);
+	uint32_t connection_id = 0;
+	uint32_t sequence = 0;
+	bool has_address = false;
+	std::span<const uint8_t> data;
+	bool has_data = false;
+	for (uint16_t i = 0; i < num_items && !des.has_error(); ++i)
+	{
+		const auto type = ser::read<uint16_t>(des);
+		const auto length = ser::read<uint16_t>(des);
+		const auto item = des.remaining_buffer().first(std::min<size_t>(length, des.remaining_buffer().size()));
+		des.advance(length);
+		if (type == sequenced_address_item && length == 8)
+		{
+			std::memcpy(&connection_id, item.data(), sizeof(connection_id));
+			std::memcpy(&sequence, item.data() + 4, sizeof(sequence));
+			has_address = true;
+		}
+		else if (type == connected_data_item)
+		{
+			data = item;
+			has_data = true;
+		}
+	}
+	const auto index = connection_id - _id_base;
+	if (des.has_error() || !has_address || !has_data || index >= _connections.size())
+	{
+		return;
+	}
+	auto &conn = *_connections[index];
+	if (!conn.open.load(std::memory_order_relaxed) || data.size() != conn.size + sequence_count_size)
+	{
+		return;
+	}
+	// UDP can reorder, anything not newer than the last packet is dropped
+	if (conn.received && static_cast<int32_t>(sequence - conn.encap_sequence) <= 0)
+	{
+		conn.stale_packets.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	const auto payload = data.subspan(sequence_count_size);
+	const auto version = conn.version.load(std::memory_order_relaxed);
+	conn.version.store(version + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (const auto &op : conn.layout)
+	{
+		uint64_t value = 0;
+		if (op.width == 0)
+		{
+			value = (payload[op.offset] >> op.bit) & 1;
+		}
+		else
+		{
+			for (uint8_t i = 0; i < op.width; ++i)
+			{
+				value |= static_cast<uint64_t>(payload[op.offset + i]) << (8 * i);
+			}
+		}
+		conn.values[op.slot].store(value, std::memory_order_relaxed);
+	}
+	const auto time =
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
+	conn.time.store(time.count(), std::memory_order_relaxed);
+	conn.version.store(version + 2, std::memory_order_release);
+
+	conn.encap_sequence = sequence;
+	conn.received = true;
+	conn.last_packet = now;
+	conn.packets.fetch_add(1, std::memory_order_relaxed);
+	if (conn.timed_out.exchange(false, std::memory_order_relaxed))
+	{
+		logger->info("Class 1 connection for produced tag '{}' receives data again", conn.name);
+	}
+}
+
+Clock::time_point ImplicitConsumer::send_heartbeats(Clock::time_point now)
+{
+	auto next = now + max_wait;
+	for (auto &conn_ptr : _connections)
+	{
+		auto &conn = *conn_ptr;
+		if (!conn.open.load(std::memory_order_relaxed))
+		{
+			continue;
+		}
+
+		if (!conn.timed_out.load(std::memory_order_relaxed))
+		{
+			if (now - conn.last_packet > conn.timeout)
+			{
+				conn.timed_out.store(true, std::memory_order_relaxed);
+				conn.timeouts.fetch_add(1, std::memory_order_relaxed);
+				logger->warn("Class 1 connection for produced tag '{}' timed out after {} ms without data", conn.name,
+					std::chrono::duration_cast<std::chrono::milliseconds>(conn.timeout).count());
+			}
+			else
+			{
+				next = std::min(next, conn.last_packet + conn.timeout);
+			}
+		}
+
+		if (now >= conn.next_heartbeat)
+		{
+			++conn.heartbeat_sequence;
+			std::array<uint8_t, 22> packet;
+			Serializer out(packet);
+			ser::serialize_multi(out,
+				uint16_t{2},
+				sequenced_address_item,
+				uint16_t{8},
+				conn.o_t_id,
+				conn.heartbeat_sequence,
+				connected_data_item,
+				static_cast<uint16_t>(sequence_count_size),
+				static_cast<uint16_t>(conn.heartbeat_sequence));
+			sockaddr_in addr{};
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(_options.controller_port);
+			addr.sin_addr.s_addr = conn.controller_address;
+			// A lost heartbeat is like a lost datagram, the controller only drops the connection after several
+			sendto(_fd, packet.data(), packet.size(), 0, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr));
+			conn.next_heartbeat += conn.o_t_api;
+			if (conn.next_heartbeat <= now)
+			{
+				conn.next_heartbeat = now + conn.o_t_api;
+			}
+		}
+		next = std::min(next, conn.next_heartbeat);
+	}
+	return next;
+}
+
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "omron.h"
+
+namespace daq
+{
+
+// A value inside the data of a produced tag
+struct ImplicitField
+{
+	std::string name;
+	DataType type;
+	uint32_t offset; // bytes from the start of the produced data
+	uint8_t bit = 0; // BOOL only
+};
+
+// A produced tag (a tag data link output on NJ/NX) consumed with a class 1 connection
+struct ProducedTag
+{
+	std::string name;
+	uint16_t size; // bytes of produced data, without the sequence count
+	std::chrono::microseconds rpi{10000};
+	std::vector<ImplicitField> fields;
+	// Route in front of the symbol in the connection path, e.g. "\x01\x00" for the CPU through a backplane
+	std::vector<uint8_t> route;
+};
+
+struct ImplicitConsumerOptions
+{
+	// The controller sends to port 2222 of the originator and takes the heartbeats on port 2222. The ports only need
+	// to be changed for tests.
+	std::string local_address = "0.0.0.0";
+	uint16_t port = 2222;
+	uint16_t controller_port = 2222;
+	// The connection times out after RPI * 4 << timeout_multiplier without data
+	uint8_t timeout_multiplier = 1;
+	// Datagrams per recvmmsg call
+	size_t batch_size = 32;
+};
+
+struct ImplicitStats
+{
+	uint64_t packets = 0;
+	uint64_t stale_packets = 0; // older than the last one, dropped
+	uint64_t timeouts = 0;
+};
+
+// Consumer for CIP class 1 (implicit I/O) connections. open() makes a Forward Open for a produced tag over explicit
+// messaging, after that the controller sends the data cyclically over UDP without being asked. A receive thread reads
+// the datagrams of all connections from one socket with recvmmsg, sends the O->T heartbeats and decodes the data with
+// a layout compiled from the fields into a value table per connection.
+//
+// Values are the raw little endian bits of a field zero extended to 64 bits, 0 or 1 for BOOL. Interpret them with
+// data_type_traits(field.type).
+class ImplicitConsumer
+{
+public:
+	explicit ImplicitConsumer(ImplicitConsumerOptions options = {});
+	~ImplicitConsumer();
+
+	ImplicitConsumer(const ImplicitConsumer &) = delete;
+	ImplicitConsumer &operator=(const ImplicitConsumer &) = delete;
+
+	// Forward Open for the tag, sent with rc, which has to use unconnected messaging. controller_host is where the
+	// heartbeats go. Returns the connection index. Throws on CIP errors and fields that don't fit the tag. Only
+	// before start().
+	size_t open(RequestContext &rc, std::string_view controller_host, const ProducedTag &tag);
+
+	// Forward Close. The values of the connection stay readable.
+	void close(RequestContext &rc, size_t connection);
+
+	void start();
+	void stop();
+
+	// Copies the newest values of the connection, one per field. Returns false if no data arrived yet or the connection
+	// timed out, values has the last data then. Lock free, can be called from any thread.
+	bool read(
+		size_t connection, std::span<uint64_t> values, std::chrono::system_clock::time_point *time = nullptr) const;
+
+	ImplicitStats stats(size_t connection) const;
+
+	size_t num_connections() const
+	{
+		return _connections.size();
+	}
+
+private:
+	// One step of a compiled layout
+	struct Op
+	{
+		uint32_t offset;
+		uint32_t slot;
+		uint8_t width; // bytes, 0 for a bit
+		uint8_t bit;
+	};
+
+	struct Connection
+	{
+		std::string name;
+		std::vector<uint8_t> connection_path;
+		uint32_t controller_address = 0; // IPv4, network byte order
+		uint32_t o_t_id = 0;
+		uint32_t t_o_id = 0;
+		uint16_t serial = 0;
+		std::chrono::microseconds o_t_api{0};
+		std::chrono::microseconds timeout{0};
+		uint16_t size = 0;
+		std::vector<Op> layout; // ordered by offset
+		std::unique_ptr<std::atomic<uint64_t>[]> values;
+		size_t num_values = 0;
+
+		// Receive thread only
+		uint32_t encap_sequence = 0;
+		uint32_t heartbeat_sequence = 0;
+		std::chrono::steady_clock::time_point next_heartbeat;
+		std::chrono::steady_clock::time_point last_packet;
+		bool received = false;
+
+		std::atomic<bool> open = false;
+		std::atomic<bool> timed_out = false;
+		std::atomic<uint32_t> version = 0; // seqlock, odd while the values are written
+		std::atomic<int64_t> time = 0; // system clock nanoseconds of the last data
+		std::atomic<uint64_t> packets = 0;
+		std::atomic<uint64_t> stale_packets = 0;
+		std::atomic<uint64_t> timeouts = 0;
+	};
+
+	void run(std::stop_token stop);
+	void handle_packet(std::span<const uint8_t> packet, std::chrono::steady_clock::time_point now);
+	std::chrono::steady_clock::time_point send_heartbeats(std::chrono::steady_clock::time_point now);
+
+	ImplicitConsumerOptions _options;
+	int _fd = -1;
+	uint32_t _id_base; // T->O connection ids are _id_base + index
+	uint16_t _vendor_id = 0xF33D;
+	uint32_t _originator_serial;
+	std::vector<std::unique_ptr<Connection>> _connections;
+	std::jthread _thread;
+};
+
+}
@@ -0,0 +1,210 @@
+// Opens a class 1 connection for a variable of a simulated controller (sim_plc.h) with ImplicitConsumer, checks the
+// decoded fields and bits against the value from Read Data, then shuts the simulator down and checks that the
+// connection times out and read() reports it.
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "implicit_io.h"
+#include "list_signals.h"
+#include "sim_plc.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+// A UDP port on 127.0.0.1 that was free a moment ago
+uint16_t free_udp_port()
+{
+	const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	const auto ok = fd >= 0 && bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0
+		&& getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) == 0;
+	::close(fd);
+	if (!ok)
+	{
+		throw std::runtime_error("Could not find a free UDP port");
+	}
+	return ntohs(addr.sin_port);
+}
+
+// The value of the variable, with Read Data
+std::vector<uint8_t> read_value(RequestContext &rc, std::string_view name)
+{
+	const auto path = variable_request_path(std::string(name));
+	rc.serializer.reset();
+	ser::serialize_multi(rc.serializer, uint8_t{0x4C}, static_cast<uint8_t>(path.size() / 2));
+	ser::serialize(rc.serializer, std::span<const uint8_t>(path));
+	ser::serialize(rc.serializer, uint16_t{1});
+	rc.request();
+	// Data type and a reserved byte, then the value
+	rc.deserializer.advance(2);
+	const auto value = rc.deserializer.remaining_buffer();
+	return {value.begin(), value.end()};
+}
+
+uint64_t little_endian(std::span<const uint8_t> bytes)
+{
+	uint64_t value = 0;
+	for (size_t i = 0; i < bytes.size(); ++i)
+	{
+		value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+	}
+	return value;
+}
+
+template <typename Predicate>
+bool wait_for(Predicate predicate, std::chrono::milliseconds timeout = std::chrono::milliseconds(2000))
+{
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (!predicate())
+	{
+		if (std::chrono::steady_clock::now() > deadline)
+		{
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	return true;
+}
+
+bool run()
+{
+	Checker check;
+	const auto port = free_udp_port();
+	std::vector<SimulatedControllerConfig> configs(1);
+	configs[0].num_variables = 200;
+	configs[0].implicit_port = port;
+	auto server = std::make_unique<SimulatedPlcServer>(configs);
+	plc_tag::Attributes attributes;
+	attributes.gateway = server->gateway(0);
+	attributes.path = "1,0";
+	attributes.plc = "omron-njnx";
+	auto rc = std::make_unique<RequestContext>(attributes);
+
+	// A variable of at least 8 bytes, so the fields below fit
+	const auto vars = get_variables_fast(*rc, VariableAddressing::Symbolic, std::pmr::get_default_resource());
+	std::optional<VariableView> var;
+	for (size_t i = 0; i < vars.size() && !var; ++i)
+	{
+		if (vars[i].size >= 8)
+		{
+			var = vars[i];
+		}
+	}
+	if (!var)
+	{
+		throw std::runtime_error("The simulated controller has no variable of 8 bytes or more");
+	}
+	const auto value = read_value(*rc, var->name);
+	check.expect(value.size() == var->size, "Read Data returns the whole variable");
+
+	ProducedTag tag{
+		.name = std::string(var->name),
+		.size = static_cast<uint16_t>(var->size),
+		.rpi = std::chrono::milliseconds(10),
+		.fields = {
+			{.name = "Raw", .type = DataType::Lword, .offset = 0},
+			{.name = "Low", .type = DataType::Uint, .offset = 0},
+			{.name = "Third", .type = DataType::Usint, .offset = 2},
+			{.name = "High", .type = DataType::Udint, .offset = 4},
+			{.name = "Last", .type = DataType::Sint, .offset = var->size - 1},
+		},
+		.route = {},
+	};
+	for (uint8_t bit = 0; bit < 8; ++bit)
+	{
+		tag.fields.push_back({.name = fmt::format("Bit{}", bit), .type = DataType::Bool, .offset = 1, .bit = bit});
+	}
+	std::vector<uint64_t> expected{
+		little_endian(std::span(value).first(8)),
+		little_endian(std::span(value).first(2)),
+		value[2],
+		little_endian(std::span(value).subspan(4, 4)),
+		value.back(), // zero extended
+	};
+	for (uint8_t bit = 0; bit < 8; ++bit)
+	{
+		expected.push_back((value[1] >> bit) & 1);
+	}
+
+	ImplicitConsumer consumer({
+		.local_address = "127.0.0.1",
+		.port = port,
+		.controller_port = free_udp_port(),
+		.timeout_multiplier = 2,
+		.batch_size = 4,
+	});
+	auto too_long = tag;
+	too_long.fields.push_back({.name = "Outside", .type = DataType::Udint, .offset = var->size - 2});
+	bool threw = false;
+	try
+	{
+		consumer.open(*rc, "127.0.0.1", too_long);
+	}
+	catch (const std::runtime_error &)
+	{
+		threw = true;
+	}
+	check.expect(threw && consumer.num_connections() == 0, "a field outside the tag is rejected");
+
+	const auto connection = consumer.open(*rc, "127.0.0.1", tag);
+	std::vector<uint64_t> values(tag.fields.size());
+	check.expect(!consumer.read(connection, values), "no data before the first packet");
+	consumer.start();
+	check.expect(wait_for([&] { return consumer.stats(connection).packets >= 5; }), "the producer sends every RPI");
+	std::chrono::system_clock::time_point time;
+	check.expect(consumer.read(connection, values, &time), "read() after the first packets");
+	check.expect(std::chrono::system_clock::now() - time < std::chrono::seconds(2), "time of the last data");
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		check.expect(values[i] == expected[i],
+			fmt::format("field {} is {:#x}, expected {:#x}", tag.fields[i].name, values[i], expected[i]));
+	}
+	check.expect(consumer.stats(connection).timeouts == 0, "no timeouts while the producer runs");
+
+	// The producer goes away without a Forward Close, like a controller that lost power
+	rc.reset();
+	server.reset();
+	check.expect(wait_for([&] { return consumer.stats(connection).timeouts > 0; }), "the connection times out");
+	check.expect(!consumer.read(connection, values), "read() is false after the timeout");
+	check.expect(values == expected, "the last values stay readable");
+	const auto stats = consumer.stats(connection);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	check.expect(consumer.stats(connection).timeouts == stats.timeouts, "a timed out connection counts once");
+	consumer.stop();
+
+	if (check.ok)
+	{
+		std::cout << fmt::format(
+			"PASS {} fields of '{}' after {} packets\n", tag.fields.size(), tag.name, stats.packets);
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
@@ -1,33 +1,39 @@
 #include "list_signals.h"
 
+#include <algorithm>
+#include <array>
+
 #include <log.h>
 
+#include "cip_error.h"
+#include "cip_request.h"
+#include "data_type.h"
+#include "hex.h"
+#include "metrics.h"
+#include "msp.h"
 #include "omron.h"
 #include "serialization.h"
 #include "string_util.h"
+#include "trace.h"
 
 namespace daq
 {
 
 namespace
 {
-std::vector<uint8_t> address_request_path(uint8_t class_id, uint16_t instance_id)
-{
-	std::vector<uint8_t> buf(6);
-	ser::FixedBufferSerializer<std::endian::little> s(buf);
-	ser::serialize_multi(s, "\x20", class_id, "\x25\x00", instance_id);
-	assert(!s.has_error());
-	return buf;
-}
-
 void encode_get_attribute_all(ser::Serializer auto &ser, uint16_t instance_id)
 {
-	daq::encode_get_attribute_all(ser, address_request_path(0x6a, instance_id));
+	daq::encode_get_attribute_all(ser, address_request_path(variable_class_id, instance_id));
 }
 
+// Get Attribute All on instance 0 of the tag name server, answers with the number of variables
+constexpr auto get_num_variables_request =
+	cip_request<CipRequestBuilder(0x01).class_id(variable_class_id).instance_id(0)>;
+
 size_t get_num_variables(RequestContext &rc)
 {
-	encode_get_attribute_all(rc.serializer, 0);
+	rc.serializer.reset();
+	ser::serialize(rc.serializer, get_num_variables_request);
 	rc.request();
 	rc.deserializer.advance(2);
 	const auto num = ser::read<uint16_t>(rc.deserializer);
@@ -76,13 +82,14 @@ enum class TagType : uint16_t
 	User = 2,
 };
 
+// Omron specific Get All Instances, up to the request data
+constexpr auto get_all_instances_header =
+	cip_request<CipRequestBuilder(0x5F).class_id(variable_class_id).instance_id(0)>;
+
 void encode_omron_get_all_instances(ser::Serializer auto &ser, uint32_t next_instance_id, TagType tag_type)
 {
 	ser.reset();
-	const auto request_path = address_request_path(0x6a, 0);
-	ser::serialize(ser, "\x5F"); // Omron specific Get All Instances
-	ser::serialize(ser, static_cast<uint8_t>(request_path.size() / 2)); // in words
-	ser::serialize(ser, request_path);
+	ser::serialize(ser, get_all_instances_header);
 	ser::serialize(ser, next_instance_id); // next instance id placeholder
 	ser::serialize(ser, "\x20\x00\x00\x00"); // not sure
 	ser::serialize(ser, static_cast<uint16_t>(tag_type)); // tag type placeholder
@@ -95,32 +102,36 @@ void encode_omron_get_all_instances(ser::Serializer auto &ser, uint32_t next_ins
 struct InstanceData
 {
 	uint32_t id;
-	std::string name;
+	uint32_t variable_instance_id; // of the variable object (class 0x6B)
+	std::pmr::string name;
 };
 
-InstanceData decode_instance_data(ser::Deserializer auto &deser)
+// trailer is set to the record bytes after the name
+InstanceData decode_instance_data(
+	ser::Deserializer auto &deser, std::pmr::memory_resource *resource, std::span<const uint8_t> &trailer)
 {
-	InstanceData data;
+	InstanceData data{.id = 0, .variable_instance_id = 0, .name = std::pmr::string(resource)};
 	data.id = ser::read<uint32_t>(deser);
 	const auto instance_data_len = ser::read<uint16_t>(deser); // includes class, instance id, name
-	deser.advance(2); // class? always 6B
-	deser.advance(4); // instance id again
+	deser.advance(2); // class, always 6B (variable object)
+	data.variable_instance_id = ser::read<uint32_t>(deser);
 	const auto name_len = ser::read<uint8_t>(deser);
-	data.name = ser::read_string(deser, name_len);
+	ser::serialize(deser, data.name, name_len);
+	trailer = {};
 	if (instance_data_len > 2 + 4 + 1 + name_len)
 	{
 		const auto remaining = instance_data_len - 2 - 4 - 1 - name_len;
-		deser.advance(remaining); // mostly padding I think
+		trailer = deser.remaining_buffer().first(std::min<size_t>(remaining, deser.remaining_buffer().size()));
+		deser.advance(remaining);
 	}
 	return data;
 }
 
-std::vector<VariableInfo> get_variables_fast(RequestContext &rc)
+std::pmr::vector<InstanceData> get_instances(RequestContext &rc, size_t num, std::pmr::memory_resource *resource)
 {
-	const auto num = get_num_variables(rc);
-
-	std::vector<std::string> names;
-	names.reserve(num);
+	std::pmr::vector<InstanceData> instances(resource);
+	instances.reserve(num);
+	bool logged_trailer = false;
 
 	constexpr std::array tag_types{TagType::System, TagType::User};
 	for (const auto &tag_type : tag_types)
@@ -128,7 +139,10 @@ std::vector<VariableInfo> get_variables_fast(RequestContext &rc)
 		uint32_t next_instance_id = 1;
 		while (true)
 		{
-			encode_omron_get_all_instances(rc.serializer, next_instance_id, tag_type);
+			{
+				TraceSpan span("encode get all instances");
+				encode_omron_get_all_instances(rc.serializer, next_instance_id, tag_type);
+			}
 
 			rc.request();
 			const auto num_instances = ser::read<uint16_t>(rc.deserializer);
@@ -139,33 +153,333 @@ std::vector<VariableInfo> get_variables_fast(RequestContext &rc)
 				break;
 			}
 
+			TraceSpan span("decode instances");
 			for (size_t i = 0; i < num_instances; ++i)
 			{
-				auto instance_data = decode_instance_data(rc.deserializer);
+				std::span<const uint8_t> trailer;
+				auto instance_data = decode_instance_data(rc.deserializer, resource, trailer);
 				if (rc.deserializer.has_error())
 				{
 					throw std::runtime_error(fmt::format("Could not decode all instance data {}", i));
 				}
-				names.push_back(std::move(instance_data.name));
+				// The bytes after the name aren't documented, so nothing is taken from them and the types come from
+				// the type queries. The first trailer that isn't all zero is logged, so its layout can be worked out
+				// from a real controller before discovery relies on it.
+				if (!logged_trailer && std::any_of(trailer.begin(), trailer.end(), [](uint8_t b) { return b != 0; }))
+				{
+					logger->info("Get all instances record of '{}' has {} bytes after the name: {}", instance_data.name,
+						trailer.size(), hex(trailer, HexLayout::Bytes));
+					logged_trailer = true;
+				}
 				next_instance_id = instance_data.id + 1;
+				instances.push_back(std::move(instance_data));
 			}
 		}
 	}
+	return instances;
+}
+
+// Largest request and reply of the batched type queries. It fits unconnected messaging, so it works on every route.
+constexpr size_t type_query_packet_limit = 502;
+// Variables whose infos are kept at a time
+constexpr size_t type_query_chunk_size = 256;
+
+// Sends the Get Attribute List requests of set for the selected variables, packed into Multiple Service Packets, and
+// decodes the replies into types. Variables with a failed embedded reply or a missing attribute are queried again on
+// their own with Get Attribute All, which throws with the actual error. The batch bookkeeping comes from resource.
+void query_attributes_batched(
+	RequestContext &rc,
+	std::span<const InstanceData> instances,
+	std::span<VariableType> types,
+	std::span<const size_t> selection,
+	VariableAddressing addressing,
+	AttributeSet set,
+	std::pmr::memory_resource *resource)
+{
+	constexpr size_t msp_request_header = 6 + 2;
+	constexpr size_t msp_reply_header = 4 + 2;
+	const auto reply_size = variable_attributes_reply_size(set);
 
-	if (names.size() > num)
+	// The embedded requests back to back, they fit because a packet does
+	std::array<uint8_t, type_query_packet_limit> encoded;
+	size_t encoded_size = 0;
+	std::pmr::vector<std::span<const uint8_t>> requests(resource);
+	std::pmr::vector<size_t> batch(resource);
+	std::pmr::vector<std::span<const uint8_t>> replies(resource);
+	std::pmr::vector<size_t> failed(resource);
+	size_t request_bytes = msp_request_header;
+	size_t reply_bytes = msp_reply_header;
+
+	const auto flush = [&]
 	{
-		logger->warn("Read more variable names ({}) than number of variables ({})", names.size(), num);
+		if (batch.empty())
+		{
+			return;
+		}
+		{
+			TraceSpan span("encode type query batch");
+			if (!encode_multiple_service_packet(rc.serializer, requests))
+			{
+				throw std::runtime_error("Could not encode type query batch");
+			}
+		}
+		try
+		{
+			rc.request();
+		}
+		catch (const CipStatusError &e)
+		{
+			// Some of the embedded requests failed, the others still have their replies
+			if (e.general_status() != 0x1E)
+			{
+				throw;
+			}
+		}
+		TraceSpan span("decode type query batch");
+		if (!decode_multiple_service_reply(rc.deserializer.remaining_buffer(), replies)
+				|| replies.size() != batch.size())
+		{
+			throw std::runtime_error("Could not decode type query batch");
+		}
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			const auto reply = replies[i];
+			if (reply.size() < 4 || reply[2] != 0)
+			{
+				if (auto *metrics = ControllerMetrics::current(); metrics && reply.size() >= 4)
+				{
+					metrics->record_error(reply[2], reply.subspan(4, std::min(reply.size() - 4, reply[3] * size_t{2})));
+				}
+				failed.push_back(batch[i]);
+				continue;
+			}
+			const auto data = reply.subspan(std::min(reply.size(), 4 + reply[3] * size_t{2}));
+			ser::FixedBufferDeserializer<std::endian::little> des(data);
+			if (!decode_variable_attributes(des, set, instances[batch[i]].name, types[batch[i]]))
+			{
+				failed.push_back(batch[i]);
+			}
+		}
+		requests.clear();
+		batch.clear();
+		encoded_size = 0;
+		request_bytes = msp_request_header;
+		reply_bytes = msp_reply_header;
+	};
+
+	std::array<uint8_t, max_request_path_size> path_buffer;
+	std::array<uint8_t, 512> buffer;
+	for (const auto i : selection)
+	{
+		const auto &instance = instances[i];
+		const auto path = variable_request_path(instance.name, instance.variable_instance_id, addressing, path_buffer);
+		ser::FixedBufferSerializer<std::endian::little> ser(buffer);
+		encode_variable_attributes(ser, path, set);
+		const auto request = ser.serialized_buffer();
+		if (request_bytes + 2 + request.size() > type_query_packet_limit
+				|| reply_bytes + 2 + reply_size > type_query_packet_limit)
+		{
+			flush();
+		}
+		request_bytes += 2 + request.size();
+		reply_bytes += 2 + reply_size;
+		const auto copy = std::span(encoded).subspan(encoded_size, request.size());
+		std::copy(request.begin(), request.end(), copy.begin());
+		encoded_size += request.size();
+		requests.push_back(copy);
+		batch.push_back(i);
 	}
+	flush();
 
-	std::vector<VariableInfo> vars;
-	for (size_t i = 0; i < num; ++i)
+	// The replies point into the receive buffer, so these are only sent once all are decoded
+	for (const auto i : failed)
+	{
+		types[i] = get_variable_type(rc, instances[i].name, instances[i].variable_instance_id, addressing);
+	}
+}
+bool same_type(const VariableType &a, const VariableType &b)
+{
+	if (a.data_type != b.data_type || a.size != b.size || a.array_info.has_value() != b.array_info.has_value())
+	{
+		return false;
+	}
+	if (!a.array_info)
+	{
+		return true;
+	}
+	const auto &x = *a.array_info;
+	const auto &y = *b.array_info;
+	return x.element_type == y.element_type && x.element_size == y.element_size
+		&& std::ranges::equal(x.dims(), y.dims()) && std::ranges::equal(x.starts(), y.starts());
+}
+
+// The attribute ids of the Get Attribute List queries are unverified, so the first variable of each data type (element
+// type for arrays) is also queried with Get Attribute All. A different type means the ids are wrong for the controller.
+class AttributeListCheck
+{
+public:
+	// False if the Get Attribute All reply for instance differs from type
+	bool verify(
+		RequestContext &rc, const InstanceData &instance, const VariableType &type, VariableAddressing addressing)
+	{
+		auto &checked = type.array_info ? _arrays[static_cast<uint8_t>(type.array_info->element_type)]
+										: _scalars[static_cast<uint8_t>(type.data_type)];
+		if (checked)
+		{
+			return true;
+		}
+		checked = true;
+		if (same_type(get_variable_type(rc, instance.name, instance.variable_instance_id, addressing), type))
+		{
+			return true;
+		}
+		logger->warn(
+			"Get Attribute List and Get Attribute All disagree on the type of variable '{}', discovering with Get "
+			"Attribute All",
+			instance.name);
+		return false;
+	}
+
+private:
+	std::array<bool, 256> _scalars{};
+	std::array<bool, 256> _arrays{};
+};
+
+// False if check finds a type that Get Attribute All doesn't confirm
+bool get_variable_infos_batched(
+	RequestContext &rc,
+	std::span<const InstanceData> instances,
+	VariableAddressing addressing,
+	std::pmr::memory_resource *resource,
+	AttributeListCheck &check,
+	VariableTable &vars)
+{
+	std::pmr::vector<VariableType> types(resource);
+	std::pmr::vector<size_t> selection(resource);
+	types.reserve(std::min(type_query_chunk_size, instances.size()));
+	selection.reserve(types.capacity());
+	for (size_t start = 0; start < instances.size(); start += type_query_chunk_size)
 	{
-		vars.push_back(get_variable_info(rc, std::move(names[i])));
+		const auto chunk = instances.subspan(start, std::min(type_query_chunk_size, instances.size() - start));
+		types.assign(chunk.size(), VariableType{});
+		selection.clear();
+		for (size_t i = 0; i < chunk.size(); ++i)
+		{
+			selection.push_back(i);
+		}
+		query_attributes_batched(rc, chunk, types, selection, addressing, AttributeSet::Type, resource);
+
+		// Arrays that didn't get their array info from a single query yet
+		selection.clear();
+		for (size_t i = 0; i < chunk.size(); ++i)
+		{
+			if (types[i].data_type == DataType::Array && !types[i].array_info)
+			{
+				selection.push_back(i);
+			}
+		}
+		query_attributes_batched(rc, chunk, types, selection, addressing, AttributeSet::Array, resource);
+
+		for (size_t i = 0; i < chunk.size(); ++i)
+		{
+			if (!check.verify(rc, chunk[i], types[i], addressing))
+			{
+				return false;
+			}
+			vars.add(chunk[i].name, types[i], chunk[i].variable_instance_id);
+		}
+	}
+	return true;
+}
+
+// Instances past the announced number of variables are dropped
+std::span<const InstanceData> announced_instances(std::span<const InstanceData> instances, size_t num)
+{
+	if (instances.size() > num)
+	{
+		logger->warn("Read more variable names ({}) than number of variables ({})", instances.size(), num);
+	}
+	return instances.first(std::min(num, instances.size()));
+}
+
+VariableTable get_variable_infos(
+	RequestContext &rc,
+	std::span<const InstanceData> instances,
+	VariableAddressing addressing,
+	std::pmr::memory_resource *resource,
+	TypeQuery type_query)
+{
+	check_type_query(type_query);
+	size_t name_bytes = 0;
+	for (const auto &instance : instances)
+	{
+		name_bytes += instance.name.size();
+	}
+
+	VariableTable vars(resource);
+	vars.reserve(instances.size(), name_bytes);
+	AttributeListCheck check;
+	if (type_query == TypeQuery::BatchedAttributeList)
+	{
+		if (get_variable_infos_batched(rc, instances, addressing, resource, check, vars))
+		{
+			return vars;
+		}
+		return get_variable_infos(rc, instances, addressing, resource, TypeQuery::AttributeAll);
+	}
+	for (const auto &instance : instances)
+	{
+		const auto type = get_variable_type(rc, instance.name, instance.variable_instance_id, addressing, type_query);
+		if (type_query == TypeQuery::AttributeList && !check.verify(rc, instance, type, addressing))
+		{
+			return get_variable_infos(rc, instances, addressing, resource, TypeQuery::AttributeAll);
+		}
+		vars.add(instance.name, type, instance.variable_instance_id);
 	}
 	return vars;
 }
 }
 
+VariableTable get_variables_fast(
+	RequestContext &rc, VariableAddressing addressing, std::pmr::memory_resource *resource, TypeQuery type_query)
+{
+	const auto num = get_num_variables(rc);
+	const auto instances = get_instances(rc, num, resource);
+	return get_variable_infos(rc, announced_instances(instances, num), addressing, resource, type_query);
+}
+
+std::shared_ptr<const VariableTable> get_variables_shared(
+	RequestContext &rc, VariableAddressing addressing, SymbolStore &store, TypeQuery type_query)
+{
+	const auto num = get_num_variables(rc);
+	const auto all_instances = get_instances(rc, num, std::pmr::get_default_resource());
+	const auto instances = announced_instances(all_instances, num);
+
+	SymbolDigest digest;
+	for (const auto &instance : instances)
+	{
+		digest.add(instance.variable_instance_id, instance.name);
+	}
+	const auto matches = [&](const VariableTable &vars)
+	{
+		if (vars.size() != instances.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < instances.size(); ++i)
+		{
+			const auto var = vars[i];
+			if (var.instance_id != instances[i].variable_instance_id || var.name != instances[i].name)
+			{
+				return false;
+			}
+		}
+		return true;
+	};
+	return store.get_or_discover(digest.value(), matches,
+		[&] { return get_variable_infos(rc, instances, addressing, std::pmr::get_default_resource(), type_query); });
+}
+
 bool include_signal_data_type_in_list(DataType data_type)
 {
 	if (!is_valid_value(data_type))
@@ -183,15 +497,17 @@ bool include_signal_data_type_in_list(DataType data_type)
 	return true;
 }
 
-nlohmann::json list_signals(const plc_tag::Attributes &base_attributes)
+nlohmann::json list_signals(
+	const plc_tag::Attributes &base_attributes, VariableAddressing addressing, std::pmr::memory_resource *resource)
 {
 	RequestContext rc(base_attributes);
 
-	const auto vars = get_variables_fast(rc);
+	const auto vars = get_variables_fast(rc, addressing, resource);
 
 	auto result = nlohmann::json::array();
-	for (const auto &var : vars)
+	for (size_t v = 0; v < vars.size(); ++v)
 	{
+		const auto var = vars[v];
 		// Filter out data types that should not be available.
 		if (!include_signal_data_type_in_list(var.data_type))
 		{
@@ -200,19 +516,22 @@ nlohmann::json list_signals(const plc_tag::Attributes &base_attributes)
 
 		nlohmann::json symbol;
 		symbol["name"] = var.name;
-		symbol["type"] = to_string(var.data_type);
+		symbol["type"] = data_type_name(var.data_type);
+		if (addressing == VariableAddressing::InstanceId)
+		{
+			symbol["instanceId"] = var.instance_id;
+		}
 		if (var.array_info)
 		{
-			const auto &array_info = var.array_info.value();
+			const auto &array_info = *var.array_info;
 			// Filter out data types that should not be available.
 			if (!include_signal_data_type_in_list(array_info.element_type))
 			{
 				continue;
 			}
-			symbol["type"] = to_string(array_info.element_type);
+			symbol["type"] = data_type_name(array_info.element_type);
 			auto dimensions = nlohmann::json::array();
-			assert(array_info.dimensions.size() == array_info.start_indices.size());
-			for (size_t i = 0; i < array_info.dimensions.size(); ++i)
+			for (size_t i = 0; i < array_info.num_dimensions; ++i)
 			{
 				dimensions.push_back(
 					nlohmann::json({array_info.start_indices[i], array_info.start_indices[i] + array_info.dimensions[i]}));
@@ -1,14 +1,45 @@
 #pragma once
 
 #include <array>
+#include <memory>
+#include <memory_resource>
 
 #include <nlohmann/json.hpp>
 
 #include "plc_tag.h"
+#include "symbol_store.h"
+#include "variable_address.h"
+#include "variable_table.h"
 
 namespace daq
 {
 
-nlohmann::json list_signals(const plc_tag::Attributes &base_attributes);
+// Discovers all variables with the Omron get all instances service and one type query per variable (two for arrays
+// with TypeQuery::AttributeList, a packet of them with BatchedAttributeList). The result, the instance list and the
+// bookkeeping of the type queries come from resource, the types are decoded straight into the table, so a one-shot
+// discovery can run out of a monotonic_buffer_resource that is released in one step.
+VariableTable get_variables_fast(
+	RequestContext &rc,
+	VariableAddressing addressing,
+	std::pmr::memory_resource *resource,
+	TypeQuery type_query = TypeQuery::AttributeAll);
+
+// get_variables_fast for fleets of identical controllers: after the get all instances pages, controllers with the same
+// name stream (see SymbolDigest) share one table from store and skip the type queries. Only the first one of a program
+// makes them.
+std::shared_ptr<const VariableTable> get_variables_shared(
+	RequestContext &rc,
+	VariableAddressing addressing,
+	SymbolStore &store = SymbolStore::global(),
+	TypeQuery type_query = TypeQuery::AttributeAll);
+
+// addressing is used for the per-variable type queries. With VariableAddressing::InstanceId each signal also has an
+// "instanceId", the instance id of its variable object, so reads can be addressed with
+// address_request_path(variable_object_class_id, instance_id). Symbolic keeps the signals to name, type and array
+// dimensions.
+nlohmann::json list_signals(
+	const plc_tag::Attributes &base_attributes,
+	VariableAddressing addressing = VariableAddressing::Symbolic,
+	std::pmr::memory_resource *resource = std::pmr::get_default_resource());
 
 }
@@ -0,0 +1,557 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "fins.h"
+#include "omron.h"
+
+namespace daq
+{
+
+namespace
+{
+constexpr uint32_t cells_per_chunk = 512;
+constexpr uint32_t max_chunks = 1024;
+
+// Upper bounds in seconds. Each histogram has a cell per bucket, one for +Inf and one for the sum in nanoseconds.
+constexpr std::array discovery_buckets{0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0, 120.0, 300.0};
+constexpr std::array poll_buckets{0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5};
+
+std::atomic<uint64_t> next_registry_id = 1;
+
+// The live registries by id, so a thread that exits can hand its slabs back to those that still exist. Never
+// destroyed, threads can exit after static destruction started.
+struct Registries
+{
+	std::mutex mutex;
+	std::unordered_map<uint64_t, MetricsRegistry *> by_id;
+};
+
+Registries &registries()
+{
+	static auto *instance = new Registries;
+	return *instance;
+}
+
+thread_local ControllerMetrics *current_metrics = nullptr;
+
+uint16_t extended_status_word(std::span<const uint8_t> ext)
+{
+	uint16_t value = 0;
+	std::memcpy(&value, ext.data(), std::min(ext.size(), sizeof(value)));
+	return value;
+}
+
+void append_label_value(fmt::memory_buffer &out, std::string_view value)
+{
+	for (const auto c : value)
+	{
+		switch (c)
+		{
+			case '\\':
+				out.append(std::string_view("\\\\"));
+				break;
+			case '"':
+				out.append(std::string_view("\\\""));
+				break;
+			case '\n':
+				out.append(std::string_view("\\n"));
+				break;
+			default:
+				out.push_back(c);
+				break;
+		}
+	}
+}
+
+void append_header(fmt::memory_buffer &out, std::string_view name, std::string_view type, std::string_view help)
+{
+	fmt::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+}
+
+// One per thread and registry. Chunks are cache line aligned, so no two threads ever write to the same line.
+struct MetricsRegistry::Slab
+{
+	struct alignas(64) Chunk
+	{
+		std::array<std::atomic<uint64_t>, cells_per_chunk> cells{};
+	};
+
+	std::array<std::atomic<Chunk *>, max_chunks> chunks{};
+
+	~Slab()
+	{
+		for (auto &chunk : chunks)
+		{
+			delete chunk.load();
+		}
+	}
+
+	Chunk &chunk(uint32_t cell)
+	{
+		auto &chunk_ptr = chunks[cell / cells_per_chunk];
+		auto *chunk = chunk_ptr.load(std::memory_order_relaxed);
+		if (!chunk)
+		{
+			chunk = new Chunk;
+			chunk_ptr.store(chunk, std::memory_order_release);
+		}
+		return *chunk;
+	}
+};
+
+// The slabs of one thread, handed back to their registries when it exits
+struct MetricsRegistry::ThreadSlabs
+{
+	std::vector<std::pair<uint64_t, Slab *>> slabs;
+
+	~ThreadSlabs()
+	{
+		auto &live = registries();
+		std::lock_guard lock(live.mutex);
+		for (const auto &[id, slab] : slabs)
+		{
+			// A destroyed registry took its slabs with it
+			if (const auto it = live.by_id.find(id); it != live.by_id.end())
+			{
+				it->second->retire(*slab);
+			}
+		}
+	}
+};
+
+ControllerMetrics::ControllerMetrics(MetricsRegistry &registry, std::string key)
+	: _registry(registry)
+	, _key(std::move(key))
+	, _discovery_histogram(registry.allocate_cells(discovery_buckets.size() + 2))
+	, _poll_histogram(registry.allocate_cells(poll_buckets.size() + 2))
+	, _overruns(registry.allocate_cells(1))
+{
+}
+
+void ControllerMetrics::record_request(uint8_t service, size_t request_bytes, size_t reply_bytes)
+{
+	auto &slot = _services[service];
+	auto cell = slot.load(std::memory_order_acquire);
+	if (cell == 0)
+	{
+		std::lock_guard lock(_cells_mutex);
+		cell = slot.load(std::memory_order_relaxed);
+		if (cell == 0)
+		{
+			cell = _registry.allocate_cells(3);
+			slot.store(cell, std::memory_order_release);
+		}
+	}
+	_registry.add(cell, 1);
+	_registry.add(cell + 1, request_bytes);
+	_registry.add(cell + 2, reply_bytes);
+}
+
+void ControllerMetrics::record_error(uint8_t general_status, std::span<const uint8_t> extended_status)
+{
+	const auto cell = cells(_errors, uint32_t{general_status} << 16 | extended_status_word(extended_status), 1);
+	if (cell != 0)
+	{
+		_registry.add(cell, 1);
+	}
+}
+
+void ControllerMetrics::record_fins_request(uint16_t command, size_t request_bytes)
+{
+	const auto cell = cells(_fins_commands, command, 3);
+	if (cell != 0)
+	{
+		_registry.add(cell, 1);
+		_registry.add(cell + 1, request_bytes);
+	}
+}
+
+void ControllerMetrics::record_fins_reply(uint16_t command, size_t reply_bytes)
+{
+	const auto cell = cells(_fins_commands, command, 3);
+	if (cell != 0)
+	{
+		_registry.add(cell + 2, reply_bytes);
+	}
+}
+
+void ControllerMetrics::record_fins_error(uint16_t end_code)
+{
+	const auto cell = cells(_fins_errors, end_code, 1);
+	if (cell != 0)
+	{
+		_registry.add(cell, 1);
+	}
+}
+
+void ControllerMetrics::record_discovery(std::chrono::nanoseconds duration)
+{
+	observe(_discovery_histogram, discovery_buckets, duration);
+}
+
+void ControllerMetrics::record_poll(std::chrono::nanoseconds duration, bool overrun)
+{
+	observe(_poll_histogram, poll_buckets, duration);
+	if (overrun)
+	{
+		_registry.add(_overruns, 1);
+	}
+}
+
+void ControllerMetrics::observe(uint32_t cell, std::span<const double> buckets, std::chrono::nanoseconds duration)
+{
+	const auto seconds = std::chrono::duration<double>(duration).count();
+	const auto bucket = std::lower_bound(buckets.begin(), buckets.end(), seconds) - buckets.begin();
+	_registry.add(cell + static_cast<uint32_t>(bucket), 1);
+	const auto nanoseconds = static_cast<uint64_t>(std::max<int64_t>(0, duration.count()));
+	_registry.add(cell + static_cast<uint32_t>(buckets.size()) + 1, nanoseconds);
+}
+
+uint32_t ControllerMetrics::cells(std::span<std::atomic<uint64_t>> table, uint32_t key, uint32_t num)
+{
+	// Entries are only added at the end, under _cells_mutex, so a lookup can stop at the first free one
+	for (const auto &slot : table)
+	{
+		const auto entry = slot.load(std::memory_order_acquire);
+		if (entry == 0)
+		{
+			break;
+		}
+		if (entry >> 32 == key)
+		{
+			return static_cast<uint32_t>(entry);
+		}
+	}
+	std::lock_guard lock(_cells_mutex);
+	for (auto &slot : table)
+	{
+		const auto entry = slot.load(std::memory_order_relaxed);
+		if (entry == 0)
+		{
+			const auto cell = _registry.allocate_cells(num);
+			slot.store(uint64_t{key} << 32 | cell, std::memory_order_release);
+			return cell;
+		}
+		if (entry >> 32 == key)
+		{
+			return static_cast<uint32_t>(entry);
+		}
+	}
+	return 0; // more distinct keys than slots
+}
+
+ControllerMetrics::Scope::Scope(ControllerMetrics *metrics) : _previous(current_metrics)
+{
+	current_metrics = metrics;
+}
+
+ControllerMetrics::Scope::~Scope()
+{
+	current_metrics = _previous;
+}
+
+ControllerMetrics *ControllerMetrics::current()
+{
+	return current_metrics;
+}
+
+MetricsRegistry::MetricsRegistry() : _id(next_registry_id.fetch_add(1)), _retired(std::make_unique<Slab>())
+{
+	auto &live = registries();
+	std::lock_guard lock(live.mutex);
+	live.by_id.emplace(_id, this);
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+	auto &live = registries();
+	std::lock_guard lock(live.mutex);
+	live.by_id.erase(_id);
+}
+
+std::shared_ptr<ControllerMetrics> MetricsRegistry::controller(const std::string &key)
+{
+	{
+		std::lock_guard lock(_mutex);
+		const auto it = _controllers.find(key);
+		if (it != _controllers.end())
+		{
+			return it->second;
+		}
+	}
+	// Allocates cells, which takes the lock
+	auto metrics = std::make_shared<ControllerMetrics>(*this, key);
+	std::lock_guard lock(_mutex);
+	return _controllers.try_emplace(key, std::move(metrics)).first->second;
+}
+
+uint32_t MetricsRegistry::allocate_cells(uint32_t num)
+{
+	std::lock_guard lock(_mutex);
+	if (_next_cell + num > cells_per_chunk * max_chunks)
+	{
+		throw std::runtime_error("Too many metric series");
+	}
+	const auto cell = _next_cell;
+	_next_cell += num;
+	return cell;
+}
+
+// Registries are identified by id instead of address, a new registry can get the address of a destroyed one
+MetricsRegistry::Slab &MetricsRegistry::thread_slab()
+{
+	thread_local ThreadSlabs thread_slabs;
+	auto &slabs = thread_slabs.slabs;
+	for (const auto &[id, slab] : slabs)
+	{
+		if (id == _id)
+		{
+			return *slab;
+		}
+	}
+	Slab *ptr;
+	{
+		std::lock_guard lock(_mutex);
+		if (_free_slabs.empty())
+		{
+			ptr = _slabs.emplace_back(std::make_unique<Slab>()).get();
+		}
+		else
+		{
+			ptr = _free_slabs.back();
+			_free_slabs.pop_back();
+		}
+	}
+	slabs.emplace_back(_id, ptr);
+	return *ptr;
+}
+
+void MetricsRegistry::retire(Slab &slab)
+{
+	std::lock_guard lock(_mutex);
+	for (uint32_t c = 0; c < max_chunks; ++c)
+	{
+		auto *chunk = slab.chunks[c].load(std::memory_order_acquire);
+		if (!chunk)
+		{
+			continue;
+		}
+		for (uint32_t i = 0; i < cells_per_chunk; ++i)
+		{
+			const auto value = chunk->cells[i].exchange(0, std::memory_order_relaxed);
+			if (value != 0)
+			{
+				auto &retired = _retired->chunk(c * cells_per_chunk + i).cells[i];
+				retired.store(retired.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+			}
+		}
+	}
+	_free_slabs.push_back(&slab);
+}
+
+void MetricsRegistry::add(uint32_t cell, uint64_t value)
+{
+	// Only this thread writes the cell, a plain load and store is enough
+	auto &counter = thread_slab().chunk(cell).cells[cell % cells_per_chunk];
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+uint64_t MetricsRegistry::sum(uint32_t cell) const
+{
+	const auto value = [&](const Slab &slab) -> uint64_t
+	{
+		const auto *chunk = slab.chunks[cell / cells_per_chunk].load(std::memory_order_acquire);
+		return chunk ? chunk->cells[cell % cells_per_chunk].load(std::memory_order_relaxed) : 0;
+	};
+	uint64_t total = value(*_retired);
+	for (const auto &slab : _slabs)
+	{
+		total += value(*slab);
+	}
+	return total;
+}
+
+size_t MetricsRegistry::num_slabs() const
+{
+	std::lock_guard lock(_mutex);
+	return _slabs.size();
+}
+
+void MetricsRegistry::write_prometheus(fmt::memory_buffer &out) const
+{
+	std::lock_guard lock(_mutex);
+
+	const auto labels = [&](const ControllerMetrics &metrics)
+	{
+		out.append(std::string_view("{controller=\""));
+		append_label_value(out, metrics.key());
+		out.push_back('"');
+	};
+
+	constexpr std::array<std::pair<std::string_view, std::string_view>, 3> request_families{{
+		{"omron_cip_requests_total", "CIP requests sent, per service code"},
+		{"omron_cip_request_bytes_total", "Bytes of CIP requests sent, per service code"},
+		{"omron_cip_reply_bytes_total", "Bytes of CIP replies received, per service code"},
+	}};
+	for (uint32_t f = 0; f < request_families.size(); ++f)
+	{
+		const auto [name, help] = request_families[f];
+		append_header(out, name, "counter", help);
+		for (const auto &[key, metrics] : _controllers)
+		{
+			for (size_t service = 0; service < metrics->_services.size(); ++service)
+			{
+				const auto cell = metrics->_services[service].load(std::memory_order_acquire);
+				if (cell == 0)
+				{
+					continue;
+				}
+				out.append(name);
+				labels(*metrics);
+				fmt::format_to(std::back_inserter(out), ",service=\"{:#04x}\"}} {}\n", service, sum(cell + f));
+			}
+		}
+	}
+
+	append_header(out, "omron_cip_errors_total", "counter", "CIP replies with an error status");
+	for (const auto &[key, metrics] : _controllers)
+	{
+		for (const auto &slot : metrics->_errors)
+		{
+			const auto entry = slot.load(std::memory_order_acquire);
+			if (entry == 0)
+			{
+				break;
+			}
+			const auto cell = static_cast<uint32_t>(entry);
+			const auto general = static_cast<uint8_t>(entry >> 48);
+			const auto extended = static_cast<uint16_t>(entry >> 32);
+			const std::array<uint8_t, 2> ext{static_cast<uint8_t>(extended), static_cast<uint8_t>(extended >> 8)};
+			auto message = std::string(general_status_message(general));
+			const auto ext_message = extended_status_message(ext);
+			if (!ext_message.empty())
+			{
+				message += message.empty() ? "" : ", ";
+				message += ext_message;
+			}
+			out.append(std::string_view("omron_cip_errors_total"));
+			labels(*metrics);
+			fmt::format_to(std::back_inserter(out),
+				",general_status=\"{:#04x}\",extended_status=\"{:#06x}\",message=\"",
+				general,
+				extended);
+			append_label_value(out, message);
+			fmt::format_to(std::back_inserter(out), "\"}} {}\n", sum(cell));
+		}
+	}
+
+	constexpr std::array<std::pair<std::string_view, std::string_view>, 3> fins_families{{
+		{"omron_fins_requests_total", "FINS commands sent, per command code"},
+		{"omron_fins_request_bytes_total", "Bytes of FINS commands sent, per command code"},
+		{"omron_fins_reply_bytes_total", "Bytes of FINS responses received, per command code"},
+	}};
+	for (uint32_t f = 0; f < fins_families.size(); ++f)
+	{
+		const auto [name, help] = fins_families[f];
+		append_header(out, name, "counter", help);
+		for (const auto &[key, metrics] : _controllers)
+		{
+			for (const auto &slot : metrics->_fins_commands)
+			{
+				const auto entry = slot.load(std::memory_order_acquire);
+				if (entry == 0)
+				{
+					break;
+				}
+				out.append(name);
+				labels(*metrics);
+				fmt::format_to(
+					std::back_inserter(out),
+					",command=\"{:#06x}\"}} {}\n",
+					entry >> 32,
+					sum(static_cast<uint32_t>(entry) + f));
+			}
+		}
+	}
+
+	append_header(out, "omron_fins_errors_total", "counter", "FINS responses with an error end code");
+	for (const auto &[key, metrics] : _controllers)
+	{
+		for (const auto &slot : metrics->_fins_errors)
+		{
+			const auto entry = slot.load(std::memory_order_acquire);
+			if (entry == 0)
+			{
+				break;
+			}
+			const auto cell = static_cast<uint32_t>(entry);
+			const auto end_code = static_cast<uint16_t>(entry >> 32);
+			out.append(std::string_view("omron_fins_errors_total"));
+			labels(*metrics);
+			fmt::format_to(std::back_inserter(out), ",end_code=\"{:#06x}\",message=\"", end_code);
+			append_label_value(out, fins_end_code_message(end_code));
+			fmt::format_to(std::back_inserter(out), "\"}} {}\n", sum(cell));
+		}
+	}
+
+	const auto histogram = [&](
+		std::string_view name, std::string_view help, std::span<const double> buckets, auto cell_of)
+	{
+		append_header(out, name, "histogram", help);
+		for (const auto &[key, metrics] : _controllers)
+		{
+			const uint32_t cell = cell_of(*metrics);
+			uint64_t count = 0;
+			for (size_t b = 0; b <= buckets.size(); ++b)
+			{
+				count += sum(cell + static_cast<uint32_t>(b));
+				out.append(name);
+				out.append(std::string_view("_bucket"));
+				labels(*metrics);
+				if (b < buckets.size())
+				{
+					fmt::format_to(std::back_inserter(out), ",le=\"{}\"}} {}\n", buckets[b], count);
+				}
+				else
+				{
+					fmt::format_to(std::back_inserter(out), ",le=\"+Inf\"}} {}\n", count);
+				}
+			}
+			const auto sum_seconds = static_cast<double>(sum(cell + static_cast<uint32_t>(buckets.size()) + 1)) / 1e9;
+			out.append(name);
+			out.append(std::string_view("_sum"));
+			labels(*metrics);
+			fmt::format_to(std::back_inserter(out), "}} {}\n", sum_seconds);
+			out.append(name);
+			out.append(std::string_view("_count"));
+			labels(*metrics);
+			fmt::format_to(std::back_inserter(out), "}} {}\n", count);
+		}
+	};
+	histogram(
+		"omron_discovery_duration_seconds",
+		"Duration of variable discovery",
+		discovery_buckets,
+		[](const ControllerMetrics &m) { return m._discovery_histogram; });
+	histogram(
+		"omron_poll_cycle_duration_seconds",
+		"Duration of poll cycles",
+		poll_buckets,
+		[](const ControllerMetrics &m) { return m._poll_histogram; });
+
+	append_header(out, "omron_poll_overruns_total", "counter", "Poll cycles that took longer than the period");
+	for (const auto &[key, metrics] : _controllers)
+	{
+		out.append(std::string_view("omron_poll_overruns_total"));
+		labels(*metrics);
+		fmt::format_to(std::back_inserter(out), "}} {}\n", sum(metrics->_overruns));
+	}
+}
+
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+namespace daq
+{
+
+class MetricsRegistry;
+
+// The series of one controller. Recording only touches the calling thread's counters (no atomic read-modify-write, no
+// shared cache lines), the registry sums them up when scraped.
+class ControllerMetrics
+{
+public:
+	ControllerMetrics(MetricsRegistry &registry, std::string key);
+
+	void record_request(uint8_t service, size_t request_bytes, size_t reply_bytes);
+	void record_error(uint8_t general_status, std::span<const uint8_t> extended_status);
+	// command is the FINS command code (MRC, SRC), end_code the one masked with fins_end_code_mask. A request is
+	// recorded when it is sent, its reply when one arrives.
+	void record_fins_request(uint16_t command, size_t request_bytes);
+	void record_fins_reply(uint16_t command, size_t reply_bytes);
+	void record_fins_error(uint16_t end_code);
+	void record_discovery(std::chrono::nanoseconds duration);
+	void record_poll(std::chrono::nanoseconds duration, bool overrun);
+
+	const std::string &key() const
+	{
+		return _key;
+	}
+
+	// While alive, RequestContext::request() on this thread records into metrics
+	class Scope
+	{
+	public:
+		explicit Scope(ControllerMetrics *metrics);
+		~Scope();
+
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+
+	private:
+		ControllerMetrics *_previous;
+	};
+
+	// nullptr outside of a Scope
+	static ControllerMetrics *current();
+
+private:
+	friend class MetricsRegistry;
+
+	void observe(uint32_t cell, std::span<const double> buckets, std::chrono::nanoseconds duration);
+	// First of num cells for key in a table of (key << 32) | first cell entries, taken on first use. 0 if the table
+	// is full. Doesn't lock once the key is there.
+	uint32_t cells(std::span<std::atomic<uint64_t>> table, uint32_t key, uint32_t num);
+
+	MetricsRegistry &_registry;
+	std::string _key;
+	// Only taken to hand out the cells of a series on its first use
+	std::mutex _cells_mutex;
+	// First of 3 cells (requests, request bytes, reply bytes) per service, 0 until the service is first used
+	std::array<std::atomic<uint32_t>, 256> _services{};
+	// (command << 32) | first of 3 cells, like _services. FINS only has a handful of commands.
+	std::array<std::atomic<uint64_t>, 16> _fins_commands{};
+	// ((general << 16 | first extended status word) << 32) | cell
+	std::array<std::atomic<uint64_t>, 64> _errors{};
+	// (end code << 32) | cell
+	std::array<std::atomic<uint64_t>, 32> _fins_errors{};
+	uint32_t _discovery_histogram;
+	uint32_t _poll_histogram;
+	uint32_t _overruns;
+};
+
+// Counters and histograms of the CIP client, per controller, rendered in the Prometheus text format:
+//   omron_cip_requests_total, omron_cip_request_bytes_total, omron_cip_reply_bytes_total  {controller, service}
+//   omron_cip_errors_total                       {controller, general_status, extended_status, message}
+//   omron_fins_requests_total, omron_fins_request_bytes_total, omron_fins_reply_bytes_total  {controller, command}
+//   omron_fins_errors_total                      {controller, end_code, message}
+//   omron_discovery_duration_seconds, omron_poll_cycle_duration_seconds (histograms)  {controller}
+//   omron_poll_overruns_total                    {controller}
+class MetricsRegistry
+{
+public:
+	MetricsRegistry();
+	~MetricsRegistry();
+
+	MetricsRegistry(const MetricsRegistry &) = delete;
+	MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+	// Returns the same object for the same key. key is the controller label, e.g. the gateway address.
+	std::shared_ptr<ControllerMetrics> controller(const std::string &key);
+
+	void write_prometheus(fmt::memory_buffer &out) const;
+
+	// Per-thread counter slabs, in use or free. Bounded by the most threads that recorded at the same time, the slab
+	// of an exited thread is reused.
+	size_t num_slabs() const;
+
+private:
+	friend class ControllerMetrics;
+
+	struct Slab;
+	struct ThreadSlabs;
+
+	// Cells are numbered across all threads. 0 is never handed out.
+	uint32_t allocate_cells(uint32_t num);
+	void add(uint32_t cell, uint64_t value);
+	uint64_t sum(uint32_t cell) const;
+	Slab &thread_slab();
+	// Called when the thread of slab exits: adds its counts to _retired, clears it and puts it on the free list
+	void retire(Slab &slab);
+
+	const uint64_t _id;
+	mutable std::mutex _mutex;
+	uint32_t _next_cell = 1;
+	std::vector<std::unique_ptr<Slab>> _slabs;
+	std::vector<Slab *> _free_slabs;
+	// The counts of exited threads
+	std::unique_ptr<Slab> _retired;
+	std::map<std::string, std::shared_ptr<ControllerMetrics>> _controllers;
+};
+
+}
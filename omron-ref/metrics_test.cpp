@@ -0,0 +1,78 @@
+// Records from many short lived threads into a MetricsRegistry. The counts of the threads that exited are still in the
+// scrape, and their slabs are reused instead of piling up.
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "metrics.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+bool run()
+{
+	constexpr size_t rounds = 50;
+	constexpr size_t threads_per_round = 4;
+	constexpr size_t requests_per_thread = 1000;
+
+	Checker check;
+	MetricsRegistry registry;
+	const auto metrics = registry.controller("192.168.250.1");
+	for (size_t round = 0; round < rounds; ++round)
+	{
+		std::vector<std::jthread> threads;
+		for (size_t t = 0; t < threads_per_round; ++t)
+		{
+			threads.emplace_back(
+				[&]
+				{
+					for (size_t i = 0; i < requests_per_thread; ++i)
+					{
+						metrics->record_request(0x4C, 10, 20);
+					}
+				});
+		}
+	}
+	check.expect(
+		registry.num_slabs() <= threads_per_round,
+		fmt::format("{} slabs for {} threads at a time", registry.num_slabs(), threads_per_round));
+
+	// This thread's slab is still in use
+	metrics->record_request(0x4C, 10, 20);
+	const auto requests = rounds * threads_per_round * requests_per_thread + 1;
+	fmt::memory_buffer out;
+	registry.write_prometheus(out);
+	const std::string text(out.data(), out.size());
+	const std::pair<const char *, size_t> expected[] = {
+		{"omron_cip_requests_total", requests},
+		{"omron_cip_request_bytes_total", requests * 10},
+		{"omron_cip_reply_bytes_total", requests * 20},
+	};
+	for (const auto &[name, value] : expected)
+	{
+		const auto line = fmt::format("{}{{controller=\"192.168.250.1\",service=\"0x4c\"}} {}\n", name, value);
+		check.expect(text.find(line) != std::string::npos, fmt::format("missing {}", line));
+	}
+
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS {} requests, {} slabs\n", requests, registry.num_slabs());
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
@@ -0,0 +1,52 @@
+#include "msp.h"
+
+namespace daq
+{
+
+namespace
+{
+template <typename Allocator>
+bool decode_replies(std::span<const uint8_t> data, std::vector<std::span<const uint8_t>, Allocator> &replies)
+{
+	replies.clear();
+	ser::FixedBufferDeserializer<std::endian::little> deser(data);
+	const auto num = ser::read<uint16_t>(deser);
+	if (deser.has_error())
+	{
+		return false;
+	}
+
+	const size_t header_size = sizeof(uint16_t) * (1 + num);
+	size_t prev_offset = header_size;
+	for (uint16_t i = 0; i < num; ++i)
+	{
+		const auto offset = ser::read<uint16_t>(deser);
+		if (deser.has_error() || offset < prev_offset || offset > data.size())
+		{
+			return false;
+		}
+		if (i > 0)
+		{
+			replies.push_back(data.subspan(prev_offset, offset - prev_offset));
+		}
+		prev_offset = offset;
+	}
+	if (num > 0)
+	{
+		replies.push_back(data.subspan(prev_offset));
+	}
+	return true;
+}
+}
+
+bool decode_multiple_service_reply(std::span<const uint8_t> data, std::vector<std::span<const uint8_t>> &replies)
+{
+	return decode_replies(data, replies);
+}
+
+bool decode_multiple_service_reply(std::span<const uint8_t> data, std::pmr::vector<std::span<const uint8_t>> &replies)
+{
+	return decode_replies(data, replies);
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+#include "serialization.h"
+
+namespace daq
+{
+
+// Multiple Service Packet (0x0A) addressed to the message router (class 2, instance 1). requests are the already
+// encoded embedded service requests.
+bool encode_multiple_service_packet(ser::Serializer auto &ser, std::span<const std::span<const uint8_t>> requests)
+{
+	ser.reset();
+	ser::serialize(ser, "\x0A\x02\x20\x02\x24\x01");
+	ser::serialize(ser, static_cast<uint16_t>(requests.size()));
+	auto offset = static_cast<uint16_t>(sizeof(uint16_t) * (1 + requests.size()));
+	for (const auto &request : requests)
+	{
+		ser::serialize(ser, offset);
+		offset += static_cast<uint16_t>(request.size());
+	}
+	for (const auto &request : requests)
+	{
+		ser::serialize(ser, request);
+	}
+	return !ser.has_error();
+}
+
+// Splits the MSP reply data (what follows the CIP response header) into the embedded replies.
+// Returns false if the offsets are inconsistent.
+bool decode_multiple_service_reply(std::span<const uint8_t> data, std::vector<std::span<const uint8_t>> &replies);
+bool decode_multiple_service_reply(std::span<const uint8_t> data, std::pmr::vector<std::span<const uint8_t>> &replies);
+
+}
@@ -0,0 +1,50 @@
+#include "name_interner.h"
+
+#include <cstring>
+
+namespace daq
+{
+
+NameId NameInterner::intern(std::string_view name)
+{
+	if (const auto it = _ids.find(name); it != _ids.end())
+	{
+		return it->second;
+	}
+	const auto id = static_cast<NameId>(_names.size());
+	const auto stored = store(name);
+	_names.push_back(stored);
+	_ids.emplace(stored, id);
+	return id;
+}
+
+std::optional<NameId> NameInterner::find(std::string_view name) const
+{
+	if (const auto it = _ids.find(name); it != _ids.end())
+	{
+		return it->second;
+	}
+	return std::nullopt;
+}
+
+std::string_view NameInterner::store(std::string_view name)
+{
+	if (name.size() > block_size)
+	{
+		// Doesn't happen with CIP names (< 256 chars), but don't break if someone interns something big
+		auto &large = _large.emplace_back(std::make_unique_for_overwrite<char[]>(name.size()));
+		std::memcpy(large.get(), name.data(), name.size());
+		return {large.get(), name.size()};
+	}
+	if (_blocks.empty() || _block_used + name.size() > block_size)
+	{
+		_blocks.push_back(std::make_unique_for_overwrite<char[]>(block_size));
+		_block_used = 0;
+	}
+	char *dst = _blocks.back().get() + _block_used;
+	std::memcpy(dst, name.data(), name.size());
+	_block_used += name.size();
+	return {dst, name.size()};
+}
+
+}
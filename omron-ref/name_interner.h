@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace daq
+{
+
+using NameId = uint32_t;
+
+// Stores each distinct name once in a block arena and hands out dense ids. Views returned by name() stay valid for
+// the lifetime of the interner.
+class NameInterner
+{
+public:
+	NameId intern(std::string_view name);
+	std::optional<NameId> find(std::string_view name) const;
+
+	std::string_view name(NameId id) const
+	{
+		return _names[id];
+	}
+
+	size_t size() const
+	{
+		return _names.size();
+	}
+
+private:
+	std::string_view store(std::string_view name);
+
+	static constexpr size_t block_size = 64 * 1024;
+
+	std::vector<std::unique_ptr<char[]>> _blocks;
+	size_t _block_used = 0;
+	std::vector<std::unique_ptr<char[]>> _large;
+	std::vector<std::string_view> _names;
+	std::unordered_map<std::string_view, NameId> _ids;
+};
+
+}
@@ -1,108 +1,40 @@
 #include "omron.h"
 
+#include <array>
 #include <cassert>
 #include <optional>
+#include <span>
+#include <stdexcept>
+#include <string_view>
 
 #include <spdlog/fmt/fmt.h>
 #include <spdlog/fmt/std.h>
 
+#include "cip_error.h"
+#include "data_type.h"
+#include "hex.h"
 #include "log.h"
-#include "string_util.h"
+#include "metrics.h"
+#include "trace.h"
+#include "variable_address.h"
 
 namespace daq
 {
 
 std::string to_string(DataType type)
 {
-	switch (type)
-	{
-		case DataType::Undefined:
-			return "UNDEFINED";
-		case DataType::Date:
-			return "DATE";
-		case DataType::Time:
-			return "TIME";
-		case DataType::DateAndTime:
-			return "DATE_AND_TIME";
-		case DataType::TimeOfDay:
-			return "TIME_OF_DAY";
-		case DataType::Bool:
-			return "BOOL";
-		case DataType::Sint:
-			return "SINT";
-		case DataType::Int:
-			return "INT";
-		case DataType::Dint:
-			return "DINT";
-		case DataType::Lint:
-			return "LINT";
-		case DataType::Usint:
-			return "USINT";
-		case DataType::Uint:
-			return "UINT";
-		case DataType::Udint:
-			return "UDINT";
-		case DataType::Ulint:
-			return "ULINT";
-		case DataType::Real:
-			return "REAL";
-		case DataType::Lreal:
-			return "LREAL";
-		case DataType::String:
-			return "STRING";
-		case DataType::Byte:
-			return "BYTE";
-		case DataType::Word:
-			return "WORD";
-		case DataType::Dword:
-			return "DWORD";
-		case DataType::Lword:
-			return "LWORD";
-		case DataType::Time2:
-			return "TIME2";
-		case DataType::AbbreviatedStructure:
-			return "ABBREVIATED_STRUCTURE";
-		case DataType::Structure:
-			return "STRUCTURE";
-		case DataType::Array:
-			return "ARRAY";
-		default:
-			return fmt::format("Unknown({:x})", static_cast<uint8_t>(type));
+	const auto name = data_type_name(type);
+	if (name.empty())
+	{
+		return fmt::format("Unknown({:x})", static_cast<uint8_t>(type));
 	}
+	return std::string(name);
 }
 
 bool is_valid_value(DataType data_type)
 {
-	switch (data_type)
-	{
-		case DataType::Date:
-		case DataType::Time:
-		case DataType::DateAndTime:
-		case DataType::TimeOfDay:
-		case DataType::Bool:
-		case DataType::Sint:
-		case DataType::Int:
-		case DataType::Dint:
-		case DataType::Lint:
-		case DataType::Usint:
-		case DataType::Uint:
-		case DataType::Udint:
-		case DataType::Ulint:
-		case DataType::Real:
-		case DataType::Lreal:
-		case DataType::String:
-		case DataType::Byte:
-		case DataType::Word:
-		case DataType::Dword:
-		case DataType::Lword:
-		case DataType::Time2:
-		case DataType::AbbreviatedStructure:
-		case DataType::Structure:
-		case DataType::Array:
-			return true;
-		default:
-			return false;
-	}
+	const auto *traits = data_type_traits(data_type);
+	return traits && traits->valid;
 }
 
 std::string ArrayInfo::to_string() const
@@ -125,8 +57,11 @@ std::string VariableInfo::to_string() const
 		array_info ? array_info->to_string() : "null");
 }
 
+namespace
+{
 // in bytes
-size_t get_array_size(const std::vector<size_t> &dimensions, DataType element_type, size_t element_size)
+template <typename T>
+size_t array_size(std::span<const T> dimensions, DataType element_type, size_t element_size)
 {
 	size_t dim_product = 1;
 	for (const auto dim : dimensions)
@@ -134,7 +69,7 @@ size_t get_array_size(const std::vector<size_t> &dimensions, DataType element_ty
 		dim_product *= dim;
 	}
 
-	if (element_type == DataType::Bool)
+	if (value_kind(element_type) == ValueKind::Bool)
 	{
 		// Boolean arrays are packed into bits of full words
 		const auto remainder = dim_product % 16;
@@ -152,6 +87,12 @@ size_t get_array_size(const std::vector<size_t> &dimensions, DataType element_ty
 
 	return dim_product * element_size;
 }
+}
+
+size_t get_array_size(const std::vector<size_t> &dimensions, DataType element_type, size_t element_size)
+{
+	return array_size(std::span(dimensions), element_type, element_size);
+}
 
 std::vector<uint8_t> variable_request_path(const std::string &name)
 {
@@ -170,65 +111,436 @@ std::vector<uint8_t> variable_request_path(const std::string &name)
 	return buf;
 }
 
+std::vector<uint8_t> address_request_path(uint8_t class_id, uint32_t instance_id)
+{
+	const bool is_32bit = instance_id > 0xFFFF;
+	std::vector<uint8_t> buf(is_32bit ? 8 : 6);
+	ser::FixedBufferSerializer<std::endian::little> s(buf);
+	if (is_32bit)
+	{
+		ser::serialize_multi(s, "\x20", class_id, "\x26\x00", instance_id);
+	}
+	else
+	{
+		ser::serialize_multi(s, "\x20", class_id, "\x25\x00", static_cast<uint16_t>(instance_id));
+	}
+	assert(!s.has_error());
+	return buf;
+}
+
+std::vector<uint8_t> variable_request_path(const std::string &name, uint32_t instance_id, VariableAddressing addressing)
+{
+	if (addressing == VariableAddressing::InstanceId)
+	{
+		return address_request_path(variable_object_class_id, instance_id);
+	}
+	return variable_request_path(name);
+}
+
+std::span<const uint8_t> variable_request_path(
+	std::string_view name,
+	uint32_t instance_id,
+	VariableAddressing addressing,
+	std::span<uint8_t, max_request_path_size> buffer)
+{
+	ser::FixedBufferSerializer<std::endian::little> s(buffer);
+	if (addressing == VariableAddressing::InstanceId && instance_id > 0xFFFF)
+	{
+		ser::serialize_multi(s, "\x20", variable_object_class_id, "\x26\x00", instance_id);
+	}
+	else if (addressing == VariableAddressing::InstanceId)
+	{
+		ser::serialize_multi(s, "\x20", variable_object_class_id, "\x25\x00", static_cast<uint16_t>(instance_id));
+	}
+	else
+	{
+		if (name.size() > 255)
+		{
+			throw std::runtime_error(fmt::format("Variable name '{}' is too long", name));
+		}
+		ser::serialize_multi(s, "\x91", static_cast<uint8_t>(name.size()), name);
+		if (name.size() % 2 != 0)
+		{
+			ser::serialize(s, "\x00");
+		}
+	}
+	assert(!s.has_error());
+	return s.serialized_buffer();
+}
+
 void encode_get_attribute_all(ser::Serializer auto &ser, const std::string &variable_name)
 {
 	encode_get_attribute_all(ser, variable_request_path(variable_name));
 }
 
-VariableInfo get_variable_info(RequestContext &rc, std::string name)
+namespace
 {
-	encode_get_attribute_all(rc.serializer, name);
-	rc.request();
+using Serializer = ser::FixedBufferSerializer<std::endian::little>;
+using Deserializer = ser::FixedBufferDeserializer<std::endian::little>;
+
+// Attributes of the variable object (class 0x6B). These ids are unverified: they are guessed from the order of the
+// Get Attribute All reply, but that reply has 8 unknown bytes between the dimensions and the start indices, and no
+// documentation or capture confirms them. A controller that doesn't have them answers with a non-zero attribute status
+// (or another id), or with a size that doesn't fit the data type, and get_variable_info_list falls back to Get
+// Attribute All.
+constexpr uint16_t attribute_size = 1; // UDINT, element size for arrays
+constexpr uint16_t attribute_data_type = 2; // USINT
+constexpr uint16_t attribute_element_type = 3; // USINT
+constexpr uint16_t attribute_num_dimensions = 4; // USINT
+constexpr uint16_t attribute_dimensions = 5; // UDINT[3]
+constexpr uint16_t attribute_start_indices = 8; // UDINT[3]
+constexpr size_t attribute_array_dimensions = max_array_dimensions;
+
+constexpr std::array type_attributes{attribute_size, attribute_data_type};
+constexpr std::array array_attributes{
+	attribute_element_type, attribute_num_dimensions, attribute_dimensions, attribute_start_indices};
+
+// General statuses about the variable itself rather than the attributes asked for: path segment error and path
+// destination unknown
+bool is_variable_status(uint8_t general_status)
+{
+	return general_status == 0x04 || general_status == 0x05;
+}
 
-	VariableInfo var{.name = name};
-	var.size = ser::read<uint32_t>(rc.deserializer);
-	var.data_type = static_cast<DataType>(ser::read<uint8_t>(rc.deserializer));
-	if (!is_valid_value(var.data_type))
+void check_data_type(std::string_view name, DataType data_type)
+{
+	if (!is_valid_value(data_type))
 	{
-		logger->warn("Variable '{}' has unknown type {:#x}", name, fmt::underlying(var.data_type));
+		logger->warn("Variable '{}' has unknown type {:#x}", name, fmt::underlying(data_type));
 	}
+}
 
-	if (var.data_type == DataType::Array)
+void check_element_type(std::string_view name, DataType element_type)
+{
+	if (!is_valid_value(element_type))
 	{
-		ArrayInfo arr;
-		arr.element_type = static_cast<DataType>(ser::read<uint8_t>(rc.deserializer));
-		if (!is_valid_value(arr.element_type))
+		logger->warn("Variable '{}' is array of unknown type {:#x}", name, fmt::underlying(element_type));
+	}
+}
+
+// The Get Attribute All reply of a variable object
+VariableType decode_variable_type(Deserializer &des, std::string_view name)
+{
+	TraceSpan span("decode variable info");
+	VariableType type;
+	type.size = ser::read<uint32_t>(des);
+	type.data_type = static_cast<DataType>(ser::read<uint8_t>(des));
+	check_data_type(name, type.data_type);
+
+	if (type.data_type == DataType::Array)
+	{
+		CompactArrayInfo arr{};
+		arr.element_type = static_cast<DataType>(ser::read<uint8_t>(des));
+		check_element_type(name, arr.element_type);
+		// For arrays size is actually element size. We need to calculate the real size later (when we know more)
+		arr.element_size = type.size;
+		arr.num_dimensions = ser::read<uint8_t>(des);
+		if (arr.num_dimensions > max_array_dimensions)
 		{
-			logger->warn("Variable '{}' is array of unknown type {:#x}", name, fmt::underlying(arr.element_type));
+			throw std::runtime_error(fmt::format("Variable '{}' has {} array dimensions", name, arr.num_dimensions));
 		}
-		// For arrays size is actually element size. We need to calculate the real size later (when we know more)
-		arr.element_size = var.size;
-		const auto num_dimensions = ser::read<uint8_t>(rc.deserializer);
-		rc.deserializer.advance(1); // 1 byte padding
+		des.advance(1); // 1 byte padding
 
-		for (uint8_t i = 0; i < num_dimensions; ++i)
+		for (uint8_t i = 0; i < arr.num_dimensions; ++i)
 		{
-			arr.dimensions.push_back(ser::read<uint32_t>(rc.deserializer));
+			arr.dimensions[i] = ser::read<uint32_t>(des);
 		}
 
-		rc.deserializer.advance(8); // Not sure what's here
-		/*const auto bit_number =*/ser::read<uint8_t>(rc.deserializer);
-		rc.deserializer.advance(3); // Maybe padding?
-		/*const auto variable_type_instance_id=*/ser::read<uint32_t>(rc.deserializer);
+		des.advance(8); // Not sure what's here
+		/*const auto bit_number =*/ser::read<uint8_t>(des);
+		des.advance(3); // Maybe padding?
+		/*const auto variable_type_instance_id=*/ser::read<uint32_t>(des);
 
-		for (uint8_t i = 0; i < num_dimensions; ++i)
+		for (uint8_t i = 0; i < arr.num_dimensions; ++i)
 		{
-			arr.start_indices.push_back(ser::read<uint32_t>(rc.deserializer));
+			arr.start_indices[i] = ser::read<uint32_t>(des);
 		}
-		var.array_info = arr;
-
-		var.size = get_array_size(arr.dimensions, arr.element_type, arr.element_size);
+		type.size = static_cast<uint32_t>(array_size(arr.dims(), arr.element_type, arr.element_size));
+		type.array_info = arr;
 	}
 
 	// for struct and abbreviated struct response_data[8:12] is instance_id
-	if (rc.deserializer.has_error())
+	if (des.has_error())
 	{
-		throw std::runtime_error("Could not decode get attribute all response for instance=0");
+		throw std::runtime_error(fmt::format("Could not decode get attribute all response for '{}'", name));
 	}
 
+	return type;
+}
+
+VariableInfo to_variable_info(std::string name, const VariableType &type)
+{
+	VariableInfo var{
+		.name = std::move(name),
+		.data_type = type.data_type,
+		.size = type.size,
+		.array_info = std::nullopt,
+	};
+	if (type.array_info)
+	{
+		ArrayInfo arr;
+		arr.element_type = type.array_info->element_type;
+		arr.element_size = type.array_info->element_size;
+		arr.dimensions.assign(type.array_info->dims().begin(), type.array_info->dims().end());
+		arr.start_indices.assign(type.array_info->starts().begin(), type.array_info->starts().end());
+		var.array_info = std::move(arr);
+	}
 	return var;
 }
 
+// Get Attribute List reply: number of attributes, then id, status and (if the status is 0) the value of each. False if
+// the attribute isn't there, then no value follows.
+bool read_attribute_header(Deserializer &des, std::string_view name, uint16_t attribute)
+{
+	const auto id = ser::read<uint16_t>(des);
+	const auto status = ser::read<uint16_t>(des);
+	if (des.has_error())
+	{
+		throw std::runtime_error(fmt::format("Could not decode get attribute list response for '{}'", name));
+	}
+	if (id != attribute || status != 0)
+	{
+		logger->debug("Attribute {} of variable '{}' not available, id {} status {:#x}", attribute, name, id, status);
+		return false;
+	}
+	return true;
+}
+
+// A size that differs from the fixed size of the type means the attribute ids don't match this controller
+bool has_type_size(std::string_view name, DataType type, uint32_t size)
+{
+	const auto *traits = data_type_traits(type);
+	if (traits && traits->size > 0 && traits->size != size)
+	{
+		logger->debug("Attribute size {} of variable '{}' doesn't fit type {:#x}", size, name, fmt::underlying(type));
+		return false;
+	}
+	return true;
+}
+
+bool decode_type_attributes(Deserializer &des, std::string_view name, VariableType &type)
+{
+	if (!read_attribute_header(des, name, attribute_size))
+	{
+		return false;
+	}
+	type.size = ser::read<uint32_t>(des);
+	if (!read_attribute_header(des, name, attribute_data_type))
+	{
+		return false;
+	}
+	type.data_type = static_cast<DataType>(ser::read<uint8_t>(des));
+	check_data_type(name, type.data_type);
+	return has_type_size(name, type.data_type, type.size);
+}
+
+bool decode_array_attributes(Deserializer &des, std::string_view name, VariableType &type)
+{
+	CompactArrayInfo arr{};
+	arr.element_size = type.size;
+	if (!read_attribute_header(des, name, attribute_element_type))
+	{
+		return false;
+	}
+	arr.element_type = static_cast<DataType>(ser::read<uint8_t>(des));
+	check_element_type(name, arr.element_type);
+	if (!has_type_size(name, arr.element_type, arr.element_size))
+	{
+		return false;
+	}
+	if (!read_attribute_header(des, name, attribute_num_dimensions))
+	{
+		return false;
+	}
+	arr.num_dimensions = ser::read<uint8_t>(des);
+	if (arr.num_dimensions > attribute_array_dimensions)
+	{
+		throw std::runtime_error(fmt::format("Variable '{}' has {} array dimensions", name, arr.num_dimensions));
+	}
+	if (!read_attribute_header(des, name, attribute_dimensions))
+	{
+		return false;
+	}
+	for (size_t i = 0; i < attribute_array_dimensions; ++i)
+	{
+		const auto dimension = ser::read<uint32_t>(des);
+		if (i < arr.num_dimensions)
+		{
+			arr.dimensions[i] = dimension;
+		}
+	}
+	if (!read_attribute_header(des, name, attribute_start_indices))
+	{
+		return false;
+	}
+	for (size_t i = 0; i < attribute_array_dimensions; ++i)
+	{
+		const auto start_index = ser::read<uint32_t>(des);
+		if (i < arr.num_dimensions)
+		{
+			arr.start_indices[i] = start_index;
+		}
+	}
+	type.size = static_cast<uint32_t>(array_size(arr.dims(), arr.element_type, arr.element_size));
+	type.array_info = arr;
+	return true;
+}
+}
+
+void encode_variable_attributes(Serializer &ser, std::span<const uint8_t> request_path, AttributeSet set)
+{
+	const auto attributes = set == AttributeSet::Type ? std::span<const uint16_t>(type_attributes) : array_attributes;
+	ser.reset();
+	ser::serialize_multi(ser, "\x03", static_cast<uint8_t>(request_path.size() / 2));
+	ser::serialize(ser, request_path);
+	ser::serialize(ser, static_cast<uint16_t>(attributes.size()));
+	for (const auto attribute : attributes)
+	{
+		ser::serialize(ser, attribute);
+	}
+	if (ser.has_error())
+	{
+		throw std::runtime_error("Could not encode get attribute list request");
+	}
+}
+
+size_t variable_attributes_reply_size(AttributeSet set)
+{
+	// Response header, count, then id and status before each value
+	constexpr size_t header = 4 + 2;
+	constexpr size_t attribute = 4;
+	if (set == AttributeSet::Type)
+	{
+		return header + 2 * attribute + 4 + 1;
+	}
+	return header + 4 * attribute + 1 + 1 + 2 * 4 * attribute_array_dimensions;
+}
+
+bool decode_variable_attributes(Deserializer &des, AttributeSet set, std::string_view name, VariableType &type)
+{
+	const auto expected = set == AttributeSet::Type ? type_attributes.size() : array_attributes.size();
+	if (ser::read<uint16_t>(des) != expected || des.has_error())
+	{
+		throw std::runtime_error(fmt::format("Could not decode get attribute list response for '{}'", name));
+	}
+	const auto available =
+		set == AttributeSet::Type ? decode_type_attributes(des, name, type) : decode_array_attributes(des, name, type);
+	if (des.has_error())
+	{
+		throw std::runtime_error(fmt::format("Could not decode get attribute list response for '{}'", name));
+	}
+	return available;
+}
+
+namespace
+{
+VariableType get_variable_type_all(
+	RequestContext &rc, std::string_view name, uint32_t instance_id, VariableAddressing addressing)
+{
+	std::array<uint8_t, max_request_path_size> path;
+	{
+		TraceSpan span("encode get attribute all");
+		encode_get_attribute_all(rc.serializer, variable_request_path(name, instance_id, addressing, path));
+	}
+	rc.request();
+	return decode_variable_type(rc.deserializer, name);
+}
+
+VariableType get_variable_type_list(
+	RequestContext &rc, std::string_view name, uint32_t instance_id, VariableAddressing addressing)
+{
+	check_type_query(TypeQuery::AttributeList);
+	std::array<uint8_t, max_request_path_size> path_buffer;
+	const auto path = variable_request_path(name, instance_id, addressing, path_buffer);
+	VariableType type;
+	for (const auto set : {AttributeSet::Type, AttributeSet::Array})
+	{
+		{
+			TraceSpan span("encode get attribute list");
+			encode_variable_attributes(rc.serializer, path, set);
+		}
+		try
+		{
+			rc.request();
+		}
+		catch (const CipStatusError &e)
+		{
+			// Get Attribute All would fail the same way
+			if (is_variable_status(e.general_status()))
+			{
+				throw;
+			}
+			// The attribute ids are guessed, so a controller that rejects them still gets the whole object asked for
+			logger->debug("Get attribute list of variable '{}' failed, using get attribute all: {}", name, e.what());
+			return get_variable_type_all(rc, name, instance_id, addressing);
+		}
+		TraceSpan span("decode variable info");
+		if (!decode_variable_attributes(rc.deserializer, set, name, type))
+		{
+			return get_variable_type_all(rc, name, instance_id, addressing);
+		}
+		// Arrays need a second request, that's still less than the whole object for every variable
+		if (type.data_type != DataType::Array)
+		{
+			break;
+		}
+	}
+	return type;
+}
+}
+
+void check_type_query(TypeQuery query)
+{
+	if (query != TypeQuery::AttributeAll && !experimental_type_queries)
+	{
+		throw std::invalid_argument(
+			"The Get Attribute List type queries use unverified attribute ids, they need a build with "
+			"OMRON_REF_EXPERIMENTAL_TYPE_QUERIES");
+	}
+}
+
+VariableType get_variable_type(
+	RequestContext &rc, std::string_view name, uint32_t instance_id, VariableAddressing addressing, TypeQuery query)
+{
+	if (query == TypeQuery::AttributeList || query == TypeQuery::BatchedAttributeList)
+	{
+		return get_variable_type_list(rc, name, instance_id, addressing);
+	}
+	return get_variable_type_all(rc, name, instance_id, addressing);
+}
+
+VariableInfo get_variable_info_list(
+	RequestContext &rc, std::string name, uint32_t instance_id, VariableAddressing addressing)
+{
+	const auto type = get_variable_type_list(rc, name, instance_id, addressing);
+	return to_variable_info(std::move(name), type);
+}
+
+VariableInfo get_variable_info(RequestContext &rc, std::string name)
+{
+	{
+		TraceSpan span("encode get attribute all");
+		encode_get_attribute_all(rc.serializer, name);
+	}
+	rc.request();
+	const auto type = decode_variable_type(rc.deserializer, name);
+	return to_variable_info(std::move(name), type);
+}
+
+VariableInfo get_variable_info(
+	RequestContext &rc, std::string name, uint32_t instance_id, VariableAddressing addressing)
+{
+	const auto type = get_variable_type_all(rc, name, instance_id, addressing);
+	return to_variable_info(std::move(name), type);
+}
+
+VariableInfo get_variable_info(
+	RequestContext &rc, std::string name, uint32_t instance_id, VariableAddressing addressing, TypeQuery query)
+{
+	const auto type = get_variable_type(rc, name, instance_id, addressing, query);
+	return to_variable_info(std::move(name), type);
+}
+
 std::string CipResponse::to_string() const
 {
 	return fmt::format(
@@ -236,7 +548,7 @@ std::string CipResponse::to_string() const
 		reply_service,
 		general_status,
 		extended_status.size(),
-		to_hex(extended_status));
+		hex(extended_status));
 }
 
 // https://rockwellautomation.custhelp.com/ci/okcsFattach/get/114390_5
@@ -394,8 +706,12 @@ std::optional<uint64_t> extended_status_to_int(std::span<const uint8_t> data)
 
 CipResponse RequestContext::request()
 {
+	TraceSpan send_span("send");
 	tag.send(serializer.serialized_buffer());
+	send_span.end();
+	TraceSpan receive_span("receive");
 	const auto size = tag.get_data(recv_buffer);
+	receive_span.end();
 	if (size > recv_buffer.size())
 	{
 		throw std::runtime_error(fmt::format("Receive buffer too small. {} bytes needed", size));
@@ -404,20 +720,33 @@ CipResponse RequestContext::request()
 
 	deserializer = ser::FixedBufferDeserializer<std::endian::little>(response_data);
 	CipResponse cip_response;
-	if (!cip_response.decode(deserializer))
+	TraceSpan decode_span("decode cip response");
+	const auto decoded = cip_response.decode(deserializer);
+	decode_span.end();
+	if (!decoded)
+	{
+		throw std::runtime_error(fmt::format("Could not decode CIP response: {}", hex(response_data)));
+	}
+	auto *metrics = ControllerMetrics::current();
+	if (metrics)
 	{
-		throw std::runtime_error("Could not decode CIP response: " + to_hex(response_data));
+		const auto request_data = serializer.serialized_buffer();
+		metrics->record_request(request_data.empty() ? 0 : request_data[0], request_data.size(), size);
 	}
 	if (cip_response.general_status != 0)
 	{
+		if (metrics)
+		{
+			metrics->record_error(cip_response.general_status, cip_response.extended_status);
+		}
 		const auto gen_message = general_status_message(cip_response.general_status);
 		const auto ext_message = extended_status_message(cip_response.extended_status);
 		const auto ext_status = extended_status_to_int(cip_response.extended_status);
 
 		std::string message = fmt::format("Received error status in CIP response: {:#x}", cip_response.general_status);
-		if (!cip_response.extended_status.empty())
+		if (ext_status)
 		{
-			message.append(fmt::format(", extended: {:#x}", ext_status));
+			message.append(fmt::format(", extended: {:#x}", *ext_status));
 		}
 		if (!gen_message.empty() || !ext_message.empty())
 		{
@@ -432,7 +761,7 @@ CipResponse RequestContext::request()
 				message.append(ext_message);
 			}
 		}
-		throw std::runtime_error(message);
+		throw CipStatusError(message, cip_response.general_status, cip_response.extended_status);
 	}
 	return cip_response;
 }
@@ -0,0 +1,701 @@
+// End-to-end throughput benchmark. Starts simulated controllers in-process (sim_plc.h), discovers them with
+// discover_fleet and polls all their variables through RequestContext on the sharded runtime, like the real
+// acquisition.
+// Prints one JSON object per controller count, so the scaling from 1 to 500 controllers can be tracked between
+// releases:
+//
+//   omron_bench --controllers=1,10,100,500 --variables=2000 --latency-us=500 --output=bench.json
+//
+// Links alloc_tracker.cpp and poll_allocations.cpp. With --check-allocations=1 it exits with an error if the polling
+// steps of omron_poll, RequestContext::request() included, allocate for the first discovered controller, so a
+// regression shows up in CI instead of as jitter on a production machine. poll_allocations_test runs the same check on
+// its own.
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <nlohmann/json.hpp>
+#include <spdlog/fmt/fmt.h>
+
+#include "cip_error.h"
+#include "fleet_discovery.h"
+#include "list_signals.h"
+#include "log.h"
+#include "metrics.h"
+#include "msp.h"
+#include "omron.h"
+#include "poll_allocations.h"
+#include "read_plan.h"
+#include "sharded_runtime.h"
+#include "sim_plc.h"
+#include "symbol_file.h"
+#include "symbol_store.h"
+#include "trace.h"
+#include "variable_address.h"
+
+namespace daq
+{
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+// General status of a Multiple Service Packet with an error in one of the embedded replies
+constexpr uint8_t status_embedded_service_error = 0x1E;
+
+struct BenchOptions
+{
+	std::vector<size_t> controllers{1};
+	size_t variables = 1000;
+	std::chrono::microseconds latency{500};
+	size_t reply_limit = 1994;
+	size_t server_threads = 0; // 0 uses a quarter of the hardware threads
+	size_t shards = 0; // 0 uses one per hardware thread
+	std::chrono::milliseconds period{100};
+	std::chrono::seconds warmup{2};
+	std::chrono::seconds duration{10};
+	size_t discovery_workers = 16;
+	VariableAddressing addressing = VariableAddressing::InstanceId;
+	TypeQuery type_query = TypeQuery::AttributeAll;
+	size_t programs = 0; // 0 gives every controller its own program
+	bool share_symbols = false;
+	std::string path = "1,0";
+	std::string plc = "omron-njnx";
+	std::string output;
+	std::string trace;
+	std::string metrics;
+	std::string symbol_file;
+	bool check_allocations = false;
+};
+
+constexpr std::string_view usage = R"(Usage: omron_bench [options]
+  --controllers=N[,N...]   controller counts to run, one result each (default 1)
+  --variables=N            variables per controller (default 1000)
+  --latency-us=N           added to every reply by the simulated controllers (default 500)
+  --reply-limit=N          largest CIP reply in bytes (default 1994)
+  --server-threads=N       simulator threads (default hardware threads / 4)
+  --shards=N               acquisition shards (default hardware threads)
+  --period-ms=N            poll period per controller (default 100)
+  --warmup-s=N             not measured (default 2)
+  --duration-s=N           measured (default 10)
+  --discovery-workers=N    (default 16)
+  --addressing=instance|symbolic (default instance)
+  --type-query=all|list|batched  discovery with Get Attribute All, Get Attribute List or batched
+                           Get Attribute List (default all, list and batched are experimental and
+                           need a build with OMRON_REF_EXPERIMENTAL_TYPE_QUERIES)
+  --programs=N             distinct programs, controller i runs program i % N (default one per controller)
+  --share-symbols=1        share the tables of controllers with the same program through a SymbolStore
+  --path=PATH --plc=PLC    libplctag attributes (default 1,0 and omron-njnx)
+  --output=FILE            also write the JSON results to FILE
+  --trace=FILE             write a Chrome trace of the end of the measurement (last run)
+  --metrics=FILE           write the Prometheus metrics after the measurement (last run)
+  --symbol-file=FILE       write the first controller's table to FILE, map it and compare (last run)
+  --check-allocations=1    fail if polling like omron_poll allocates once warmed up (request() included)
+)";
+
+size_t parse_number(std::string_view key, std::string_view value)
+{
+	size_t number = 0;
+	const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+	if (ec != std::errc() || ptr != value.data() + value.size())
+	{
+		throw std::runtime_error(fmt::format("Invalid value '{}' for --{}", value, key));
+	}
+	return number;
+}
+
+BenchOptions parse_args(int argc, char **argv)
+{
+	BenchOptions options;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string_view arg = argv[i];
+		const auto eq = arg.find('=');
+		if (!arg.starts_with("--") || eq == std::string_view::npos)
+		{
+			throw std::runtime_error(fmt::format("Invalid argument '{}'\n{}", arg, usage));
+		}
+		const auto key = arg.substr(2, eq - 2);
+		const auto value = arg.substr(eq + 1);
+		if (key == "controllers")
+		{
+			options.controllers.clear();
+			size_t pos = 0;
+			while (pos <= value.size())
+			{
+				const auto end = std::min(value.find(',', pos), value.size());
+				options.controllers.push_back(parse_number(key, value.substr(pos, end - pos)));
+				pos = end + 1;
+			}
+		}
+		else if (key == "variables")
+		{
+			options.variables = parse_number(key, value);
+		}
+		else if (key == "latency-us")
+		{
+			options.latency = std::chrono::microseconds(parse_number(key, value));
+		}
+		else if (key == "reply-limit")
+		{
+			options.reply_limit = parse_number(key, value);
+		}
+		else if (key == "server-threads")
+		{
+			options.server_threads = parse_number(key, value);
+		}
+		else if (key == "shards")
+		{
+			options.shards = parse_number(key, value);
+		}
+		else if (key == "period-ms")
+		{
+			options.period = std::chrono::milliseconds(parse_number(key, value));
+		}
+		else if (key == "warmup-s")
+		{
+			options.warmup = std::chrono::seconds(parse_number(key, value));
+		}
+		else if (key == "duration-s")
+		{
+			options.duration = std::chrono::seconds(parse_number(key, value));
+		}
+		else if (key == "discovery-workers")
+		{
+			options.discovery_workers = parse_number(key, value);
+		}
+		else if (key == "addressing" && (value == "instance" || value == "symbolic"))
+		{
+			options.addressing = value == "instance" ? VariableAddressing::InstanceId : VariableAddressing::Symbolic;
+		}
+		else if (key == "type-query" && (value == "all" || value == "list" || value == "batched"))
+		{
+			options.type_query = value == "all" ? TypeQuery::AttributeAll
+				: value == "list"               ? TypeQuery::AttributeList
+												: TypeQuery::BatchedAttributeList;
+			check_type_query(options.type_query);
+		}
+		else if (key == "programs")
+		{
+			options.programs = parse_number(key, value);
+		}
+		else if (key == "share-symbols")
+		{
+			options.share_symbols = parse_number(key, value) != 0;
+		}
+		else if (key == "path")
+		{
+			options.path = value;
+		}
+		else if (key == "plc")
+		{
+			options.plc = value;
+		}
+		else if (key == "output")
+		{
+			options.output = value;
+		}
+		else if (key == "trace")
+		{
+			options.trace = value;
+		}
+		else if (key == "metrics")
+		{
+			options.metrics = value;
+		}
+		else if (key == "symbol-file")
+		{
+			options.symbol_file = value;
+		}
+		else if (key == "check-allocations")
+		{
+			options.check_allocations = parse_number(key, value) != 0;
+		}
+		else
+		{
+			throw std::runtime_error(fmt::format("Invalid argument '{}'\n{}", arg, usage));
+		}
+	}
+	if (options.server_threads == 0)
+	{
+		options.server_threads = std::max(1u, std::thread::hardware_concurrency() / 4);
+	}
+	if (options.reply_limit < 64)
+	{
+		throw std::runtime_error("--reply-limit must be at least 64");
+	}
+	return options;
+}
+
+void encode_read_batch(RequestContext &rc, const ReadBatch &batch)
+{
+	rc.serializer.reset();
+	ser::serialize(rc.serializer, batch.request);
+}
+
+// Counts the successful reads of an MSP reply and records them in the plan's quarantine. Returns false if it can't be
+// split into the embedded replies.
+bool decode_read_replies(
+	std::span<const uint8_t> data,
+	const ReadBatch &batch,
+	QuarantinedReadPlan &reads,
+	Clock::time_point now,
+	std::vector<std::span<const uint8_t>> &replies,
+	uint64_t &tags,
+	uint64_t &errors)
+{
+	if (!decode_multiple_service_reply(data, replies) || replies.size() != batch.variables.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < replies.size(); ++i)
+	{
+		const auto reply = replies[i];
+		if (reply.size() >= 4 && reply[2] == 0)
+		{
+			++tags;
+		}
+		else
+		{
+			++errors;
+		}
+		reads.record_reply(batch.variables[i], reply, now);
+	}
+	return true;
+}
+
+// Only touched by the poll function of its controller, read after the runtime is gone
+struct ControllerStats
+{
+	std::vector<float> cycle_ms;
+	uint64_t tags = 0;
+	uint64_t requests = 0;
+	uint64_t errors = 0;
+};
+
+struct MeasurementWindow
+{
+	Clock::time_point start;
+	Clock::time_point end;
+};
+
+PollFunction create_poller(
+	const plc_tag::Attributes &attributes,
+	const VariableTable &vars,
+	const BenchOptions &options,
+	MeasurementWindow window,
+	ControllerStats &stats)
+{
+	struct State
+	{
+		std::unique_ptr<RequestContext> rc;
+		std::optional<QuarantinedReadPlan> reads;
+		std::vector<std::span<const uint8_t>> replies;
+	};
+	auto state = std::make_shared<State>();
+	state->rc = std::make_unique<RequestContext>(attributes);
+	state->reads.emplace(vars, options.addressing, options.reply_limit);
+
+	return [state, window, &stats]
+	{
+		auto &rc = *state->rc;
+		uint64_t tags = 0;
+		uint64_t errors = 0;
+		const auto start = Clock::now();
+		auto &reads = *state->reads;
+		reads.update(start);
+		for (const auto &batch : reads.batches())
+		{
+			TraceSpan encode_span("encode read batch");
+			encode_read_batch(rc, batch);
+			encode_span.end();
+			try
+			{
+				rc.request();
+			}
+			catch (const CipStatusError &e)
+			{
+				// Only a packet with errors in some of the embedded replies has replies to decode. A packet that fails
+				// as a whole has its bad variables isolated, so the next cycles plan without them.
+				if (e.general_status() != status_embedded_service_error)
+				{
+					reads.isolate_failure(rc, batch, e.general_status(), e.extended_status(), start);
+					errors += batch.variables.size();
+					continue;
+				}
+			}
+			TraceSpan decode_span("decode values");
+			if (!decode_read_replies(
+					rc.deserializer.remaining_buffer(), batch, reads, start, state->replies, tags, errors))
+			{
+				errors += batch.variables.size();
+			}
+		}
+		const auto end = Clock::now();
+		if (start >= window.start && end <= window.end)
+		{
+			stats.cycle_ms.push_back(std::chrono::duration<float, std::milli>(end - start).count());
+			stats.tags += tags;
+			stats.requests += reads.batches().size();
+			stats.errors += errors;
+		}
+	};
+}
+
+// Fails if the steady state polling of one controller allocates, see check_poll_allocations
+nlohmann::json check_allocations(
+	const plc_tag::Attributes &attributes, const BenchOptions &options, ControllerMetrics *metrics)
+{
+	const auto check = check_poll_allocations(attributes, options.reply_limit, options.addressing, metrics);
+	nlohmann::json result{
+		{"cycles", check.cycles},
+		{"variables", check.variables},
+		{"changes", check.changes},
+		{"errors", check.errors},
+		{"encode_allocations", check.encode.allocations},
+		{"decode_allocations", check.decode.allocations},
+		{"decode_bytes", check.decode.bytes},
+		{"transport_allocations", check.transport.allocations},
+		{"transport_bytes", check.transport.bytes},
+	};
+	if (!check.allocation_free())
+	{
+		throw std::runtime_error(fmt::format("Allocations in the polling hot path: {}", result.dump()));
+	}
+	return result;
+}
+
+template <typename T>
+double percentile(std::vector<T> &values, double p)
+{
+	if (values.empty())
+	{
+		return 0;
+	}
+	const auto index = std::min(values.size() - 1, static_cast<size_t>(p * static_cast<double>(values.size())));
+	std::nth_element(values.begin(), values.begin() + static_cast<ptrdiff_t>(index), values.end());
+	return static_cast<double>(values[index]);
+}
+
+std::chrono::nanoseconds process_cpu_time()
+{
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	const auto to_ns = [](const timeval &tv)
+	{
+		return std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec);
+	};
+	return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+}
+
+uint64_t total_overruns(const ShardedRuntime &runtime)
+{
+	uint64_t overruns = 0;
+	for (const auto &shard : runtime.stats())
+	{
+		overruns += shard.overruns;
+	}
+	return overruns;
+}
+
+// Writes the table as a symbol file and maps it again, the mapping has to give the same variables and lookups
+nlohmann::json check_symbol_file(const VariableTable &vars, const std::string &path)
+{
+	const auto start = Clock::now();
+	write_symbol_file(vars, path);
+	const auto written = Clock::now();
+	const MappedSymbolTable mapped(path);
+	const auto mapped_time = Clock::now();
+
+	if (mapped.size() != vars.size())
+	{
+		throw std::runtime_error(fmt::format("Symbol file has {} variables, {} expected", mapped.size(), vars.size()));
+	}
+	for (size_t i = 0; i < vars.size(); ++i)
+	{
+		if (mapped.to_variable_info(i).to_string() != vars.to_variable_info(i).to_string()
+				|| mapped[i].instance_id != vars[i].instance_id || mapped.find(vars[i].name) != vars.find(vars[i].name))
+		{
+			throw std::runtime_error(fmt::format("Symbol file differs at variable '{}'", vars[i].name));
+		}
+	}
+	if (mapped.find("no such variable"))
+	{
+		throw std::runtime_error("Symbol file finds a variable that doesn't exist");
+	}
+
+	const auto ms = [](auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+	return {
+		{"bytes", std::filesystem::file_size(path)},
+		{"write_ms", ms(written - start)},
+		{"map_ms", ms(mapped_time - written)},
+	};
+}
+
+nlohmann::json run(const BenchOptions &options, size_t num_controllers)
+{
+	std::vector<SimulatedControllerConfig> configs(num_controllers);
+	for (size_t i = 0; i < num_controllers; ++i)
+	{
+		configs[i] = {
+			.num_variables = options.variables,
+			.latency = options.latency,
+			.reply_limit = options.reply_limit,
+			.seed = (options.programs > 0 ? i % options.programs : i) + 1,
+		};
+	}
+	SimulatedPlcServer server(configs, options.server_threads);
+
+	std::vector<DiscoveryJob> jobs(num_controllers);
+	std::unordered_map<std::string, size_t> controller_index;
+	for (size_t i = 0; i < num_controllers; ++i)
+	{
+		jobs[i].attributes.gateway = server.gateway(i);
+		jobs[i].attributes.path = options.path;
+		jobs[i].attributes.plc = options.plc;
+		controller_index.emplace(jobs[i].attributes.gateway, i);
+	}
+
+	// Discovery
+	MetricsRegistry metrics;
+	std::vector<std::shared_ptr<const VariableTable>> tables(num_controllers);
+	SymbolStore store; // per run, so runs don't share
+	DiscoveryOptions discovery_options;
+	discovery_options.num_workers = options.discovery_workers;
+	discovery_options.metrics = &metrics;
+	discovery_options.discover = [&](const plc_tag::Attributes &attributes)
+	{
+		RequestContext rc(attributes);
+		auto &table = tables[controller_index.at(attributes.gateway)];
+		if (options.share_symbols)
+		{
+			table = get_variables_shared(rc, options.addressing, store, options.type_query);
+		}
+		else
+		{
+			table = std::make_shared<const VariableTable>(
+				get_variables_fast(rc, options.addressing, std::pmr::get_default_resource(), options.type_query));
+		}
+		return nlohmann::json{{"variables", table->size()}};
+	};
+	const auto discovery_requests = server.num_requests();
+	const auto discovery_start = Clock::now();
+	auto discovery_results = discover_fleet(jobs, discovery_options);
+	const auto discovery_time = std::chrono::duration<double>(Clock::now() - discovery_start).count();
+	const auto num_discovery_requests = server.num_requests() - discovery_requests;
+
+	std::vector<double> discovery_durations;
+	size_t discovery_errors = 0;
+	size_t num_variables = 0;
+	size_t tables_memory = 0;
+	// Controllers whose discovery failed have no table and aren't polled
+	std::optional<size_t> first_discovered;
+	for (size_t i = 0; i < num_controllers; ++i)
+	{
+		discovery_durations.push_back(static_cast<double>(discovery_results[i].duration.count()));
+		discovery_errors += discovery_results[i].error.empty() ? 0 : 1;
+		if (tables[i])
+		{
+			num_variables += tables[i]->size();
+			first_discovered = first_discovered.value_or(i);
+		}
+	}
+	std::unordered_set<const VariableTable *> distinct_tables;
+	for (const auto &table : tables)
+	{
+		if (table && distinct_tables.insert(table.get()).second)
+		{
+			tables_memory += table->memory_usage();
+		}
+	}
+	if (discovery_errors > 0)
+	{
+		logger->warn(
+			"Discovery failed for {} of {} controllers, they are not polled", discovery_errors, num_controllers);
+	}
+
+	nlohmann::json allocations;
+	if (options.check_allocations && num_controllers > 0)
+	{
+		if (!first_discovered)
+		{
+			throw std::runtime_error("No controller was discovered, can't check the allocations");
+		}
+		const auto &attributes = jobs[*first_discovered].attributes;
+		allocations = check_allocations(attributes, options, metrics.controller(attributes.gateway).get());
+	}
+
+	nlohmann::json symbol_file;
+	if (!options.symbol_file.empty() && first_discovered)
+	{
+		symbol_file = check_symbol_file(*tables[*first_discovered], options.symbol_file);
+	}
+
+	// Steady state polling
+	std::vector<ControllerStats> stats(num_controllers);
+	const auto setup_start = Clock::now();
+	const MeasurementWindow window{
+		.start = setup_start + options.warmup,
+		.end = setup_start + options.warmup + options.duration,
+	};
+	std::chrono::nanoseconds client_cpu{0};
+	std::chrono::nanoseconds server_cpu{0};
+	uint64_t overruns = 0;
+	{
+		ShardedRuntime runtime(options.shards);
+		for (size_t i = 0; i < num_controllers; ++i)
+		{
+			if (!tables[i])
+			{
+				continue;
+			}
+			runtime.add_controller({
+				.key = jobs[i].attributes.gateway,
+				.period = options.period,
+				.create = [&, i](std::pmr::memory_resource *)
+				{ return create_poller(jobs[i].attributes, *tables[i], options, window, stats[i]); },
+				.metrics = metrics.controller(jobs[i].attributes.gateway),
+			});
+		}
+
+		std::this_thread::sleep_until(window.start);
+		if (!options.trace.empty())
+		{
+			start_tracing();
+		}
+		const auto cpu_start = process_cpu_time();
+		const auto server_cpu_start = server.cpu_time();
+		const auto overruns_start = total_overruns(runtime);
+		std::this_thread::sleep_until(window.end);
+		server_cpu = server.cpu_time() - server_cpu_start;
+		client_cpu = process_cpu_time() - cpu_start - server_cpu;
+		overruns = total_overruns(runtime) - overruns_start;
+		if (!options.trace.empty())
+		{
+			stop_tracing();
+			std::ofstream trace(options.trace);
+			write_chrome_trace(trace);
+		}
+	}
+	if (!options.metrics.empty())
+	{
+		fmt::memory_buffer buf;
+		metrics.write_prometheus(buf);
+		std::ofstream(options.metrics).write(buf.data(), static_cast<std::streamsize>(buf.size()));
+	}
+
+	std::vector<float> cycles;
+	uint64_t tags = 0;
+	uint64_t requests = 0;
+	uint64_t errors = 0;
+	for (const auto &s : stats)
+	{
+		cycles.insert(cycles.end(), s.cycle_ms.begin(), s.cycle_ms.end());
+		tags += s.tags;
+		requests += s.requests;
+		errors += s.errors;
+	}
+	const auto seconds = std::chrono::duration<double>(options.duration).count();
+
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+
+	nlohmann::json result;
+	result["controllers"] = num_controllers;
+	result["variables_per_controller"] = options.variables;
+	result["latency_us"] = options.latency.count();
+	result["reply_limit"] = options.reply_limit;
+	result["period_ms"] = options.period.count();
+	result["addressing"] = options.addressing == VariableAddressing::InstanceId ? "instance" : "symbolic";
+	result["type_query"] = options.type_query == TypeQuery::AttributeAll ? "all"
+		: options.type_query == TypeQuery::AttributeList                 ? "list"
+																		 : "batched";
+	result["programs"] = options.programs > 0 ? std::min(options.programs, num_controllers) : num_controllers;
+	result["share_symbols"] = options.share_symbols;
+	result["discovery"] = {
+		{"duration_s", discovery_time},
+		{"controller_p50_ms", percentile(discovery_durations, 0.5)},
+		{"controller_p99_ms", percentile(discovery_durations, 0.99)},
+		{"variables", num_variables},
+		{"requests", num_discovery_requests},
+		{"errors", discovery_errors},
+	};
+	result["polling"] = {
+		{"tags_per_s", static_cast<double>(tags) / seconds},
+		{"requests_per_s", static_cast<double>(requests) / seconds},
+		{"cycles", cycles.size()},
+		{"cycle_p50_ms", percentile(cycles, 0.5)},
+		{"cycle_p99_ms", percentile(cycles, 0.99)},
+		{"overruns", overruns},
+		{"errors", errors},
+		{"client_cpu_s", std::chrono::duration<double>(client_cpu).count()},
+		{"simulator_cpu_s", std::chrono::duration<double>(server_cpu).count()},
+		{"cpu_ns_per_tag", tags > 0 ? static_cast<double>(client_cpu.count()) / static_cast<double>(tags) : 0.0},
+	};
+	if (!allocations.is_null())
+	{
+		result["allocations"] = allocations;
+	}
+	if (!symbol_file.is_null())
+	{
+		result["symbol_file"] = symbol_file;
+	}
+	result["memory"] = {
+		{"max_rss_kib", usage.ru_maxrss},
+		{"variable_tables_bytes", tables_memory},
+		{"distinct_variable_tables", distinct_tables.size()},
+	};
+
+	logger->info(
+		"{} controllers: {:.0f} tags/s, {:.0f} requests/s, cycle p50 {:.2f}ms p99 {:.2f}ms, {:.0f}ns CPU per tag",
+		num_controllers,
+		result["polling"]["tags_per_s"].get<double>(),
+		result["polling"]["requests_per_s"].get<double>(),
+		result["polling"]["cycle_p50_ms"].get<double>(),
+		result["polling"]["cycle_p99_ms"].get<double>(),
+		result["polling"]["cpu_ns_per_tag"].get<double>());
+	return result;
+}
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	try
+	{
+		const auto options = daq::parse_args(argc, argv);
+		auto results = nlohmann::json::array();
+		for (const auto num_controllers : options.controllers)
+		{
+			results.push_back(daq::run(options, num_controllers));
+		}
+		std::cout << results.dump(2) << std::endl;
+		if (!options.output.empty())
+		{
+			std::ofstream(options.output) << results.dump(2) << '\n';
+		}
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
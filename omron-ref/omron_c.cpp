@@ -0,0 +1,316 @@
+#include "omron_c.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cip_error.h"
+#include "list_signals.h"
+#include "omron.h"
+#include "poll_block.h"
+#include "read_plan.h"
+#include "serialization.h"
+#include "variable_table.h"
+
+struct omron_client
+{
+	omron_client(const plc_tag::Attributes &attributes, size_t packet_limit, daq::VariableAddressing addressing)
+		: rc(attributes)
+		, packet_limit(packet_limit)
+		, addressing(addressing)
+	{
+	}
+
+	daq::RequestContext rc;
+	size_t packet_limit;
+	daq::VariableAddressing addressing;
+	std::string error;
+
+	std::optional<daq::VariableTable> variables;
+	std::vector<uint8_t> discovery; // encoded once
+
+	// The subscribed set
+	std::optional<daq::VariableTable> subscribed;
+	std::optional<daq::QuarantinedReadPlan> reads; // plans for subscribed
+	daq::PollBlock changes; // sized for every variable changing, so polling doesn't allocate
+	std::span<const uint8_t> block; // of the last poll, until it's copied out
+	bool block_pending = false;
+};
+
+namespace daq
+{
+
+namespace
+{
+using Serializer = ser::FixedBufferSerializer<std::endian::little>;
+
+// General status of a Multiple Service Packet with an error in one of the embedded replies
+constexpr uint8_t status_embedded_service_error = 0x1E;
+
+// Runs f and turns exceptions into OMRON_ERROR
+template <typename F>
+int guarded(omron_client *client, F &&f)
+{
+	if (!client)
+	{
+		return OMRON_INVALID_ARGUMENT;
+	}
+	try
+	{
+		return f();
+	}
+	catch (const std::exception &e)
+	{
+		client->error = e.what();
+		return OMRON_ERROR;
+	}
+	catch (...)
+	{
+		client->error = "Unknown error";
+		return OMRON_ERROR;
+	}
+}
+
+int copy_out(std::span<const uint8_t> data, uint8_t *buffer, size_t *size)
+{
+	const auto capacity = *size;
+	*size = data.size();
+	if (capacity < data.size() || (!buffer && !data.empty()))
+	{
+		return OMRON_BUFFER_TOO_SMALL;
+	}
+	std::copy(data.begin(), data.end(), buffer);
+	return OMRON_OK;
+}
+
+void discover(omron_client &client)
+{
+	if (client.variables)
+	{
+		return;
+	}
+	auto vars = get_variables_fast(client.rc, client.addressing, std::pmr::get_default_resource());
+
+	size_t size = 4;
+	for (size_t i = 0; i < vars.size(); ++i)
+	{
+		const auto var = vars[i];
+		size += 4 + 4 + 4 + var.name.size() + (var.array_info ? 8 * var.array_info->num_dimensions : 0);
+	}
+	client.discovery.resize(size);
+	Serializer out(client.discovery);
+	ser::serialize(out, static_cast<uint32_t>(vars.size()));
+	for (size_t i = 0; i < vars.size(); ++i)
+	{
+		const auto var = vars[i];
+		const auto *array = var.array_info;
+		ser::serialize_multi(out, var.instance_id, var.size, static_cast<uint8_t>(var.data_type),
+			static_cast<uint8_t>(array ? array->element_type : DataType::Undefined),
+			static_cast<uint8_t>(array ? array->num_dimensions : 0), static_cast<uint8_t>(var.name.size()));
+		if (array)
+		{
+			for (size_t d = 0; d < array->num_dimensions; ++d)
+			{
+				ser::serialize_multi(out, array->dimensions[d], array->start_indices[d]);
+			}
+		}
+		ser::serialize(out, std::span(reinterpret_cast<const uint8_t *>(var.name.data()), var.name.size()));
+	}
+	if (out.has_error())
+	{
+		throw std::runtime_error("Could not encode the discovered variables");
+	}
+	client.variables = std::move(vars);
+}
+
+void subscribe(omron_client &client, std::span<const uint32_t> indices)
+{
+	const auto &vars = *client.variables;
+	VariableTable subscribed;
+	subscribed.reserve(indices.size());
+	for (const auto index : indices)
+	{
+		subscribed.add(vars.to_variable_info(index), vars[index].instance_id);
+	}
+
+	client.changes.reset(subscribed);
+	client.block_pending = false;
+	client.reads.reset();
+	client.subscribed = std::move(subscribed);
+	client.reads.emplace(*client.subscribed, client.addressing, client.packet_limit);
+}
+
+void poll_batches(omron_client &client)
+{
+	auto &changes = client.changes;
+	changes.begin(std::chrono::system_clock::now());
+	// Quarantined variables keep their last error until they are retried
+	const auto now = TagQuarantine::Clock::now();
+	auto &reads = *client.reads;
+	reads.update(now);
+	for (const auto &batch : reads.batches())
+	{
+		auto &rc = client.rc;
+		rc.serializer.reset();
+		ser::serialize(rc.serializer, batch.request);
+		try
+		{
+			rc.request();
+		}
+		catch (const CipStatusError &e)
+		{
+			// The embedded replies of a failed packet still have the values and errors of the single reads. A packet
+			// that fails as a whole has its bad variables isolated, so the next polls plan without them.
+			if (e.general_status() != status_embedded_service_error)
+			{
+				reads.isolate_failure(rc, batch, e.general_status(), e.extended_status(), now);
+				for (const auto index : batch.variables)
+				{
+					changes.update(index, e.general_status(), {});
+				}
+				continue;
+			}
+		}
+		changes.add_read_replies(reads, batch, rc.deserializer.remaining_buffer(), now);
+	}
+
+	client.block = changes.finish();
+	client.block_pending = true;
+}
+
+void poll(omron_client &client)
+{
+	try
+	{
+		poll_batches(client);
+	}
+	catch (const std::exception &)
+	{
+		// Some values may be updated already without being reported, the next poll reports all of them
+		client.changes.invalidate();
+		throw;
+	}
+}
+}
+
+}
+
+extern "C" {
+
+omron_client *omron_client_new(
+	const char *gateway, const char *path, size_t packet_limit, int addressing, char *error, size_t error_size)
+{
+	std::string message;
+	try
+	{
+		if (!gateway || !path)
+		{
+			throw std::invalid_argument("gateway and path are required");
+		}
+		if (packet_limit < 64)
+		{
+			throw std::invalid_argument("packet_limit must be at least 64");
+		}
+		if (addressing != OMRON_ADDRESSING_SYMBOLIC && addressing != OMRON_ADDRESSING_INSTANCE_ID)
+		{
+			throw std::invalid_argument("addressing must be OMRON_ADDRESSING_SYMBOLIC or OMRON_ADDRESSING_INSTANCE_ID");
+		}
+		plc_tag::Attributes attributes;
+		attributes.gateway = gateway;
+		attributes.path = path;
+		attributes.plc = "omron-njnx";
+		const auto variable_addressing = addressing == OMRON_ADDRESSING_INSTANCE_ID
+			? daq::VariableAddressing::InstanceId
+			: daq::VariableAddressing::Symbolic;
+		return new omron_client(attributes, packet_limit, variable_addressing);
+	}
+	catch (const std::exception &e)
+	{
+		message = e.what();
+	}
+	catch (...)
+	{
+		message = "Unknown error";
+	}
+	if (error && error_size > 0)
+	{
+		const auto n = std::min(message.size(), error_size - 1);
+		std::memcpy(error, message.data(), n);
+		error[n] = '\0';
+	}
+	return nullptr;
+}
+
+void omron_client_free(omron_client *client)
+{
+	delete client;
+}
+
+const char *omron_last_error(const omron_client *client)
+{
+	return client ? client->error.c_str() : "";
+}
+
+int omron_discover(omron_client *client, uint8_t *buffer, size_t *size)
+{
+	return daq::guarded(client,
+		[&]() -> int
+		{
+			if (!size)
+			{
+				return OMRON_INVALID_ARGUMENT;
+			}
+			daq::discover(*client);
+			return daq::copy_out(client->discovery, buffer, size);
+		});
+}
+
+int omron_subscribe(omron_client *client, const uint32_t *variables, size_t count)
+{
+	return daq::guarded(client,
+		[&]() -> int
+		{
+			if (!variables && count > 0)
+			{
+				return OMRON_INVALID_ARGUMENT;
+			}
+			daq::discover(*client);
+			const auto indices = std::span(variables, count);
+			if (std::any_of(indices.begin(), indices.end(), [&](uint32_t i) { return i >= client->variables->size(); }))
+			{
+				return OMRON_INVALID_ARGUMENT;
+			}
+			daq::subscribe(*client, indices);
+			return OMRON_OK;
+		});
+}
+
+int omron_poll(omron_client *client, uint8_t *buffer, size_t *size)
+{
+	return daq::guarded(client,
+		[&]() -> int
+		{
+			if (!size || !client->subscribed)
+			{
+				return OMRON_INVALID_ARGUMENT;
+			}
+			if (!client->block_pending)
+			{
+				daq::poll(*client);
+			}
+			const auto result = daq::copy_out(client->block, buffer, size);
+			if (result == OMRON_OK)
+			{
+				client->block_pending = false;
+			}
+			return result;
+		});
+}
+}
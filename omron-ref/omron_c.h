@@ -0,0 +1,74 @@
+#pragma once
+
+// C ABI for embedding the client, made for cgo: every call moves a whole batch through one flat, little endian buffer
+// that the caller owns, so one crossing handles thousands of variables and no pointers into C++ memory escape.
+//
+// A client is used by one thread at a time. Calls return OMRON_OK or a negative omron_status; after OMRON_ERROR the
+// message is available from omron_last_error().
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct omron_client omron_client;
+
+enum omron_status
+{
+	OMRON_OK = 0,
+	OMRON_ERROR = -1,
+	// *size has been set to the size that is needed
+	OMRON_BUFFER_TOO_SMALL = -2,
+	OMRON_INVALID_ARGUMENT = -3,
+};
+
+// How the reads address the variables. Symbolic always works, by instance id the request paths are shorter and the
+// controller skips the symbol lookup (see VariableAddressing in variable_address.h).
+enum omron_addressing
+{
+	OMRON_ADDRESSING_SYMBOLIC = 0,
+	OMRON_ADDRESSING_INSTANCE_ID = 1,
+};
+
+// gateway is "ip[:port]", path the route like "1,0". packet_limit is the largest request and reply the reads are
+// packed into: 1994 with a large forward open, 502 for unconnected messaging. addressing is an omron_addressing and
+// is used by omron_discover and omron_subscribe. Returns NULL if the controller can't be reached, with the message
+// copied to error (if error_size > 0, truncated and null terminated).
+omron_client *omron_client_new(
+	const char *gateway, const char *path, size_t packet_limit, int addressing, char *error, size_t error_size);
+
+void omron_client_free(omron_client *client);
+
+// Message of the last call that returned OMRON_ERROR, valid until the next call on the client
+const char *omron_last_error(const omron_client *client);
+
+// Discovers the variables of the controller, on the first call only, and writes them to buffer. *size is the capacity
+// of buffer on input and the bytes written (or needed) on output. The variables are numbered in the order of the
+// buffer, omron_subscribe takes these numbers.
+//
+//   u32 count
+//   count times:
+//     u32 instance id, u32 size in bytes, u8 data type, u8 element type (arrays), u8 number of dimensions n,
+//     u8 name length l, n times (u32 dimension, u32 start index), l bytes name (not null terminated)
+int omron_discover(omron_client *client, uint8_t *buffer, size_t *size);
+
+// Replaces the polled set with the given variable numbers from omron_discover. The read requests are planned here,
+// once. Structures and variables that don't fit into one reply are accepted but never reported by omron_poll.
+int omron_subscribe(omron_client *client, const uint32_t *variables, size_t count);
+
+// Reads all subscribed variables and writes the ones whose value or status changed since the last poll (all of them on
+// the first poll after omron_subscribe). *size works like in omron_discover. If the buffer is too small, the block is
+// kept and the next call returns it without reading again, so no change is lost.
+//
+//   u32 count, u32 reserved, i64 system time of the poll in nanoseconds since the epoch
+//   count times:
+//     u32 index into the subscribed set, u8 CIP general status (a value follows only when the status is 0),
+//     u8 reserved, u16 value length l, l bytes value as sent by the controller
+// A value longer than the variable's size is reported as status 0x11 (reply data too large) without a value.
+int omron_poll(omron_client *client, uint8_t *buffer, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,150 @@
+// Drives the C ABI (omron_c.h) against a simulated controller (sim_plc.h) with both kinds of addressing: discovery,
+// subscribing all variables, a first poll that reports every value, a poll into a too small buffer that keeps the
+// block and a second poll without changes. The values have to be the same with symbolic and instance id addressing.
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "omron_c.h"
+#include "sim_plc.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+template <typename T>
+T read_at(const std::vector<uint8_t> &buffer, size_t offset)
+{
+	T value;
+	std::memcpy(&value, buffer.data() + offset, sizeof(value));
+	return value;
+}
+
+struct Entry
+{
+	uint8_t status;
+	std::vector<uint8_t> value;
+};
+
+// Decodes a block of omron_poll, by index into the subscribed set
+std::map<uint32_t, Entry> decode_block(const std::vector<uint8_t> &block)
+{
+	std::map<uint32_t, Entry> entries;
+	const auto count = read_at<uint32_t>(block, 0);
+	size_t offset = 4 + 4 + 8;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const auto length = read_at<uint16_t>(block, offset + 6);
+		const auto value = block.begin() + static_cast<ptrdiff_t>(offset + 8);
+		entries[read_at<uint32_t>(block, offset)] = {.status = block[offset + 4], .value = {value, value + length}};
+		offset += 4 + 1 + 1 + 2 + length;
+	}
+	return entries;
+}
+
+// Sizes of the discovered variables, in the order of the discovery buffer
+std::vector<uint32_t> decode_sizes(const std::vector<uint8_t> &discovery)
+{
+	std::vector<uint32_t> sizes(read_at<uint32_t>(discovery, 0));
+	size_t offset = 4;
+	for (auto &size : sizes)
+	{
+		size = read_at<uint32_t>(discovery, offset + 4);
+		const auto num_dimensions = discovery[offset + 10];
+		const auto name_length = discovery[offset + 11];
+		offset += 12 + 8 * num_dimensions + name_length;
+	}
+	return sizes;
+}
+
+std::map<uint32_t, Entry> check_client(Checker &check, const std::string &gateway, int addressing)
+{
+	char error[256];
+	auto *client = omron_client_new(gateway.c_str(), "1,0", 502, addressing, error, sizeof(error));
+	if (!client)
+	{
+		check.expect(false, fmt::format("omron_client_new failed: {}", error));
+		return {};
+	}
+
+	size_t size = 0;
+	check.expect(omron_discover(client, nullptr, &size) == OMRON_BUFFER_TOO_SMALL && size > 4, "discovery size");
+	std::vector<uint8_t> discovery(size);
+	check.expect(omron_discover(client, discovery.data(), &size) == OMRON_OK, "discovery");
+	const auto sizes = decode_sizes(discovery);
+
+	std::vector<uint32_t> all(sizes.size());
+	std::iota(all.begin(), all.end(), 0);
+	const uint32_t unknown = static_cast<uint32_t>(sizes.size());
+	check.expect(omron_subscribe(client, &unknown, 1) == OMRON_INVALID_ARGUMENT, "unknown variable number");
+	check.expect(omron_subscribe(client, all.data(), all.size()) == OMRON_OK, "subscribe");
+
+	std::vector<uint8_t> block(16);
+	size = block.size();
+	check.expect(omron_poll(client, block.data(), &size) == OMRON_BUFFER_TOO_SMALL && size > block.size(),
+		"first poll into a small buffer");
+	block.resize(size);
+	check.expect(omron_poll(client, block.data(), &size) == OMRON_OK && size == block.size(), "kept block");
+	const auto first = decode_block(block);
+	check.expect(first.size() == sizes.size(), fmt::format("{} of {} variables reported", first.size(), sizes.size()));
+	for (const auto &[index, entry] : first)
+	{
+		check.expect(entry.status == 0 && entry.value.size() == sizes[index], fmt::format("variable {}", index));
+	}
+
+	size = block.size();
+	check.expect(omron_poll(client, block.data(), &size) == OMRON_OK && read_at<uint32_t>(block, 0) == 0,
+		"no changes in the second poll");
+
+	omron_client_free(client);
+	return first;
+}
+
+bool run()
+{
+	Checker check;
+	std::vector<SimulatedControllerConfig> configs(1);
+	configs[0].num_variables = 300;
+	SimulatedPlcServer server(configs);
+	const auto gateway = server.gateway(0);
+
+	check.context("omron_client_new");
+	char error[256] = "";
+	check.expect(!omron_client_new(gateway.c_str(), "1,0", 502, 7, error, sizeof(error)) && error[0] != '\0',
+		"invalid addressing is rejected");
+
+	check.context("symbolic");
+	const auto symbolic = check_client(check, gateway, OMRON_ADDRESSING_SYMBOLIC);
+	check.context("instance id");
+	const auto instance_id = check_client(check, gateway, OMRON_ADDRESSING_INSTANCE_ID);
+	bool same = symbolic.size() == instance_id.size();
+	for (const auto &[index, entry] : symbolic)
+	{
+		const auto it = instance_id.find(index);
+		same = same && it != instance_id.end() && it->second.value == entry.value;
+	}
+	check.expect(same, "same values as with symbolic addressing");
+
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS {} variables with both kinds of addressing\n", symbolic.size());
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
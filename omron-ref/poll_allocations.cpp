@@ -0,0 +1,125 @@
+#include "poll_allocations.h"
+
+#include <chrono>
+#include <cstring>
+#include <memory_resource>
+
+#include "cip_error.h"
+#include "list_signals.h"
+#include "omron.h"
+#include "poll_block.h"
+#include "read_plan.h"
+
+namespace daq
+{
+
+namespace
+{
+// General status of a Multiple Service Packet with an error in one of the embedded replies
+constexpr uint8_t status_embedded_service_error = 0x1E;
+
+template <typename T>
+T read_at(std::span<const uint8_t> buffer, size_t offset)
+{
+	T value;
+	std::memcpy(&value, buffer.data() + offset, sizeof(value));
+	return value;
+}
+
+void add(AllocationCount &total, const AllocationScope &scope, bool counted)
+{
+	if (counted)
+	{
+		const auto count = scope.count();
+		total.allocations += count.allocations;
+		total.bytes += count.bytes;
+	}
+}
+}
+
+PollAllocations check_poll_allocations(
+	const plc_tag::Attributes &attributes,
+	size_t packet_limit,
+	VariableAddressing addressing,
+	ControllerMetrics *metrics)
+{
+	constexpr size_t warmup_cycles = 3;
+	constexpr size_t checked_cycles = 100;
+
+	RequestContext rc(attributes);
+	ControllerMetrics::Scope scope(metrics);
+	const auto vars = get_variables_fast(rc, addressing, std::pmr::get_default_resource());
+	QuarantinedReadPlan reads(vars, addressing, packet_limit);
+	PollBlock block;
+	block.reset(vars);
+
+	PollAllocations result{
+		.cycles = checked_cycles,
+		.variables = vars.size(),
+		.changes = 0,
+		.errors = 0,
+		.encode = {},
+		.decode = {},
+		.transport = {},
+	};
+	for (size_t cycle = 0; cycle < warmup_cycles + checked_cycles; ++cycle)
+	{
+		const auto counted = cycle >= warmup_cycles;
+		const auto now = TagQuarantine::Clock::now();
+		{
+			AllocationScope update_scope;
+			reads.update(now);
+			add(result.encode, update_scope, counted);
+		}
+		{
+			AllocationScope begin_scope;
+			block.begin(std::chrono::system_clock::now());
+			add(result.decode, begin_scope, counted);
+		}
+		for (const auto &batch : reads.batches())
+		{
+			AllocationScope encode_scope;
+			rc.serializer.reset();
+			ser::serialize(rc.serializer, batch.request);
+			add(result.encode, encode_scope, counted);
+
+			AllocationScope transport_scope;
+			try
+			{
+				rc.request();
+			}
+			catch (const CipStatusError &e)
+			{
+				// The embedded replies have the statuses of the single reads
+				if (e.general_status() != status_embedded_service_error)
+				{
+					throw;
+				}
+			}
+			add(result.transport, transport_scope, counted);
+
+			AllocationScope decode_scope;
+			block.add_read_replies(reads, batch, rc.deserializer.remaining_buffer(), now);
+			add(result.decode, decode_scope, counted);
+		}
+		AllocationScope finish_scope;
+		const auto changes = block.finish();
+		add(result.decode, finish_scope, counted);
+
+		// u32 count, u32 reserved, i64 time, then u32 index, u8 status, u8 reserved, u16 length and the value
+		const auto count = read_at<uint32_t>(changes, 0);
+		size_t offset = 4 + 4 + 8;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (changes[offset + 4] != 0)
+			{
+				++result.errors;
+			}
+			offset += 4 + 1 + 1 + 2 + read_at<uint16_t>(changes, offset + 6);
+		}
+		result.changes += count;
+	}
+	return result;
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "alloc_tracker.h"
+#include "metrics.h"
+#include "plc_tag.h"
+#include "variable_address.h"
+
+namespace daq
+{
+
+struct PollAllocations
+{
+	size_t cycles = 0;
+	size_t variables = 0;
+	uint64_t changes = 0; // entries of the poll blocks, every variable is in the first one
+	uint64_t errors = 0; // of them with a non-zero status
+	// Copying the encoded read batches into the request serializer and keeping the plan up to date
+	AllocationCount encode;
+	// Splitting the replies into the embedded Read Data replies, recording them with the quarantine and building the
+	// poll block
+	AllocationCount decode;
+	// RequestContext::request(): the SDK's plc_tag::Tag sends and receives, then the CIP response is decoded, traced
+	// and the metrics recorded
+	AllocationCount transport;
+
+	bool allocation_free() const
+	{
+		return encode.allocations == 0 && decode.allocations == 0 && transport.allocations == 0;
+	}
+};
+
+// Polls all variables of a controller the way omron_poll of the C ABI (omron_c.h) does, with a QuarantinedReadPlan and
+// a PollBlock, and counts the heap allocations of each step once warmed up. Discovery, planning and the warmup polls
+// size the buffers, connect and set up the metrics cells, their allocations are not counted, their changes are.
+// Errors throw. Only counts in executables that link alloc_tracker.cpp.
+PollAllocations check_poll_allocations(
+	const plc_tag::Attributes &attributes,
+	size_t packet_limit,
+	VariableAddressing addressing,
+	ControllerMetrics *metrics = nullptr);
+
+}
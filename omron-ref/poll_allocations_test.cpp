@@ -0,0 +1,87 @@
+// Checks that steady state polling doesn't allocate: encoding the read batches, RequestContext::request(), decoding the
+// replies and building the poll block of omron_poll, for all variables of a simulated controller (sim_plc.h), with
+// the packet sizes of connected and unconnected messaging and both kinds of addressing. Exits with 1 on any
+// allocation, so it can run in CI. Links alloc_tracker.cpp and poll_allocations.cpp.
+//
+//   poll_allocations_test [variables]
+
+#include <charconv>
+#include <exception>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "metrics.h"
+#include "poll_allocations.h"
+#include "sim_plc.h"
+
+namespace daq
+{
+
+namespace
+{
+bool run(size_t num_variables)
+{
+	std::vector<SimulatedControllerConfig> configs(1);
+	configs[0].num_variables = num_variables;
+	SimulatedPlcServer server(configs);
+	plc_tag::Attributes attributes;
+	attributes.gateway = server.gateway(0);
+	attributes.path = "1,0";
+	attributes.plc = "omron-njnx";
+
+	MetricsRegistry metrics;
+	bool ok = true;
+	for (const auto addressing : {VariableAddressing::Symbolic, VariableAddressing::InstanceId})
+	{
+		for (const size_t packet_limit : {size_t{502}, size_t{1994}})
+		{
+			auto *controller_metrics = metrics.controller(attributes.gateway).get();
+			const auto check = check_poll_allocations(attributes, packet_limit, addressing, controller_metrics);
+			const auto passed = check.allocation_free() && check.changes >= check.variables && check.errors == 0;
+			std::cout << fmt::format(
+				"{} {} addressing, packet limit {}: {} variables, {} changes, {} errors, {} allocations encoding, {} "
+				"decoding, {} in the transport in {} polls\n",
+				passed ? "PASS" : "FAIL",
+				addressing == VariableAddressing::Symbolic ? "symbolic" : "instance id",
+				packet_limit,
+				check.variables,
+				check.changes,
+				check.errors,
+				check.encode.allocations,
+				check.decode.allocations,
+				check.transport.allocations,
+				check.cycles);
+			ok = ok && passed;
+		}
+	}
+	return ok;
+}
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	size_t num_variables = 2000;
+	if (argc > 1)
+	{
+		const std::string_view arg = argv[1];
+		if (std::from_chars(arg.data(), arg.data() + arg.size(), num_variables).ec != std::errc{})
+		{
+			std::cerr << "usage: poll_allocations_test [variables]\n";
+			return 2;
+		}
+	}
+	try
+	{
+		return daq::run(num_variables) ? 0 : 1;
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+}
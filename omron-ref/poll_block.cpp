@@ -0,0 +1,113 @@
+#include "poll_block.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "msp.h"
+#include "trace.h"
+
+namespace daq
+{
+
+namespace
+{
+constexpr size_t poll_header_size = 4 + 4 + 8;
+constexpr size_t poll_entry_header_size = 4 + 1 + 1 + 2;
+// General status of a Multiple Service Packet with an error in one of the embedded replies
+constexpr uint8_t status_embedded_service_error = 0x1E;
+// Reported instead of a value that is longer than the variable
+constexpr uint8_t status_reply_data_too_large = 0x11;
+}
+
+void PollBlock::reset(const VariableTable &vars)
+{
+	_value_offsets.resize(vars.size() + 1);
+	size_t values_size = 0;
+	for (size_t i = 0; i < vars.size(); ++i)
+	{
+		_value_offsets[i] = static_cast<uint32_t>(values_size);
+		values_size += vars[i].size;
+	}
+	_value_offsets.back() = static_cast<uint32_t>(values_size);
+	_value_sizes.assign(vars.size(), 0);
+	_statuses.assign(vars.size(), not_polled);
+	_values.assign(values_size, 0);
+	_block.resize(poll_header_size + poll_entry_header_size * vars.size() + values_size);
+	_out = ser::FixedBufferSerializer<std::endian::little>(_block);
+	_count = 0;
+}
+
+void PollBlock::begin(std::chrono::system_clock::time_point time)
+{
+	_out.reset();
+	_out.advance(poll_header_size);
+	_time = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+	_count = 0;
+}
+
+void PollBlock::update(uint32_t index, uint8_t status, std::span<const uint8_t> value)
+{
+	const auto offset = _value_offsets[index];
+	if (value.size() > _value_offsets[index + 1] - offset)
+	{
+		status = status_reply_data_too_large;
+		value = {};
+	}
+	const auto slot = std::span(_values).subspan(offset, value.size());
+	if (_statuses[index] == status && _value_sizes[index] == value.size()
+			&& std::equal(value.begin(), value.end(), slot.begin()))
+	{
+		return;
+	}
+	_statuses[index] = status;
+	_value_sizes[index] = static_cast<uint16_t>(value.size());
+	std::copy(value.begin(), value.end(), slot.begin());
+	ser::serialize_multi(_out, index, status, uint8_t{0}, static_cast<uint16_t>(value.size()));
+	ser::serialize(_out, value);
+	++_count;
+}
+
+void PollBlock::add_read_replies(
+	QuarantinedReadPlan &reads,
+	const ReadBatch &batch,
+	std::span<const uint8_t> data,
+	TagQuarantine::Clock::time_point now)
+{
+	TraceSpan span("decode read replies");
+	if (!decode_multiple_service_reply(data, _replies) || _replies.size() != batch.variables.size())
+	{
+		throw std::runtime_error("Could not decode read reply");
+	}
+	for (size_t i = 0; i < batch.variables.size(); ++i)
+	{
+		// Reply service, reserved, general status, extended status size, extended status, type and a reserved byte
+		const auto reply = _replies[i];
+		const auto status = reply.size() >= 4 ? reply[2] : status_embedded_service_error;
+		const auto value_offset = 4 + (reply.size() >= 4 ? reply[3] * size_t{2} : 0) + 2;
+		if (status == 0 && value_offset > reply.size())
+		{
+			throw std::runtime_error("Could not decode read reply");
+		}
+		reads.record_reply(batch.variables[i], reply, now);
+		update(batch.variables[i], status, status == 0 ? reply.subspan(value_offset) : std::span<const uint8_t>());
+	}
+}
+
+std::span<const uint8_t> PollBlock::finish()
+{
+	const auto size = _out.serialized_buffer().size();
+	ser::FixedBufferSerializer<std::endian::little> header(_block);
+	ser::serialize_multi(header, _count, uint32_t{0}, _time);
+	if (_out.has_error() || header.has_error())
+	{
+		throw std::runtime_error("Could not encode the changed values");
+	}
+	return std::span(_block).first(size);
+}
+
+void PollBlock::invalidate()
+{
+	std::fill(_statuses.begin(), _statuses.end(), not_polled);
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "read_plan.h"
+#include "serialization.h"
+#include "variable_table.h"
+
+namespace daq
+{
+
+// The changes of one poll in the block layout of omron_poll (omron_c.h). Keeps the last status and value of every
+// variable to find the changes. All buffers are sized by reset(), so building a block doesn't allocate.
+class PollBlock
+{
+public:
+	// Status of a variable that hasn't been reported yet, so its first update is always a change
+	static constexpr uint16_t not_polled = 0x100;
+
+	// Sizes the block for all variables of vars changing at once and forgets the previous values
+	void reset(const VariableTable &vars);
+
+	// Starts a block, time is the system time of the poll
+	void begin(std::chrono::system_clock::time_point time);
+
+	// Appends an entry for variable index if its status or value changed. A value longer than the variable is reported
+	// as status 0x11 (reply data too large) without a value.
+	void update(uint32_t index, uint8_t status, std::span<const uint8_t> value);
+
+	// Decodes the Multiple Service Packet reply data of batch, records each embedded Read Data reply with reads and
+	// updates its variable. Throws if the reply doesn't match the batch.
+	void add_read_replies(
+		QuarantinedReadPlan &reads,
+		const ReadBatch &batch,
+		std::span<const uint8_t> data,
+		TagQuarantine::Clock::time_point now);
+
+	// Writes the header and returns the block, valid until the next begin(). Throws if the block didn't fit.
+	std::span<const uint8_t> finish();
+
+	// The next block reports every variable, e.g. after a poll that failed half way
+	void invalidate();
+
+private:
+	std::vector<uint32_t> _value_offsets; // one more than variables, so the size of a slot is the difference
+	std::vector<uint16_t> _value_sizes;
+	std::vector<uint16_t> _statuses;
+	std::vector<uint8_t> _values;
+	std::vector<std::span<const uint8_t>> _replies;
+	std::vector<uint8_t> _block;
+	ser::FixedBufferSerializer<std::endian::little> _out{std::span<uint8_t>()};
+	int64_t _time = 0;
+	uint32_t _count = 0;
+};
+
+}
@@ -0,0 +1,252 @@
+#include "prefix_index.h"
+
+#include <algorithm>
+#include <span>
+
+namespace daq
+{
+
+namespace
+{
+// Byte order with '.' before everything else, so a path sorts right before its members, e.g. "A" < "A.x" < "A0"
+uint32_t rank(char c)
+{
+	return c == '.' ? 0 : static_cast<uint8_t>(c) + 1u;
+}
+
+bool name_less(std::string_view a, std::string_view b)
+{
+	const auto n = std::min(a.size(), b.size());
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (a[i] != b[i])
+		{
+			return rank(a[i]) < rank(b[i]);
+		}
+	}
+	return a.size() < b.size();
+}
+
+// name is path or one of its members
+bool is_at_or_below(std::string_view name, std::string_view path)
+{
+	return name.starts_with(path) && (name.size() == path.size() || path.empty() || name[path.size()] == '.');
+}
+}
+
+PrefixIndex::PrefixIndex(const VariableTable &vars)
+{
+	_entries.reserve(vars.size());
+	for (uint32_t i = 0; i < vars.size(); ++i)
+	{
+		// An empty name would be a node with the empty path of the root, and can't be browsed to anyway
+		if (!vars[i].name.empty())
+		{
+			_entries.push_back({_names.name(_names.intern(vars[i].name)), i});
+		}
+	}
+	// Stable, so of equal names the first variable wins like in VariableTable::find
+	std::stable_sort(
+		_entries.begin(), _entries.end(), [](const Entry &a, const Entry &b) { return name_less(a.name, b.name); });
+
+	// Depth first over the sorted names, stack holds the nodes along the path of the current name
+	std::vector<uint32_t> parents{root};
+	_nodes.push_back({
+		.entry = 0,
+		.entries_end = 0,
+		.path_length = 0,
+		.segment_offset = 0,
+		.children_begin = 0,
+		.num_children = 0,
+		.variable = no_variable,
+	});
+	std::vector<uint32_t> stack{root};
+	const auto path = [&](uint32_t node)
+	{
+		return _entries[_nodes[node].entry].name.substr(0, _nodes[node].path_length);
+	};
+	for (uint32_t e = 0; e < _entries.size(); ++e)
+	{
+		const auto name = _entries[e].name;
+		while (stack.size() > 1 && !is_at_or_below(name, path(stack.back())))
+		{
+			_nodes[stack.back()].entries_end = e;
+			stack.pop_back();
+		}
+		auto top = stack.back();
+		if (top == root || _nodes[top].path_length < name.size())
+		{
+			size_t start = top == root ? 0 : _nodes[top].path_length + size_t{1};
+			while (true)
+			{
+				const auto end = std::min(name.find('.', start), name.size());
+				const auto node = static_cast<uint32_t>(_nodes.size());
+				_nodes.push_back({
+					.entry = e,
+					.entries_end = 0,
+					.path_length = static_cast<uint16_t>(end),
+					.segment_offset = static_cast<uint16_t>(start),
+					.children_begin = 0,
+					.num_children = 0,
+					.variable = no_variable,
+				});
+				parents.push_back(top);
+				++_nodes[top].num_children;
+				stack.push_back(node);
+				top = node;
+				if (end == name.size())
+				{
+					break;
+				}
+				start = end + 1;
+			}
+		}
+		if (_nodes[top].variable == no_variable)
+		{
+			_nodes[top].variable = _entries[e].variable;
+		}
+	}
+	for (const auto node : stack)
+	{
+		_nodes[node].entries_end = static_cast<uint32_t>(_entries.size());
+	}
+
+	// The children of a node were created in sorted order, group them by parent
+	uint32_t offset = 0;
+	for (auto &node : _nodes)
+	{
+		node.children_begin = offset;
+		offset += node.num_children;
+	}
+	_children.resize(offset);
+	std::vector<uint32_t> filled(_nodes.size(), 0);
+	for (uint32_t node = 1; node < _nodes.size(); ++node)
+	{
+		const auto parent = parents[node];
+		_children[_nodes[parent].children_begin + filled[parent]++] = node;
+	}
+}
+
+std::string_view PrefixIndex::segment(uint32_t node) const
+{
+	const auto &n = _nodes[node];
+	return _entries[n.entry].name.substr(n.segment_offset, n.path_length - n.segment_offset);
+}
+
+TagNode PrefixIndex::to_tag_node(uint32_t node) const
+{
+	const auto &n = _nodes[node];
+	const auto path = node == root ? std::string_view() : _entries[n.entry].name.substr(0, n.path_length);
+	return {
+		.path = path,
+		.segment = path.substr(n.segment_offset),
+		.num_variables = n.entries_end - n.entry,
+		.num_children = n.num_children,
+		.variable = n.variable == no_variable ? std::nullopt : std::optional(n.variable),
+	};
+}
+
+std::optional<uint32_t> PrefixIndex::find_node(std::string_view path) const
+{
+	auto node = root;
+	if (path.empty())
+	{
+		return node;
+	}
+	size_t start = 0;
+	while (true)
+	{
+		const auto end = std::min(path.find('.', start), path.size());
+		const auto seg = path.substr(start, end - start);
+		const auto &n = _nodes[node];
+		const auto children = std::span(_children).subspan(n.children_begin, n.num_children);
+		const auto it = std::lower_bound(children.begin(), children.end(), seg,
+			[&](uint32_t child, std::string_view s) { return name_less(segment(child), s); });
+		if (it == children.end() || segment(*it) != seg)
+		{
+			return std::nullopt;
+		}
+		node = *it;
+		if (end == path.size())
+		{
+			return node;
+		}
+		start = end + 1;
+	}
+}
+
+std::optional<TagNode> PrefixIndex::node(std::string_view path) const
+{
+	const auto node = find_node(path);
+	return node ? std::optional(to_tag_node(*node)) : std::nullopt;
+}
+
+VariablePage PrefixIndex::find_prefix(std::string_view prefix, std::string_view cursor, size_t limit) const
+{
+	const auto less = [](const Entry &entry, std::string_view name) { return name_less(entry.name, name); };
+	auto it = std::lower_bound(_entries.begin(), _entries.end(), prefix, less);
+	if (!cursor.empty())
+	{
+		it = std::max(it,
+			std::upper_bound(_entries.begin(), _entries.end(), cursor,
+				[](std::string_view name, const Entry &entry) { return name_less(name, entry.name); }));
+	}
+
+	VariablePage page;
+	limit = std::max<size_t>(limit, 1);
+	for (; it != _entries.end() && it->name.starts_with(prefix); ++it)
+	{
+		if (page.variables.size() == limit)
+		{
+			page.next = (it - 1)->name;
+			break;
+		}
+		page.variables.push_back(it->variable);
+	}
+	return page;
+}
+
+NodePage PrefixIndex::children(
+	std::string_view path, std::string_view partial, std::string_view cursor, size_t limit) const
+{
+	NodePage page;
+	const auto node = find_node(path);
+	if (!node)
+	{
+		return page;
+	}
+	const auto &n = _nodes[*node];
+	const auto children = std::span(_children).subspan(n.children_begin, n.num_children);
+	auto it = std::lower_bound(children.begin(), children.end(), partial,
+		[&](uint32_t child, std::string_view s) { return name_less(segment(child), s); });
+	if (!cursor.empty())
+	{
+		it = std::max(it,
+			std::upper_bound(children.begin(), children.end(), cursor,
+				[&](std::string_view s, uint32_t child) { return name_less(s, segment(child)); }));
+	}
+
+	limit = std::max<size_t>(limit, 1);
+	for (; it != children.end() && segment(*it).starts_with(partial); ++it)
+	{
+		if (page.nodes.size() == limit)
+		{
+			page.next = page.nodes.back().segment;
+			break;
+		}
+		page.nodes.push_back(to_tag_node(*it));
+	}
+	return page;
+}
+
+NodePage PrefixIndex::complete(std::string_view text, std::string_view cursor, size_t limit) const
+{
+	const auto dot = text.rfind('.');
+	if (dot == std::string_view::npos)
+	{
+		return children({}, text, cursor, limit);
+	}
+	return children(text.substr(0, dot), text.substr(dot + 1), cursor, limit);
+}
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "name_interner.h"
+#include "variable_table.h"
+
+namespace daq
+{
+
+// A level of the dotted name hierarchy, e.g. "Line2.Station3" in "Line2.Station3.Torque"
+struct TagNode
+{
+	std::string_view path;
+	std::string_view segment; // last segment of path
+	uint32_t num_variables; // at and below the node
+	uint32_t num_children;
+	std::optional<uint32_t> variable; // table index, if path is a variable itself
+};
+
+// Cursors are the last name or segment of the page, so they stay valid when the index is rebuilt. An empty cursor
+// starts at the beginning, and an empty next cursor means there are no more results. A limit of 0 is taken as 1.
+struct VariablePage
+{
+	std::vector<uint32_t> variables; // table indices
+	std::string next;
+};
+
+struct NodePage
+{
+	std::vector<TagNode> nodes;
+	std::string next;
+};
+
+// Index for browsing and autocompleting the variables of a VariableTable. The names are interned and sorted, with '.'
+// ordered before every other character, so the variables under a path are one range of the sorted array, and a trie
+// whose edges are whole dotted segments keeps the children of each level as one sorted range. Queries are binary
+// searches plus the page itself. Variables with an empty name are left out.
+class PrefixIndex
+{
+public:
+	explicit PrefixIndex(const VariableTable &vars);
+
+	size_t size() const
+	{
+		return _entries.size();
+	}
+
+	// Variables whose name starts with prefix, in name order
+	VariablePage find_prefix(std::string_view prefix, std::string_view cursor = {}, size_t limit = 100) const;
+
+	// The level below path ("" is the top level) whose segments start with partial. Returns nothing if path isn't
+	// in the hierarchy.
+	NodePage children(
+		std::string_view path, std::string_view partial = {}, std::string_view cursor = {}, size_t limit = 100) const;
+
+	// Completions of a partially typed path: "Line2.Sta" gives the children of "Line2" starting with "Sta"
+	NodePage complete(std::string_view text, std::string_view cursor = {}, size_t limit = 100) const;
+
+	std::optional<TagNode> node(std::string_view path) const;
+
+private:
+	static constexpr uint32_t no_variable = UINT32_MAX;
+	static constexpr uint32_t root = 0;
+
+	struct Entry
+	{
+		std::string_view name; // from _names
+		uint32_t variable;
+	};
+
+	struct Node
+	{
+		uint32_t entry; // first entry at or below the node, its name starts with the node's path
+		uint32_t entries_end;
+		uint16_t path_length;
+		uint16_t segment_offset;
+		uint32_t children_begin; // into _children
+		uint32_t num_children;
+		uint32_t variable;
+	};
+
+	TagNode to_tag_node(uint32_t node) const;
+	std::optional<uint32_t> find_node(std::string_view path) const;
+	std::string_view segment(uint32_t node) const;
+
+	NameInterner _names;
+	std::vector<Entry> _entries; // sorted
+	std::vector<Node> _nodes; // depth first, _nodes[0] is the root
+	std::vector<uint32_t> _children; // node ids, grouped by parent and sorted by segment
+};
+
+}
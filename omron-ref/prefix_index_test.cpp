@@ -0,0 +1,173 @@
+// Checks PrefixIndex on a small table: the name order with '.' before every other character ("A" < "A.x" < "A0"),
+// find_prefix, children and complete with their cursors across page boundaries, node, and that a variable with an
+// empty name doesn't break the names after it.
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "prefix_index.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+// Table order, the empty name first so it's the first one sorted too
+const std::vector<std::string_view> table_names{
+	"",
+	"Line2.Station2.Torque",
+	"A0",
+	"Line1.Temp",
+	"A.y.z",
+	"Line2.Station10.Torque",
+	"A",
+	"B",
+	"Line2.Alarm",
+	"A.x",
+	"Line2.Station1.Torque",
+	"Line1.Speed",
+};
+
+const std::vector<std::string_view> sorted_names{
+	"A",
+	"A.x",
+	"A.y.z",
+	"A0",
+	"B",
+	"Line1.Speed",
+	"Line1.Temp",
+	"Line2.Alarm",
+	"Line2.Station1.Torque",
+	"Line2.Station10.Torque",
+	"Line2.Station2.Torque",
+};
+
+std::vector<std::string_view> names(const VariablePage &page)
+{
+	std::vector<std::string_view> result;
+	for (const auto variable : page.variables)
+	{
+		result.push_back(table_names[variable]);
+	}
+	return result;
+}
+
+std::vector<std::string_view> segments(const NodePage &page)
+{
+	std::vector<std::string_view> result;
+	for (const auto &node : page.nodes)
+	{
+		result.push_back(node.segment);
+	}
+	return result;
+}
+
+std::vector<std::string_view> slice(const std::vector<std::string_view> &names, size_t begin, size_t end)
+{
+	return {names.begin() + static_cast<ptrdiff_t>(begin), names.begin() + static_cast<ptrdiff_t>(end)};
+}
+
+void check_find_prefix(Checker &check, const PrefixIndex &index)
+{
+	check.expect(index.size() == sorted_names.size(), "the empty name is left out");
+	check.expect(names(index.find_prefix("")) == sorted_names, "all names in order");
+	check.expect(names(index.find_prefix("A")) == slice(sorted_names, 0, 4), "prefix A");
+	check.expect(names(index.find_prefix("A.")) == slice(sorted_names, 1, 3), "prefix A.");
+	check.expect(names(index.find_prefix("Line2.Station1")) == slice(sorted_names, 8, 10),
+		"prefix that isn't a whole segment");
+	check.expect(names(index.find_prefix("C")).empty(), "no match");
+
+	// Pages of 4 over all names: the cursor is the last name of a page, the last page has no next cursor
+	std::vector<std::string_view> all;
+	std::string cursor;
+	std::vector<std::string> cursors;
+	do
+	{
+		const auto page = index.find_prefix("", cursor, 4);
+		const auto page_names = names(page);
+		all.insert(all.end(), page_names.begin(), page_names.end());
+		cursor = page.next;
+		cursors.push_back(cursor);
+	} while (!cursor.empty() && cursors.size() < 10);
+	check.expect(all == sorted_names, "pages of 4 give all names once");
+	check.expect(cursors == std::vector<std::string>{"A0", "Line2.Alarm", ""}, "cursors of the pages");
+
+	const auto page = index.find_prefix("Line2", "Line2.Station1.Torque", 1);
+	check.expect(names(page) == slice(sorted_names, 9, 10) && page.next == "Line2.Station10.Torque",
+		"cursor inside a prefix");
+	check.expect(names(index.find_prefix("A", {}, 0)).size() == 1, "limit 0 is taken as 1");
+}
+
+void check_children(Checker &check, const PrefixIndex &index)
+{
+	const std::vector<std::string_view> top{"A", "A0", "B", "Line1", "Line2"};
+	check.expect(segments(index.children("")) == top, "top level");
+	check.expect(segments(index.children("A")) == std::vector<std::string_view>{"x", "y"}, "children of A");
+	check.expect(segments(index.children("A.y")) == std::vector<std::string_view>{"z"}, "children of A.y");
+	check.expect(index.children("A.x").nodes.empty(), "a leaf has no children");
+	check.expect(index.children("Nope").nodes.empty() && index.children("A.q").nodes.empty(), "unknown path");
+
+	const std::vector<std::string_view> stations{"Station1", "Station10", "Station2"};
+	check.expect(segments(index.children("Line2", "Sta")) == stations, "partial segment");
+	auto page = index.children("Line2", "Sta", {}, 2);
+	check.expect(segments(page) == slice(stations, 0, 2) && page.next == "Station10", "first page of children");
+	page = index.children("Line2", "Sta", page.next, 2);
+	check.expect(segments(page) == slice(stations, 2, 3) && page.next.empty(), "last page of children");
+
+	check.expect(segments(index.complete("Line2.Sta")) == stations, "complete a member");
+	check.expect(
+		segments(index.complete("L")) == std::vector<std::string_view>{"Line1", "Line2"}, "complete a top level");
+	check.expect(segments(index.complete("")) == top, "complete nothing");
+	check.expect(segments(index.complete("A.")) == std::vector<std::string_view>{"x", "y"}, "complete after a dot");
+}
+
+void check_nodes(Checker &check, const PrefixIndex &index)
+{
+	const auto root = index.node("");
+	check.expect(root && root->num_variables == sorted_names.size() && root->num_children == 5 && !root->variable,
+		"root node");
+	const auto a = index.node("A");
+	check.expect(a && a->path == "A" && a->segment == "A" && a->num_variables == 3 && a->num_children == 2
+			&& a->variable && table_names[*a->variable] == "A",
+		"A is a variable with members");
+	const auto y = index.node("A.y");
+	check.expect(y && y->segment == "y" && y->num_variables == 1 && y->num_children == 1 && !y->variable,
+		"A.y is only a level");
+	const auto station = index.node("Line2.Station1");
+	check.expect(station && station->num_variables == 1 && station->path == "Line2.Station1",
+		"Line2.Station1 doesn't include Station10");
+	check.expect(!index.node("Line2.Station") && !index.node("A.x.q"), "unknown nodes");
+}
+
+bool run()
+{
+	VariableTable vars;
+	for (const auto name : table_names)
+	{
+		vars.add(name, VariableType{.data_type = DataType::Int, .size = 2, .array_info = std::nullopt});
+	}
+	const PrefixIndex index(vars);
+
+	Checker check;
+	check_find_prefix(check, index);
+	check_children(check, index);
+	check_nodes(check, index);
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS {} variables\n", index.size());
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
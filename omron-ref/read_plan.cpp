@@ -0,0 +1,305 @@
+#include "read_plan.h"
+
+#include <array>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+
+#include "cip_error.h"
+#include "log.h"
+#include "metrics.h"
+#include "msp.h"
+#include "omron.h"
+
+namespace daq
+{
+
+namespace
+{
+// General status of a Multiple Service Packet with an error in one of the embedded replies
+constexpr uint8_t status_embedded_service_error = 0x1E;
+
+void encode_read_request(ser::FixedBufferSerializer<std::endian::little> &ser, std::span<const uint8_t> path)
+{
+	ser::serialize_multi(ser, "\x4C", static_cast<uint8_t>(path.size() / 2));
+	ser::serialize(ser, path);
+	ser::serialize(ser, uint16_t{1});
+}
+
+// Symbolic paths are compiled once by paths, instance id paths are written into buffer. The result is valid until the
+// next call.
+std::span<const uint8_t> read_request_path(
+	TagPathCache &paths,
+	const VariableView &var,
+	VariableAddressing addressing,
+	std::span<uint8_t, max_request_path_size> buffer)
+{
+	if (addressing == VariableAddressing::InstanceId)
+	{
+		return variable_request_path(var.name, var.instance_id, addressing, buffer);
+	}
+	return paths.request_path(var.name);
+}
+
+std::vector<ReadBatch> plan_reads_of(
+	const VariableTable &vars,
+	std::span<const uint32_t> candidates,
+	VariableAddressing addressing,
+	size_t packet_limit,
+	TagPathCache &paths)
+{
+	constexpr size_t msp_request_header = 6 + 2;
+	constexpr size_t msp_reply_header = 4 + 2;
+	constexpr size_t read_reply_header = 4 + 2;
+
+	std::vector<ReadBatch> batches;
+	std::array<uint8_t, max_request_path_size> path_buffer;
+	std::vector<uint8_t> requests; // the Read Data requests of the batch back to back
+	std::vector<size_t> request_ends;
+	std::vector<std::span<const uint8_t>> spans;
+	std::vector<uint32_t> variables;
+	size_t request_size = msp_request_header;
+	size_t reply_size = msp_reply_header;
+
+	const auto flush = [&]
+	{
+		if (request_ends.empty())
+		{
+			return;
+		}
+		spans.clear();
+		size_t begin = 0;
+		for (const auto end : request_ends)
+		{
+			spans.push_back(std::span<const uint8_t>(requests).subspan(begin, end - begin));
+			begin = end;
+		}
+		ReadBatch batch{.request = std::vector<uint8_t>(request_size), .variables = std::move(variables)};
+		ser::FixedBufferSerializer<std::endian::little> ser(batch.request);
+		if (!encode_multiple_service_packet(ser, spans))
+		{
+			throw std::runtime_error("Could not encode read batch");
+		}
+		batch.request.resize(ser.serialized_buffer().size());
+		batches.push_back(std::move(batch));
+		requests.clear();
+		request_ends.clear();
+		variables.clear();
+		request_size = msp_request_header;
+		reply_size = msp_reply_header;
+	};
+
+	for (const auto i : candidates)
+	{
+		const auto var = vars[i];
+		if (!is_valid_value(var.data_type) || var.data_type == DataType::Structure
+				|| var.data_type == DataType::AbbreviatedStructure)
+		{
+			continue;
+		}
+		std::span<const uint8_t> path;
+		try
+		{
+			path = read_request_path(paths, var, addressing, path_buffer);
+		}
+		catch (const std::runtime_error &e)
+		{
+			logger->warn("Variable '{}' has no request path, not polled: {}", var.name, e.what());
+			continue;
+		}
+		const auto read_request_size = 2 + path.size() + 2;
+
+		const auto tag_reply_size = read_reply_header + var.size;
+		if (msp_reply_header + 2 + tag_reply_size > packet_limit)
+		{
+			logger->warn("Variable '{}' ({} bytes) doesn't fit into one reply, not polled", var.name, var.size);
+			continue;
+		}
+		if (request_size + 2 + read_request_size > packet_limit || reply_size + 2 + tag_reply_size > packet_limit)
+		{
+			flush();
+		}
+		request_size += 2 + read_request_size;
+		reply_size += 2 + tag_reply_size;
+		const auto offset = requests.size();
+		requests.resize(offset + read_request_size);
+		ser::FixedBufferSerializer<std::endian::little> ser(std::span<uint8_t>(requests).subspan(offset));
+		encode_read_request(ser, path);
+		request_ends.push_back(requests.size());
+		variables.push_back(i);
+	}
+	flush();
+	return batches;
+}
+
+std::vector<uint32_t> all_variables(const VariableTable &vars)
+{
+	std::vector<uint32_t> all(vars.size());
+	std::iota(all.begin(), all.end(), 0);
+	return all;
+}
+}
+
+std::vector<ReadBatch> plan_reads(const VariableTable &vars, VariableAddressing addressing, size_t packet_limit)
+{
+	NameInterner names;
+	TagPathCache paths(names);
+	return plan_reads_of(vars, all_variables(vars), addressing, packet_limit, paths);
+}
+
+std::vector<ReadBatch> plan_reads(
+	const VariableTable &vars,
+	VariableAddressing addressing,
+	size_t packet_limit,
+	const TagQuarantine &quarantine,
+	TagQuarantine::Clock::time_point now)
+{
+	std::vector<uint32_t> due;
+	quarantine.filter_due(all_variables(vars), now, due);
+	NameInterner names;
+	TagPathCache paths(names);
+	return plan_reads_of(vars, due, addressing, packet_limit, paths);
+}
+
+std::optional<ReadReply> decode_read_reply(std::span<const uint8_t> reply)
+{
+	// Reply service, reserved, general status, extended status size, extended status, then the data type and a
+	// reserved byte before the value
+	if (reply.size() < 4 || reply.size() < 4 + reply[3] * size_t{2})
+	{
+		return std::nullopt;
+	}
+	ReadReply result{
+		.general_status = reply[2],
+		.extended_status = reply.subspan(4, reply[3] * size_t{2}),
+		.data_type = 0,
+		.value = {},
+	};
+	const auto value_offset = 4 + result.extended_status.size() + 2;
+	if (result.general_status == 0)
+	{
+		if (value_offset > reply.size())
+		{
+			return std::nullopt;
+		}
+		result.data_type = reply[value_offset - 2];
+		result.value = reply.subspan(value_offset);
+	}
+	return result;
+}
+
+QuarantinedReadPlan::QuarantinedReadPlan(
+	const VariableTable &vars, VariableAddressing addressing, size_t packet_limit, QuarantinePolicy policy)
+	: _vars(vars), _addressing(addressing), _packet_limit(packet_limit),
+	  _quarantine(policy, [&vars](NameId tag) { return vars[tag].name; }), _paths(_names),
+	  _all(all_variables(vars)), _planned(_all), _batches(plan_reads_of(vars, _all, addressing, packet_limit, _paths))
+{
+	_due.reserve(_all.size());
+}
+
+bool QuarantinedReadPlan::update(TagQuarantine::Clock::time_point now)
+{
+	if (_quarantine.num_quarantined() == 0 && _planned.size() == _all.size())
+	{
+		return false;
+	}
+	_due.clear();
+	_quarantine.filter_due(_all, now, _due);
+	if (_due == _planned)
+	{
+		return false;
+	}
+	_planned.swap(_due);
+	_batches = plan_reads_of(_vars, _planned, _addressing, _packet_limit, _paths);
+	logger->debug(
+		"Planned {} read batches, {} variables in quarantine", _batches.size(), _all.size() - _planned.size());
+	return true;
+}
+
+void QuarantinedReadPlan::record_reply(
+	uint32_t variable, std::span<const uint8_t> reply, TagQuarantine::Clock::time_point now)
+{
+	const auto decoded = decode_read_reply(reply);
+	if (!decoded)
+	{
+		return;
+	}
+	if (decoded->general_status == 0)
+	{
+		_quarantine.record_success(variable);
+		return;
+	}
+	// The packet only counts as 0x1E, the statuses of the single reads are here
+	if (auto *metrics = ControllerMetrics::current())
+	{
+		metrics->record_error(decoded->general_status, decoded->extended_status);
+	}
+	_quarantine.record_failure(variable, decoded->general_status, decoded->extended_status, now);
+}
+
+BatchIsolationResult QuarantinedReadPlan::isolate_failure(
+	RequestContext &rc,
+	const ReadBatch &batch,
+	uint8_t general_status,
+	std::span<const uint8_t> extended_status,
+	TagQuarantine::Clock::time_point now)
+{
+	std::vector<std::vector<uint8_t>> requests;
+	std::vector<std::span<const uint8_t>> spans;
+	std::vector<std::span<const uint8_t>> replies;
+	std::array<uint8_t, max_request_path_size> path_buffer;
+	const BatchRequest request = [&](std::span<const NameId> variables)
+	{
+		requests.clear();
+		for (const auto variable : variables)
+		{
+			const auto path = read_request_path(_paths, _vars[variable], _addressing, path_buffer);
+			auto &request = requests.emplace_back(2 + path.size() + 2);
+			ser::FixedBufferSerializer<std::endian::little> ser(request);
+			encode_read_request(ser, path);
+		}
+		// A single variable is read on its own, so the status is its own and not that of a packet
+		if (requests.size() == 1)
+		{
+			rc.serializer.reset();
+			ser::serialize(rc.serializer, requests.front());
+		}
+		else
+		{
+			spans.assign(requests.begin(), requests.end());
+			if (!encode_multiple_service_packet(rc.serializer, spans))
+			{
+				throw std::runtime_error("Could not encode read batch");
+			}
+		}
+		try
+		{
+			rc.request();
+		}
+		catch (const CipStatusError &e)
+		{
+			if (requests.size() == 1 || e.general_status() != status_embedded_service_error)
+			{
+				throw;
+			}
+		}
+		if (requests.size() == 1)
+		{
+			return;
+		}
+		// The packet went through, so this part doesn't fail as a whole. The embedded replies have the statuses of the
+		// single reads, failing variables are counted and quarantined like in a regular poll.
+		if (!decode_multiple_service_reply(rc.deserializer.remaining_buffer(), replies)
+				|| replies.size() != variables.size())
+		{
+			throw std::runtime_error("Could not split the reply of a read batch");
+		}
+		for (size_t i = 0; i < replies.size(); ++i)
+		{
+			record_reply(variables[i], replies[i], now);
+		}
+	};
+	return isolate_batch_failure(batch.variables, general_status, extended_status, request, _quarantine, now);
+}
+
+}
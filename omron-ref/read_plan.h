@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "batch_isolation.h"
+#include "serialization.h"
+#include "tag_path.h"
+#include "tag_quarantine.h"
+#include "variable_address.h"
+#include "variable_table.h"
+
+namespace daq
+{
+
+// One Multiple Service Packet with Read Data requests, encoded once and sent every cycle
+struct ReadBatch
+{
+	std::vector<uint8_t> request;
+	std::vector<uint32_t> variables; // table indices, in the order of the embedded replies
+};
+
+// Packs Read Data requests for all readable variables of the table into as few packets as fit into packet_limit, for
+// the requests and the replies. Structures and variables whose value doesn't fit into one reply are left out. Symbolic
+// request paths are compiled with TagPathCache, so a name like "Line1.Station[3]" is encoded as member and element
+// segments.
+std::vector<ReadBatch> plan_reads(const VariableTable &vars, VariableAddressing addressing, size_t packet_limit);
+
+// Same, but only for the variables that quarantine lets through at now. The table indices are the tag ids.
+std::vector<ReadBatch> plan_reads(
+	const VariableTable &vars,
+	VariableAddressing addressing,
+	size_t packet_limit,
+	const TagQuarantine &quarantine,
+	TagQuarantine::Clock::time_point now);
+
+struct ReadReply
+{
+	uint8_t general_status;
+	std::span<const uint8_t> extended_status;
+	uint8_t data_type; // of the value, if general_status is 0
+	std::span<const uint8_t> value;
+};
+
+// Decodes an embedded Read Data reply, as split by decode_multiple_service_reply. Returns nothing if it's truncated.
+std::optional<ReadReply> decode_read_reply(std::span<const uint8_t> reply);
+
+// Read plan that keeps up with a TagQuarantine: embedded read replies are counted against their variable, and the
+// batches are planned again when a variable goes into quarantine or is due for a retry. vars has to outlive the plan.
+class QuarantinedReadPlan
+{
+public:
+	QuarantinedReadPlan(
+		const VariableTable &vars, VariableAddressing addressing, size_t packet_limit, QuarantinePolicy policy = {});
+	QuarantinedReadPlan(const QuarantinedReadPlan &) = delete;
+	QuarantinedReadPlan &operator=(const QuarantinedReadPlan &) = delete;
+
+	// Call before each cycle. Returns true if the batches changed. Doesn't allocate while nothing changes.
+	bool update(TagQuarantine::Clock::time_point now);
+
+	const std::vector<ReadBatch> &batches() const
+	{
+		return _batches;
+	}
+
+	// reply is the embedded Read Data reply for variable, as split by decode_multiple_service_reply
+	void record_reply(uint32_t variable, std::span<const uint8_t> reply, TagQuarantine::Clock::time_point now);
+
+	// Call when batch failed as a whole, with another status than that of an embedded reply. Finds the variables that
+	// make it fail by bisection (isolate_batch_failure), sending parts of the batch with rc, and puts them into
+	// quarantine, so the next update() plans without them. The embedded replies of the parts that go through are
+	// recorded with record_reply.
+	BatchIsolationResult isolate_failure(
+		RequestContext &rc,
+		const ReadBatch &batch,
+		uint8_t general_status,
+		std::span<const uint8_t> extended_status,
+		TagQuarantine::Clock::time_point now);
+
+	const TagQuarantine &quarantine() const
+	{
+		return _quarantine;
+	}
+
+private:
+	const VariableTable &_vars;
+	VariableAddressing _addressing;
+	size_t _packet_limit;
+	TagQuarantine _quarantine;
+	NameInterner _names;
+	TagPathCache _paths; // symbolic request paths, compiled once per name
+	std::vector<NameId> _all;
+	std::vector<NameId> _planned; // the due variables the batches were planned for
+	std::vector<NameId> _due;
+	std::vector<ReadBatch> _batches;
+};
+
+}
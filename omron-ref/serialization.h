@@ -5,8 +5,10 @@
 #include <concepts>
 #include <cstdint>
 #include <cstring>
+#include <memory_resource>
 #include <span>
 #include <string>
+#include <string_view>
 
 namespace ser
 {
@@ -192,12 +194,19 @@ bool serialize(Serializer auto &ser, const char (&str)[N])
 	return ser.write({reinterpret_cast<const uint8_t *>(str), N - 1});
 }
 
-bool serialize(Serializer auto &ser, const std::string &str, size_t len = 0)
+// Templated on the allocator, so std::pmr::string works too
+template <typename Alloc>
+bool serialize(Serializer auto &ser, const std::basic_string<char, std::char_traits<char>, Alloc> &str, size_t len = 0)
 {
 	assert(len == 0 || len == str.size());
 	return ser.write({reinterpret_cast<const uint8_t *>(str.data()), str.size()});
 }
 
+bool serialize(Serializer auto &ser, std::string_view str)
+{
+	return ser.write({reinterpret_cast<const uint8_t *>(str.data()), str.size()});
+}
+
 // clang-format off
 template <typename T, typename S>
 concept Serializable = requires(T v, S s) {
@@ -317,7 +326,8 @@ bool serialize(Deserializer auto &ser, std::floating_point auto &v)
 	return res;
 }
 
-bool serialize(Deserializer auto &ser, std::string &str, size_t len)
+template <typename Alloc>
+bool serialize(Deserializer auto &ser, std::basic_string<char, std::char_traits<char>, Alloc> &str, size_t len)
 {
 	str.resize(len);
 	return ser.read({reinterpret_cast<uint8_t *>(str.data()), str.size()});
@@ -349,5 +359,12 @@ std::string read_string(Deserializer auto &des, size_t len)
 	return str;
 }
 
+std::pmr::string read_string(Deserializer auto &des, size_t len, std::pmr::memory_resource *resource)
+{
+	std::pmr::string str(resource);
+	serialize(des, str, len);
+	return str;
+}
+
 }
 
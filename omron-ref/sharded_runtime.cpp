@@ -0,0 +1,460 @@
+#include "sharded_runtime.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <numeric>
+#include <stop_token>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "log.h"
+#include "trace.h"
+
+namespace daq
+{
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t default_weight = 64;
+constexpr uint32_t min_weight = 4;
+constexpr uint32_t max_weight = 1024;
+
+// FNV-1a, so the assignment is the same across runs and platforms (std::hash isn't)
+uint64_t stable_hash(std::string_view str, uint64_t seed = 14695981039346656037ull)
+{
+	auto hash = seed;
+	for (const auto c : str)
+	{
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 1099511628211ull;
+	}
+	// FNV has weak low bits for short keys, finish with a mixer (splitmix64)
+	hash ^= hash >> 30;
+	hash *= 0xbf58476d1ce4e5b9ull;
+	hash ^= hash >> 27;
+	hash *= 0x94d049bb133111ebull;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+void pin_current_thread(size_t cpu)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu % CPU_SETSIZE, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+	{
+		logger->warn("Could not pin shard thread to cpu {}", cpu);
+	}
+#else
+	(void)cpu;
+#endif
+}
+}
+
+void HashRing::build(std::span<const uint32_t> weights)
+{
+	_nodes.clear();
+	_nodes.reserve(std::accumulate(weights.begin(), weights.end(), size_t{0}));
+	for (uint32_t shard = 0; shard < weights.size(); ++shard)
+	{
+		const auto shard_seed = stable_hash(std::to_string(shard));
+		for (uint32_t i = 0; i < weights[shard]; ++i)
+		{
+			_nodes.emplace_back(stable_hash(std::to_string(i), shard_seed), shard);
+		}
+	}
+	std::sort(_nodes.begin(), _nodes.end());
+}
+
+size_t HashRing::shard_for(std::string_view key) const
+{
+	assert(!_nodes.empty());
+	const auto hash = stable_hash(key);
+	auto it = std::lower_bound(_nodes.begin(), _nodes.end(), std::pair<uint64_t, uint32_t>{hash, 0});
+	if (it == _nodes.end())
+	{
+		it = _nodes.begin();
+	}
+	return it->second;
+}
+
+// Where a controller belongs, shared with the messages about it. A moved controller is in flight as an Add message for
+// a while, and the messages that follow may overtake it, so the shard that gets it checks here where it has to go.
+struct ShardedRuntime::Placement
+{
+	// New for every add_controller, so messages for an earlier controller with the same key don't match
+	const uint64_t generation;
+	std::atomic<Shard *> shard; // nullptr once removed
+};
+
+class ShardedRuntime::Shard
+{
+public:
+	struct Message
+	{
+		enum class Kind
+		{
+			Add,
+			Remove,
+			Move,
+		};
+
+		Kind kind;
+		std::shared_ptr<Placement> placement;
+		ControllerConfig config; // Add
+	};
+
+	Shard(size_t index, bool pin)
+		: _thread(
+				[this, index, pin](std::stop_token stop)
+				{
+					if (pin)
+					{
+						pin_current_thread(index);
+					}
+					set_trace_thread_name("shard " + std::to_string(index));
+					run(stop);
+				})
+	{
+	}
+
+	void post(Message msg)
+	{
+		{
+			std::lock_guard lock(_mail_mutex);
+			_mail.push_back(std::move(msg));
+			_has_mail.store(true, std::memory_order_release);
+		}
+		_mail_cv.notify_one();
+	}
+
+	void request_stop()
+	{
+		_thread.request_stop();
+	}
+
+	void join()
+	{
+		if (_thread.joinable())
+		{
+			_thread.join();
+		}
+	}
+
+	ShardStats stats() const
+	{
+		return {
+			.num_controllers = _num_controllers.load(std::memory_order_relaxed),
+			.cycles = _cycles.load(std::memory_order_relaxed),
+			.overruns = _overruns.load(std::memory_order_relaxed),
+			.load = _load.load(std::memory_order_relaxed),
+		};
+	}
+
+private:
+	struct Controller
+	{
+		std::shared_ptr<Placement> placement;
+		ControllerConfig config;
+		PollFunction poll;
+		Clock::time_point next_due;
+		double load = 0; // EWMA of poll time / period
+	};
+
+	void run(std::stop_token stop)
+	{
+		std::vector<Message> mail;
+		while (!stop.stop_requested())
+		{
+			if (_has_mail.load(std::memory_order_acquire))
+			{
+				{
+					std::lock_guard lock(_mail_mutex);
+					mail.swap(_mail);
+					_has_mail.store(false, std::memory_order_relaxed);
+				}
+				for (auto &msg : mail)
+				{
+					handle(std::move(msg));
+				}
+				mail.clear();
+			}
+
+			// Wake up now and then even when idle, a far away time_point doesn't work with every wait_until
+			auto next_due = Clock::now() + std::chrono::seconds(1);
+			double load = 0;
+			for (auto &controller : _controllers)
+			{
+				auto now = Clock::now();
+				if (now >= controller.next_due)
+				{
+					poll(controller, now);
+				}
+				next_due = std::min(next_due, controller.next_due);
+				load += controller.load;
+			}
+			_load.store(load, std::memory_order_relaxed);
+
+			std::unique_lock lock(_mail_mutex);
+			_mail_cv.wait_until(lock, stop, next_due, [this] { return !_mail.empty(); });
+		}
+	}
+
+	void poll(Controller &controller, Clock::time_point start)
+	{
+		TraceSpan span("poll");
+		try
+		{
+			ControllerMetrics::Scope scope(controller.config.metrics.get());
+			controller.poll();
+		}
+		catch (const std::exception &e)
+		{
+			logger->warn("Poll of controller '{}' failed: {}", controller.config.key, e.what());
+		}
+		catch (...)
+		{
+			logger->warn("Poll of controller '{}' failed: unknown exception", controller.config.key);
+		}
+		span.end();
+		const auto end = Clock::now();
+		const auto period = controller.config.period;
+		const auto busy = std::chrono::duration<double>(end - start) / std::chrono::duration<double>(period);
+		controller.load = controller.load * 0.9 + busy * 0.1;
+		_cycles.fetch_add(1, std::memory_order_relaxed);
+
+		// Keep the schedule, but if a cycle overran, skip ahead instead of trying to catch up
+		controller.next_due += period;
+		const auto overrun = controller.next_due <= end;
+		if (overrun)
+		{
+			_overruns.fetch_add(1, std::memory_order_relaxed);
+			trace_instant("overrun");
+			controller.next_due = end + period;
+		}
+		if (controller.config.metrics)
+		{
+			controller.config.metrics->record_poll(end - start, overrun);
+		}
+	}
+
+	void handle(Message msg)
+	{
+		switch (msg.kind)
+		{
+			case Message::Kind::Add:
+			{
+				const auto owner = msg.placement->shard.load(std::memory_order_acquire);
+				if (owner == nullptr)
+				{
+					logger->debug("Controller '{}' was removed before it was created", msg.config.key);
+					return;
+				}
+				if (owner != this)
+				{
+					// Moved on while in flight
+					owner->post(std::move(msg));
+					return;
+				}
+				Controller controller{
+					.placement = std::move(msg.placement),
+					.config = std::move(msg.config),
+					.poll = {},
+					.next_due = Clock::now(),
+					.load = 0,
+				};
+				try
+				{
+					controller.poll = controller.config.create(&_resource);
+				}
+				catch (const std::exception &e)
+				{
+					logger->warn("Could not create controller '{}': {}", controller.config.key, e.what());
+					return;
+				}
+				catch (...)
+				{
+					logger->warn("Could not create controller '{}': unknown exception", controller.config.key);
+					return;
+				}
+				_controllers.push_back(std::move(controller));
+				break;
+			}
+			case Message::Kind::Remove:
+			case Message::Kind::Move:
+			{
+				const auto generation = msg.placement->generation;
+				const auto it = std::find_if(
+					_controllers.begin(),
+					_controllers.end(),
+					[&](const auto &c) { return c.placement->generation == generation; });
+				if (it == _controllers.end())
+				{
+					// Still in flight, the Add goes by the placement when it arrives
+					return;
+				}
+				auto config = std::move(it->config);
+				// Destroy the controller state here, before the target shard creates it again
+				_controllers.erase(it);
+				const auto owner = msg.placement->shard.load(std::memory_order_acquire);
+				if (msg.kind == Message::Kind::Move && owner != nullptr)
+				{
+					owner->post({
+						.kind = Message::Kind::Add,
+						.placement = std::move(msg.placement),
+						.config = std::move(config),
+					});
+				}
+				break;
+			}
+		}
+		_num_controllers.store(_controllers.size(), std::memory_order_relaxed);
+	}
+
+	// Only used by the shard thread
+	std::pmr::unsynchronized_pool_resource _resource;
+	std::vector<Controller> _controllers;
+
+	std::mutex _mail_mutex;
+	std::condition_variable_any _mail_cv;
+	std::vector<Message> _mail;
+	std::atomic<bool> _has_mail = false;
+
+	std::atomic<size_t> _num_controllers = 0;
+	std::atomic<uint64_t> _cycles = 0;
+	std::atomic<uint64_t> _overruns = 0;
+	std::atomic<double> _load = 0;
+
+	// Last member, so it's stopped before the rest goes away. The runtime joins all shards before destroying any of
+	// them, a shard posts to other shards when moving controllers.
+	std::jthread _thread;
+};
+
+ShardedRuntime::ShardedRuntime(size_t num_shards, bool pin_threads)
+{
+	if (num_shards == 0)
+	{
+		num_shards = std::max(1u, std::thread::hardware_concurrency());
+	}
+	_shards.reserve(num_shards);
+	for (size_t i = 0; i < num_shards; ++i)
+	{
+		_shards.push_back(std::make_unique<Shard>(i, pin_threads));
+	}
+	_weights.assign(num_shards, default_weight);
+	_ring.build(_weights);
+}
+
+ShardedRuntime::~ShardedRuntime()
+{
+	for (auto &shard : _shards)
+	{
+		shard->request_stop();
+	}
+	for (auto &shard : _shards)
+	{
+		shard->join();
+	}
+}
+
+void ShardedRuntime::add_controller(ControllerConfig config)
+{
+	std::lock_guard lock(_mutex);
+	if (_assignment.contains(config.key))
+	{
+		throw std::runtime_error("Controller '" + config.key + "' already exists");
+	}
+	const auto shard = _ring.shard_for(config.key);
+	auto placement = std::make_shared<Placement>(_next_generation++, _shards[shard].get());
+	_assignment.emplace(config.key, Assignment{.shard = shard, .placement = placement});
+	_shards[shard]->post({
+		.kind = Shard::Message::Kind::Add,
+		.placement = std::move(placement),
+		.config = std::move(config),
+	});
+}
+
+void ShardedRuntime::remove_controller(const std::string &key)
+{
+	std::lock_guard lock(_mutex);
+	const auto it = _assignment.find(key);
+	if (it == _assignment.end())
+	{
+		return;
+	}
+	auto &[shard, placement] = it->second;
+	placement->shard.store(nullptr, std::memory_order_release);
+	_shards[shard]->post({.kind = Shard::Message::Kind::Remove, .placement = std::move(placement), .config = {}});
+	_assignment.erase(it);
+}
+
+size_t ShardedRuntime::rebalance(double max_imbalance)
+{
+	std::lock_guard lock(_mutex);
+
+	std::vector<double> loads;
+	loads.reserve(_shards.size());
+	for (const auto &shard : _shards)
+	{
+		loads.push_back(shard->stats().load);
+	}
+	const auto mean = std::accumulate(loads.begin(), loads.end(), 0.0) / static_cast<double>(loads.size());
+	if (mean <= 0 || *std::max_element(loads.begin(), loads.end()) < mean * max_imbalance)
+	{
+		return 0;
+	}
+
+	// Shrink the ring share of overloaded shards and grow the one of underloaded shards. Damped, because a few heavy
+	// controllers make the load move in big steps. Calling this periodically converges.
+	for (size_t i = 0; i < _shards.size(); ++i)
+	{
+		const auto factor = loads[i] > 0 ? std::clamp(std::sqrt(mean / loads[i]), 0.75, 1.5) : 1.5;
+		_weights[i] = std::clamp(static_cast<uint32_t>(std::lround(_weights[i] * factor)), min_weight, max_weight);
+	}
+	_ring.build(_weights);
+
+	size_t moved = 0;
+	for (auto &[key, assignment] : _assignment)
+	{
+		const auto new_shard = _ring.shard_for(key);
+		if (new_shard == assignment.shard)
+		{
+			continue;
+		}
+		// Set before posting, so wherever the controller is or arrives, it's sent on to the new shard
+		assignment.placement->shard.store(_shards[new_shard].get(), std::memory_order_release);
+		_shards[assignment.shard]->post({
+			.kind = Shard::Message::Kind::Move,
+			.placement = assignment.placement,
+			.config = {},
+		});
+		assignment.shard = new_shard;
+		++moved;
+	}
+	logger->info("Rebalanced shards, moved {} controllers", moved);
+	return moved;
+}
+
+std::vector<ShardStats> ShardedRuntime::stats() const
+{
+	std::vector<ShardStats> stats;
+	stats.reserve(_shards.size());
+	for (const auto &shard : _shards)
+	{
+		stats.push_back(shard->stats());
+	}
+	return stats;
+}
+
+}
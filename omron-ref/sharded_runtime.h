@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "metrics.h"
+
+namespace daq
+{
+
+using PollFunction = std::function<void()>;
+
+struct ControllerConfig
+{
+	// Identifies the controller (e.g. gateway address) and determines its shard
+	std::string key;
+	std::chrono::milliseconds period{1000};
+	// Called on the shard thread with the shard's memory resource. Returns the poll function, which owns all controller
+	// state (RequestContext etc.), so it's only ever touched by that thread.
+	std::function<PollFunction(std::pmr::memory_resource *)> create;
+	// Optional. Gets the poll cycle times and overruns, and the requests made by the poll function.
+	std::shared_ptr<ControllerMetrics> metrics;
+};
+
+struct ShardStats
+{
+	size_t num_controllers;
+	uint64_t cycles;
+	uint64_t overruns;
+	// Sum of poll time / period over the shard's controllers. 1.0 means the thread is fully busy.
+	double load;
+};
+
+// Consistent hash ring with weighted virtual nodes per shard. Changing one shard's weight only moves the keys between
+// that shard's virtual nodes and their neighbours.
+class HashRing
+{
+public:
+	void build(std::span<const uint32_t> weights);
+	size_t shard_for(std::string_view key) const;
+
+private:
+	std::vector<std::pair<uint64_t, uint32_t>> _nodes; // hash, shard. sorted
+};
+
+// Thread-per-core acquisition runtime. Each shard is one thread with its own memory resource and controllers, and polls
+// them without taking any shared lock. Adding, removing and moving controllers is done with messages to the shards.
+class ShardedRuntime
+{
+public:
+	// num_shards = 0 uses one shard per hardware thread. pin_threads binds shard i to cpu i (Linux only).
+	explicit ShardedRuntime(size_t num_shards = 0, bool pin_threads = false);
+	~ShardedRuntime();
+
+	ShardedRuntime(const ShardedRuntime &) = delete;
+	ShardedRuntime &operator=(const ShardedRuntime &) = delete;
+
+	void add_controller(ControllerConfig config);
+	void remove_controller(const std::string &key);
+
+	// Adjusts the ring weights by the measured shard loads and moves the controllers whose shard changed.
+	// Returns the number of moved controllers.
+	size_t rebalance(double max_imbalance = 1.25);
+
+	size_t num_shards() const
+	{
+		return _shards.size();
+	}
+
+	std::vector<ShardStats> stats() const;
+
+private:
+	class Shard;
+	struct Placement;
+
+	struct Assignment
+	{
+		size_t shard;
+		std::shared_ptr<Placement> placement;
+	};
+
+	std::vector<std::unique_ptr<Shard>> _shards;
+	std::vector<uint32_t> _weights;
+	HashRing _ring;
+	std::unordered_map<std::string, Assignment> _assignment;
+	uint64_t _next_generation = 1;
+	mutable std::mutex _mutex;
+};
+
+}
@@ -0,0 +1,273 @@
+// Runs ShardedRuntime with fake sessions that record the thread they are created and polled on. Controllers are
+// placed by the hash ring and only touched by their shard's thread. A removed controller is destroyed, a moved one is
+// destroyed on its old shard and created again on the new one, and shutting down destroys the rest. A create that
+// throws something not derived from std::exception only loses its own controller.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "sharded_runtime.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t num_shards = 4;
+constexpr size_t num_controllers = 16;
+constexpr auto period = std::chrono::milliseconds(5);
+
+// What the sessions of one controller key did, guarded by Sessions::mutex
+struct SessionLog
+{
+	std::vector<std::thread::id> created_on;
+	size_t destroyed = 0;
+	uint64_t polls = 0;
+	// Polls from a thread other than the one the current session was created on
+	uint64_t foreign_polls = 0;
+};
+
+struct Sessions
+{
+	std::mutex mutex;
+	std::map<std::string, SessionLog> logs;
+
+	// Owned by the poll function, like the RequestContext of a real controller
+	struct Session
+	{
+		Sessions &sessions;
+		std::string key;
+		std::thread::id thread;
+
+		~Session()
+		{
+			std::lock_guard lock(sessions.mutex);
+			++sessions.logs[key].destroyed;
+		}
+	};
+
+	ControllerConfig config(const std::string &key, std::chrono::milliseconds busy = {})
+	{
+		ControllerConfig config;
+		config.key = key;
+		config.period = period;
+		config.create = [this, key, busy](std::pmr::memory_resource *)
+		{
+			auto session = std::make_shared<Session>(*this, key, std::this_thread::get_id());
+			{
+				std::lock_guard lock(mutex);
+				logs[key].created_on.push_back(session->thread);
+			}
+			return [this, session, busy]
+			{
+				if (busy.count() > 0)
+				{
+					std::this_thread::sleep_for(busy);
+				}
+				std::lock_guard lock(mutex);
+				auto &log = logs[session->key];
+				++log.polls;
+				if (std::this_thread::get_id() != session->thread)
+				{
+					++log.foreign_polls;
+				}
+			};
+		};
+		return config;
+	}
+
+	template <typename F>
+	bool wait_for(F &&done)
+	{
+		const auto deadline = Clock::now() + std::chrono::seconds(10);
+		while (Clock::now() < deadline)
+		{
+			{
+				std::lock_guard lock(mutex);
+				if (done())
+				{
+					return true;
+				}
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		return false;
+	}
+};
+
+size_t total_controllers(const ShardedRuntime &runtime)
+{
+	size_t total = 0;
+	for (const auto &stats : runtime.stats())
+	{
+		total += stats.num_controllers;
+	}
+	return total;
+}
+
+bool run()
+{
+	Checker check;
+	Sessions sessions;
+	std::vector<std::string> keys;
+	for (size_t i = 0; i < num_controllers; ++i)
+	{
+		keys.push_back(fmt::format("192.168.250.{}", i + 1));
+	}
+
+	auto runtime = std::make_unique<ShardedRuntime>(num_shards);
+	// The first controller keeps its shard busy, so rebalance has something to move
+	runtime->add_controller(sessions.config(keys[0], std::chrono::milliseconds(4)));
+	for (size_t i = 1; i < num_controllers; ++i)
+	{
+		runtime->add_controller(sessions.config(keys[i]));
+	}
+	auto broken = sessions.config("broken");
+	broken.create = [](std::pmr::memory_resource *) -> PollFunction { throw 42; };
+	runtime->add_controller(std::move(broken));
+
+	check.context("placement");
+	check.expect(
+		sessions.wait_for(
+			[&] { return std::ranges::all_of(keys, [&](const auto &key) { return sessions.logs[key].polls >= 3; }); }),
+		"not every controller polled");
+	check.expect(total_controllers(*runtime) == num_controllers, "the broken controller was added");
+	{
+		std::vector<uint32_t> weights(num_shards, 64);
+		HashRing ring;
+		ring.build(weights);
+		std::lock_guard lock(sessions.mutex);
+		std::map<size_t, std::set<std::thread::id>> threads_of_shard;
+		std::set<std::thread::id> threads;
+		for (const auto &key : keys)
+		{
+			const auto &log = sessions.logs[key];
+			check.expect(log.created_on.size() == 1, fmt::format("{} created {} times", key, log.created_on.size()));
+			check.expect(log.foreign_polls == 0, fmt::format("{} polled from another thread", key));
+			threads_of_shard[ring.shard_for(key)].insert(log.created_on.front());
+			threads.insert(log.created_on.front());
+		}
+		check.expect(threads.size() == threads_of_shard.size(), "controllers of different shards share a thread");
+		for (const auto &[shard, shard_threads] : threads_of_shard)
+		{
+			check.expect(shard_threads.size() == 1, fmt::format("the controllers of shard {} are split", shard));
+		}
+	}
+
+	check.context("remove");
+	const std::vector<std::string> removed(keys.end() - 4, keys.end());
+	for (const auto &key : removed)
+	{
+		runtime->remove_controller(key);
+	}
+	check.expect(
+		sessions.wait_for(
+			[&]
+			{
+				return std::ranges::all_of(
+					removed, [&](const auto &key) { return sessions.logs[key].destroyed == 1; });
+			}),
+		"removed controllers not destroyed");
+	keys.resize(keys.size() - removed.size());
+	// Counted after the destruction
+	check.expect(
+		sessions.wait_for([&] { return total_controllers(*runtime) == keys.size(); }),
+		"removed controllers still counted");
+
+	check.context("move");
+	size_t moved = 0;
+	const auto deadline = Clock::now() + std::chrono::seconds(10);
+	while (moved == 0 && Clock::now() < deadline)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		moved = runtime->rebalance();
+	}
+	check.expect(moved > 0, "rebalance moved nothing");
+	std::map<std::string, uint64_t> polls_after_move;
+	check.expect(
+		sessions.wait_for(
+			[&]
+			{
+				size_t recreated = 0;
+				for (const auto &key : keys)
+				{
+					const auto &log = sessions.logs[key];
+					recreated += log.created_on.size() - 1;
+					polls_after_move[key] = log.polls;
+				}
+				return recreated == moved;
+			}),
+		"moved controllers not created again");
+	{
+		std::lock_guard lock(sessions.mutex);
+		for (const auto &key : keys)
+		{
+			const auto &log = sessions.logs[key];
+			check.expect(
+				log.destroyed == log.created_on.size() - 1,
+				fmt::format("{} has {} sessions left", key, log.created_on.size() - log.destroyed));
+			check.expect(log.foreign_polls == 0, fmt::format("{} polled from another thread", key));
+			if (log.created_on.size() == 2)
+			{
+				check.expect(log.created_on[0] != log.created_on[1], fmt::format("{} moved to its own shard", key));
+			}
+		}
+	}
+	check.expect(
+		sessions.wait_for(
+			[&]
+			{
+				return std::ranges::all_of(
+					keys, [&](const auto &key) { return sessions.logs[key].polls > polls_after_move[key]; });
+			}),
+		"not every controller polled after the move");
+	check.expect(total_controllers(*runtime) == keys.size(), "controllers lost by the move");
+
+	check.context("shutdown");
+	runtime.reset();
+	std::map<std::string, uint64_t> polls_at_shutdown;
+	{
+		std::lock_guard lock(sessions.mutex);
+		for (const auto &[key, log] : sessions.logs)
+		{
+			check.expect(log.destroyed == log.created_on.size(), fmt::format("{} not destroyed", key));
+			polls_at_shutdown[key] = log.polls;
+		}
+	}
+	std::this_thread::sleep_for(period * 4);
+	{
+		std::lock_guard lock(sessions.mutex);
+		for (const auto &[key, log] : sessions.logs)
+		{
+			check.expect(log.polls == polls_at_shutdown[key], fmt::format("{} polled after shutdown", key));
+		}
+	}
+
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS {} controllers on {} shards, moved {}\n", num_controllers, num_shards, moved);
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
@@ -0,0 +1,1224 @@
+#include "sim_plc.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <queue>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <tuple>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "data_type.h"
+#include "log.h"
+#include "serialization.h"
+#include "trace.h"
+
+namespace daq
+{
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+using Serializer = ser::FixedBufferSerializer<std::endian::little>;
+using Deserializer = ser::FixedBufferDeserializer<std::endian::little>;
+
+constexpr uint8_t status_path_segment_error = 0x04;
+constexpr uint8_t status_path_destination_unknown = 0x05;
+constexpr uint8_t status_service_not_supported = 0x08;
+constexpr uint8_t status_reply_data_too_large = 0x11;
+constexpr uint8_t status_not_enough_data = 0x13;
+constexpr uint8_t status_attribute_not_supported = 0x14;
+constexpr uint8_t status_embedded_service_error = 0x1E;
+constexpr uint8_t status_vendor_specific = 0x1F;
+// Extended status of 0x1F for a variable that can't be accessed in bulk
+constexpr uint16_t bulk_access_error = 0x8029;
+
+// Extended status of a failed Forward Open (general status 0x01)
+constexpr uint16_t invalid_connection_size = 0x0109;
+constexpr uint16_t connection_path_error = 0x0315;
+
+constexpr uint16_t tag_type_user = 2;
+
+uint64_t splitmix64(uint64_t &state)
+{
+	auto z = (state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+uint32_t data_type_size(DataType type)
+{
+	const auto *traits = data_type_traits(type);
+	return traits && traits->size > 0 ? traits->size : 8;
+}
+
+void begin_reply(Serializer &out, uint8_t service, uint8_t status = 0)
+{
+	ser::serialize_multi(out, static_cast<uint8_t>(service | 0x80), "\x00", status, "\x00");
+}
+
+void begin_reply(Serializer &out, uint8_t service, uint8_t status, uint16_t extended_status)
+{
+	ser::serialize_multi(out, static_cast<uint8_t>(service | 0x80), "\x00", status, "\x01", extended_status);
+}
+
+// Class/instance logical segments and one symbol segment. Element and member segments aren't needed by the client.
+bool parse_path(std::span<const uint8_t> path, uint16_t &class_id, uint32_t &instance_id, std::string_view &symbol)
+{
+	Deserializer des(path);
+	while (!des.remaining_buffer().empty())
+	{
+		const auto segment = ser::read<uint8_t>(des);
+		switch (segment)
+		{
+			case 0x20:
+				class_id = ser::read<uint8_t>(des);
+				break;
+			case 0x21:
+				des.advance(1);
+				class_id = ser::read<uint16_t>(des);
+				break;
+			case 0x24:
+				instance_id = ser::read<uint8_t>(des);
+				break;
+			case 0x25:
+				des.advance(1);
+				instance_id = ser::read<uint16_t>(des);
+				break;
+			case 0x26:
+				des.advance(1);
+				instance_id = ser::read<uint32_t>(des);
+				break;
+			case 0x91:
+			{
+				if (!symbol.empty())
+				{
+					return false;
+				}
+				const auto len = ser::read<uint8_t>(des);
+				const auto name = des.remaining_buffer().first(std::min<size_t>(len, des.remaining_buffer().size()));
+				symbol = {reinterpret_cast<const char *>(name.data()), name.size()};
+				des.advance(len + len % 2);
+				break;
+			}
+			default:
+				return false;
+		}
+		if (des.has_error())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+}
+
+SimulatedController::SimulatedController(const SimulatedControllerConfig &config) : _config(config)
+{
+	constexpr std::array areas{"Press", "Oven", "Conveyor", "Robot", "Filler", "Mixer", "Palletizer", "Washer"};
+	constexpr std::array signals{
+		"Temperature", "Pressure", "Speed", "Position", "Torque", "State", "Counter", "Alarm",
+		"Setpoint", "Current", "Voltage", "FlowRate", "Level", "CycleTime", "Enabled", "ErrorCode",
+	};
+
+	auto state = config.seed;
+	_variables.reserve(config.num_variables);
+	uint32_t value_offset = 0;
+	for (size_t i = 0; i < config.num_variables; ++i)
+	{
+		const auto r = splitmix64(state);
+		Variable var{
+			.name = fmt::format(
+				"{}{}_{}_{}", areas[r % areas.size()], 1 + (i / 64) % 9, signals[(r >> 8) % signals.size()], i),
+			.data_type = DataType::Real,
+			.element_type = DataType::Undefined,
+			.element_size = 0,
+			.num_elements = 0,
+			.value_offset = value_offset,
+			.failure = Failure::None,
+		};
+		// Mostly scalars, like a typical application
+		const auto pick = (r >> 16) % 100;
+		if (pick < 15)
+		{
+			var.data_type = DataType::Bool;
+		}
+		else if (pick < 30)
+		{
+			var.data_type = DataType::Int;
+		}
+		else if (pick < 50)
+		{
+			var.data_type = DataType::Dint;
+		}
+		else if (pick < 75)
+		{
+			var.data_type = DataType::Real;
+		}
+		else if (pick < 85)
+		{
+			var.data_type = DataType::Lreal;
+		}
+		else if (pick < 90)
+		{
+			var.data_type = DataType::Udint;
+		}
+		else
+		{
+			var.data_type = DataType::Array;
+			var.element_type = pick < 95 ? DataType::Int : DataType::Real;
+			var.num_elements = 2 + static_cast<uint32_t>((r >> 24) % 31);
+		}
+		var.element_size = data_type_size(var.num_elements > 0 ? var.element_type : var.data_type);
+		value_offset += var.element_size * std::max<uint32_t>(1, var.num_elements);
+		_variables.push_back(std::move(var));
+	}
+
+	_values.resize(value_offset);
+	for (auto &v : _values)
+	{
+		v = static_cast<uint8_t>(splitmix64(state));
+	}
+
+	for (const auto i : config.failing_variables)
+	{
+		_variables.at(i).failure = Failure::Read;
+	}
+	for (const auto i : config.bulk_failing_variables)
+	{
+		_variables.at(i).failure = Failure::Bulk;
+	}
+
+	// The names don't move anymore
+	_index.reserve(_variables.size());
+	for (uint32_t i = 0; i < _variables.size(); ++i)
+	{
+		_index.emplace(_variables[i].name, i);
+	}
+}
+
+size_t SimulatedController::handle(std::span<const uint8_t> request, std::span<uint8_t> reply)
+{
+	Serializer out(reply.first(std::min(reply.size(), _config.reply_limit)));
+	reply_to(request, out);
+	if (out.has_error())
+	{
+		out.reset();
+		begin_reply(out, request.empty() ? 0 : request[0], status_reply_data_too_large);
+	}
+	return out.serialized_buffer().size();
+}
+
+void SimulatedController::reply_to(std::span<const uint8_t> request, Serializer &out)
+{
+	Deserializer des(request);
+	const auto service = ser::read<uint8_t>(des);
+	const auto path_size = ser::read<uint8_t>(des) * size_t{2};
+	const auto path = des.remaining_buffer().first(std::min(path_size, des.remaining_buffer().size()));
+	des.advance(path_size);
+
+	Target target;
+	if (des.has_error() || !parse_path(path, target.class_id, target.instance_id, target.symbol))
+	{
+		begin_reply(out, service, status_path_segment_error);
+		return;
+	}
+	const auto data = des.remaining_buffer();
+
+	switch (service)
+	{
+		case 0x01:
+			get_attribute_all(target, out);
+			break;
+		case 0x03:
+			get_attribute_list(target, data, out);
+			break;
+		case 0x5F:
+			get_all_instances(target, data, out);
+			break;
+		case 0x4C:
+			if (data.size() < 2)
+			{
+				begin_reply(out, service, status_not_enough_data);
+				break;
+			}
+			read_data(target, out);
+			break;
+		case 0x0A:
+			if (target.class_id != 0x02)
+			{
+				begin_reply(out, service, status_path_destination_unknown);
+				break;
+			}
+			multiple_service_packet(data, out);
+			break;
+		default:
+			begin_reply(out, service, status_service_not_supported);
+			break;
+	}
+}
+
+const SimulatedController::Variable *SimulatedController::resolve(const Target &target) const
+{
+	if (!target.symbol.empty())
+	{
+		const auto it = _index.find(target.symbol);
+		return it == _index.end() ? nullptr : &_variables[it->second];
+	}
+	if (target.class_id == 0x6B && target.instance_id >= variable_instance_base
+			&& target.instance_id - variable_instance_base < _variables.size())
+	{
+		return &_variables[target.instance_id - variable_instance_base];
+	}
+	return nullptr;
+}
+
+std::span<const uint8_t> SimulatedController::produced_data(std::span<const uint8_t> connection_path) const
+{
+	Target target;
+	if (!parse_path(connection_path, target.class_id, target.instance_id, target.symbol))
+	{
+		return {};
+	}
+	const auto *var = resolve(target);
+	if (!var)
+	{
+		return {};
+	}
+	const auto size = var->element_size * std::max<uint32_t>(1, var->num_elements);
+	return std::span<const uint8_t>(_values).subspan(var->value_offset, size);
+}
+
+void SimulatedController::get_attribute_all(const Target &target, Serializer &out)
+{
+	if (target.symbol.empty() && target.class_id == 0x6A)
+	{
+		if (target.instance_id == 0)
+		{
+			begin_reply(out, 0x01);
+			ser::serialize_multi(
+				out, uint16_t{1}, static_cast<uint16_t>(_variables.size()), static_cast<uint16_t>(_variables.size()));
+			return;
+		}
+		if (target.instance_id > _variables.size())
+		{
+			begin_reply(out, 0x01, status_path_destination_unknown);
+			return;
+		}
+		const auto &var = _variables[target.instance_id - 1];
+		begin_reply(out, 0x01);
+		ser::serialize_multi(
+			out, variable_instance_base + target.instance_id - 1, static_cast<uint8_t>(var.name.size()), var.name);
+		return;
+	}
+
+	const auto *var = resolve(target);
+	if (!var)
+	{
+		begin_reply(out, 0x01, status_path_destination_unknown);
+		return;
+	}
+	begin_reply(out, 0x01);
+	ser::serialize(out, var->element_size); // element size for arrays
+	ser::serialize(out, static_cast<uint8_t>(var->data_type));
+	if (var->num_elements == 0)
+	{
+		ser::serialize(out, "\x00\x00\x00");
+		ser::serialize(out, "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00");
+		return;
+	}
+	ser::serialize_multi(out, static_cast<uint8_t>(var->element_type), "\x01\x00", var->num_elements);
+	ser::serialize(out, "\x00\x00\x00\x00\x00\x00\x00\x00"); // unknown
+	ser::serialize(out, "\x00\x00\x00\x00"); // bit number, padding
+	ser::serialize(out, "\x00\x00\x00\x00"); // variable type instance
+	ser::serialize(out, uint32_t{0}); // start index
+}
+
+// The attributes of the Get Attribute All reply, numbered in its order. These are the client's unverified guess (see
+// omcon.cpp), not ids known from a controller. Dimensions and start indices are UDINT[3].
+void SimulatedController::get_attribute_list(const Target &target, std::span<const uint8_t> data, Serializer &out)
+{
+	const auto *var = target.class_id == 0x6A ? nullptr : resolve(target);
+	if (!var)
+	{
+		begin_reply(out, 0x03, status_path_destination_unknown);
+		return;
+	}
+	Deserializer des(data);
+	const auto num = ser::read<uint16_t>(des);
+	if (des.has_error() || des.remaining_buffer().size() < num * size_t{2})
+	{
+		begin_reply(out, 0x03, status_not_enough_data);
+		return;
+	}
+	begin_reply(out, 0x03);
+	ser::serialize(out, num);
+	const bool is_array = var->num_elements > 0;
+	for (uint16_t i = 0; i < num; ++i)
+	{
+		const auto attribute = ser::read<uint16_t>(des);
+		const uint16_t status = attribute >= 1 && attribute <= 8 ? 0 : status_attribute_not_supported;
+		ser::serialize_multi(out, attribute, status);
+		switch (attribute)
+		{
+			case 1:
+				ser::serialize(out, var->element_size);
+				break;
+			case 2:
+				ser::serialize(out, static_cast<uint8_t>(var->data_type));
+				break;
+			case 3:
+				ser::serialize(out, static_cast<uint8_t>(is_array ? var->element_type : DataType::Undefined));
+				break;
+			case 4:
+				ser::serialize(out, static_cast<uint8_t>(is_array ? 1 : 0));
+				break;
+			case 5:
+				ser::serialize_multi(out, var->num_elements, uint32_t{0}, uint32_t{0});
+				break;
+			case 6: // bit number
+				ser::serialize(out, uint8_t{0});
+				break;
+			case 7: // variable type instance
+				ser::serialize(out, uint32_t{0});
+				break;
+			case 8:
+				ser::serialize_multi(out, uint32_t{0}, uint32_t{0}, uint32_t{0});
+				break;
+		}
+	}
+}
+
+void SimulatedController::get_all_instances(const Target &target, std::span<const uint8_t> data, Serializer &out)
+{
+	if (!target.symbol.empty() || target.class_id != 0x6A)
+	{
+		begin_reply(out, 0x5F, status_path_destination_unknown);
+		return;
+	}
+	Deserializer des(data);
+	const auto next_instance_id = ser::read<uint32_t>(des);
+	des.advance(4);
+	const auto tag_type = ser::read<uint16_t>(des);
+	if (des.has_error())
+	{
+		begin_reply(out, 0x5F, status_not_enough_data);
+		return;
+	}
+
+	begin_reply(out, 0x5F);
+	const auto count_pos = out.serialized_buffer().size();
+	ser::serialize(out, "\x00\x00\x00\x00"); // count, unknown
+	uint16_t count = 0;
+	// Only user variables, and as many as fit into one reply
+	const size_t first = std::max<uint32_t>(next_instance_id, 1) - 1;
+	for (size_t i = first; tag_type == tag_type_user && i < _variables.size(); ++i)
+	{
+		const auto &var = _variables[i];
+		const auto padding = (var.name.size() + 1) % 2;
+		const auto instance_data_len = 2 + 4 + 1 + var.name.size() + padding;
+		if (out.get_remaining_bytes() < 4 + 2 + instance_data_len || count == UINT16_MAX)
+		{
+			break;
+		}
+		ser::serialize_multi(
+			out,
+			static_cast<uint32_t>(i + 1),
+			static_cast<uint16_t>(instance_data_len),
+			uint16_t{0x6B},
+			static_cast<uint32_t>(variable_instance_base + i),
+			static_cast<uint8_t>(var.name.size()),
+			var.name);
+		out.advance(padding);
+		++count;
+	}
+	const auto buffer = out.serialized_buffer();
+	std::memcpy(buffer.data() + count_pos, &count, sizeof(count));
+}
+
+void SimulatedController::read_data(const Target &target, Serializer &out)
+{
+	const auto *var = resolve(target);
+	if (!var || var->failure == Failure::Read)
+	{
+		begin_reply(out, 0x4C, status_path_destination_unknown);
+		return;
+	}
+	if (var->failure == Failure::Bulk)
+	{
+		begin_reply(out, 0x4C, status_vendor_specific, bulk_access_error);
+		return;
+	}
+	begin_reply(out, 0x4C);
+	ser::serialize_multi(out, static_cast<uint8_t>(var->num_elements > 0 ? var->element_type : var->data_type), "\x00");
+	const auto size = var->element_size * std::max<uint32_t>(1, var->num_elements);
+	ser::serialize(out, std::span<const uint8_t>(_values).subspan(var->value_offset, size));
+}
+
+void SimulatedController::multiple_service_packet(std::span<const uint8_t> data, Serializer &out)
+{
+	Deserializer des(data);
+	const auto num = ser::read<uint16_t>(des);
+	std::vector<uint16_t> offsets(num);
+	for (auto &offset : offsets)
+	{
+		offset = ser::read<uint16_t>(des);
+	}
+	if (des.has_error())
+	{
+		begin_reply(out, 0x0A, status_not_enough_data);
+		return;
+	}
+
+	begin_reply(out, 0x0A);
+	const auto start = out.serialized_buffer().size();
+	ser::serialize(out, num);
+	out.advance(sizeof(uint16_t) * num);
+	bool embedded_error = false;
+	for (uint16_t i = 0; i < num; ++i)
+	{
+		const size_t end = i + 1 < num ? offsets[i + 1] : data.size();
+		if (offsets[i] > end || end > data.size())
+		{
+			out.reset();
+			begin_reply(out, 0x0A, status_path_segment_error);
+			return;
+		}
+		const auto offset = static_cast<uint16_t>(out.serialized_buffer().size() - start);
+		std::memcpy(out.serialized_buffer().data() + start + sizeof(uint16_t) * (1 + i), &offset, sizeof(offset));
+		const auto request = data.subspan(offsets[i], end - offsets[i]);
+		if (!request.empty() && request[0] == 0x0A)
+		{
+			begin_reply(out, 0x0A, status_service_not_supported);
+			embedded_error = true;
+			continue;
+		}
+		reply_to(request, out);
+		if (out.has_error())
+		{
+			return;
+		}
+		// Reply service, reserved, general status, extended status size, extended status
+		const auto reply = out.serialized_buffer().subspan(start + offset);
+		if (reply[2] == status_vendor_specific && reply[3] == 1 && (reply[4] | reply[5] << 8) == bulk_access_error)
+		{
+			out.reset();
+			begin_reply(out, 0x0A, status_vendor_specific, bulk_access_error);
+			return;
+		}
+		embedded_error = embedded_error || reply[2] != 0;
+	}
+	if (embedded_error)
+	{
+		out.serialized_buffer()[2] = status_embedded_service_error;
+	}
+}
+
+class SimulatedPlcServer::Loop
+{
+public:
+	Loop(std::vector<std::pair<int, SimulatedController *>> listeners)
+		: _listeners(std::move(listeners))
+		, _epoll(epoll_create1(EPOLL_CLOEXEC))
+		, _wake(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+		, _timer(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+		, _udp(socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))
+	{
+		if (_epoll < 0 || _wake < 0 || _timer < 0 || _udp < 0)
+		{
+			throw std::runtime_error(fmt::format("Could not create simulator event loop: {}", std::strerror(errno)));
+		}
+		for (size_t i = 0; i < _listeners.size(); ++i)
+		{
+			add(_listeners[i].first, EPOLLIN, Kind::Listener, i);
+		}
+		add(_wake, EPOLLIN, Kind::Wake, 0);
+		add(_timer, EPOLLIN, Kind::Timer, 0);
+		_thread = std::jthread(
+			[this](std::stop_token stop)
+			{
+				set_trace_thread_name("simulator");
+				run(stop);
+			});
+	}
+
+	~Loop()
+	{
+		_thread.request_stop();
+		const uint64_t one = 1;
+		[[maybe_unused]] const auto res = write(_wake, &one, sizeof(one));
+		_thread.join();
+		for (auto &[id, conn] : _connections)
+		{
+			close(conn.fd);
+		}
+		for (auto &[fd, controller] : _listeners)
+		{
+			close(fd);
+		}
+		close(_udp);
+		close(_timer);
+		close(_wake);
+		close(_epoll);
+	}
+
+	uint64_t num_requests() const
+	{
+		return _num_requests.load(std::memory_order_relaxed);
+	}
+
+	std::chrono::nanoseconds cpu_time()
+	{
+		clockid_t clock;
+		timespec ts{};
+		if (pthread_getcpuclockid(_thread.native_handle(), &clock) != 0 || clock_gettime(clock, &ts) != 0)
+		{
+			return {};
+		}
+		return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+	}
+
+private:
+	enum class Kind : uint64_t
+	{
+		Listener = 1,
+		Connection,
+		Wake,
+		Timer,
+	};
+
+	struct ForwardOpen
+	{
+		uint32_t o_t_id;
+		uint32_t t_o_id;
+		uint16_t serial;
+	};
+
+	struct Connection
+	{
+		int fd;
+		SimulatedController *controller;
+		std::vector<uint8_t> in;
+		std::vector<uint8_t> out; // not sent yet, socket was full
+		std::vector<ForwardOpen> forward_opens;
+	};
+
+	// Class 1 connection, produces the value of a variable every RPI
+	struct Producer
+	{
+		const Connection *owner;
+		uint16_t serial;
+		uint32_t t_o_id;
+		sockaddr_in destination;
+		std::chrono::microseconds rpi;
+		Clock::time_point due;
+		uint32_t sequence;
+		std::span<const uint8_t> data;
+	};
+
+	struct DelayedReply
+	{
+		Clock::time_point due;
+		uint64_t seq;
+		uint64_t connection;
+		std::vector<uint8_t> data;
+
+		bool operator>(const DelayedReply &other) const
+		{
+			return std::tie(due, seq) > std::tie(other.due, other.seq);
+		}
+	};
+
+	void add(int fd, uint32_t events, Kind kind, uint64_t value)
+	{
+		epoll_event ev{.events = events, .data = {.u64 = (static_cast<uint64_t>(kind) << 56) | value}};
+		epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
+	}
+
+	void run(std::stop_token stop)
+	{
+		std::array<epoll_event, 64> events;
+		while (!stop.stop_requested())
+		{
+			const auto n = epoll_wait(_epoll, events.data(), static_cast<int>(events.size()), -1);
+			for (int i = 0; i < n; ++i)
+			{
+				const auto kind = static_cast<Kind>(events[i].data.u64 >> 56);
+				const auto value = events[i].data.u64 & ((uint64_t{1} << 56) - 1);
+				switch (kind)
+				{
+					case Kind::Listener:
+						accept_connections(value);
+						break;
+					case Kind::Connection:
+						if (events[i].events & EPOLLOUT)
+						{
+							flush(value);
+						}
+						if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+						{
+							receive(value);
+						}
+						break;
+					case Kind::Timer:
+					{
+						uint64_t expirations;
+						[[maybe_unused]] const auto res = read(_timer, &expirations, sizeof(expirations));
+						break;
+					}
+					case Kind::Wake:
+						break;
+				}
+			}
+			run_timers();
+		}
+	}
+
+	void accept_connections(size_t listener)
+	{
+		while (true)
+		{
+			const auto fd = accept4(_listeners[listener].first, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0)
+			{
+				return;
+			}
+			const int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			const auto id = _next_connection++;
+			_connections.emplace(
+				id,
+				Connection{
+					.fd = fd,
+					.controller = _listeners[listener].second,
+					.in = {},
+					.out = {},
+					.forward_opens = {},
+				});
+			add(fd, EPOLLIN, Kind::Connection, id);
+		}
+	}
+
+	void receive(uint64_t id)
+	{
+		const auto it = _connections.find(id);
+		if (it == _connections.end())
+		{
+			return;
+		}
+		auto &conn = it->second;
+		std::array<uint8_t, 16384> buf;
+		while (true)
+		{
+			const auto n = recv(conn.fd, buf.data(), buf.size(), 0);
+			if (n > 0)
+			{
+				conn.in.insert(conn.in.end(), buf.begin(), buf.begin() + n);
+				continue;
+			}
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				break;
+			}
+			disconnect(id);
+			return;
+		}
+
+		constexpr size_t header_size = 24;
+		size_t pos = 0;
+		std::vector<uint8_t> immediate;
+		while (conn.in.size() - pos >= header_size)
+		{
+			uint16_t length;
+			std::memcpy(&length, conn.in.data() + pos + 2, sizeof(length));
+			if (conn.in.size() - pos < header_size + length)
+			{
+				break;
+			}
+			std::vector<uint8_t> reply;
+			if (!handle_frame(conn, std::span<const uint8_t>(conn.in).subspan(pos, header_size + length), reply))
+			{
+				disconnect(id);
+				return;
+			}
+			pos += header_size + length;
+			const auto latency = conn.controller->config().latency;
+			if (latency.count() > 0)
+			{
+				_delayed.push({
+					.due = Clock::now() + latency,
+					.seq = _next_seq++,
+					.connection = id,
+					.data = std::move(reply),
+				});
+			}
+			else
+			{
+				immediate.insert(immediate.end(), reply.begin(), reply.end());
+			}
+		}
+		conn.in.erase(conn.in.begin(), conn.in.begin() + static_cast<ptrdiff_t>(pos));
+		// Last, send can disconnect
+		if (!immediate.empty())
+		{
+			send(id, immediate);
+		}
+	}
+
+	// Sends the due delayed replies and class 1 data and sets the timer to the next one
+	void run_timers()
+	{
+		const auto now = Clock::now();
+		while (!_delayed.empty() && _delayed.top().due <= now)
+		{
+			// Connection may be gone already, send ignores that
+			send(_delayed.top().connection, _delayed.top().data);
+			_delayed.pop();
+		}
+		auto next = _delayed.empty() ? Clock::time_point::max() : _delayed.top().due;
+		for (auto &producer : _producers)
+		{
+			if (producer.due <= now)
+			{
+				produce(producer);
+				producer.due += producer.rpi;
+				if (producer.due <= now)
+				{
+					producer.due = now + producer.rpi;
+				}
+			}
+			next = std::min(next, producer.due);
+		}
+		itimerspec spec{};
+		if (next != Clock::time_point::max())
+		{
+			const auto due = std::chrono::duration_cast<std::chrono::nanoseconds>(next.time_since_epoch());
+			spec.it_value.tv_sec = due.count() / 1'000'000'000;
+			spec.it_value.tv_nsec = due.count() % 1'000'000'000;
+		}
+		timerfd_settime(_timer, TFD_TIMER_ABSTIME, &spec, nullptr);
+	}
+
+	// Sequenced address item and connected data item with the sequence count. UDP errors are ignored like lost
+	// datagrams.
+	void produce(Producer &producer)
+	{
+		++producer.sequence;
+		_datagram.resize(2 + 12 + 6 + producer.data.size());
+		Serializer out(_datagram);
+		ser::serialize_multi(
+			out,
+			uint16_t{2},
+			uint16_t{0x8002},
+			uint16_t{8},
+			producer.t_o_id,
+			producer.sequence,
+			uint16_t{0x00B1},
+			static_cast<uint16_t>(2 + producer.data.size()),
+			static_cast<uint16_t>(producer.sequence),
+			producer.data);
+		sendto(_udp, _datagram.data(), _datagram.size(), 0, reinterpret_cast<const sockaddr *>(&producer.destination),
+			sizeof(producer.destination));
+	}
+
+	void send(uint64_t id, std::span<const uint8_t> data)
+	{
+		const auto it = _connections.find(id);
+		if (it == _connections.end())
+		{
+			return;
+		}
+		auto &conn = it->second;
+		if (!conn.out.empty())
+		{
+			conn.out.insert(conn.out.end(), data.begin(), data.end());
+			return;
+		}
+		const auto n = ::send(conn.fd, data.data(), data.size(), MSG_NOSIGNAL);
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			disconnect(id);
+			return;
+		}
+		const auto sent = static_cast<size_t>(std::max<ssize_t>(n, 0));
+		if (sent < data.size())
+		{
+			conn.out.assign(data.begin() + static_cast<ptrdiff_t>(sent), data.end());
+			epoll_event ev{
+				.events = EPOLLIN | EPOLLOUT,
+				.data = {.u64 = (static_cast<uint64_t>(Kind::Connection) << 56) | id},
+			};
+			epoll_ctl(_epoll, EPOLL_CTL_MOD, conn.fd, &ev);
+		}
+	}
+
+	void flush(uint64_t id)
+	{
+		const auto it = _connections.find(id);
+		if (it == _connections.end())
+		{
+			return;
+		}
+		auto &conn = it->second;
+		std::vector<uint8_t> pending;
+		pending.swap(conn.out);
+		epoll_event ev{.events = EPOLLIN, .data = {.u64 = (static_cast<uint64_t>(Kind::Connection) << 56) | id}};
+		epoll_ctl(_epoll, EPOLL_CTL_MOD, conn.fd, &ev);
+		send(id, pending);
+	}
+
+	void disconnect(uint64_t id)
+	{
+		const auto it = _connections.find(id);
+		if (it != _connections.end())
+		{
+			std::erase_if(_producers, [&](const auto &producer) { return producer.owner == &it->second; });
+			close(it->second.fd);
+			_connections.erase(it);
+		}
+	}
+
+	// Encapsulation header: command, length, session handle, status, sender context, options
+	bool handle_frame(Connection &conn, std::span<const uint8_t> frame, std::vector<uint8_t> &reply)
+	{
+		Deserializer des(frame);
+		const auto command = ser::read<uint16_t>(des);
+		des.advance(2);
+		auto session = ser::read<uint32_t>(des);
+		des.advance(4);
+		const auto context = des.remaining_buffer().first(8);
+		des.advance(8 + 4);
+		const auto data = des.remaining_buffer();
+
+		reply.resize(64 + conn.controller->config().reply_limit);
+		Serializer out(reply);
+		uint32_t status = 0;
+		out.advance(24);
+		switch (command)
+		{
+			case 0x65: // RegisterSession
+				session = _next_session++;
+				ser::serialize(out, data.first(std::min<size_t>(data.size(), 4)));
+				break;
+			case 0x66: // UnRegisterSession
+				return false;
+			case 0x6F: // SendRRData
+				if (!send_rr_data(conn, data, out))
+				{
+					return false;
+				}
+				break;
+			case 0x70: // SendUnitData
+				if (!send_unit_data(conn, data, out))
+				{
+					return false;
+				}
+				break;
+			default:
+				status = 0x01; // invalid or unsupported command
+				break;
+		}
+
+		const auto length = static_cast<uint16_t>(out.serialized_buffer().size() - 24);
+		Serializer header(std::span<uint8_t>(reply).first(24));
+		ser::serialize_multi(header, command, length, session, status, context, uint32_t{0});
+		reply.resize(out.has_error() ? 0 : 24 + length);
+		return !reply.empty();
+	}
+
+	// Common packet format: interface handle, timeout, item count, items (type, length, data)
+	static bool find_item(std::span<const uint8_t> data, uint16_t type, std::span<const uint8_t> &item)
+	{
+		Deserializer des(data);
+		des.advance(4 + 2);
+		const auto num_items = ser::read<uint16_t>(des);
+		for (uint16_t i = 0; i < num_items && !des.has_error(); ++i)
+		{
+			const auto item_type = ser::read<uint16_t>(des);
+			const auto length = ser::read<uint16_t>(des);
+			const auto item_data =
+				des.remaining_buffer().first(std::min<size_t>(length, des.remaining_buffer().size()));
+			des.advance(length);
+			if (item_type == type && !des.has_error())
+			{
+				item = item_data;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool send_rr_data(Connection &conn, std::span<const uint8_t> data, Serializer &out)
+	{
+		std::span<const uint8_t> request;
+		if (!find_item(data, 0xB2, request) || request.size() < 2)
+		{
+			return false;
+		}
+		// Null address item and unconnected data item
+		ser::serialize(out, "\x00\x00\x00\x00\x00\x00\x02\x00\x00\x00\x00\x00\xB2\x00");
+		const auto length_pos = out.serialized_buffer().size();
+		out.advance(2);
+
+		const auto is_connection_manager =
+			request.size() >= 6 && request[1] >= 2 && request[2] == 0x20 && request[3] == 0x06;
+		const auto service = request[0];
+		if (is_connection_manager && service == 0x52)
+		{
+			// Unconnected Send: priority, timeout ticks, message size, message, route path. The route ends here.
+			Deserializer des(request.subspan(6));
+			des.advance(2);
+			const auto size = ser::read<uint16_t>(des);
+			const auto message = des.remaining_buffer().first(std::min<size_t>(size, des.remaining_buffer().size()));
+			cip_request(conn, message, out);
+		}
+		else if (is_connection_manager && (service == 0x54 || service == 0x5B))
+		{
+			forward_open(conn, request, out);
+		}
+		else if (is_connection_manager && service == 0x4E)
+		{
+			forward_close(conn, request, out);
+		}
+		else
+		{
+			cip_request(conn, request, out);
+		}
+
+		const auto length = static_cast<uint16_t>(out.serialized_buffer().size() - length_pos - 2);
+		std::memcpy(out.serialized_buffer().data() + length_pos, &length, sizeof(length));
+		return true;
+	}
+
+	bool send_unit_data(Connection &conn, std::span<const uint8_t> data, Serializer &out)
+	{
+		std::span<const uint8_t> address;
+		std::span<const uint8_t> item;
+		if (!find_item(data, 0xA1, address) || address.size() != 4 || !find_item(data, 0xB1, item) || item.size() < 2)
+		{
+			return false;
+		}
+		uint32_t o_t_id;
+		std::memcpy(&o_t_id, address.data(), sizeof(o_t_id));
+		const auto it = std::find_if(
+			conn.forward_opens.begin(), conn.forward_opens.end(), [&](const auto &fo) { return fo.o_t_id == o_t_id; });
+		if (it == conn.forward_opens.end())
+		{
+			return false;
+		}
+		// Connected address and data item. The data starts with the sequence count, which the reply echoes.
+		ser::serialize_multi(out, "\x00\x00\x00\x00\x00\x00\x02\x00\xA1\x00\x04\x00", it->t_o_id, "\xB1\x00");
+		const auto length_pos = out.serialized_buffer().size();
+		out.advance(2);
+		ser::serialize(out, item.first(2));
+		cip_request(conn, item.subspan(2), out);
+		const auto length = static_cast<uint16_t>(out.serialized_buffer().size() - length_pos - 2);
+		std::memcpy(out.serialized_buffer().data() + length_pos, &length, sizeof(length));
+		return true;
+	}
+
+	void cip_request(Connection &conn, std::span<const uint8_t> request, Serializer &out)
+	{
+		TraceSpan span("simulator request");
+		_num_requests.fetch_add(1, std::memory_order_relaxed);
+		const auto reply = out.serialized_buffer();
+		const auto pos = reply.size();
+		// out is over the whole frame buffer, which has room for reply_limit after the headers
+		const auto size = conn.controller->handle(request, std::span(reply.data() + pos, out.get_remaining_bytes()));
+		out.advance(size);
+	}
+
+	void forward_open(Connection &conn, std::span<const uint8_t> request, Serializer &out)
+	{
+		// After service and path: priority/tick, timeout ticks, O->T id, T->O id, serial, vendor, originator serial
+		if (request.size() < 2 + request[1] * size_t{2})
+		{
+			begin_reply(out, request[0], status_not_enough_data);
+			return;
+		}
+		Deserializer des(request.subspan(2 + request[1] * size_t{2}));
+		des.advance(2 + 4);
+		const auto t_o_id = ser::read<uint32_t>(des);
+		const auto serial = ser::read<uint16_t>(des);
+		const auto vendor = ser::read<uint16_t>(des);
+		const auto originator_serial = ser::read<uint32_t>(des);
+		des.advance(1 + 3);
+		const auto o_t_rpi = ser::read<uint32_t>(des);
+		const bool large = request[0] == 0x5B;
+		des.advance(large ? 4 : 2);
+		const auto t_o_rpi = ser::read<uint32_t>(des);
+		const auto t_o_size = large ? ser::read<uint32_t>(des) & 0xFFFF : ser::read<uint16_t>(des) & 0x1FFu;
+		const auto transport = ser::read<uint8_t>(des);
+		const auto path_size = ser::read<uint8_t>(des) * size_t{2};
+		const auto path = des.remaining_buffer().first(std::min(path_size, des.remaining_buffer().size()));
+		if (des.has_error())
+		{
+			begin_reply(out, request[0], status_not_enough_data);
+			return;
+		}
+		if ((transport & 0x0F) == 1)
+		{
+			// The T->O data is the sequence count and the value
+			const auto data = conn.controller->produced_data(path);
+			if (data.empty() || data.size() + 2 != t_o_size)
+			{
+				ser::serialize_multi(out, static_cast<uint8_t>(request[0] | 0x80), "\x00\x01\x01",
+					static_cast<uint16_t>(data.empty() ? connection_path_error : invalid_connection_size));
+				return;
+			}
+			sockaddr_in peer{};
+			socklen_t len = sizeof(peer);
+			getpeername(conn.fd, reinterpret_cast<sockaddr *>(&peer), &len);
+			peer.sin_port = htons(conn.controller->config().implicit_port);
+			_producers.push_back({
+				.owner = &conn,
+				.serial = serial,
+				.t_o_id = t_o_id,
+				.destination = peer,
+				.rpi = std::chrono::microseconds(std::max<uint32_t>(t_o_rpi, 100)),
+				.due = Clock::now(),
+				.sequence = 0,
+				.data = data,
+			});
+		}
+		const auto o_t_id = _next_connection_id++;
+		conn.forward_opens.push_back({.o_t_id = o_t_id, .t_o_id = t_o_id, .serial = serial});
+		begin_reply(out, request[0]);
+		ser::serialize_multi(out, o_t_id, t_o_id, serial, vendor, originator_serial, o_t_rpi, t_o_rpi, "\x00\x00");
+	}
+
+	void forward_close(Connection &conn, std::span<const uint8_t> request, Serializer &out)
+	{
+		if (request.size() < 2 + request[1] * size_t{2})
+		{
+			begin_reply(out, 0x4E, status_not_enough_data);
+			return;
+		}
+		Deserializer des(request.subspan(2 + request[1] * size_t{2}));
+		des.advance(2);
+		const auto serial = ser::read<uint16_t>(des);
+		const auto vendor = ser::read<uint16_t>(des);
+		const auto originator_serial = ser::read<uint32_t>(des);
+		if (des.has_error())
+		{
+			begin_reply(out, 0x4E, status_not_enough_data);
+			return;
+		}
+		std::erase_if(conn.forward_opens, [&](const auto &fo) { return fo.serial == serial; });
+		std::erase_if(
+			_producers, [&](const auto &producer) { return producer.owner == &conn && producer.serial == serial; });
+		begin_reply(out, 0x4E);
+		ser::serialize_multi(out, serial, vendor, originator_serial, "\x00\x00");
+	}
+
+	std::vector<std::pair<int, SimulatedController *>> _listeners;
+	int _epoll;
+	int _wake;
+	int _timer;
+	int _udp;
+
+	std::unordered_map<uint64_t, Connection> _connections;
+	uint64_t _next_connection = 1;
+	uint32_t _next_session = 1;
+	uint32_t _next_connection_id = 0x10000;
+	std::priority_queue<DelayedReply, std::vector<DelayedReply>, std::greater<>> _delayed;
+	uint64_t _next_seq = 0;
+	std::vector<Producer> _producers;
+	std::vector<uint8_t> _datagram;
+
+	std::atomic<uint64_t> _num_requests = 0;
+	std::jthread _thread;
+};
+
+SimulatedPlcServer::SimulatedPlcServer(std::span<const SimulatedControllerConfig> controllers, size_t num_threads)
+{
+	num_threads = std::clamp<size_t>(num_threads, 1, std::max<size_t>(1, controllers.size()));
+	std::vector<std::vector<std::pair<int, SimulatedController *>>> listeners(num_threads);
+	const auto close_all = [&]
+	{
+		for (auto &loop_listeners : listeners)
+		{
+			for (auto &[fd, controller] : loop_listeners)
+			{
+				close(fd);
+			}
+		}
+	};
+
+	for (size_t i = 0; i < controllers.size(); ++i)
+	{
+		_controllers.push_back(std::make_unique<SimulatedController>(controllers[i]));
+
+		const auto fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		socklen_t len = sizeof(addr);
+		if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 128) != 0
+				|| getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+		{
+			const auto error = std::strerror(errno);
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+			close_all();
+			throw std::runtime_error(fmt::format("Could not listen for simulated controller {}: {}", i, error));
+		}
+		_ports.push_back(ntohs(addr.sin_port));
+		listeners[i % num_threads].emplace_back(fd, _controllers.back().get());
+	}
+
+	for (auto &loop_listeners : listeners)
+	{
+		_loops.push_back(std::make_unique<Loop>(std::move(loop_listeners)));
+	}
+	logger->info("Started {} simulated controllers on {} threads", controllers.size(), num_threads);
+}
+
+SimulatedPlcServer::~SimulatedPlcServer() = default;
+
+std::string SimulatedPlcServer::gateway(size_t controller) const
+{
+	return fmt::format("127.0.0.1:{}", _ports.at(controller));
+}
+
+uint64_t SimulatedPlcServer::num_requests() const
+{
+	uint64_t num = 0;
+	for (const auto &loop : _loops)
+	{
+		num += loop->num_requests();
+	}
+	return num;
+}
+
+std::chrono::nanoseconds SimulatedPlcServer::cpu_time() const
+{
+	std::chrono::nanoseconds time{0};
+	for (const auto &loop : _loops)
+	{
+		time += loop->cpu_time();
+	}
+	return time;
+}
+
+}
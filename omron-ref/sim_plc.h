@@ -0,0 +1,142 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "omron.h"
+
+namespace daq
+{
+
+struct SimulatedControllerConfig
+{
+	size_t num_variables = 1000;
+	// Added to every reply, like the processing time of a real controller
+	std::chrono::microseconds latency{0};
+	// Largest CIP reply. 502 bytes for unconnected messages, 1994 with a large forward open
+	size_t reply_limit = 1994;
+	// Names, types and values are derived from it, the same seed gives the same symbol table
+	uint64_t seed = 1;
+	// Class 1 connections produce to this UDP port of the originator
+	uint16_t implicit_port = 2222;
+	// Variable numbers (the n in the name suffix "_n") whose Read Data fails with path destination unknown (0x05)
+	std::vector<size_t> failing_variables{};
+	// Variable numbers that can't be read in bulk: Read Data fails with 0x1F/0x8029, and a Multiple Service Packet
+	// that reads one of them fails as a whole with that status
+	std::vector<size_t> bulk_failing_variables{};
+};
+
+// Stand-in for an Omron NJ/NX controller. Implements the CIP services the client uses: Get Attribute All on the tag
+// name server (0x6A) and the variable objects (0x6B), Get Attribute List on the variable objects, the Omron get all
+// instances service (0x5F), Read Data (0x4C) and Multiple Service Packet (0x0A). Variables can be addressed by name or
+// by variable object instance.
+class SimulatedController
+{
+public:
+	// Variable object instance ids start here, so mixing them up with the tag name server ids (1..n) fails
+	static constexpr uint32_t variable_instance_base = 0x100;
+
+	explicit SimulatedController(const SimulatedControllerConfig &config);
+
+	// Handles one CIP request (service, path, data) and writes the reply. reply needs room for reply_limit bytes.
+	// Returns the size of the reply.
+	size_t handle(std::span<const uint8_t> request, std::span<uint8_t> reply);
+
+	const SimulatedControllerConfig &config() const
+	{
+		return _config;
+	}
+
+	size_t num_variables() const
+	{
+		return _variables.size();
+	}
+
+	// The value of the variable a class 1 connection path points to, empty if there is none
+	std::span<const uint8_t> produced_data(std::span<const uint8_t> connection_path) const;
+
+private:
+	enum class Failure : uint8_t
+	{
+		None,
+		Read,
+		Bulk,
+	};
+
+	struct Variable
+	{
+		std::string name;
+		DataType data_type;
+		DataType element_type; // arrays only
+		uint32_t element_size;
+		uint32_t num_elements; // 0 for scalars
+		uint32_t value_offset;
+		Failure failure;
+	};
+
+	struct Target
+	{
+		uint16_t class_id = 0;
+		uint32_t instance_id = 0;
+		std::string_view symbol;
+	};
+
+	void reply_to(std::span<const uint8_t> request, ser::FixedBufferSerializer<std::endian::little> &out);
+	const Variable *resolve(const Target &target) const;
+
+	void get_attribute_all(const Target &target, ser::FixedBufferSerializer<std::endian::little> &out);
+	void get_attribute_list(
+		const Target &target, std::span<const uint8_t> data, ser::FixedBufferSerializer<std::endian::little> &out);
+	void get_all_instances(
+		const Target &target, std::span<const uint8_t> data, ser::FixedBufferSerializer<std::endian::little> &out);
+	void read_data(const Target &target, ser::FixedBufferSerializer<std::endian::little> &out);
+	void multiple_service_packet(std::span<const uint8_t> data, ser::FixedBufferSerializer<std::endian::little> &out);
+
+	SimulatedControllerConfig _config;
+	std::vector<Variable> _variables;
+	std::unordered_map<std::string_view, uint32_t> _index; // name -> variable index
+	std::vector<uint8_t> _values;
+};
+
+// EtherNet/IP server for simulated controllers with one listening port per controller on 127.0.0.1. Handles sessions,
+// SendRRData (with or without Unconnected Send), Forward Open/Close and SendUnitData, so a RequestContext can talk to
+// it like to a real controller. A class 1 Forward Open for a variable produces its value over UDP every RPI. The
+// controllers are spread over num_threads epoll loops. Linux only.
+class SimulatedPlcServer
+{
+public:
+	explicit SimulatedPlcServer(std::span<const SimulatedControllerConfig> controllers, size_t num_threads = 1);
+	~SimulatedPlcServer();
+
+	SimulatedPlcServer(const SimulatedPlcServer &) = delete;
+	SimulatedPlcServer &operator=(const SimulatedPlcServer &) = delete;
+
+	size_t num_controllers() const
+	{
+		return _controllers.size();
+	}
+
+	// "127.0.0.1:<port>", for plc_tag::Attributes::gateway
+	std::string gateway(size_t controller) const;
+
+	// CIP requests handled so far. A Multiple Service Packet counts once.
+	uint64_t num_requests() const;
+
+	// CPU time used by the server threads, so benchmarks can subtract it
+	std::chrono::nanoseconds cpu_time() const;
+
+private:
+	class Loop;
+
+	std::vector<std::unique_ptr<SimulatedController>> _controllers;
+	std::vector<uint16_t> _ports;
+	std::vector<std::unique_ptr<Loop>> _loops;
+};
+
+}
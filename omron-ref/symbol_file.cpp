@@ -0,0 +1,347 @@
+#include "symbol_file.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "symbol_store.h"
+
+namespace daq
+{
+
+namespace
+{
+static_assert(std::endian::native == std::endian::little, "symbol files are mapped as little endian");
+static_assert(std::is_trivially_copyable_v<SymbolFileHeader> && sizeof(SymbolFileHeader) == 64);
+static_assert(std::is_trivially_copyable_v<SymbolFileRecord> && sizeof(SymbolFileRecord) == 48);
+static_assert(offsetof(SymbolFileRecord, array_info) == 16 && alignof(SymbolFileRecord) == 4);
+
+constexpr size_t section_alignment = 8;
+
+size_t align(size_t offset)
+{
+	return (offset + section_alignment - 1) & ~(section_alignment - 1);
+}
+
+std::string file_error(std::string_view what, const std::string &path)
+{
+	return fmt::format("{} '{}': {}", what, path, std::strerror(errno));
+}
+
+// FNV-1a, the index has to be the same for every build that maps the file (std::hash isn't)
+uint32_t name_hash(std::string_view name)
+{
+	uint32_t hash = 2166136261u;
+	for (const auto c : name)
+	{
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+void write_all(int fd, std::span<const uint8_t> data, const std::string &path)
+{
+	while (!data.empty())
+	{
+		const auto n = ::write(fd, data.data(), data.size());
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			throw std::runtime_error(file_error("Could not write", path));
+		}
+		data = data.subspan(static_cast<size_t>(n));
+	}
+}
+}
+
+void write_symbol_file(const VariableTable &vars, const std::string &path)
+{
+	SymbolFileHeader header{};
+	header.magic = SymbolFileHeader::file_magic;
+	header.version = SymbolFileHeader::file_version;
+	header.num_records = static_cast<uint32_t>(vars.size());
+	header.index_size = static_cast<uint32_t>(std::bit_ceil(std::max<size_t>(16, 2 * vars.size())));
+
+	std::vector<SymbolFileRecord> records(vars.size());
+	std::vector<uint32_t> index(header.index_size, 0);
+	std::string names;
+	SymbolDigest digest;
+	for (size_t i = 0; i < vars.size(); ++i)
+	{
+		const auto var = vars[i];
+		auto &record = records[i];
+		record.name_offset = static_cast<uint32_t>(names.size());
+		record.size = var.size;
+		record.instance_id = var.instance_id;
+		record.name_length = static_cast<uint8_t>(var.name.size());
+		record.data_type = var.data_type;
+		if (var.array_info)
+		{
+			// Field by field, so the padding stays zero and equal tables give equal files
+			const auto &arr = *var.array_info;
+			record.is_array = 1;
+			record.array_info.element_type = arr.element_type;
+			record.array_info.num_dimensions = arr.num_dimensions;
+			record.array_info.element_size = arr.element_size;
+			record.array_info.dimensions = arr.dimensions;
+			record.array_info.start_indices = arr.start_indices;
+		}
+		names += var.name;
+		digest.add(var.instance_id, var.name);
+
+		const auto mask = index.size() - 1;
+		for (auto slot = name_hash(var.name) & mask;; slot = (slot + 1) & mask)
+		{
+			if (index[slot] == 0)
+			{
+				index[slot] = static_cast<uint32_t>(i + 1);
+				break;
+			}
+			// Names are unique per controller, but if not, the first one wins like in VariableTable
+			const auto &other = records[index[slot] - 1];
+			if (std::string_view(names).substr(other.name_offset, other.name_length) == var.name)
+			{
+				break;
+			}
+		}
+	}
+
+	header.records_offset = align(sizeof(SymbolFileHeader));
+	header.index_offset = align(header.records_offset + records.size() * sizeof(SymbolFileRecord));
+	header.names_offset = align(header.index_offset + index.size() * sizeof(uint32_t));
+	header.name_bytes = names.size();
+	header.file_size = header.names_offset + names.size();
+	header.digest = digest.value();
+
+	std::vector<uint8_t> file(header.file_size, 0);
+	std::memcpy(file.data(), &header, sizeof(header));
+	std::memcpy(file.data() + header.records_offset, records.data(), records.size() * sizeof(SymbolFileRecord));
+	std::memcpy(file.data() + header.index_offset, index.data(), index.size() * sizeof(uint32_t));
+	std::memcpy(file.data() + header.names_offset, names.data(), names.size());
+
+	const auto temp_path = path + ".tmp";
+	const int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		throw std::runtime_error(file_error("Could not create", temp_path));
+	}
+	try
+	{
+		write_all(fd, file, temp_path);
+		if (::fsync(fd) != 0)
+		{
+			throw std::runtime_error(file_error("Could not sync", temp_path));
+		}
+	}
+	catch (...)
+	{
+		::close(fd);
+		::unlink(temp_path.c_str());
+		throw;
+	}
+	::close(fd);
+	if (::rename(temp_path.c_str(), path.c_str()) != 0)
+	{
+		const auto message = file_error("Could not rename to", path);
+		::unlink(temp_path.c_str());
+		throw std::runtime_error(message);
+	}
+}
+
+MappedSymbolTable::MappedSymbolTable(const std::string &path)
+{
+	const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		throw std::runtime_error(file_error("Could not open", path));
+	}
+	struct stat st{};
+	if (::fstat(fd, &st) != 0)
+	{
+		const auto message = file_error("Could not stat", path);
+		::close(fd);
+		throw std::runtime_error(message);
+	}
+	_size = static_cast<size_t>(st.st_size);
+	if (_size < sizeof(SymbolFileHeader))
+	{
+		::close(fd);
+		throw std::runtime_error(fmt::format("Symbol file '{}' is too small", path));
+	}
+	void *data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+	{
+		throw std::runtime_error(file_error("Could not map", path));
+	}
+	_data = static_cast<const uint8_t *>(data);
+
+	const auto fail = [&](std::string_view what)
+	{
+		unmap();
+		return std::runtime_error(fmt::format("Invalid symbol file '{}': {}", path, what));
+	};
+	_header = reinterpret_cast<const SymbolFileHeader *>(_data);
+	const auto &h = *_header;
+	if (h.magic != SymbolFileHeader::file_magic)
+	{
+		throw fail("bad magic");
+	}
+	if (h.version != SymbolFileHeader::file_version)
+	{
+		throw fail(fmt::format("version {}, {} expected", h.version, SymbolFileHeader::file_version));
+	}
+	if (h.file_size != _size)
+	{
+		throw fail(fmt::format("{} bytes, header says {}", _size, h.file_size));
+	}
+	const auto inside = [&](uint64_t offset, uint64_t bytes) { return offset <= _size && bytes <= _size - offset; };
+	if (h.records_offset % alignof(SymbolFileRecord) != 0 || h.index_offset % alignof(uint32_t) != 0
+			|| !inside(h.records_offset, uint64_t{h.num_records} * sizeof(SymbolFileRecord))
+			|| !inside(h.index_offset, uint64_t{h.index_size} * sizeof(uint32_t))
+			|| !inside(h.names_offset, h.name_bytes)
+			|| !std::has_single_bit(h.index_size) || h.index_size <= h.num_records)
+	{
+		throw fail("sections out of bounds");
+	}
+
+	_records = {reinterpret_cast<const SymbolFileRecord *>(_data + h.records_offset), h.num_records};
+	_index = {reinterpret_cast<const uint32_t *>(_data + h.index_offset), h.index_size};
+	_names = {reinterpret_cast<const char *>(_data + h.names_offset), h.name_bytes};
+	for (const auto &record : _records)
+	{
+		if (uint64_t{record.name_offset} + record.name_length > _names.size()
+				|| (record.is_array && record.array_info.num_dimensions > max_array_dimensions))
+		{
+			throw fail("bad record");
+		}
+	}
+	size_t empty_slots = 0;
+	for (const auto entry : _index)
+	{
+		if (entry > _records.size())
+		{
+			throw fail("bad index entry");
+		}
+		empty_slots += entry == 0 ? 1 : 0;
+	}
+	// find() stops at an empty slot
+	if (empty_slots == 0)
+	{
+		throw fail("full index");
+	}
+}
+
+MappedSymbolTable::~MappedSymbolTable()
+{
+	unmap();
+}
+
+MappedSymbolTable::MappedSymbolTable(MappedSymbolTable &&other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedSymbolTable &MappedSymbolTable::operator=(MappedSymbolTable &&other) noexcept
+{
+	if (this != &other)
+	{
+		unmap();
+		_data = std::exchange(other._data, nullptr);
+		_size = std::exchange(other._size, 0);
+		_header = std::exchange(other._header, nullptr);
+		_records = std::exchange(other._records, {});
+		_index = std::exchange(other._index, {});
+		_names = std::exchange(other._names, {});
+	}
+	return *this;
+}
+
+void MappedSymbolTable::unmap()
+{
+	if (_data)
+	{
+		::munmap(const_cast<uint8_t *>(_data), _size);
+		_data = nullptr;
+	}
+}
+
+VariableView MappedSymbolTable::operator[](size_t index) const
+{
+	const auto &record = _records[index];
+	return {
+		.name = _names.substr(record.name_offset, record.name_length),
+		.data_type = record.data_type,
+		.size = record.size,
+		.instance_id = record.instance_id,
+		.array_info = record.is_array ? &record.array_info : nullptr,
+	};
+}
+
+std::optional<uint32_t> MappedSymbolTable::find(std::string_view name) const
+{
+	const auto mask = _index.size() - 1;
+	for (auto slot = name_hash(name) & mask;; slot = (slot + 1) & mask)
+	{
+		const auto entry = _index[slot];
+		if (entry == 0)
+		{
+			return std::nullopt;
+		}
+		const auto &record = _records[entry - 1];
+		if (_names.substr(record.name_offset, record.name_length) == name)
+		{
+			return entry - 1;
+		}
+	}
+}
+
+VariableInfo MappedSymbolTable::to_variable_info(size_t index) const
+{
+	const auto view = (*this)[index];
+	VariableInfo var{
+		.name = std::string(view.name),
+		.data_type = view.data_type,
+		.size = view.size,
+		.array_info = std::nullopt,
+	};
+	if (view.array_info)
+	{
+		ArrayInfo arr;
+		arr.element_type = view.array_info->element_type;
+		arr.element_size = view.array_info->element_size;
+		arr.dimensions.assign(view.array_info->dims().begin(), view.array_info->dims().end());
+		arr.start_indices.assign(view.array_info->starts().begin(), view.array_info->starts().end());
+		var.array_info = std::move(arr);
+	}
+	return var;
+}
+
+VariableTable MappedSymbolTable::to_variable_table(std::pmr::memory_resource *resource) const
+{
+	VariableTable vars(resource);
+	vars.reserve(size(), _names.size());
+	for (size_t i = 0; i < size(); ++i)
+	{
+		vars.add(to_variable_info(i), _records[i].instance_id);
+	}
+	return vars;
+}
+
+}
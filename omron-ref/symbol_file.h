@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "omron.h"
+#include "variable_table.h"
+
+namespace daq
+{
+
+// Flat symbol table file, used straight from mmap. All integers are little endian, offsets are from the start of the
+// file and sections are 8 byte aligned:
+//
+//   SymbolFileHeader
+//   records      num_records SymbolFileRecord, in discovery order
+//   index        index_size uint32_t, open addressing over the names (FNV-1a, linear probing), record + 1, 0 is empty
+//   names        name_bytes characters, not null terminated
+//
+// The records embed a CompactArrayInfo, so VariableViews point right into the mapping.
+struct SymbolFileHeader
+{
+	static constexpr uint32_t file_magic = 0x4D59534F; // "OSYM"
+	static constexpr uint32_t file_version = 1;
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_records;
+	uint32_t index_size; // power of two
+	uint64_t records_offset;
+	uint64_t index_offset;
+	uint64_t names_offset;
+	uint64_t name_bytes;
+	uint64_t file_size;
+	// SymbolDigest of the instance ids and names, compare it with the controller's to know if the file is current
+	uint64_t digest;
+};
+
+struct SymbolFileRecord
+{
+	uint32_t name_offset; // into the names section
+	uint32_t size;
+	uint32_t instance_id;
+	uint8_t name_length;
+	DataType data_type;
+	uint8_t is_array;
+	uint8_t reserved;
+	CompactArrayInfo array_info; // zero if not an array
+};
+
+// Writes vars to path, through a temporary file that is renamed, so a reader never maps a partial file. Throws on
+// I/O errors.
+void write_symbol_file(const VariableTable &vars, const std::string &path);
+
+// Read only mapping of a symbol file with the lookups of VariableTable. Opening checks the header and that all records,
+// names and index entries are inside the file (one pass over the records, no copies), and throws if not.
+class MappedSymbolTable
+{
+public:
+	explicit MappedSymbolTable(const std::string &path);
+	~MappedSymbolTable();
+
+	MappedSymbolTable(MappedSymbolTable &&other) noexcept;
+	MappedSymbolTable &operator=(MappedSymbolTable &&other) noexcept;
+	MappedSymbolTable(const MappedSymbolTable &) = delete;
+	MappedSymbolTable &operator=(const MappedSymbolTable &) = delete;
+
+	size_t size() const
+	{
+		return _records.size();
+	}
+
+	VariableView operator[](size_t index) const;
+
+	std::optional<uint32_t> find(std::string_view name) const;
+
+	VariableInfo to_variable_info(size_t index) const;
+
+	uint64_t digest() const
+	{
+		return _header->digest;
+	}
+
+	// Copies the file into a VariableTable, for code that needs one
+	VariableTable to_variable_table(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) const;
+
+private:
+	void unmap();
+
+	const uint8_t *_data = nullptr;
+	size_t _size = 0;
+	const SymbolFileHeader *_header = nullptr;
+	std::span<const SymbolFileRecord> _records;
+	std::span<const uint32_t> _index;
+	std::string_view _names;
+};
+
+}
@@ -0,0 +1,186 @@
+// Writes a VariableTable with arrays and a duplicate name as a symbol file and maps it again: the mapping gives the
+// same variables, lookups and digest, and equal tables give equal files. Damaged copies of the file (bad magic,
+// truncated, a full index, ...) are rejected when opening instead of being read out of bounds.
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "symbol_file.h"
+#include "symbol_store.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+std::vector<char> read_file(const std::filesystem::path &path)
+{
+	std::ifstream in(path, std::ios::binary);
+	return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+void write_file(const std::filesystem::path &path, const std::vector<char> &data)
+{
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+// The message of the error opening path throws, empty if it opens
+std::string open_error(const std::filesystem::path &path)
+{
+	try
+	{
+		MappedSymbolTable mapped(path.string());
+	}
+	catch (const std::runtime_error &e)
+	{
+		return e.what();
+	}
+	return {};
+}
+
+VariableTable make_table()
+{
+	VariableTable vars;
+	for (uint32_t i = 0; i < 500; ++i)
+	{
+		vars.add(
+			fmt::format("Line{}.Station[{}]", i % 7, i),
+			{.data_type = i % 2 ? DataType::Real : DataType::Dint, .size = 4, .array_info = std::nullopt},
+			i + 1);
+	}
+	VariableInfo array{.name = "Recipe", .data_type = DataType::Array, .size = 24, .array_info = std::nullopt};
+	array.array_info =
+		ArrayInfo{.element_type = DataType::Dint, .element_size = 4, .dimensions = {2, 3}, .start_indices = {0, 1}};
+	vars.add(array, 1000);
+	// Not unique, the first one wins
+	vars.add("Line0.Station[0]", {.data_type = DataType::Lreal, .size = 8, .array_info = std::nullopt}, 1001);
+	return vars;
+}
+
+bool run()
+{
+	Checker check;
+	const auto dir = std::filesystem::temp_directory_path() / fmt::format("symbol_file_test.{}", ::getpid());
+	std::filesystem::create_directories(dir);
+	const auto path = dir / "plc.osym";
+
+	const auto vars = make_table();
+	write_symbol_file(vars, path.string());
+	check.expect(!std::filesystem::exists(path.string() + ".tmp"), "temporary file left behind");
+	{
+		check.context("round trip");
+		MappedSymbolTable mapped(path.string());
+		check.expect(mapped.size() == vars.size(), fmt::format("{} of {} variables", mapped.size(), vars.size()));
+		SymbolDigest digest;
+		for (size_t i = 0; i < vars.size() && i < mapped.size(); ++i)
+		{
+			const auto expected = vars.to_variable_info(i);
+			check.expect(
+				mapped.to_variable_info(i).to_string() == expected.to_string()
+					&& mapped[i].instance_id == vars[i].instance_id,
+				fmt::format("{} differs", expected.name));
+			check.expect(
+				mapped.find(vars[i].name) == vars.find(vars[i].name), fmt::format("{} found elsewhere", expected.name));
+			digest.add(vars[i].instance_id, vars[i].name);
+		}
+		check.expect(mapped.digest() == digest.value(), "digest of another stream");
+		check.expect(!mapped.find("Line0.Station").has_value(), "prefix found");
+		const auto copy = mapped.to_variable_table();
+		check.expect(copy.name_arena() == vars.name_arena(), "to_variable_table lost names");
+
+		const auto moved = std::move(mapped);
+		check.expect(moved.size() == vars.size() && moved.find("Recipe").has_value(), "moved mapping");
+	}
+
+	check.context("deterministic");
+	const auto file = read_file(path);
+	write_symbol_file(make_table(), (dir / "again.osym").string());
+	check.expect(read_file(dir / "again.osym") == file, "equal tables, different files");
+
+	check.context("damaged");
+	SymbolFileHeader header;
+	std::memcpy(&header, file.data(), sizeof(header));
+	const auto damaged =
+		[&](std::string_view name, std::string_view error, const std::function<void(std::vector<char> &)> &damage)
+	{
+		auto data = file;
+		damage(data);
+		const auto damaged_path = dir / fmt::format("{}.osym", name);
+		write_file(damaged_path, data);
+		const auto message = open_error(damaged_path);
+		check.expect(
+			message.find(error) != std::string::npos,
+			fmt::format("{}: \"{}\", expected \"{}\"", name, message, error));
+	};
+	damaged("magic", "bad magic", [](auto &data) { data[0] ^= 0x20; });
+	damaged("version", "version 2", [](auto &data) { data[offsetof(SymbolFileHeader, version)] = 2; });
+	damaged("truncated", "header says", [](auto &data) { data.pop_back(); });
+	damaged("small", "too small", [](auto &data) { data.resize(sizeof(SymbolFileHeader) - 1); });
+	damaged(
+		"index_size",
+		"sections out of bounds",
+		[&](auto &data)
+		{
+			const uint32_t index_size = 1u << 30;
+			std::memcpy(data.data() + offsetof(SymbolFileHeader, index_size), &index_size, sizeof(index_size));
+		});
+	damaged(
+		"record",
+		"bad record",
+		[&](auto &data)
+		{
+			const auto name_offset = static_cast<uint32_t>(header.name_bytes);
+			std::memcpy(data.data() + header.records_offset, &name_offset, sizeof(name_offset));
+		});
+	damaged(
+		"entry",
+		"bad index entry",
+		[&](auto &data)
+		{
+			const auto entry = header.num_records + 1;
+			std::memcpy(data.data() + header.index_offset, &entry, sizeof(entry));
+		});
+	damaged(
+		"full_index",
+		"full index",
+		[&](auto &data)
+		{
+			for (uint32_t slot = 0; slot < header.index_size; ++slot)
+			{
+				const uint32_t entry = 1;
+				std::memcpy(data.data() + header.index_offset + slot * sizeof(entry), &entry, sizeof(entry));
+			}
+		});
+	check.expect(open_error(dir / "missing.osym").find("Could not open") != std::string::npos, "missing file opened");
+
+	std::filesystem::remove_all(dir);
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS {} variables, {} bytes\n", vars.size(), file.size());
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
@@ -0,0 +1,121 @@
+#include "symbol_store.h"
+
+#include <algorithm>
+
+namespace daq
+{
+
+void SymbolDigest::add(uint32_t instance_id, std::string_view name)
+{
+	const auto add_byte = [this](uint8_t b)
+	{
+		_hash ^= b;
+		_hash *= 1099511628211ull;
+	};
+	for (size_t i = 0; i < 4; ++i)
+	{
+		add_byte(static_cast<uint8_t>(instance_id >> (8 * i)));
+	}
+	// The length keeps "ab" + "c" apart from "a" + "bc"
+	add_byte(static_cast<uint8_t>(name.size()));
+	for (const auto c : name)
+	{
+		add_byte(static_cast<uint8_t>(c));
+	}
+	++_count;
+}
+
+uint64_t SymbolDigest::value() const
+{
+	// splitmix64 finalizer over the FNV state and the count
+	auto hash = _hash ^ (_count * 0x9e3779b97f4a7c15ull);
+	hash ^= hash >> 30;
+	hash *= 0xbf58476d1ce4e5b9ull;
+	hash ^= hash >> 27;
+	hash *= 0x94d049bb133111ebull;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+SymbolStore &SymbolStore::global()
+{
+	static SymbolStore store;
+	return store;
+}
+
+SymbolStore::Table SymbolStore::get_or_discover(
+	uint64_t digest,
+	const std::function<bool(const VariableTable &)> &matches,
+	const std::function<VariableTable()> &discover)
+{
+	for (;;)
+	{
+		std::unique_lock lock(_mutex);
+		std::erase_if(_entries, [](const auto &e) { return !e.second.pending.valid() && e.second.table.expired(); });
+		auto &entry = _entries[digest];
+		if (auto table = entry.table.lock())
+		{
+			lock.unlock();
+			if (!matches(*table))
+			{
+				break;
+			}
+			++_hits;
+			return table;
+		}
+		if (entry.pending.valid())
+		{
+			auto pending = entry.pending;
+			lock.unlock();
+			auto table = pending.get();
+			if (!table)
+			{
+				continue; // the discovery failed, the next one tries
+			}
+			if (!matches(*table))
+			{
+				break;
+			}
+			++_hits;
+			return table;
+		}
+
+		// Entries with a pending discovery aren't erased, so entry stays valid
+		std::promise<Table> promise;
+		entry.pending = promise.get_future().share();
+		lock.unlock();
+		Table table;
+		try
+		{
+			table = std::make_shared<const VariableTable>(discover());
+		}
+		catch (...)
+		{
+			lock.lock();
+			entry.pending = {};
+			lock.unlock();
+			promise.set_value(nullptr);
+			throw;
+		}
+		++_misses;
+		lock.lock();
+		entry.table = table;
+		entry.pending = {};
+		lock.unlock();
+		promise.set_value(table);
+		return table;
+	}
+
+	++_misses;
+	return std::make_shared<const VariableTable>(discover());
+}
+
+SymbolStoreStats SymbolStore::stats() const
+{
+	std::lock_guard lock(_mutex);
+	const auto tables =
+		std::count_if(_entries.begin(), _entries.end(), [](const auto &e) { return !e.second.table.expired(); });
+	return {.hits = _hits, .misses = _misses, .tables = static_cast<size_t>(tables)};
+}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include "variable_table.h"
+
+namespace daq
+{
+
+// Content hash of a get all instances (0x5F) name stream: the instance ids and names in the order the controller sent
+// them. Controllers running the same program have the same stream.
+class SymbolDigest
+{
+public:
+	void add(uint32_t instance_id, std::string_view name);
+
+	// Mixed, so the low bits can be used as well
+	uint64_t value() const;
+
+private:
+	uint64_t _hash = 14695981039346656037ull; // FNV-1a offset basis
+	uint64_t _count = 0;
+};
+
+struct SymbolStoreStats
+{
+	uint64_t hits = 0; // discoveries that got the table of another controller
+	uint64_t misses = 0; // discoveries that made the type queries
+	size_t tables = 0; // distinct tables alive
+};
+
+// Process-wide store of discovered variable tables, keyed by the SymbolDigest of their name stream. The tables are
+// shared and immutable, an entry lives as long as one controller holds its table, so memory scales with the number of
+// distinct programs instead of controllers.
+//
+// A matching name stream is taken to mean the same types. Changing only the type of a variable without renaming or
+// adding one isn't noticed while another controller with the old program still holds the table.
+class SymbolStore
+{
+public:
+	using Table = std::shared_ptr<const VariableTable>;
+
+	static SymbolStore &global();
+
+	// Returns the table stored for digest, if matches accepts it, or the result of discover, which is stored then.
+	// discover runs outside the lock. Discoveries of the same digest at the same time wait for the first one instead
+	// of querying their controllers too; if it fails, the next one discovers. A table that matches rejects (a hash
+	// collision) is ignored, and that discovery isn't stored. The table from discover has to use the global heap, it
+	// outlives the controller.
+	Table get_or_discover(
+		uint64_t digest,
+		const std::function<bool(const VariableTable &)> &matches,
+		const std::function<VariableTable()> &discover);
+
+	SymbolStoreStats stats() const;
+
+private:
+	struct Entry
+	{
+		std::weak_ptr<const VariableTable> table;
+		std::shared_future<Table> pending; // valid while a discovery runs
+	};
+
+	mutable std::mutex _mutex;
+	std::unordered_map<uint64_t, Entry> _entries;
+	std::atomic<uint64_t> _hits = 0;
+	std::atomic<uint64_t> _misses = 0;
+};
+
+}
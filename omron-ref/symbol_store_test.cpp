@@ -0,0 +1,140 @@
+// Checks SymbolDigest over name streams and the reuse of SymbolStore: a digest that was discovered is served to the
+// next controller without discovering again, also to those waiting for a discovery running at the same time, a table
+// that matches rejects isn't stored, a failed discovery lets the next one try, and tables go away with their last
+// holder.
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "symbol_store.h"
+#include "test_util.h"
+
+namespace daq
+{
+
+namespace
+{
+uint64_t digest_of(const std::vector<std::pair<uint32_t, std::string>> &stream)
+{
+	SymbolDigest digest;
+	for (const auto &[instance_id, name] : stream)
+	{
+		digest.add(instance_id, name);
+	}
+	return digest.value();
+}
+
+VariableTable table_of(std::string_view name)
+{
+	VariableTable table;
+	table.add(name, {.data_type = DataType::Dint, .size = 4, .array_info = std::nullopt}, 1);
+	return table;
+}
+
+bool run()
+{
+	Checker check;
+
+	check.context("digest");
+	const auto digest = digest_of({{1, "Motor"}, {2, "Speed"}});
+	check.expect(digest == digest_of({{1, "Motor"}, {2, "Speed"}}), "same stream, other digest");
+	check.expect(digest != digest_of({{2, "Speed"}, {1, "Motor"}}), "order ignored");
+	check.expect(digest != digest_of({{1, "Motor"}, {3, "Speed"}}), "instance id ignored");
+	check.expect(digest_of({{1, "ab"}, {2, "c"}}) != digest_of({{1, "a"}, {2, "bc"}}), "name boundaries ignored");
+	check.expect(digest_of({}) != digest_of({{0, ""}}), "empty entries ignored");
+
+	check.context("reuse");
+	SymbolStore store;
+	size_t discoveries = 0;
+	const auto accept = [](const VariableTable &) { return true; };
+	const auto discover = [&]
+	{
+		++discoveries;
+		return table_of("Motor");
+	};
+	auto first = store.get_or_discover(digest, accept, discover);
+	auto second = store.get_or_discover(digest, accept, discover);
+	check.expect(discoveries == 1, fmt::format("{} discoveries", discoveries));
+	check.expect(first == second, "the second controller got another table");
+	check.expect(store.stats().hits == 1 && store.stats().misses == 1, "hits and misses");
+	check.expect(store.stats().tables == 1, fmt::format("{} tables", store.stats().tables));
+
+	check.context("collision");
+	const auto collision = store.get_or_discover(digest, [](const VariableTable &) { return false; }, discover);
+	check.expect(discoveries == 2 && collision != first, "a rejected table was used");
+	check.expect(store.get_or_discover(digest, accept, discover) == first, "a rejected table was stored");
+
+	check.context("expiry");
+	first.reset();
+	second.reset();
+	check.expect(store.stats().tables == 0, "table alive without holders");
+	const auto again = store.get_or_discover(digest, accept, discover);
+	check.expect(discoveries == 3 && again, "expired table reused");
+
+	check.context("failure");
+	const auto other = digest_of({{1, "Valve"}});
+	bool threw = false;
+	try
+	{
+		store.get_or_discover(other, accept, []() -> VariableTable { throw std::runtime_error("Timeout"); });
+	}
+	catch (const std::runtime_error &)
+	{
+		threw = true;
+	}
+	check.expect(threw, "the discovery error is lost");
+	check.expect(store.get_or_discover(other, accept, discover) != nullptr, "no discovery after a failed one");
+
+	check.context("concurrent");
+	constexpr size_t num_threads = 8;
+	const auto fleet = digest_of({{1, "Conveyor"}});
+	std::atomic<size_t> fleet_discoveries = 0;
+	std::vector<SymbolStore::Table> tables(num_threads);
+	{
+		std::vector<std::jthread> threads;
+		for (size_t i = 0; i < num_threads; ++i)
+		{
+			threads.emplace_back(
+				[&, i]
+				{
+					tables[i] = store.get_or_discover(
+						fleet,
+						accept,
+						[&]
+						{
+							++fleet_discoveries;
+							std::this_thread::sleep_for(std::chrono::milliseconds(50));
+							return table_of("Conveyor");
+						});
+				});
+		}
+	}
+	check.expect(fleet_discoveries == 1, fmt::format("{} discoveries", fleet_discoveries.load()));
+	for (const auto &table : tables)
+	{
+		check.expect(table == tables.front(), "controllers of the same program got different tables");
+	}
+
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS {} hits, {} misses\n", store.stats().hits, store.stats().misses);
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
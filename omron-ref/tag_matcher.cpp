@@ -0,0 +1,407 @@
+#include "tag_matcher.h"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <spdlog/fmt/fmt.h>
+
+namespace daq
+{
+
+namespace
+{
+// Not part of CIP names, so a '?' in a piece is always the wildcard
+bool piece_equal(std::string_view text, std::string_view piece)
+{
+	if (text.size() != piece.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		if (text[i] != piece[i] && piece[i] != '?')
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t find_piece(std::string_view text, std::string_view piece)
+{
+	if (piece.find('?') == std::string_view::npos)
+	{
+		return text.find(piece);
+	}
+	for (size_t i = 0; i + piece.size() <= text.size(); ++i)
+	{
+		if (piece_equal(text.substr(i, piece.size()), piece))
+		{
+			return i;
+		}
+	}
+	return std::string_view::npos;
+}
+
+// Longest run without wildcards
+std::string longest_literal(std::string_view piece)
+{
+	std::string_view longest;
+	size_t start = 0;
+	while (start <= piece.size())
+	{
+		const auto end = std::min(piece.find('?', start), piece.size());
+		if (end - start > longest.size())
+		{
+			longest = piece.substr(start, end - start);
+		}
+		start = end + 1;
+	}
+	return std::string(longest);
+}
+
+// Longest run of plain characters at the top level of the regex, which every match has to contain. Conservative: a
+// pattern with alternatives gives nothing, groups and classes end a run, and a character with an optional
+// quantifier is taken off the run.
+std::string regex_literal(std::string_view pattern)
+{
+	if (pattern.find('|') != std::string_view::npos)
+	{
+		return {};
+	}
+	std::string longest;
+	std::string run;
+	const auto end_run = [&]
+	{
+		if (run.size() > longest.size())
+		{
+			longest = run;
+		}
+		run.clear();
+	};
+	int depth = 0;
+	for (size_t i = 0; i < pattern.size(); ++i)
+	{
+		const auto c = pattern[i];
+		if (c == '\\')
+		{
+			const auto escaped = i + 1 < pattern.size() ? pattern[i + 1] : '\0';
+			++i;
+			if (depth == 0 && escaped != '\0'
+					&& std::string_view(".*+?()[]{}|^$\\/-").find(escaped) != std::string_view::npos)
+			{
+				run += escaped;
+				continue;
+			}
+			end_run(); // \d, \w, \b and the like
+			if (i >= pattern.size())
+			{
+				continue;
+			}
+			// The operands of \xhh, \uhhhh and \cX and the digits of \0 and back references aren't literal characters
+			if (escaped >= '0' && escaped <= '9')
+			{
+				while (i + 1 < pattern.size() && pattern[i + 1] >= '0' && pattern[i + 1] <= '9')
+				{
+					++i;
+				}
+			}
+			const size_t operands = escaped == 'x' ? 2 : escaped == 'u' ? 4 : escaped == 'c' ? 1 : 0;
+			i += std::min(operands, pattern.size() - 1 - i);
+			continue;
+		}
+		if (c == '[')
+		{
+			// Skip the class, "[]...]" and "[^]...]" start with a literal ']'
+			i += pattern.substr(i + 1).starts_with("^") ? 2 : 1;
+			if (i < pattern.size() && pattern[i] == ']')
+			{
+				++i;
+			}
+			while (i < pattern.size() && pattern[i] != ']')
+			{
+				i += pattern[i] == '\\' ? 2 : 1;
+			}
+			end_run();
+			continue;
+		}
+		if (c == '(')
+		{
+			++depth;
+			end_run();
+			continue;
+		}
+		if (c == ')')
+		{
+			depth = std::max(depth - 1, 0);
+			continue;
+		}
+		if (depth > 0)
+		{
+			continue;
+		}
+		if (c == '*' || c == '?' || c == '{')
+		{
+			// The atom before is optional (or repeated, {n} is treated the same, it's only a filter)
+			if (!run.empty())
+			{
+				run.pop_back();
+			}
+			end_run();
+			if (c == '{')
+			{
+				i = std::min(pattern.find('}', i), pattern.size());
+			}
+			continue;
+		}
+		if (c == '+' || c == '.' || c == '^' || c == '$')
+		{
+			end_run();
+			continue;
+		}
+		run += c;
+	}
+	end_run();
+	return longest;
+}
+
+// Calls f with the position of every occurrence of needle (not empty) in haystack, in order. Compares the first and
+// last character of 16 positions at once, the rest only where both match.
+template <typename F>
+void find_all(std::string_view haystack, std::string_view needle, F &&f)
+{
+	const auto n = needle.size();
+	if (haystack.size() < n)
+	{
+		return;
+	}
+	const auto positions = haystack.size() - n + 1;
+	size_t i = 0;
+#if defined(__SSE2__)
+	const auto first = _mm_set1_epi8(needle.front());
+	const auto last = _mm_set1_epi8(needle.back());
+	for (; i + 16 <= positions; i += 16)
+	{
+		const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack.data() + i));
+		const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack.data() + i + n - 1));
+		const auto candidates = _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last));
+		auto mask = static_cast<uint32_t>(_mm_movemask_epi8(candidates));
+		while (mask != 0)
+		{
+			const auto pos = i + std::countr_zero(mask);
+			if (haystack.substr(pos, n) == needle)
+			{
+				f(pos);
+			}
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for (; i < positions; ++i)
+	{
+		if (haystack[i] == needle.front() && haystack.substr(i, n) == needle)
+		{
+			f(i);
+		}
+	}
+}
+}
+
+TagMatcher::TagMatcher(std::span<const TagRule> rules)
+{
+	for (const auto &rule : rules)
+	{
+		Rule compiled{.exclude = rule.exclude, .literal = {}, .glob = {}, .regex = std::nullopt};
+		if (rule.syntax == PatternSyntax::Regex)
+		{
+			try
+			{
+				compiled.regex.emplace(rule.pattern, std::regex::ECMAScript | std::regex::optimize);
+			}
+			catch (const std::regex_error &e)
+			{
+				throw std::runtime_error(fmt::format("Invalid tag pattern '{}': {}", rule.pattern, e.what()));
+			}
+			compiled.literal = regex_literal(rule.pattern);
+			_rules.push_back(std::move(compiled));
+			continue;
+		}
+
+		const std::string_view pattern = rule.pattern;
+		if (pattern.find_first_of("*?") == std::string_view::npos)
+		{
+			(rule.exclude ? _excluded_names : _names).emplace(pattern);
+			continue;
+		}
+		auto &glob = compiled.glob;
+		const auto first_star = pattern.find('*');
+		glob.has_star = first_star != std::string_view::npos;
+		glob.prefix = pattern.substr(0, first_star);
+		if (glob.has_star)
+		{
+			const auto last_star = pattern.rfind('*');
+			glob.suffix = pattern.substr(last_star + 1);
+			size_t start = first_star + 1;
+			while (start < last_star)
+			{
+				const auto end = pattern.find('*', start);
+				if (end > start)
+				{
+					glob.middle.emplace_back(pattern.substr(start, end - start));
+				}
+				start = end + 1;
+			}
+		}
+		const auto take_literal = [&](std::string_view piece)
+		{
+			auto literal = longest_literal(piece);
+			if (literal.size() > compiled.literal.size())
+			{
+				compiled.literal = std::move(literal);
+			}
+		};
+		take_literal(glob.prefix);
+		take_literal(glob.suffix);
+		for (const auto &piece : glob.middle)
+		{
+			take_literal(piece);
+		}
+		_rules.push_back(std::move(compiled));
+	}
+}
+
+bool TagMatcher::matches(const Rule &rule, std::string_view name)
+{
+	if (rule.regex)
+	{
+		return std::regex_match(name.begin(), name.end(), *rule.regex);
+	}
+	const auto &glob = rule.glob;
+	if (!glob.has_star)
+	{
+		return piece_equal(name, glob.prefix);
+	}
+	if (name.size() < glob.prefix.size() + glob.suffix.size()
+			|| !piece_equal(name.substr(0, glob.prefix.size()), glob.prefix)
+			|| !piece_equal(name.substr(name.size() - glob.suffix.size()), glob.suffix))
+	{
+		return false;
+	}
+	// Leftmost match of each piece is enough with only '*' between them
+	auto rest = name.substr(glob.prefix.size(), name.size() - glob.prefix.size() - glob.suffix.size());
+	for (const auto &piece : glob.middle)
+	{
+		const auto pos = find_piece(rest, piece);
+		if (pos == std::string_view::npos)
+		{
+			return false;
+		}
+		rest = rest.substr(pos + piece.size());
+	}
+	return true;
+}
+
+bool TagMatcher::matches(std::string_view name) const
+{
+	const std::string key(name);
+	if (_excluded_names.contains(key)
+			|| std::any_of(
+				_rules.begin(), _rules.end(), [&](const Rule &rule) { return rule.exclude && matches(rule, name); }))
+	{
+		return false;
+	}
+	return _names.contains(key)
+		|| std::any_of(
+			_rules.begin(), _rules.end(), [&](const Rule &rule) { return !rule.exclude && matches(rule, name); });
+}
+
+std::vector<uint32_t> TagMatcher::select(const VariableTable &vars) const
+{
+	enum : uint8_t
+	{
+		unselected,
+		included,
+		excluded
+	};
+	std::vector<uint8_t> state(vars.size(), unselected);
+	const auto mark = [&](uint32_t index, bool exclude)
+	{
+		if (exclude || state[index] == unselected)
+		{
+			state[index] = exclude ? excluded : included;
+		}
+	};
+	for (const auto &name : _names)
+	{
+		if (const auto index = vars.find(name))
+		{
+			mark(*index, false);
+		}
+	}
+	for (const auto &name : _excluded_names)
+	{
+		if (const auto index = vars.find(name))
+		{
+			mark(*index, true);
+		}
+	}
+
+	const auto arena = vars.name_arena();
+	std::vector<uint32_t> offsets(vars.size());
+	for (uint32_t i = 0; i < vars.size(); ++i)
+	{
+		offsets[i] = static_cast<uint32_t>(vars[i].name.data() - arena.data());
+	}
+	for (const auto &rule : _rules)
+	{
+		const auto done = rule.exclude ? excluded : included;
+		const auto check = [&](uint32_t index)
+		{
+			if (state[index] != done && state[index] != excluded && matches(rule, vars[index].name))
+			{
+				mark(index, rule.exclude);
+			}
+		};
+		if (rule.literal.empty())
+		{
+			for (uint32_t i = 0; i < vars.size(); ++i)
+			{
+				check(i);
+			}
+			continue;
+		}
+		// The hits are in arena order, like the names, so the variable of a hit is found by walking forward
+		uint32_t index = 0;
+		uint32_t checked = UINT32_MAX;
+		find_all(arena, rule.literal,
+			[&](size_t pos)
+			{
+				while (index + 1 < offsets.size() && offsets[index + 1] <= pos)
+				{
+					++index;
+				}
+				if (index != checked && pos + rule.literal.size() <= offsets[index] + vars[index].name.size())
+				{
+					checked = index;
+					check(index);
+				}
+			});
+	}
+
+	std::vector<uint32_t> selected;
+	for (uint32_t i = 0; i < state.size(); ++i)
+	{
+		if (state[i] == included)
+		{
+			selected.push_back(i);
+		}
+	}
+	return selected;
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <regex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "variable_table.h"
+
+namespace daq
+{
+
+enum class PatternSyntax
+{
+	// '*' is any number of characters, '.' included, so "Line2.*" is everything below Line2. '?' is one character.
+	Glob,
+	// ECMAScript, has to match the whole name
+	Regex,
+};
+
+struct TagRule
+{
+	std::string pattern;
+	PatternSyntax syntax = PatternSyntax::Glob;
+	// Removes the names it matches from the selection, whatever the order of the rules
+	bool exclude = false;
+};
+
+// Tag selection rules compiled once. Globs become anchored literal pieces, globs without wildcards a set of exact
+// names, and every rule gets the literal that each of its matches contains (the longest piece of a glob, the longest
+// plain run of a regex). select() screens the name arena of a table for that literal with SSE2 and only runs the full
+// match, the regex in particular, on the names that contain it.
+class TagMatcher
+{
+public:
+	// Throws on invalid regexes
+	explicit TagMatcher(std::span<const TagRule> rules);
+
+	bool matches(std::string_view name) const;
+
+	// Table indices of the selected variables, in table order
+	std::vector<uint32_t> select(const VariableTable &vars) const;
+
+private:
+	struct Glob
+	{
+		std::string prefix; // up to the first '*', the whole pattern without one
+		std::string suffix; // after the last '*'
+		std::vector<std::string> middle;
+		bool has_star = false;
+	};
+
+	struct Rule
+	{
+		bool exclude;
+		std::string literal; // in every match, empty if none is known
+		Glob glob;
+		std::optional<std::regex> regex;
+	};
+
+	static bool matches(const Rule &rule, std::string_view name);
+
+	std::vector<Rule> _rules;
+	std::unordered_set<std::string> _names; // exact names to include
+	std::unordered_set<std::string> _excluded_names;
+};
+
+}
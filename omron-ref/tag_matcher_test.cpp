@@ -0,0 +1,205 @@
+// Checks TagMatcher against expected selections for globs (prefix, suffix, middle pieces, '?', exact names) and for
+// include and exclude rules together, and that select() picks the same variables as matches() on each name for
+// patterns whose literal prescreening is easy to get wrong: regex escapes (\x, \u, \c, \0, back references), classes,
+// groups and optional characters.
+
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "tag_matcher.h"
+#include "test_util.h"
+#include "variable_table.h"
+
+namespace daq
+{
+
+namespace
+{
+const std::vector<std::string> names{
+	"Line2Temp",
+	"Line22Temp",
+	"Line32Temp",
+	"LineATemp",
+	"Line\tTemp",
+	"Line2.Station3.Torque",
+	"Line2.Station3.Speed",
+	"Line12.Station3.Torque",
+	"Line2_Temp",
+	"Pump.Flow",
+	"Pump.Flow[3]",
+	"a.b",
+	"axb",
+	"abab",
+	"Tank$Level",
+	"Line2.Pump_Alarm",
+	"Tank_Alarm",
+	"Tank_Alarm2",
+	"Line2",
+};
+
+struct SelectionCase
+{
+	std::vector<TagRule> rules;
+	std::vector<uint32_t> expected; // indices into names
+};
+
+TagRule glob(std::string pattern, bool exclude = false)
+{
+	return {.pattern = std::move(pattern), .syntax = PatternSyntax::Glob, .exclude = exclude};
+}
+
+TagRule regex(std::string pattern, bool exclude = false)
+{
+	return {.pattern = std::move(pattern), .syntax = PatternSyntax::Regex, .exclude = exclude};
+}
+
+const std::vector<SelectionCase> selection_cases{
+	// Globs
+	{{glob("Line2*")}, {0, 1, 5, 6, 8, 15, 18}},
+	{{glob("Line2.*")}, {5, 6, 15}},
+	{{glob("*Temp")}, {0, 1, 2, 3, 4, 8}},
+	{{glob("*_Alarm")}, {15, 16}},
+	{{glob("*_Alarm*")}, {15, 16, 17}},
+	{{glob("Line*.Station3.*")}, {5, 6, 7}},
+	{{glob("Line*Station*Torque")}, {5, 7}},
+	{{glob("Line?Temp")}, {0, 3, 4}},
+	{{glob("Line??Temp")}, {1, 2, 8}},
+	{{glob("Line2.Station3.?????")}, {6}},
+	{{glob("*")}, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18}},
+	{{glob("?")}, {}},
+	// Exact names, '.', '[' and '$' are plain characters in a glob
+	{{glob("Pump.Flow")}, {9}},
+	{{glob("Pump.Flow[3]")}, {10}},
+	{{glob("a.b")}, {11}},
+	{{glob("Tank$Level")}, {14}},
+	{{glob("Line2")}, {18}},
+	{{glob("Nope")}, {}},
+	{{glob("Pump.Flow"), glob("a.b")}, {9, 11}},
+	// Excludes win over includes, whatever the order of the rules
+	{{glob("Line2.*"), glob("*Speed", true)}, {5, 15}},
+	{{glob("*Speed", true), glob("Line2.*")}, {5, 15}},
+	{{glob("*_Alarm*"), glob("Tank_Alarm", true)}, {15, 17}},
+	{{glob("Pump.Flow"), glob("Pump*", true)}, {}},
+	{{glob("Line2.*"), regex(R"(.*\.Speed)", true)}, {5, 15}},
+	{{regex(R"(Line\d+\..*)"), glob("Line12.*", true), glob("Line2")}, {5, 6, 15, 18}},
+	{{glob("*_Alarm", true)}, {}},
+	// Regex literals
+	{{regex(R"(a.b)")}, {11, 12}},
+	{{regex(R"(a\.b)")}, {11}},
+	{{regex(R"(Line\d+Temp)")}, {0, 1, 2}},
+	{{regex(R"(Tank_Alarm\d?)")}, {16, 17}},
+};
+
+std::string describe(std::span<const TagRule> rules)
+{
+	std::string str;
+	for (const auto &rule : rules)
+	{
+		str += fmt::format(
+			"{}{}{} ", rule.exclude ? "-" : "+", rule.syntax == PatternSyntax::Regex ? "regex " : "", rule.pattern);
+	}
+	return str;
+}
+
+bool check_selections(const VariableTable &vars)
+{
+	bool ok = true;
+	for (const auto &[rules, expected] : selection_cases)
+	{
+		const TagMatcher matcher(rules);
+		std::vector<uint32_t> matched;
+		for (uint32_t i = 0; i < vars.size(); ++i)
+		{
+			if (matcher.matches(vars[i].name))
+			{
+				matched.push_back(i);
+			}
+		}
+		const auto selected = matcher.select(vars);
+		if (selected != expected || matched != expected)
+		{
+			std::cout << fmt::format("FAIL {}: select() {}, matches() {}, expected {}\n", describe(rules),
+				fmt::join(selected, ","), fmt::join(matched, ","), fmt::join(expected, ","));
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+const std::vector<std::string> patterns{
+	R"(Line\x32Temp)",
+	R"(Line\x32\x32Temp)",
+	R"(Line2Temp)",
+	R"(Line\x41Temp)",
+	R"(Line\cITemp)",
+	R"(Line\d+Temp)",
+	R"(Line\x32\.Station\d\.Torque)",
+	R"(Line[\x30-\x39]+\.Station3\..*)",
+	R"((ab)\1)",
+	R"(a\.b)",
+	R"(a.b)",
+	R"(Pump\.Flow\[\d\])",
+	R"(Tank\$Level)",
+	R"(Line2_?Temp)",
+	R"(Line\x322Temp)",
+	R"(Line\0?2Temp)",
+};
+
+bool run()
+{
+	VariableTable vars;
+	for (const auto &name : names)
+	{
+		vars.add(VariableInfo{.name = name, .data_type = {}, .size = 0, .array_info = std::nullopt});
+	}
+
+	bool ok = check_selections(vars);
+	for (const auto &pattern : patterns)
+	{
+		for (const bool exclude : {false, true})
+		{
+			std::vector<TagRule> rules{TagRule{.pattern = pattern, .syntax = PatternSyntax::Regex, .exclude = exclude}};
+			if (exclude)
+			{
+				rules.insert(rules.begin(), TagRule{.pattern = "*", .syntax = PatternSyntax::Glob, .exclude = false});
+			}
+			const TagMatcher matcher(rules);
+			std::vector<uint32_t> expected;
+			for (uint32_t i = 0; i < vars.size(); ++i)
+			{
+				if (matcher.matches(vars[i].name))
+				{
+					expected.push_back(i);
+				}
+			}
+			const auto selected = matcher.select(vars);
+			if (selected != expected)
+			{
+				std::cout << fmt::format("FAIL {}{}: select() {} variables, matches() {}\n",
+					exclude ? "excluding " : "",
+					pattern,
+					selected.size(),
+					expected.size());
+				ok = false;
+			}
+		}
+	}
+	if (ok)
+	{
+		std::cout << fmt::format("PASS {} selections, {} patterns\n", selection_cases.size(), patterns.size());
+	}
+	return ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
@@ -0,0 +1,46 @@
+#include "tag_path.h"
+
+namespace daq
+{
+
+std::vector<uint8_t> symbolic_request_path(std::string_view path)
+{
+	std::vector<uint8_t> buf(max_symbolic_path_size(path.size()));
+	ser::FixedBufferSerializer<std::endian::little> s(buf);
+	encode_symbolic_path(s, path);
+	assert(!s.has_error());
+	buf.resize(s.serialized_buffer().size());
+	return buf;
+}
+
+std::span<const uint8_t> TagPathCache::request_path(NameId id)
+{
+	if (id >= _entries.size())
+	{
+		_entries.resize(id + 1);
+	}
+	auto &entry = _entries[id];
+	if (entry.size == 0)
+	{
+		const auto path = _names.name(id);
+		const auto offset = _paths.size();
+		_paths.resize(offset + max_symbolic_path_size(path.size()));
+		ser::FixedBufferSerializer<std::endian::little> s(std::span<uint8_t>(_paths).subspan(offset));
+		try
+		{
+			encode_symbolic_path(s, path);
+		}
+		catch (...)
+		{
+			_paths.resize(offset);
+			throw;
+		}
+		assert(!s.has_error());
+		entry.offset = static_cast<uint32_t>(offset);
+		entry.size = static_cast<uint32_t>(s.serialized_buffer().size());
+		_paths.resize(offset + entry.size);
+	}
+	return std::span<const uint8_t>(_paths).subspan(entry.offset, entry.size);
+}
+
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "name_interner.h"
+#include "serialization.h"
+
+namespace daq
+{
+
+// Encodes a symbolic path like "Line1.Station[3].Result.Torque" into CIP segments: an ANSI extended symbol segment
+// (0x91) per member and an element segment (0x28/0x29/0x2A, depending on the index size) per array index.
+// Multi dimensional indices can be written as [1,2] or [1][2]. Throws on malformed paths, returns false if the
+// serializer ran out of space.
+bool encode_symbolic_path(ser::Serializer auto &ser, std::string_view path)
+{
+	const auto fail = [&](std::string_view reason)
+	{
+		throw std::runtime_error("Invalid tag path '" + std::string(path) + "': " + std::string(reason));
+	};
+
+	size_t pos = 0;
+	while (true)
+	{
+		const auto end = path.find_first_of(".[", pos);
+		const auto name = path.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos);
+		if (name.empty())
+		{
+			fail("empty member name");
+		}
+		if (name.size() > 255)
+		{
+			fail("member name longer than 255 characters");
+		}
+		ser::serialize(ser, "\x91");
+		ser::serialize(ser, static_cast<uint8_t>(name.size()));
+		ser.write({reinterpret_cast<const uint8_t *>(name.data()), name.size()});
+		if (name.size() % 2 != 0)
+		{
+			ser::serialize(ser, "\x00");
+		}
+
+		pos = end;
+		while (pos != std::string_view::npos && path[pos] == '[')
+		{
+			do
+			{
+				++pos; // skip '[' or ','
+				uint32_t index = 0;
+				const auto [ptr, ec] = std::from_chars(path.data() + pos, path.data() + path.size(), index);
+				if (ec != std::errc())
+				{
+					fail("invalid array index");
+				}
+				pos = ptr - path.data();
+
+				if (index <= 0xFF)
+				{
+					ser::serialize(ser, "\x28");
+					ser::serialize(ser, static_cast<uint8_t>(index));
+				}
+				else if (index <= 0xFFFF)
+				{
+					ser::serialize(ser, "\x29\x00");
+					ser::serialize(ser, static_cast<uint16_t>(index));
+				}
+				else
+				{
+					ser::serialize(ser, "\x2A\x00");
+					ser::serialize(ser, index);
+				}
+			} while (pos < path.size() && path[pos] == ',');
+
+			if (pos >= path.size() || path[pos] != ']')
+			{
+				fail("expected ']'");
+			}
+			++pos;
+			if (pos == path.size())
+			{
+				pos = std::string_view::npos;
+			}
+			else if (path[pos] != '.' && path[pos] != '[')
+			{
+				fail("expected '.' or '[' after ']'");
+			}
+		}
+
+		if (pos == std::string_view::npos)
+		{
+			break;
+		}
+		++pos; // skip '.'
+	}
+	return !ser.has_error();
+}
+
+// Upper bound of the encoded size of a path. Worst cases per input character: "a" -> 0x91 len 'a' pad,
+// "[1]" -> 0x2A 0x00 + 4 bytes.
+constexpr size_t max_symbolic_path_size(size_t path_length)
+{
+	return 3 * path_length + 4;
+}
+
+std::vector<uint8_t> symbolic_request_path(std::string_view path);
+
+// Compiles each path once and keeps all compiled request paths back to back in one buffer. After the first call for
+// a name, getting its request path is a lookup by interned id without any allocation.
+class TagPathCache
+{
+public:
+	explicit TagPathCache(NameInterner &names) : _names(names) {}
+
+	// The returned span is valid until the next path is compiled
+	std::span<const uint8_t> request_path(NameId id);
+
+	std::span<const uint8_t> request_path(std::string_view path)
+	{
+		return request_path(_names.intern(path));
+	}
+
+private:
+	struct Entry
+	{
+		uint32_t offset = 0;
+		uint32_t size = 0; // 0: not compiled yet
+	};
+
+	NameInterner &_names;
+	std::vector<uint8_t> _paths;
+	std::vector<Entry> _entries; // indexed by NameId
+};
+
+}
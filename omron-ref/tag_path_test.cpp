@@ -0,0 +1,154 @@
+// Checks encode_symbolic_path against hand encoded request paths, that TagPathCache compiles each name once and then
+// returns it without allocating, and NameInterner with empty, repeated and oversized names. Links alloc_tracker.cpp.
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "alloc_tracker.h"
+#include "hex.h"
+#include "name_interner.h"
+#include "tag_path.h"
+#include "test_util.h"
+#include "variable_address.h"
+
+namespace daq
+{
+
+namespace
+{
+struct PathCase
+{
+	std::string_view path;
+	std::vector<uint8_t> expected;
+};
+
+const std::vector<PathCase> path_cases{
+	{"Temp", {0x91, 4, 'T', 'e', 'm', 'p'}},
+	{"Speed", {0x91, 5, 'S', 'p', 'e', 'e', 'd', 0}},
+	{"Line1.Station[3].Torque",
+		{0x91, 5, 'L', 'i', 'n', 'e', '1', 0, 0x91, 7, 'S', 't', 'a', 't', 'i', 'o', 'n', 0, 0x28, 3, 0x91, 6, 'T', 'o',
+			'r', 'q', 'u', 'e'}},
+	{"A[300]", {0x91, 1, 'A', 0, 0x29, 0, 0x2C, 0x01}},
+	{"A[70000]", {0x91, 1, 'A', 0, 0x2A, 0, 0x70, 0x11, 0x01, 0x00}},
+	{"A[1,2]", {0x91, 1, 'A', 0, 0x28, 1, 0x28, 2}},
+	{"A[1][2]", {0x91, 1, 'A', 0, 0x28, 1, 0x28, 2}},
+};
+
+const std::vector<std::string_view> invalid_paths{"", ".A", "A.", "A..B", "A[", "A[]", "A[1", "A[1]B", "A[x]"};
+
+void check_paths(Checker &check)
+{
+	for (const auto &[path, expected] : path_cases)
+	{
+		const auto encoded = symbolic_request_path(path);
+		check.expect(encoded == expected, fmt::format("'{}' encodes as {}, not {}", path, hex(expected), hex(encoded)));
+	}
+	for (const auto path : invalid_paths)
+	{
+		bool threw = false;
+		try
+		{
+			symbolic_request_path(path);
+		}
+		catch (const std::runtime_error &)
+		{
+			threw = true;
+		}
+		check.expect(threw, fmt::format("'{}' is rejected", path));
+	}
+
+	// A plain variable name encodes the same as the single symbol segment of variable_request_path
+	const std::string name = "Line2_Temp";
+	check.expect(symbolic_request_path(name) == variable_request_path(name, 0, VariableAddressing::Symbolic),
+		"plain name encodes like variable_request_path");
+}
+
+void check_cache(Checker &check)
+{
+	NameInterner names;
+	TagPathCache paths(names);
+	for (const auto &[path, expected] : path_cases)
+	{
+		const auto compiled = paths.request_path(path);
+		check.expect(std::equal(compiled.begin(), compiled.end(), expected.begin(), expected.end()),
+			fmt::format("cached '{}'", path));
+	}
+
+	const auto id = names.intern(path_cases[2].path);
+	const auto first = paths.request_path(id);
+	const AllocationScope scope;
+	for (const auto &[path, expected] : path_cases)
+	{
+		paths.request_path(path);
+	}
+	const auto again = paths.request_path(id);
+	check.expect(scope.count().allocations == 0, "looking up compiled paths doesn't allocate");
+	check.expect(first.data() == again.data() && first.size() == again.size(), "a path is compiled once");
+
+	bool threw = false;
+	try
+	{
+		paths.request_path("A..B");
+	}
+	catch (const std::runtime_error &)
+	{
+		threw = true;
+	}
+	const auto after = paths.request_path(id);
+	check.expect(threw && std::equal(after.begin(), after.end(), first.begin(), first.end()),
+		"a rejected path doesn't disturb the compiled ones");
+}
+
+void check_interner(Checker &check)
+{
+	NameInterner names;
+	const auto empty = names.intern("");
+	check.expect(names.name(empty).empty(), "empty name as the first name");
+	const auto a = names.intern("Line1");
+	const auto b = names.intern("Line2");
+	check.expect(names.intern("Line1") == a && a != b && a != empty, "repeated names get the same id");
+	check.expect(names.find("Line2") == b && !names.find("Line3"), "find");
+	check.expect(names.intern("") == empty && names.size() == 3, "empty name is interned once");
+
+	// Enough names to fill more than one block, the views of earlier names have to stay valid
+	const auto first = names.name(a);
+	std::vector<NameId> ids;
+	for (size_t i = 0; i < 20'000; ++i)
+	{
+		ids.push_back(names.intern(fmt::format("Area{}.Signal_{}", i % 7, i)));
+	}
+	const std::string large(100'000, 'x');
+	const auto large_id = names.intern(large);
+	bool all_match = first.data() == names.name(a).data() && names.name(large_id) == large;
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		all_match = all_match && names.name(ids[i]) == fmt::format("Area{}.Signal_{}", i % 7, i);
+	}
+	check.expect(all_match, "names stay valid across blocks");
+}
+
+bool run()
+{
+	Checker check;
+	check_paths(check);
+	check_cache(check);
+	check_interner(check);
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS {} paths\n", path_cases.size() + invalid_paths.size());
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}
@@ -0,0 +1,170 @@
+#include "tag_quarantine.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "log.h"
+#include "omron.h"
+
+namespace daq
+{
+
+namespace
+{
+uint16_t extended_status_word(std::span<const uint8_t> extended_status)
+{
+	uint16_t status = 0;
+	if (extended_status.size() >= sizeof(status))
+	{
+		std::memcpy(&status, extended_status.data(), sizeof(status));
+	}
+	return status;
+}
+}
+
+bool is_tag_specific_error(uint8_t general_status, std::span<const uint8_t> extended_status)
+{
+	switch (general_status)
+	{
+		case 0x04: // Path Segment Error
+		case 0x05: // Path Destination Error
+			return true;
+		case 0x1F: // Vendor Specific Error
+		case 0x20: // Invalid Parameter
+			switch (extended_status_word(extended_status))
+			{
+				case 0x0102: // variable I/O that cannot be read
+				case 0x2104:
+				case 0x0104: // address or size exceeds the segment area
+				case 0x1103:
+				case 0x8007: // inaccessible variable
+				case 0x8009: // segment type abnormal
+				case 0x8017: // more than one element for a single data item
+				case 0x8018: // 0 elements or out of array range
+				case 0x8029: // area can't be accessed in bulk
+					return true;
+				default:
+					return false;
+			}
+		default:
+			return false;
+	}
+}
+
+TagQuarantine::TagState &TagQuarantine::state(NameId tag)
+{
+	if (tag >= _tags.size())
+	{
+		_tags.resize(tag + 1);
+	}
+	return _tags[tag];
+}
+
+std::string TagQuarantine::tag_name(NameId tag) const
+{
+	return _names ? std::string(_names(tag)) : std::to_string(tag);
+}
+
+void TagQuarantine::record_success(NameId tag)
+{
+	auto &s = state(tag);
+	if (s.quarantined)
+	{
+		--_num_quarantined;
+		logger->info("Tag {} recovered, released from quarantine", tag_name(tag));
+	}
+	s = TagState{};
+}
+
+bool TagQuarantine::record_failure(
+	NameId tag, uint8_t general_status, std::span<const uint8_t> extended_status, Clock::time_point now)
+{
+	const auto ext = extended_status_word(extended_status);
+	auto it = std::find_if(
+		_status_counts.begin(),
+		_status_counts.end(),
+		[&](const auto &c) { return c.general_status == general_status && c.extended_status == ext; });
+	if (it == _status_counts.end())
+	{
+		_status_counts.push_back({.general_status = general_status, .extended_status = ext, .count = 0});
+		it = _status_counts.end() - 1;
+	}
+	++it->count;
+
+	// The retry of a quarantined tag failed, even if not because of the tag it waits for the next one. Otherwise it
+	// would be requested every cycle as long as the controller keeps failing.
+	if (!is_quarantined(tag) && !is_tag_specific_error(general_status, extended_status))
+	{
+		return false;
+	}
+
+	auto &s = state(tag);
+	++s.consecutive_failures;
+	if (!s.quarantined && s.consecutive_failures < _policy.max_failures)
+	{
+		return false;
+	}
+	enter_quarantine(tag, s, general_status, extended_status, now);
+	return true;
+}
+
+void TagQuarantine::quarantine(
+	NameId tag, uint8_t general_status, std::span<const uint8_t> extended_status, Clock::time_point now)
+{
+	auto &s = state(tag);
+	++s.consecutive_failures;
+	enter_quarantine(tag, s, general_status, extended_status, now);
+}
+
+void TagQuarantine::enter_quarantine(
+	NameId tag, TagState &s, uint8_t general_status, std::span<const uint8_t> extended_status, Clock::time_point now)
+{
+	if (!s.quarantined)
+	{
+		s.quarantined = true;
+		++_num_quarantined;
+		logger->warn(
+			"Tag {} quarantined after {} failures: {} {}",
+			tag_name(tag),
+			s.consecutive_failures,
+			general_status_message(general_status),
+			extended_status_message(extended_status));
+	}
+	else
+	{
+		++s.backoff_exponent;
+	}
+
+	// Clamp the exponent before shifting, the max backoff caps the result anyway
+	const auto backoff = std::min(
+		_policy.initial_backoff * (int64_t{1} << std::min<uint32_t>(s.backoff_exponent, 30)), _policy.max_backoff);
+	s.retry_at = now + backoff;
+}
+
+bool TagQuarantine::should_request(NameId tag, Clock::time_point now) const
+{
+	if (tag >= _tags.size())
+	{
+		return true;
+	}
+	const auto &s = _tags[tag];
+	return !s.quarantined || now >= s.retry_at;
+}
+
+bool TagQuarantine::is_quarantined(NameId tag) const
+{
+	return tag < _tags.size() && _tags[tag].quarantined;
+}
+
+void TagQuarantine::filter_due(std::span<const NameId> tags, Clock::time_point now, std::vector<NameId> &out) const
+{
+	for (const auto tag : tags)
+	{
+		if (should_request(tag, now))
+		{
+			out.push_back(tag);
+		}
+	}
+}
+
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "name_interner.h"
+
+namespace daq
+{
+
+// Errors that are caused by the tag itself (wrong name, out of range access, inaccessible variable) and will fail
+// again on the next cycle. Controller wide errors (connection lost, downloading, ...) are not counted against a tag.
+bool is_tag_specific_error(uint8_t general_status, std::span<const uint8_t> extended_status);
+
+struct QuarantinePolicy
+{
+	// Consecutive tag specific failures before a tag is quarantined
+	uint32_t max_failures = 3;
+	std::chrono::milliseconds initial_backoff{1000};
+	std::chrono::milliseconds max_backoff{std::chrono::minutes(10)};
+};
+
+// Per-tag error accounting. Tags that keep failing are taken out of the regular batch and only retried after an
+// exponentially growing backoff, so one broken tag doesn't cost a round trip every cycle.
+class TagQuarantine
+{
+public:
+	using Clock = std::chrono::steady_clock;
+	// The name of a tag in the log messages. Without one, tags are logged by id.
+	using TagNames = std::function<std::string_view(NameId)>;
+
+	explicit TagQuarantine(QuarantinePolicy policy = {}, TagNames names = {})
+		: _policy(policy), _names(std::move(names))
+	{
+	}
+
+	void record_success(NameId tag);
+
+	// Returns true if the tag was quarantined (or its backoff extended) because of this failure. A quarantined tag
+	// that fails its retry waits for the next one whatever the status, controller wide errors included.
+	bool record_failure(
+		NameId tag, uint8_t general_status, std::span<const uint8_t> extended_status, Clock::time_point now);
+
+	// Quarantine right away regardless of the status, e.g. when a batch failure was already isolated to this tag
+	void quarantine(
+		NameId tag, uint8_t general_status, std::span<const uint8_t> extended_status, Clock::time_point now);
+
+	// False while the tag is quarantined and its retry time hasn't come yet
+	bool should_request(NameId tag, Clock::time_point now) const;
+
+	bool is_quarantined(NameId tag) const;
+
+	// Appends the tags that should be requested this cycle to out
+	void filter_due(std::span<const NameId> tags, Clock::time_point now, std::vector<NameId> &out) const;
+
+	size_t num_quarantined() const
+	{
+		return _num_quarantined;
+	}
+
+	struct StatusCount
+	{
+		uint8_t general_status;
+		uint16_t extended_status;
+		uint64_t count;
+	};
+
+	// Failures per general/extended status over all tags
+	const std::vector<StatusCount> &status_counts() const
+	{
+		return _status_counts;
+	}
+
+private:
+	struct TagState
+	{
+		uint32_t consecutive_failures = 0;
+		uint32_t backoff_exponent = 0;
+		bool quarantined = false;
+		Clock::time_point retry_at{};
+	};
+
+	TagState &state(NameId tag);
+	std::string tag_name(NameId tag) const;
+	void enter_quarantine(
+		NameId tag,
+		TagState &s,
+		uint8_t general_status,
+		std::span<const uint8_t> extended_status,
+		Clock::time_point now);
+
+	QuarantinePolicy _policy;
+	TagNames _names;
+	std::vector<TagState> _tags; // indexed by NameId
+	size_t _num_quarantined = 0;
+	std::vector<StatusCount> _status_counts;
+};
+
+}
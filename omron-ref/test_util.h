@@ -0,0 +1,61 @@
+#pragma once
+
+#include <exception>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <spdlog/fmt/fmt.h>
+
+namespace daq
+{
+
+// Collects the mismatches of a test program (the *_test.cpp files registered with ctest). Each one prints a FAIL line,
+// after the context if one is set.
+class Checker
+{
+public:
+	bool ok = true;
+
+	void expect(bool condition, std::string_view what)
+	{
+		if (!condition)
+		{
+			if (_context.empty())
+			{
+				std::cout << fmt::format("FAIL {}\n", what);
+			}
+			else
+			{
+				std::cout << fmt::format("FAIL {}: {}\n", _context, what);
+			}
+			ok = false;
+		}
+	}
+
+	void context(std::string context)
+	{
+		_context = std::move(context);
+	}
+
+private:
+	std::string _context;
+};
+
+// The main of a test program: exits with 0 if run() returns true, with 1 if it returns false or throws
+template <typename F>
+int run_test(F &&run)
+{
+	try
+	{
+		return run() ? 0 : 1;
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+}
+
+}
@@ -0,0 +1,234 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <spdlog/fmt/fmt.h>
+
+namespace daq
+{
+
+namespace
+{
+constexpr size_t buffer_events = 1 << 15;
+
+// Every field is atomic, so the dump can read a slot the owning thread is overwriting. seq is the position + 1 of the
+// event in the slot, and 0 while it's being written (per slot seqlock).
+struct Event
+{
+	std::atomic<uint64_t> seq = 0;
+	std::atomic<const char *> name = nullptr;
+	std::atomic<uint64_t> start = 0;
+	std::atomic<uint64_t> end = 0;
+};
+
+constexpr uint64_t still_owned = std::numeric_limits<uint64_t>::max();
+
+// Single producer ring buffer, only the owning thread writes. When it exits, the buffer goes to the next new thread,
+// which continues at head. The events of the owner are those in [first, last).
+struct ThreadBuffer
+{
+	// guarded by the registry mutex
+	uint32_t tid;
+	std::string name;
+	uint64_t first = 0;
+	uint64_t last = still_owned;
+
+	std::atomic<uint64_t> head = 0;
+	std::array<Event, buffer_events> events;
+};
+
+struct Registry
+{
+	std::mutex mutex;
+	uint32_t next_tid = 1;
+	// Never removed, so threads that exited still show up in the trace until their buffer is taken over
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+	// Of exited threads, most recent last
+	std::vector<ThreadBuffer *> free_buffers;
+};
+
+// Leaked, threads may still record events during static destruction
+Registry &registry()
+{
+	static auto *registry = new Registry;
+	return *registry;
+}
+
+// Hands the buffer of the thread back to the registry when it exits
+struct BufferOwner
+{
+	ThreadBuffer *buffer = nullptr;
+
+	~BufferOwner()
+	{
+		if (buffer)
+		{
+			auto &reg = registry();
+			std::lock_guard lock(reg.mutex);
+			buffer->last = buffer->head.load(std::memory_order_relaxed);
+			reg.free_buffers.push_back(buffer);
+			buffer = nullptr;
+		}
+	}
+};
+
+thread_local std::string thread_name;
+thread_local BufferOwner thread_buffer;
+
+// Taken on the first event, threads that never record don't pay for a buffer. The oldest events of an exited thread
+// are overwritten first: its buffer is taken over by the next new thread.
+ThreadBuffer &current_buffer()
+{
+	if (!thread_buffer.buffer)
+	{
+		auto &reg = registry();
+		std::lock_guard lock(reg.mutex);
+		ThreadBuffer *buffer;
+		if (reg.free_buffers.empty())
+		{
+			buffer = reg.buffers.emplace_back(std::make_unique<ThreadBuffer>()).get();
+		}
+		else
+		{
+			buffer = reg.free_buffers.front();
+			reg.free_buffers.erase(reg.free_buffers.begin());
+		}
+		buffer->tid = reg.next_tid++;
+		buffer->name = thread_name;
+		buffer->first = buffer->head.load(std::memory_order_relaxed);
+		buffer->last = still_owned;
+		thread_buffer.buffer = buffer;
+	}
+	return *thread_buffer.buffer;
+}
+
+struct BufferSnapshot
+{
+	const ThreadBuffer *buffer;
+	uint32_t tid;
+	std::string name;
+	uint64_t first;
+	uint64_t last;
+};
+}
+
+void detail::record_trace_event(const char *name, uint64_t start, uint64_t end)
+{
+	auto &buffer = current_buffer();
+	const auto pos = buffer.head.load(std::memory_order_relaxed);
+	auto &event = buffer.events[pos % buffer_events];
+	event.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	event.name.store(name, std::memory_order_relaxed);
+	event.start.store(start, std::memory_order_relaxed);
+	event.end.store(end, std::memory_order_relaxed);
+	event.seq.store(pos + 1, std::memory_order_release);
+	buffer.head.store(pos + 1, std::memory_order_release);
+}
+
+void start_tracing()
+{
+	detail::tracing_enabled.store(true, std::memory_order_relaxed);
+}
+
+void stop_tracing()
+{
+	detail::tracing_enabled.store(false, std::memory_order_relaxed);
+}
+
+void set_trace_thread_name(std::string name)
+{
+	if (thread_buffer.buffer)
+	{
+		std::lock_guard lock(registry().mutex);
+		thread_buffer.buffer->name = name;
+	}
+	thread_name = std::move(name);
+}
+
+void write_chrome_trace(std::ostream &out)
+{
+	auto &reg = registry();
+	// Events after last are those of a thread that took the buffer over while writing, they are left out
+	std::vector<BufferSnapshot> buffers;
+	{
+		std::lock_guard lock(reg.mutex);
+		for (const auto &buffer : reg.buffers)
+		{
+			buffers.push_back({buffer.get(), buffer->tid, buffer->name, buffer->first, buffer->last});
+		}
+	}
+
+	fmt::memory_buffer buf;
+	const auto append = [&](std::string_view str) { buf.append(str.data(), str.data() + str.size()); };
+	append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	bool first = true;
+	const auto separator = [&]
+	{
+		if (!first)
+		{
+			append(",\n");
+		}
+		first = false;
+	};
+
+	for (const auto &[buffer, tid, name, first, last] : buffers)
+	{
+		if (!name.empty())
+		{
+			separator();
+			fmt::format_to(
+				std::back_inserter(buf),
+				R"({{"name":"thread_name","ph":"M","pid":1,"tid":{},"args":{{"name":{}}}}})",
+				tid,
+				nlohmann::json(name).dump());
+		}
+
+		const auto head = std::min(buffer->head.load(std::memory_order_acquire), last);
+		for (auto pos = std::max(head > buffer_events ? head - buffer_events : 0, first); pos < head; ++pos)
+		{
+			const auto &event = buffer->events[pos % buffer_events];
+			const auto seq = event.seq.load(std::memory_order_acquire);
+			const auto event_name = event.name.load(std::memory_order_relaxed);
+			const auto start = event.start.load(std::memory_order_relaxed);
+			const auto end = event.end.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seq != pos + 1 || event.seq.load(std::memory_order_relaxed) != seq)
+			{
+				continue; // overwritten while reading
+			}
+
+			separator();
+			if (end == 0)
+			{
+				fmt::format_to(
+					std::back_inserter(buf),
+					R"({{"name":{},"ph":"i","s":"t","ts":{:.3f},"pid":1,"tid":{}}})",
+					nlohmann::json(event_name).dump(),
+					static_cast<double>(start) / 1000.0,
+					tid);
+			}
+			else
+			{
+				fmt::format_to(
+					std::back_inserter(buf),
+					R"({{"name":{},"ph":"X","ts":{:.3f},"dur":{:.3f},"pid":1,"tid":{}}})",
+					nlohmann::json(event_name).dump(),
+					static_cast<double>(start) / 1000.0,
+					static_cast<double>(end - start) / 1000.0,
+					tid);
+			}
+		}
+	}
+	append("]}\n");
+	out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+}
+
+}
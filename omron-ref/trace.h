@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace daq
+{
+
+namespace detail
+{
+inline std::atomic<bool> tracing_enabled = false;
+
+inline uint64_t trace_clock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+// end == 0 is an instant event
+void record_trace_event(const char *name, uint64_t start, uint64_t end);
+}
+
+inline bool tracing_enabled()
+{
+	return detail::tracing_enabled.load(std::memory_order_relaxed);
+}
+
+void start_tracing();
+void stop_tracing();
+
+// Shows up as the thread name in the trace viewer. Cheap, can be called when tracing is off.
+void set_trace_thread_name(std::string name);
+
+// Writes the buffered events in Chrome trace event format, for chrome://tracing or ui.perfetto.dev. Each thread keeps
+// its last 32768 events. Can be called while tracing is running.
+void write_chrome_trace(std::ostream &out);
+
+// Records the time from construction to destruction (or end()) on the current thread's trace buffer. When tracing is
+// off this is a relaxed load and a branch. name must stay valid until the trace is written, use string literals.
+class TraceSpan
+{
+public:
+	explicit TraceSpan(const char *name)
+		: _name(tracing_enabled() ? name : nullptr)
+		, _start(_name ? detail::trace_clock() : 0)
+	{
+	}
+
+	~TraceSpan()
+	{
+		end();
+	}
+
+	TraceSpan(const TraceSpan &) = delete;
+	TraceSpan &operator=(const TraceSpan &) = delete;
+
+	void end()
+	{
+		if (_name)
+		{
+			detail::record_trace_event(_name, _start, detail::trace_clock());
+			_name = nullptr;
+		}
+	}
+
+private:
+	const char *_name;
+	uint64_t _start;
+};
+
+inline void trace_instant(const char *name)
+{
+	if (tracing_enabled())
+	{
+		detail::record_trace_event(name, detail::trace_clock(), 0);
+	}
+}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "omron.h"
+#include "variable_table.h"
+
+namespace daq
+{
+
+// Tag name server, lists the variable names
+constexpr uint8_t variable_class_id = 0x6a;
+// Variable object, holds the type and size of a variable. The get all instances records reference it.
+constexpr uint8_t variable_object_class_id = 0x6b;
+
+// Symbolic addressing always works. Addressing by the instance id of the variable object (class 0x6B), which is known
+// after discovery, gives a fixed 6-8 byte request path and saves the controller the symbol lookup.
+enum class VariableAddressing
+{
+	Symbolic,
+	InstanceId,
+};
+
+// Logical segments for class and instance. Uses a 32 bit instance segment if the id doesn't fit into 16 bit.
+std::vector<uint8_t> address_request_path(uint8_t class_id, uint32_t instance_id);
+
+std::vector<uint8_t> variable_request_path(
+	const std::string &name, uint32_t instance_id, VariableAddressing addressing);
+
+// A symbolic segment with a 255 character name and its pad byte
+constexpr size_t max_request_path_size = 2 + 256;
+
+// variable_request_path into buffer instead of the heap, returns the part of buffer that holds the path
+std::span<const uint8_t> variable_request_path(
+	std::string_view name,
+	uint32_t instance_id,
+	VariableAddressing addressing,
+	std::span<uint8_t, max_request_path_size> buffer);
+
+VariableInfo get_variable_info(
+	RequestContext &rc, std::string name, uint32_t instance_id, VariableAddressing addressing);
+
+// How the type of a variable is queried. Only AttributeAll is verified against real controllers, the others need a
+// build with OMRON_REF_EXPERIMENTAL_TYPE_QUERIES and throw std::invalid_argument otherwise.
+enum class TypeQuery
+{
+	// Get Attribute All (0x01), the whole variable object
+	AttributeAll,
+	// Experimental. Get Attribute List (0x03) for size and data type only, plus a second request with the element type,
+	// dimensions and start indices for arrays. Scalars, most variables, get a much smaller reply. The attribute ids are
+	// unverified: a variable whose attributes are rejected, or whose size doesn't fit its type, is queried with
+	// AttributeAll instead. Discovery of a whole table also asks for the first variable of each type with AttributeAll
+	// and starts over with AttributeAll if the two differ. Path errors about the variable itself are thrown.
+	AttributeList,
+	// Experimental. The AttributeList requests of many variables packed into each Multiple Service Packet, so discovery
+	// needs a request per page of variables instead of one per variable. Only for whole symbol tables
+	// (get_variables_fast), a single query is AttributeList.
+	BatchedAttributeList,
+};
+
+#if defined(OMRON_REF_EXPERIMENTAL_TYPE_QUERIES)
+constexpr bool experimental_type_queries = true;
+#else
+constexpr bool experimental_type_queries = false;
+#endif
+
+// Throws std::invalid_argument if query is experimental and the build doesn't enable those
+void check_type_query(TypeQuery query);
+
+VariableInfo get_variable_info_list(
+	RequestContext &rc, std::string name, uint32_t instance_id, VariableAddressing addressing);
+
+// The Get Attribute List requests of get_variable_info_list, so they can be packed into Multiple Service Packets.
+// Type asks for size and data type, Array for the rest of the array info and is only needed if the type is Array.
+enum class AttributeSet
+{
+	Type,
+	Array,
+};
+
+void encode_variable_attributes(
+	ser::FixedBufferSerializer<std::endian::little> &ser, std::span<const uint8_t> request_path, AttributeSet set);
+
+// Of a successful reply, including the CIP response header
+size_t variable_attributes_reply_size(AttributeSet set);
+
+// Decodes the reply data (after the CIP response header) into type, name is used in errors. Array needs the size from
+// Type. False if an attribute isn't available (non-zero attribute status), then the caller should fall back to
+// get_variable_type with TypeQuery::AttributeAll.
+bool decode_variable_attributes(
+	ser::FixedBufferDeserializer<std::endian::little> &des,
+	AttributeSet set,
+	std::string_view name,
+	VariableType &type);
+
+VariableInfo get_variable_info(
+	RequestContext &rc, std::string name, uint32_t instance_id, VariableAddressing addressing, TypeQuery query);
+
+// get_variable_info without the VariableInfo, doesn't allocate unless it throws
+VariableType get_variable_type(
+	RequestContext &rc,
+	std::string_view name,
+	uint32_t instance_id,
+	VariableAddressing addressing,
+	TypeQuery query = TypeQuery::AttributeAll);
+
+}
@@ -0,0 +1,177 @@
+#include "variable_table.h"
+
+#include <bit>
+#include <functional>
+#include <stdexcept>
+
+#include <spdlog/fmt/fmt.h>
+
+namespace daq
+{
+
+void VariableTable::reserve(size_t num_variables, size_t name_bytes)
+{
+	_records.reserve(num_variables);
+	_names.reserve(name_bytes);
+	if (_index.size() < 2 * num_variables)
+	{
+		rehash(2 * num_variables);
+	}
+}
+
+uint32_t VariableTable::add(const VariableInfo &var, uint32_t instance_id)
+{
+	VariableType type{.data_type = var.data_type, .size = static_cast<uint32_t>(var.size), .array_info = std::nullopt};
+	if (var.array_info)
+	{
+		const auto &arr = *var.array_info;
+		if (arr.dimensions.size() > max_array_dimensions || arr.start_indices.size() != arr.dimensions.size())
+		{
+			throw std::runtime_error(
+				fmt::format("Variable '{}' has unsupported array dimensions {}", var.name, arr.dimensions.size()));
+		}
+		CompactArrayInfo compact{
+			.element_type = arr.element_type,
+			.num_dimensions = static_cast<uint8_t>(arr.dimensions.size()),
+			.element_size = static_cast<uint32_t>(arr.element_size),
+			.dimensions = {},
+			.start_indices = {},
+		};
+		for (size_t i = 0; i < arr.dimensions.size(); ++i)
+		{
+			compact.dimensions[i] = static_cast<uint32_t>(arr.dimensions[i]);
+			compact.start_indices[i] = static_cast<uint32_t>(arr.start_indices[i]);
+		}
+		type.array_info = compact;
+	}
+	return add(var.name, type, instance_id);
+}
+
+uint32_t VariableTable::add(std::string_view name, const VariableType &type, uint32_t instance_id)
+{
+	if (name.size() > 255)
+	{
+		throw std::runtime_error(fmt::format("Variable name '{}' is too long", name));
+	}
+	if (type.array_info && type.array_info->num_dimensions > max_array_dimensions)
+	{
+		throw std::runtime_error(
+			fmt::format("Variable '{}' has unsupported array dimensions {}", name, type.array_info->num_dimensions));
+	}
+
+	Record record{
+		.name_offset = static_cast<uint32_t>(_names.size()),
+		.size = type.size,
+		.instance_id = instance_id,
+		.array_index = no_array,
+		.name_length = static_cast<uint8_t>(name.size()),
+		.data_type = type.data_type,
+	};
+
+	if (type.array_info)
+	{
+		record.array_index = static_cast<uint32_t>(_arrays.size());
+		_arrays.push_back(*type.array_info);
+	}
+
+	_names.insert(_names.end(), name.begin(), name.end());
+	const auto index = static_cast<uint32_t>(_records.size());
+	_records.push_back(record);
+
+	if (2 * _records.size() > _index.size())
+	{
+		rehash(2 * _index.size());
+	}
+	else
+	{
+		insert_index(index);
+	}
+	return index;
+}
+
+VariableView VariableTable::operator[](size_t index) const
+{
+	const auto &record = _records[index];
+	return {
+		.name = name(record),
+		.data_type = record.data_type,
+		.size = record.size,
+		.instance_id = record.instance_id,
+		.array_info = record.array_index == no_array ? nullptr : &_arrays[record.array_index],
+	};
+}
+
+std::optional<uint32_t> VariableTable::find(std::string_view name) const
+{
+	if (_index.empty())
+	{
+		return std::nullopt;
+	}
+	const auto mask = _index.size() - 1;
+	for (auto slot = std::hash<std::string_view>{}(name) & mask;; slot = (slot + 1) & mask)
+	{
+		const auto entry = _index[slot];
+		if (entry == 0)
+		{
+			return std::nullopt;
+		}
+		if (this->name(_records[entry - 1]) == name)
+		{
+			return entry - 1;
+		}
+	}
+}
+
+VariableInfo VariableTable::to_variable_info(size_t index) const
+{
+	const auto view = (*this)[index];
+	VariableInfo var{
+		.name = std::string(view.name),
+		.data_type = view.data_type,
+		.size = view.size,
+		.array_info = std::nullopt,
+	};
+	if (view.array_info)
+	{
+		ArrayInfo arr;
+		arr.element_type = view.array_info->element_type;
+		arr.element_size = view.array_info->element_size;
+		arr.dimensions.assign(view.array_info->dims().begin(), view.array_info->dims().end());
+		arr.start_indices.assign(view.array_info->starts().begin(), view.array_info->starts().end());
+		var.array_info = std::move(arr);
+	}
+	return var;
+}
+
+size_t VariableTable::memory_usage() const
+{
+	return _records.capacity() * sizeof(Record) + _arrays.capacity() * sizeof(CompactArrayInfo) + _names.capacity()
+		+ _index.capacity() * sizeof(uint32_t);
+}
+
+void VariableTable::insert_index(uint32_t index)
+{
+	const auto mask = _index.size() - 1;
+	auto slot = std::hash<std::string_view>{}(name(_records[index])) & mask;
+	while (_index[slot] != 0)
+	{
+		// Names are unique per controller, but if not, the first one wins
+		if (name(_records[_index[slot] - 1]) == name(_records[index]))
+		{
+			return;
+		}
+		slot = (slot + 1) & mask;
+	}
+	_index[slot] = index + 1;
+}
+
+void VariableTable::rehash(size_t capacity)
+{
+	_index.assign(std::bit_ceil(std::max<size_t>(16, capacity)), 0);
+	for (uint32_t i = 0; i < _records.size(); ++i)
+	{
+		insert_index(i);
+	}
+}
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "omron.h"
+
+namespace daq
+{
+
+// Omron controllers support up to 3 array dimensions
+constexpr size_t max_array_dimensions = 3;
+
+struct CompactArrayInfo
+{
+	DataType element_type;
+	uint8_t num_dimensions;
+	uint32_t element_size;
+	std::array<uint32_t, max_array_dimensions> dimensions;
+	std::array<uint32_t, max_array_dimensions> start_indices;
+
+	std::span<const uint32_t> dims() const
+	{
+		return std::span(dimensions).first(num_dimensions);
+	}
+
+	std::span<const uint32_t> starts() const
+	{
+		return std::span(start_indices).first(num_dimensions);
+	}
+};
+
+// The type of a variable without its name, what discovery decodes for each variable. Unlike VariableInfo it doesn't
+// allocate, so a discovery into a table can run out of one memory resource.
+struct VariableType
+{
+	DataType data_type{};
+	uint32_t size = 0;
+	std::optional<CompactArrayInfo> array_info;
+};
+
+struct VariableView
+{
+	std::string_view name;
+	DataType data_type;
+	uint32_t size;
+	uint32_t instance_id;
+	const CompactArrayInfo *array_info; // nullptr if not an array
+};
+
+// Compact, contiguous storage for discovered variable metadata. Names go into one character arena, records and array
+// infos are fixed size and live in two vectors, and the name index is an open addressing table. A table holds
+// 100k variables in a handful of allocations (~20 bytes per record plus the name characters) instead of up to three
+// heap allocations per variable with VariableInfo. All storage comes from the given memory resource.
+class VariableTable
+{
+public:
+	static constexpr uint32_t no_instance_id = 0;
+
+	explicit VariableTable(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+		: _records(resource)
+		, _arrays(resource)
+		, _names(resource)
+		, _index(resource)
+	{
+	}
+
+	void reserve(size_t num_variables, size_t name_bytes = 0);
+
+	// Returns the index of the new variable. Throws if the array has more than max_array_dimensions dimensions.
+	uint32_t add(const VariableInfo &var, uint32_t instance_id = no_instance_id);
+	uint32_t add(std::string_view name, const VariableType &type, uint32_t instance_id = no_instance_id);
+
+	size_t size() const
+	{
+		return _records.size();
+	}
+
+	VariableView operator[](size_t index) const;
+
+	std::optional<uint32_t> find(std::string_view name) const;
+
+	// Expands a record back into a VariableInfo for APIs that need one
+	VariableInfo to_variable_info(size_t index) const;
+
+	// All names back to back in the order of the records, the names of operator[] point into it
+	std::string_view name_arena() const
+	{
+		return {_names.data(), _names.size()};
+	}
+
+	// Bytes reserved by the table
+	size_t memory_usage() const;
+
+private:
+	static constexpr uint32_t no_array = UINT32_MAX;
+
+	struct Record
+	{
+		uint32_t name_offset;
+		uint32_t size;
+		uint32_t instance_id;
+		uint32_t array_index;
+		uint8_t name_length;
+		DataType data_type;
+	};
+
+	std::string_view name(const Record &record) const
+	{
+		return {_names.data() + record.name_offset, record.name_length};
+	}
+
+	void insert_index(uint32_t index);
+	void rehash(size_t capacity);
+
+	std::pmr::vector<Record> _records;
+	std::pmr::vector<CompactArrayInfo> _arrays;
+	std::pmr::vector<char> _names;
+	std::pmr::vector<uint32_t> _index; // record index + 1, 0 is empty
+};
+
+}
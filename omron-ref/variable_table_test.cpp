@@ -0,0 +1,117 @@
+// Fills a VariableTable past a few rehashes of its name index, with some names added twice. find returns the first
+// record of a name, before and after a rehash, and the records themselves are all kept. Also round trips arrays
+// through to_variable_info and checks the arena and the rejected inputs.
+
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <spdlog/fmt/fmt.h>
+
+#include "test_util.h"
+#include "variable_table.h"
+
+namespace daq
+{
+
+namespace
+{
+constexpr uint32_t num_variables = 1000;
+
+bool run()
+{
+	Checker check;
+	VariableTable table;
+	std::vector<std::string> names;
+	std::vector<uint32_t> first; // record index of each name
+	for (uint32_t i = 0; i < num_variables; ++i)
+	{
+		names.push_back(fmt::format("Line{}.Station[{}]", i % 7, i));
+		first.push_back(static_cast<uint32_t>(table.size()));
+		const auto index =
+			table.add(names.back(), {.data_type = DataType::Dint, .size = 4, .array_info = std::nullopt}, i + 1);
+		check.expect(index == first.back(), fmt::format("{} added at {}", names.back(), index));
+		// Every tenth name comes again right away, with another type
+		if (i % 10 == 0)
+		{
+			table.add(names.back(), {.data_type = DataType::Real, .size = 4, .array_info = std::nullopt}, 0);
+			check.expect(
+				table.find(names.back()) == first.back(),
+				fmt::format("{} not found at the first record", names.back()));
+		}
+	}
+	check.expect(table.size() == num_variables + num_variables / 10, fmt::format("{} records", table.size()));
+
+	check.context("after rehashing");
+	for (uint32_t i = 0; i < num_variables; ++i)
+	{
+		const auto index = table.find(names[i]);
+		check.expect(index == first[i], fmt::format("{} not found at the first record", names[i]));
+		if (index)
+		{
+			const auto var = table[*index];
+			check.expect(var.name == names[i], fmt::format("{} found as {}", names[i], var.name));
+			check.expect(
+				var.data_type == DataType::Dint && var.instance_id == i + 1,
+				fmt::format("{} has the type of the second record", names[i]));
+		}
+	}
+	check.expect(!table.find("Line0.Station").has_value(), "prefix found");
+	check.expect(!table.find("").has_value(), "empty name found");
+	check.expect(!VariableTable().find("Line0.Station[0]").has_value(), "found in an empty table");
+
+	check.context("arrays");
+	VariableInfo array{.name = "Recipe", .data_type = DataType::Array, .size = 2 * 3 * 4, .array_info = std::nullopt};
+	array.array_info =
+		ArrayInfo{.element_type = DataType::Dint, .element_size = 4, .dimensions = {2, 3}, .start_indices = {0, 1}};
+	const auto index = table.add(array);
+	const auto var = table.to_variable_info(index);
+	check.expect(var.name == "Recipe" && var.data_type == DataType::Array && var.size == 24, "variable");
+	check.expect(
+		var.array_info && var.array_info->element_type == DataType::Dint && var.array_info->element_size == 4
+			&& var.array_info->dimensions == std::vector<size_t>{2, 3}
+			&& var.array_info->start_indices == std::vector<size_t>{0, 1},
+		"array info");
+	check.expect(table.name_arena().ends_with("Recipe"), "name not at the end of the arena");
+	check.expect(table.name_arena().starts_with(names[0] + names[0] + names[1]), "names not in record order");
+
+	check.context("rejected");
+	array.array_info->dimensions = {1, 2, 3, 4};
+	array.array_info->start_indices = {0, 0, 0, 0};
+	bool threw = false;
+	try
+	{
+		table.add(array);
+	}
+	catch (const std::runtime_error &)
+	{
+		threw = true;
+	}
+	check.expect(threw, "4 dimensions accepted");
+	threw = false;
+	try
+	{
+		table.add(std::string(256, 'x'), {});
+	}
+	catch (const std::runtime_error &)
+	{
+		threw = true;
+	}
+	check.expect(threw, "256 character name accepted");
+
+	if (check.ok)
+	{
+		std::cout << fmt::format("PASS {} records, {} bytes\n", table.size(), table.memory_usage());
+	}
+	return check.ok;
+}
+}
+
+}
+
+int main()
+{
+	return daq::run_test(daq::run);
+}